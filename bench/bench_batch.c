@@ -0,0 +1,100 @@
+/*
+ * bench_batch.c
+ *
+ *  Measures how many schedules per second a single core can find the
+ *  next event of, one at a time with ical_record_find_next_epoch and
+ *  with ical_batch_find_next_epoch on each instruction set the CPU
+ *  supports. The schedules are a mix of MINUTELY and HOURLY floating
+ *  schedules on random days, like a large fleet.
+ *
+ *  Build:
+ *      gcc -O2 -Isrc/scheduler bench/bench_batch.c src/scheduler/ical_batch.c src/scheduler/ical.c src/scheduler/civil.c src/scheduler/tz.c -o bench_batch
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "ical_batch.h"
+#include "civil.h"
+
+#define SCHEDULES 100000
+#define TICKS 50
+
+static ICALRECORD records[SCHEDULES];
+static uint8_t events[SCHEDULES];
+static time_t epochs[SCHEDULES];
+
+static double _elapsed_ns(struct timespec *t0, struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec)*1e9 + (t1->tv_nsec - t0->tv_nsec);
+}
+
+static double _run_records(time_t start)
+{
+    struct timespec t0, t1;
+    volatile time_t sink = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(uint32_t tick = 0; tick < TICKS; tick++){
+        for(uint32_t i = 0; i < SCHEDULES; i++){
+            time_t e_next;
+            ical_record_find_next_epoch(&records[i], start + tick*61, &e_next);
+            sink += e_next;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    (void)sink;
+
+    return (double)SCHEDULES*TICKS/(_elapsed_ns(&t0, &t1)*1e-9);
+}
+
+static double _run_batch(ical_batch_t *b, time_t start)
+{
+    struct timespec t0, t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(uint32_t tick = 0; tick < TICKS; tick++){
+        ical_batch_find_next_epoch(b, 0, SCHEDULES, start + tick*61, events, epochs);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return (double)SCHEDULES*TICKS/(_elapsed_ns(&t0, &t1)*1e-9);
+}
+
+int main(void)
+{
+    const char *names[] = {"auto", "scalar", "sse4", "avx2"};
+    ical_batch_t b;
+    ICAL ical;
+    struct tm t_now;
+
+    srand(1);
+    ical_batch_init(&b);
+    ical_batch_reserve(&b, SCHEDULES);
+    for(uint32_t i = 0; i < SCHEDULES; i++){
+        ical_get_defaults(&ical);
+        ical_set_time_struct(&ical.t_start, 2016, 1, 1, rand()%12, rand()%60, rand()%60);
+        ical_set_time_struct(&ical.t_end, 2030, 12, 31, 12 + rand()%12, 0, 0);
+        ical.freq = rand()%4 ? MINUTELY : HOURLY;
+        ical.interval = 1 + rand()%20;
+        ical.byday = (BYDAY)(1 + rand()%127);
+        ical.enabled = true;
+        ical_compile(&ical, &records[i]);
+        ical_batch_set(&b, i, &records[i]);
+    }
+
+    ical_set_time_struct(&t_now, 2018, 6, 15, 13, 0, 0);
+    time_t start = civil_from_tm(&t_now);
+
+    printf("schedules: %d\r\n", SCHEDULES);
+    printf("%-14s %16s\r\n", "method", "schedules/s");
+    printf("%-14s %16.0f\r\n", "record", _run_records(start));
+    for(int isa = ICAL_BATCH_SCALAR; isa <= (int)ical_batch_get_isa(); isa++){
+        b.isa = (ICAL_BATCH_ISA)isa;
+        printf("batch %-8s %16.0f\r\n", names[isa], _run_batch(&b, start));
+    }
+    ical_batch_free(&b);
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * bench_groups.c
+ *
+ *  Measures how the number of groups affects the scheduler with the
+ *  number of schedules held fixed. For each group count, the schedules
+ *  are spread evenly over the groups, and the time to add them, to
+ *  look up every group's event, and to run an update tick is reported.
+ *  Sparse group numbers spread over the 32 bit range are timed too.
+ *
+ *  Build:
+ *      gcc -O2 -Isrc/scheduler -Isrc/queue bench/bench_groups.c src/scheduler/scheduler.c src/scheduler/group_table.c src/scheduler/pool.c src/scheduler/wheel.c src/scheduler/ical.c src/scheduler/ical_batch.c src/scheduler/civil.c src/scheduler/tz.c -o bench_groups
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "scheduler.h"
+#include "civil.h"
+
+#define SCHEDULES 100000
+#define TICKS 100
+
+static scheduler_t ctx;
+
+static double _elapsed_ns(struct timespec *t0, struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec)*1e9 + (t1->tv_nsec - t0->tv_nsec);
+}
+
+static uint32_t _group(uint32_t i, uint32_t groups, bool sparse)
+{
+    uint32_t group = i % groups;
+    return sparse ? group*2654435761u : group;
+}
+
+static void _run(uint32_t groups, bool sparse)
+{
+    struct timespec t0, t1;
+    struct tm t_now;
+    ICAL ical;
+    volatile uint32_t sink = 0;
+
+    srand(1);
+    scheduler_init_r(&ctx);
+    scheduler_set_capacity_r(&ctx, SCHEDULES);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(uint32_t i = 0; i < SCHEDULES; i++){
+        ical_get_defaults(&ical);
+        ical_set_time_struct(&ical.t_start, 2016, 1, 1, rand()%12, rand()%60, rand()%60);
+        ical_set_time_struct(&ical.t_end, 2030, 12, 31, 12 + rand()%12, 0, 0);
+        ical.freq = MINUTELY;
+        ical.interval = 1 + rand()%60;
+        ical.byday = EVERYDAY;
+        ical.enabled = true;
+        scheduler_add_r(&ctx, _group(i, groups, sparse), &ical);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double add = _elapsed_ns(&t0, &t1)/SCHEDULES;
+
+    ical_set_time_struct(&t_now, 2018, 6, 15, 13, 0, 0);
+    time_t start = civil_from_tm(&t_now);
+    scheduler_update_events_r(&ctx, &t_now);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(uint32_t i = 0; i < groups; i++){
+        EVENT *event = scheduler_get_event_by_group_r(&ctx, _group(i, groups, sparse));
+        sink += event ? event->id : 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double lookup = _elapsed_ns(&t0, &t1)/groups;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(uint32_t i = 1; i <= TICKS; i++){
+        civil_to_tm(start + i, &t_now);
+        scheduler_update_events_r(&ctx, &t_now);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double tick = _elapsed_ns(&t0, &t1)/TICKS;
+
+    printf("%-8u %-8s %12.1f %12.1f %14.1f\r\n", groups, sparse ? "sparse" : "dense", add, lookup, tick);
+    scheduler_clear_r(&ctx);
+    (void)sink;
+}
+
+int main(void)
+{
+    printf("schedules: %d\r\n", SCHEDULES);
+    printf("%-8s %-8s %12s %12s %14s\r\n", "groups", "numbers", "add ns", "lookup ns", "tick ns");
+    for(uint32_t groups = 1; groups <= SCHEDULES; groups *= 10){
+        _run(groups, false);
+    }
+    for(uint32_t groups = 1; groups <= SCHEDULES; groups *= 10){
+        _run(groups, true);
+    }
+
+    return 0;
+}
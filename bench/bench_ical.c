@@ -0,0 +1,94 @@
+/*
+ * bench_ical.c
+ *
+ *  Measures the cost of ical_find_next_event as "now" moves further
+ *  into a day's schedule window. A SECONDLY schedule with an interval
+ *  of 1 is the worst case for a search that steps through every
+ *  occurrence, so the time per call should stay flat across the window.
+ *  Then compares building a week's agenda of a MINUTELY schedule by
+ *  feeding each event back in as "now" with ical_expand.
+ *
+ *  Build:
+ *      gcc -O2 -Isrc/scheduler bench/bench_ical.c src/scheduler/ical.c src/scheduler/civil.c src/scheduler/tz.c -o bench_ical
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "ical.h"
+#include "civil.h"
+
+#define ITERATIONS 200000
+#define AGENDAS 20
+
+static bool _count_event(void *arg, ICALEVENT event, time_t e_event)
+{
+    (void)event;
+    (void)e_event;
+    (*(uint32_t*)arg)++;
+    return true;
+}
+
+static double _elapsed_ns(struct timespec *t0, struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec)*1e9 + (t1->tv_nsec - t0->tv_nsec);
+}
+
+int main(void)
+{
+    ICAL ical;
+    struct tm t_now, t_next;
+    struct timespec t0, t1;
+    volatile ICALEVENT sink = ICALEVENT_NONE;
+
+    ical_get_defaults(&ical);
+    ical_set_time_struct(&ical.t_start, 2016, 1, 1, 0, 0, 0);
+    ical_set_time_struct(&ical.t_end, 2020, 12, 31, 23, 59, 59);
+    ical.freq = SECONDLY;
+    ical.interval = 1;
+    ical.byday = EVERYDAY;
+    ical.enabled = true;
+
+    printf("%-12s %14s\r\n", "now", "ns/call");
+    for(uint8_t hour = 0; hour < 24; hour += 4){
+        ical_set_time_struct(&t_now, 2018, 6, 15, hour, 59, 30);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for(uint32_t i = 0; i < ITERATIONS; i++){
+            sink = ical_find_next_event(&ical, &t_now, &t_next);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        printf("%02d:59:30     %14.1f\r\n", hour, _elapsed_ns(&t0, &t1)/ITERATIONS);
+    }
+
+    // A week's agenda from 00:00 on a Monday
+    ical.freq = MINUTELY;
+    ical_set_time_struct(&t_now, 2018, 6, 11, 0, 0, 0);
+    time_t e_from = civil_from_tm(&t_now);
+    uint32_t searched = 0, expanded = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(uint32_t i = 0; i < AGENDAS; i++){
+        time_t e_current = e_from - 1, e_next;
+        while(ical_is_event(ical_find_next_epoch(&ical, e_current, &e_next)) && e_next < e_from + 7*24*60*60){
+            e_current = e_next;
+            searched++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns_searched = _elapsed_ns(&t0, &t1);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(uint32_t i = 0; i < AGENDAS; i++){
+        ical_expand(&ical, e_from, e_from + 7*24*60*60, _count_event, &expanded);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    printf("\r\n%-12s %14s %14s\r\n", "agenda", "events", "ns/event");
+    printf("%-12s %14u %14.1f\r\n", "search", searched/AGENDAS, ns_searched/searched);
+    printf("%-12s %14u %14.1f\r\n", "expand", expanded/AGENDAS, _elapsed_ns(&t0, &t1)/expanded);
+    (void)sink;
+
+    return 0;
+}
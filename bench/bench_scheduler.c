@@ -0,0 +1,126 @@
+/*
+ * bench_scheduler.c
+ *
+ *  Measures the cost of scheduler_update_events with a large number of
+ *  MINUTELY schedules as time advances one second per tick. Each tick
+ *  is timed twice: with a full recalculation of every schedule (how
+ *  updates used to work) and with the incremental event queue. Then
+ *  compares prefetching the next PREFETCH events with an update per
+ *  event against scheduler_next_events. Build once with the binary
+ *  heap and once with the timing wheel:
+ *
+ *  Build:
+ *      gcc -O2 -Isrc/scheduler -Isrc/queue bench/bench_scheduler.c src/scheduler/scheduler.c src/scheduler/group_table.c src/scheduler/pool.c src/scheduler/wheel.c src/scheduler/ical.c src/scheduler/ical_batch.c src/scheduler/civil.c src/scheduler/tz.c -o bench_heap
+ *      gcc -O2 -DSCHEDULER_USE_WHEEL -Isrc/scheduler -Isrc/queue bench/bench_scheduler.c src/scheduler/scheduler.c src/scheduler/group_table.c src/scheduler/pool.c src/scheduler/wheel.c src/scheduler/ical.c src/scheduler/ical_batch.c src/scheduler/civil.c src/scheduler/tz.c -o bench_wheel
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "scheduler.h"
+#include "civil.h"
+
+#define SCHEDULES 100000
+#define TICKS 600
+#define GROUPS 200
+#define PREFETCH 256
+
+static EVENT events[PREFETCH];
+
+static scheduler_t ctx;
+
+static double _elapsed_ns(struct timespec *t0, struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec)*1e9 + (t1->tv_nsec - t0->tv_nsec);
+}
+
+static double _run(time_t start, bool full)
+{
+    struct timespec t0, t1;
+    struct tm t_now;
+    double total = 0;
+
+    for(uint32_t i = 0; i < TICKS; i++){
+        civil_to_tm(start + i, &t_now);
+        ctx.rebuild = full;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        scheduler_update_events_r(&ctx, &t_now);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        total += _elapsed_ns(&t0, &t1);
+    }
+
+    return total/TICKS;
+}
+
+static double _prefetch_updates(time_t start)
+{
+    struct timespec t0, t1;
+    struct tm t_now;
+    time_t now = start;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(uint32_t i = 0; i < PREFETCH; i++){
+        civil_to_tm(now, &t_now);
+        scheduler_update_events_r(&ctx, &t_now);
+        events[i] = *scheduler_get_next_event_r(&ctx);
+        now = events[i].epoch;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return _elapsed_ns(&t0, &t1);
+}
+
+static double _prefetch_next_events(time_t start)
+{
+    struct timespec t0, t1;
+    struct tm t_now;
+
+    civil_to_tm(start, &t_now);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    scheduler_next_events_r(&ctx, &t_now, PREFETCH, events);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return _elapsed_ns(&t0, &t1);
+}
+
+int main(void)
+{
+    ICAL ical;
+    struct tm t_now;
+
+    srand(1);
+    scheduler_init_r(&ctx);
+    scheduler_set_capacity_r(&ctx, SCHEDULES);
+    for(uint32_t i = 0; i < SCHEDULES; i++){
+        ical_get_defaults(&ical);
+        ical_set_time_struct(&ical.t_start, 2016, 1, 1, rand()%12, rand()%60, rand()%60);
+        ical_set_time_struct(&ical.t_end, 2030, 12, 31, 12 + rand()%12, 0, 0);
+        ical.freq = MINUTELY;
+        ical.interval = 1 + rand()%60;
+        ical.byday = EVERYDAY;
+        ical.enabled = true;
+        scheduler_add_r(&ctx, i%GROUPS, &ical);
+    }
+
+    ical_set_time_struct(&t_now, 2018, 6, 15, 13, 0, 0);
+    time_t start = civil_from_tm(&t_now);
+    scheduler_update_events_r(&ctx, &t_now);
+
+#ifdef SCHEDULER_USE_WHEEL
+    printf("queue: wheel, schedules: %d\r\n", SCHEDULES);
+#else
+    printf("queue: heap, schedules: %d\r\n", SCHEDULES);
+#endif
+    printf("%-14s %14s\r\n", "update", "ns/tick");
+    printf("%-14s %14.1f\r\n", "full", _run(start + 1, true));
+    printf("%-14s %14.1f\r\n", "incremental", _run(start + 1 + TICKS, false));
+
+    time_t t_prefetch = start + 1 + 2*TICKS;
+    printf("\r\n%-14s %14s\r\n", "prefetch", "ns");
+    printf("%-14s %14.1f\r\n", "updates", _prefetch_updates(t_prefetch));
+    printf("%-14s %14.1f\r\n", "next_events", _prefetch_next_events(t_prefetch));
+
+    return 0;
+}
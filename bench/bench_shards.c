@@ -0,0 +1,119 @@
+/*
+ * bench_shards.c
+ *
+ *  Measures a full recalculation and a one minute tick of half a million
+ *  schedules split by group across 1 to SHARDS_MAX_COUNT shards,
+ *  doubling each time up to the number of cores or at least 4, with
+ *  each shard's thread pinned to a core. The events of every group are
+ *  checked against the single shard. Each shard holds at most
+ *  SCHEDULER_MAX_CAPACITY/count schedules, so the total is kept well
+ *  under the limit to leave room for groups hashing unevenly.
+ *
+ *  Build:
+ *      gcc -O2 -Isrc/scheduler -Isrc/queue bench/bench_shards.c src/scheduler/shards.c src/scheduler/scheduler.c src/scheduler/thread_pool.c src/scheduler/group_table.c src/scheduler/pool.c src/scheduler/wheel.c src/scheduler/ical.c src/scheduler/ical_batch.c src/scheduler/civil.c src/scheduler/tz.c -o bench_shards -lpthread
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "scheduler.h"
+#include "shards.h"
+#include "civil.h"
+
+#define SCHEDULES 500000
+#define TICKS 20
+#define GROUPS 1000
+
+static ICAL icals[SCHEDULES];
+static EVENT expected[GROUPS];
+
+static double _elapsed_ns(struct timespec *t0, struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec)*1e9 + (t1->tv_nsec - t0->tv_nsec);
+}
+
+// Mean time of TICKS updates a minute apart, rebuilding each time if
+// rebuild is set
+static double _run(shards_t *sh, time_t start, bool rebuild)
+{
+    struct timespec t0, t1;
+    struct tm t_now;
+    double total = 0;
+
+    for(uint32_t i = 0; i < TICKS; i++){
+        civil_to_tm(start + 60*(i + 1), &t_now);
+        for(uint32_t j = 0; rebuild && j < sh->count; j++){
+            sh->shards[j].rebuild = true;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        shards_update_events(sh, &t_now);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        total += _elapsed_ns(&t0, &t1);
+    }
+
+    return total/TICKS;
+}
+
+static uint32_t _mismatches(shards_t *sh, bool save)
+{
+    uint32_t count = 0;
+    EVENT event;
+
+    for(uint32_t group = 0; group < GROUPS; group++){
+        shards_get_event_by_group(sh, group, &event);
+        if(save){
+            expected[group] = event;
+        }else if(event.epoch != expected[group].epoch){
+            count++;
+        }
+    }
+
+    return count;
+}
+
+int main(void)
+{
+    struct tm t_now;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    srand(1);
+    for(uint32_t i = 0; i < SCHEDULES; i++){
+        ical_get_defaults(&icals[i]);
+        ical_set_time_struct(&icals[i].t_start, 2016, 1, 1, rand()%12, rand()%60, 0);
+        ical_set_time_struct(&icals[i].t_end, 2030, 12, 31, 12 + rand()%12, 0, 0);
+        icals[i].freq = MINUTELY;
+        icals[i].interval = 1 + rand()%60;
+        icals[i].byday = EVERYDAY;
+        icals[i].enabled = true;
+    }
+
+    ical_set_time_struct(&t_now, 2018, 6, 15, 13, 0, 0);
+    time_t start = civil_from_tm(&t_now);
+
+    printf("schedules: %d, cores: %ld\r\n", SCHEDULES, cores);
+    printf("%-8s %14s %14s %12s\r\n", "shards", "ms/rebuild", "ms/tick", "mismatches");
+    for(uint32_t count = 1; count <= SHARDS_MAX_COUNT && (count <= cores || count <= 4); count *= 2){
+        shards_t sh;
+        if(!shards_init(&sh, count, SCHEDULES, true)){
+            printf("shards_init failed\r\n");
+            return 1;
+        }
+        for(uint32_t i = 0; i < SCHEDULES; i++){
+            if(!shards_add(&sh, i%GROUPS, &icals[i], NULL)){
+                printf("shard of group %u is full\r\n", i%GROUPS);
+                return 1;
+            }
+        }
+        shards_update_events(&sh, &t_now);
+
+        double rebuild_ns = _run(&sh, start, true);
+        double tick_ns = _run(&sh, start + 60*TICKS, false);
+        printf("%-8u %14.2f %14.2f %12u\r\n", count, rebuild_ns/1e6, tick_ns/1e6, _mismatches(&sh, count == 1));
+        shards_destroy(&sh);
+    }
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+/*
+ * bench_startup.c
+ *
+ *  Measures cold start of a large site: the rate schedules are added
+ *  one at a time with scheduler_add and all at once with
+ *  scheduler_add_batch, and the time of the first update that
+ *  calculates every schedule.
+ *
+ *  Build:
+ *      gcc -O2 -Isrc/scheduler -Isrc/queue bench/bench_startup.c src/scheduler/scheduler.c src/scheduler/group_table.c src/scheduler/pool.c src/scheduler/wheel.c src/scheduler/ical.c src/scheduler/ical_batch.c src/scheduler/civil.c src/scheduler/tz.c -o bench_startup
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "scheduler.h"
+
+#define SCHEDULES 200000
+#define GROUPS 2000
+#define RUNS 5
+
+static scheduler_t ctx;
+static ICAL icals[SCHEDULES];
+static uint32_t groups[SCHEDULES];
+
+static double _elapsed_s(struct timespec *t0, struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec)*1e-9;
+}
+
+static void _run(bool batch)
+{
+    struct timespec t0, t1, t2;
+    struct tm t_now;
+    double add = 0, update = 0;
+
+    ical_set_time_struct(&t_now, 2018, 6, 15, 13, 0, 0);
+    for(uint32_t run = 0; run < RUNS; run++){
+        scheduler_init_r(&ctx);
+        scheduler_set_capacity_r(&ctx, SCHEDULES);
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if(batch){
+            scheduler_add_batch_r(&ctx, icals, groups, SCHEDULES);
+        }else{
+            for(uint32_t i = 0; i < SCHEDULES; i++){
+                scheduler_add_r(&ctx, groups[i], &icals[i]);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        scheduler_update_events_r(&ctx, &t_now);
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+
+        add += _elapsed_s(&t0, &t1);
+        update += _elapsed_s(&t1, &t2);
+        scheduler_clear_r(&ctx);
+    }
+
+    printf("%-8s %16.0f %16.1f\r\n", batch ? "batch" : "single", RUNS*SCHEDULES/add, 1e3*update/RUNS);
+}
+
+int main(void)
+{
+    srand(1);
+    for(uint32_t i = 0; i < SCHEDULES; i++){
+        ical_get_defaults(&icals[i]);
+        ical_set_time_struct(&icals[i].t_start, 2016, 1, 1, rand()%12, rand()%60, rand()%60);
+        ical_set_time_struct(&icals[i].t_end, 2030, 12, 31, 12 + rand()%12, 0, 0);
+        icals[i].freq = MINUTELY;
+        icals[i].interval = 1 + rand()%60;
+        icals[i].byday = EVERYDAY;
+        icals[i].enabled = true;
+        groups[i] = rand()%GROUPS;
+    }
+
+    printf("schedules: %d, groups: %d\r\n", SCHEDULES, GROUPS);
+    printf("%-8s %16s %16s\r\n", "add", "schedules/s", "first update ms");
+    _run(false);
+    _run(true);
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * bench_threads.c
+ *
+ *  Measures a full recalculation of a million schedules with the
+ *  update split across 1 to SCHEDULER_MAX_THREADS threads, doubling
+ *  each time up to the number of cores or at least 4. Each threaded
+ *  result is checked against the single thread.
+ *
+ *  Build:
+ *      gcc -O2 -DSCHEDULER_USE_THREADS -Isrc/scheduler -Isrc/queue bench/bench_threads.c src/scheduler/scheduler.c src/scheduler/thread_pool.c src/scheduler/group_table.c src/scheduler/pool.c src/scheduler/wheel.c src/scheduler/ical.c src/scheduler/ical_batch.c src/scheduler/civil.c src/scheduler/tz.c -o bench_threads -lpthread
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "scheduler.h"
+#include "civil.h"
+
+#define SCHEDULES 1000000
+#define TICKS 20
+#define GROUPS 1000
+
+static scheduler_t ctx;
+static EVENT expected[GROUPS];
+
+static double _elapsed_ns(struct timespec *t0, struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec)*1e9 + (t1->tv_nsec - t0->tv_nsec);
+}
+
+static double _run(time_t start)
+{
+    struct timespec t0, t1;
+    struct tm t_now;
+    double total = 0;
+
+    for(uint32_t i = 0; i < TICKS; i++){
+        civil_to_tm(start + 60*i, &t_now);
+        ctx.rebuild = true;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        scheduler_update_events_r(&ctx, &t_now);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        total += _elapsed_ns(&t0, &t1);
+    }
+
+    return total/TICKS;
+}
+
+static uint32_t _mismatches(void)
+{
+    uint32_t count = 0;
+
+    for(uint32_t group = 0; group < GROUPS; group++){
+        EVENT *event = scheduler_get_event_by_group_r(&ctx, group);
+        if(event->id != expected[group].id || event->epoch != expected[group].epoch){
+            count++;
+        }
+    }
+
+    return count;
+}
+
+int main(void)
+{
+    ICAL ical;
+    struct tm t_now;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    srand(1);
+    scheduler_init_r(&ctx);
+    scheduler_set_capacity_r(&ctx, SCHEDULES);
+    for(uint32_t i = 0; i < SCHEDULES; i++){
+        ical_get_defaults(&ical);
+        ical_set_time_struct(&ical.t_start, 2016, 1, 1, rand()%12, rand()%60, 0);
+        ical_set_time_struct(&ical.t_end, 2030, 12, 31, 12 + rand()%12, 0, 0);
+        ical.freq = MINUTELY;
+        ical.interval = 1 + rand()%60;
+        ical.byday = EVERYDAY;
+        ical.enabled = true;
+        scheduler_add_r(&ctx, i%GROUPS, &ical);
+    }
+
+    ical_set_time_struct(&t_now, 2018, 6, 15, 13, 0, 0);
+    time_t start = civil_from_tm(&t_now);
+
+    printf("schedules: %d, cores: %ld\r\n", SCHEDULES, cores);
+    printf("%-8s %14s %12s\r\n", "threads", "ms/update", "mismatches");
+    for(uint32_t threads = 1; threads <= SCHEDULER_MAX_THREADS && (threads <= cores || threads <= 4); threads *= 2){
+        scheduler_set_threads_r(&ctx, threads);
+        double ns = _run(start);
+        if(threads == 1){
+            for(uint32_t group = 0; group < GROUPS; group++){
+                expected[group] = *scheduler_get_event_by_group_r(&ctx, group);
+            }
+        }
+        printf("%-8u %14.2f %12u\r\n", threads, ns/1e6, _mismatches());
+    }
+
+    scheduler_set_threads_r(&ctx, 1);
+    scheduler_clear_r(&ctx);
+
+    return 0;
+}
@@ -29,11 +29,16 @@ int main()
     scheduler_remove_last();
     
     // Attempt to get a specific schedule
-    uint8_t count = 0;
-    SCHEDULE* schedule = scheduler_get_schedule_by_id(count++);
+    SCHEDULE* schedule = scheduler_get_schedule_by_id(3);
+    if(schedule){
+        printf("Schedule 3 is in group %d\r\n", schedule->group);
+    }
+
+    // Loop through the schedules in the order they were added
+    schedule = scheduler_get_first_schedule();
     while(schedule){
         printf("Schedule: %d\r\n", schedule->id);
-        schedule = scheduler_get_schedule_by_id(count++);
+        schedule = scheduler_get_next_schedule(schedule);
     }
     
     struct tm current_time;
@@ -45,7 +50,7 @@ int main()
     current_time.tm_sec = 0;   /* seconds,  range 0 to 59          */
 
     scheduler_update_events(&current_time);
-    count = 0;
+    uint32_t count = 0;
     EVENT* event = scheduler_get_event_by_group(count++);
 
     while(event){
@@ -0,0 +1,122 @@
+/*
+ * civil.c
+ *
+ * Created: 16/10/2026 4:22:58 PM
+ *
+ *  Integer calendar math used in place of mktime/localtime. Times
+ *  are handled as "civil seconds": the number of seconds between
+ *  1970-01-01 00:00:00 and a wall clock date and time, with no
+ *  timezone or daylight savings applied. This keeps ical results
+ *  independent of the TZ environment of the process and avoids the
+ *  libc timezone lock on every conversion.
+ *
+ *  The day conversions are based on the proleptic Gregorian
+ *  algorithms described by Howard Hinnant
+ *  (http://howardhinnant.github.io/date_algorithms.html).
+ */ 
+
+#include <stdint.h>
+#include <time.h>
+#include "civil.h"
+
+/**
+ * \brief Get number of days since 1970-01-01 for a date
+ *
+ *  mon is in the range 1 to 12
+ */
+int32_t civil_days_from_date(int32_t year, int32_t mon, int32_t mday)
+{
+    year -= mon <= 2;
+    int32_t era = (year >= 0 ? year : year-399) / 400;
+    uint32_t yoe = (uint32_t)(year - era*400);                      // [0, 399]
+    uint32_t doy = (153*(mon + (mon > 2 ? -3 : 9)) + 2)/5 + mday-1; // [0, 365]
+    uint32_t doe = yoe*365 + yoe/4 - yoe/100 + doy;                 // [0, 146096]
+    return era*146097 + (int32_t)doe - 719468;
+}
+
+/**
+ * \brief Get the date for a number of days since 1970-01-01
+ *
+ *  mon is in the range 1 to 12
+ */
+void civil_date_from_days(int32_t days, int32_t *year, int32_t *mon, int32_t *mday)
+{
+    days += 719468;
+    int32_t era = (days >= 0 ? days : days-146096) / 146097;
+    uint32_t doe = (uint32_t)(days - era*146097);                   // [0, 146096]
+    uint32_t yoe = (doe - doe/1460 + doe/36524 - doe/146096)/365;   // [0, 399]
+    uint32_t doy = doe - (365*yoe + yoe/4 - yoe/100);               // [0, 365]
+    uint32_t mp = (5*doy + 2)/153;                                  // [0, 11]
+    *mday = (int32_t)(doy - (153*mp + 2)/5 + 1);
+    *mon = (int32_t)(mp < 10 ? mp+3 : mp-9);
+    *year = (int32_t)yoe + era*400 + (*mon <= 2);
+}
+
+/**
+ * \brief Get the day number of a civil time, rounding towards -inf
+ *   
+ */
+int32_t civil_days_from_time(time_t t)
+{
+    time_t days = t / CIVIL_ONE_DAY;
+    if ((t % CIVIL_ONE_DAY) < 0){
+        days--;
+    }
+    return (int32_t)days;
+}
+
+/**
+ * \brief Get the day of the week for a day number
+ *   
+ *  Follows struct tm, 0 is Sunday. 1970-01-01 was a Thursday.
+ */
+uint8_t civil_weekday(int32_t days)
+{
+    int32_t wday = (days + 4) % 7;
+    return (uint8_t)(wday < 0 ? wday+7 : wday);
+}
+
+/**
+ * \brief Convert a time struct to civil seconds
+ *
+ *  Out of range fields are normalized the same way mktime does,
+ *  ie. a tm_mday of 32 rolls over into the next month. tm_isdst
+ *  is ignored.
+ */
+time_t civil_from_tm(const struct tm *t)
+{
+    int32_t year = t->tm_year + 1900 + t->tm_mon/12;
+    int32_t mon = t->tm_mon % 12;
+    if (mon < 0){
+        mon += 12;
+        year--;
+    }
+
+    time_t days = civil_days_from_date(year, mon+1, 1) + (t->tm_mday - 1);
+
+    return days*CIVIL_ONE_DAY + (time_t)t->tm_hour*3600 + t->tm_min*60 + t->tm_sec;
+}
+
+/**
+ * \brief Convert civil seconds to a time struct
+ *
+ *  All fields are populated, including tm_wday and tm_yday.
+ */
+void civil_to_tm(time_t t, struct tm *out)
+{
+    int32_t days = civil_days_from_time(t);
+    int32_t sod = (int32_t)(t - (time_t)days*CIVIL_ONE_DAY);
+    int32_t year, mon, mday;
+
+    civil_date_from_days(days, &year, &mon, &mday);
+
+    out->tm_sec = sod % 60;
+    out->tm_min = (sod / 60) % 60;
+    out->tm_hour = sod / 3600;
+    out->tm_mday = mday;
+    out->tm_mon = mon - 1;
+    out->tm_year = year - 1900;
+    out->tm_wday = civil_weekday(days);
+    out->tm_yday = days - civil_days_from_date(year, 1, 1);
+    out->tm_isdst = 0;
+}
@@ -0,0 +1,23 @@
+/*
+ * civil.h
+ *
+ * Created: 16/10/2026 4:22:58 PM
+ */ 
+
+
+#ifndef CIVIL_H_
+#define CIVIL_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#define CIVIL_ONE_DAY 86400
+
+int32_t civil_days_from_date(int32_t year, int32_t mon, int32_t mday);
+void civil_date_from_days(int32_t days, int32_t *year, int32_t *mon, int32_t *mday);
+int32_t civil_days_from_time(time_t t);
+uint8_t civil_weekday(int32_t days);
+time_t civil_from_tm(const struct tm *t);
+void civil_to_tm(time_t t, struct tm *out);
+
+#endif /* CIVIL_H_ */
@@ -0,0 +1,170 @@
+/*
+ * command_queue.c
+ *
+ * Created: 16/10/2026 6:11:32 PM
+ *
+ *  Bounded ring of schedule changes that any thread can write and the
+ *  scheduler's thread reads, without a lock. Each slot has a sequence
+ *  number that tells whether it is free to write at a position or holds
+ *  the command written there. A producer claims a position by moving
+ *  tail on with a compare and swap, writes the command and then
+ *  publishes it by setting the slot's sequence. The consumer reads the
+ *  slot at head once it is published and frees it for the position a
+ *  lap later. Nothing is allocated after init, and a full ring makes
+ *  the producer return false rather than wait.
+ *
+ *  With SCHEDULER_USE_COMMANDS the commands of the queue given to
+ *  scheduler_set_commands are applied at the start of each update:
+ *
+ *      command_queue_t q;
+ *      command_queue_init(&q, 256);
+ *      scheduler_set_commands_r(&ctx, &q);
+ *
+ *      // Any thread
+ *      command_queue_add(&q, group, &ical, fn, arg);
+ *
+ *      // Scheduler thread, applies the add and calls fn with the id
+ *      scheduler_update_events_r(&ctx, &current_time);
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "command_queue.h"
+
+/**
+ *  Initialize a queue with room for capacity commands
+ *
+ *  capacity is rounded up to a power of 2, and at least 2 so a slot
+ *  read a lap ago can be told from one just written. Returns false if
+ *  it is 0 or the ring can't be allocated.
+ */
+bool command_queue_init(command_queue_t *q, uint32_t capacity)
+{
+    uint32_t size = 2;
+
+    if (capacity == 0 || capacity > UINT32_C(1) << 30){
+        return false;
+    }
+    while (size < capacity){
+        size <<= 1;
+    }
+
+    q->slots = malloc((size_t)size*sizeof(command_slot_t));
+    if (q->slots == NULL){
+        return false;
+    }
+    for (uint32_t i = 0; i < size; i++){
+        atomic_init(&q->slots[i].seq, i);
+    }
+    q->mask = size - 1;
+    atomic_init(&q->tail, 0);
+    q->head = 0;
+
+    return true;
+}
+
+/**
+ *  Write a command, from any thread
+ *
+ *  Returns false if the queue is full.
+ */
+bool command_queue_push(command_queue_t *q, const command_t *command)
+{
+    uint32_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    command_slot_t *slot;
+
+    while (true){
+        slot = &q->slots[pos & q->mask];
+        int32_t diff = (int32_t)(atomic_load_explicit(&slot->seq, memory_order_acquire) - pos);
+        if (diff == 0){
+            // pos is updated to the current tail if another producer
+            // claimed it first
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)){
+                break;
+            }
+        }else if (diff < 0){
+            // The slot a lap back hasn't been read yet
+            return false;
+        }else{
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+
+    slot->command = *command;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+    return true;
+}
+
+/**
+ *  Read the oldest command, from the consumer's thread only
+ *
+ *  Returns false if there is none. A command that is still being
+ *  written holds back the ones after it until it is published.
+ */
+bool command_queue_pop(command_queue_t *q, command_t *command)
+{
+    command_slot_t *slot = &q->slots[q->head & q->mask];
+
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != q->head + 1){
+        return false;
+    }
+
+    *command = slot->command;
+    atomic_store_explicit(&slot->seq, q->head + q->mask + 1, memory_order_release);
+    q->head++;
+
+    return true;
+}
+
+/**
+ *  Queue adding a schedule to group
+ */
+bool command_queue_add(command_queue_t *q, uint32_t group, const ICAL *ical, command_fn fn, void *arg)
+{
+    command_t command = {.type = COMMAND_ADD, .key = group, .ical = *ical, .fn = fn, .arg = arg};
+
+    return command_queue_push(q, &command);
+}
+
+/**
+ *  Queue removing a schedule
+ */
+bool command_queue_remove(command_queue_t *q, uint32_t id, command_fn fn, void *arg)
+{
+    command_t command = {.type = COMMAND_REMOVE, .key = id, .fn = fn, .arg = arg};
+
+    return command_queue_push(q, &command);
+}
+
+/**
+ *  Queue replacing the ICAL of a schedule
+ */
+bool command_queue_update(command_queue_t *q, uint32_t id, const ICAL *ical, command_fn fn, void *arg)
+{
+    command_t command = {.type = COMMAND_UPDATE, .key = id, .ical = *ical, .fn = fn, .arg = arg};
+
+    return command_queue_push(q, &command);
+}
+
+/**
+ *  Queue recalculating a schedule
+ */
+bool command_queue_invalidate(command_queue_t *q, uint32_t id, command_fn fn, void *arg)
+{
+    command_t command = {.type = COMMAND_INVALIDATE, .key = id, .fn = fn, .arg = arg};
+
+    return command_queue_push(q, &command);
+}
+
+/**
+ *  Free a queue, dropping the commands left in it
+ */
+void command_queue_free(command_queue_t *q)
+{
+    free(q->slots);
+    q->slots = NULL;
+}
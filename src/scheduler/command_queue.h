@@ -0,0 +1,79 @@
+/*
+ * command_queue.h
+ *
+ * Created: 16/10/2026 6:11:32 PM
+ */
+
+
+#ifndef COMMAND_QUEUE_H_
+#define COMMAND_QUEUE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "ical.h"
+
+// Size of a cache line, to keep the producers' and the consumer's
+// positions apart
+#ifndef COMMAND_QUEUE_LINE_SIZE
+#define COMMAND_QUEUE_LINE_SIZE 64
+#endif
+
+typedef enum {
+    COMMAND_ADD,
+    COMMAND_REMOVE,
+    COMMAND_UPDATE,
+    COMMAND_INVALIDATE
+}command_type_t;
+
+// Called on the scheduler's thread once a command is applied, with the
+// id of the schedule, which for COMMAND_ADD is the id it was given
+typedef void (*command_fn)(void *arg, uint32_t id, bool ok);
+
+/**
+ * Change to the schedules of a scheduler
+ */
+typedef struct {
+    command_type_t type;
+    // Group of COMMAND_ADD, schedule id of the others
+    uint32_t key;
+    // ICAL of COMMAND_ADD and COMMAND_UPDATE
+    ICAL ical;
+    // Called when the command is applied if not NULL
+    command_fn fn;
+    void *arg;
+}command_t;
+
+/**
+ * Slot of the ring. seq is the position the slot can be written at,
+ * or that position + 1 once it holds a command to read
+ */
+typedef struct {
+    _Atomic uint32_t seq;
+    command_t command;
+}command_slot_t;
+
+/**
+ * Bounded ring of commands, written by any thread and read by one
+ */
+typedef struct command_queue
+{
+    command_slot_t *slots;
+    // Number of slots - 1, the number of slots is a power of 2
+    uint32_t mask;
+    // Next position to write, shared by the producers
+    _Alignas(COMMAND_QUEUE_LINE_SIZE) _Atomic uint32_t tail;
+    // Next position to read, only used by the consumer
+    _Alignas(COMMAND_QUEUE_LINE_SIZE) uint32_t head;
+}command_queue_t;
+
+bool command_queue_init(command_queue_t *q, uint32_t capacity);
+bool command_queue_push(command_queue_t *q, const command_t *command);
+bool command_queue_pop(command_queue_t *q, command_t *command);
+bool command_queue_add(command_queue_t *q, uint32_t group, const ICAL *ical, command_fn fn, void *arg);
+bool command_queue_remove(command_queue_t *q, uint32_t id, command_fn fn, void *arg);
+bool command_queue_update(command_queue_t *q, uint32_t id, const ICAL *ical, command_fn fn, void *arg);
+bool command_queue_invalidate(command_queue_t *q, uint32_t id, command_fn fn, void *arg);
+void command_queue_free(command_queue_t *q);
+
+#endif /* COMMAND_QUEUE_H_ */
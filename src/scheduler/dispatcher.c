@@ -0,0 +1,394 @@
+/*
+ * dispatcher.c
+ *
+ * Created: 16/10/2026 5:46:04 PM
+ *
+ *  Runs a thread that fires the events of a scheduler at their time,
+ *  instead of polling scheduler_update_events. Callbacks are registered
+ *  for a group or for a schedule id. The thread fetches the next
+ *  DISPATCHER_PREFETCH events with scheduler_next_whole_events, which
+ *  never splits the events of one time, and sleeps until the first one
+ *  is due on an absolute CLOCK_REALTIME deadline.
+ *  It then calls the callbacks of every event due. The lateness of each
+ *  wake-up is kept in the stats.
+ *
+ *  Scheduler times are taken as UTC, or as local times of tz if one is
+ *  given, which is the zone floating schedules are meant in.
+ *
+ *  While the thread runs it owns the scheduler. Other threads change
+ *  schedules between dispatcher_lock and dispatcher_unlock, and the
+ *  thread fetches the events again after the unlock. Callbacks are
+ *  called without the lock held, so they can lock it too.
+ *
+ *  With dispatcher_set_workers the callbacks are handed to a worker
+ *  pool instead of being called on the dispatcher thread. The events of
+ *  a group are handled one at a time in order, and different groups in
+ *  parallel, so a slow callback only holds up its own group.
+ *
+ *      dispatcher_t d;
+ *      dispatcher_init(&d, &ctx, NULL);
+ *      dispatcher_on_group(&d, 0, fn, arg);
+ *      dispatcher_start(&d);
+ *
+ *      dispatcher_lock(&d);
+ *      scheduler_add_r(&ctx, 0, &ical);
+ *      dispatcher_unlock(&d);
+ *
+ *      dispatcher_destroy(&d);
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "dispatcher.h"
+#include "civil.h"
+
+#define NS_PER_SEC INT64_C(1000000000)
+
+static void* _dispatcher_main(void *arg);
+static void _dispatcher_fetch(dispatcher_t *d);
+static void _dispatcher_fire(dispatcher_t *d);
+static bool _dispatcher_set(dispatcher_t *d, group_table_t *t, uint32_t key, dispatcher_fn fn, void *arg);
+static dispatcher_handler_t _dispatcher_get(group_table_t *t, uint32_t key);
+static time_t _dispatcher_to_utc(dispatcher_t *d, time_t t);
+
+/**
+ *  Initialize a dispatcher for a scheduler
+ *
+ *  tz is the zone of the scheduler's times, or NULL if they are UTC.
+ */
+void dispatcher_init(dispatcher_t *d, scheduler_t *scheduler, const TZTABLE *tz)
+{
+    d->scheduler = scheduler;
+    d->tz = tz;
+    group_table_init(&d->groups);
+    group_table_init(&d->schedules);
+    pool_init(&d->handler_pool, sizeof(dispatcher_handler_t), 8);
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->wake, NULL);
+    d->running = false;
+    d->stop = false;
+    d->changed = false;
+    d->use_workers = false;
+    d->events = NULL;
+    d->calls = NULL;
+    d->size = 0;
+    d->count = 0;
+    d->next = 0;
+    d->fired_until = 0;
+    d->stats = (dispatcher_stats_t){0};
+}
+
+/**
+ *  Call fn when an event of a group fires
+ *
+ *  A NULL fn removes the callback. Returns false if memory can't be
+ *  allocated.
+ */
+bool dispatcher_on_group(dispatcher_t *d, uint32_t group, dispatcher_fn fn, void *arg)
+{
+    return _dispatcher_set(d, &d->groups, group, fn, arg);
+}
+
+/**
+ *  Call fn when an event of a schedule fires
+ *
+ *  The schedule's group callback is called first. A NULL fn removes
+ *  the callback. Returns false if memory can't be allocated.
+ */
+bool dispatcher_on_schedule(dispatcher_t *d, uint32_t id, dispatcher_fn fn, void *arg)
+{
+    return _dispatcher_set(d, &d->schedules, id, fn, arg);
+}
+
+/**
+ *  Call the callbacks on count worker threads
+ *
+ *  Up to capacity callbacks wait for a worker, and up to group_limit
+ *  for one group. Callbacks that don't fit are dropped and counted in
+ *  the stats, the dispatcher thread doesn't wait for them. Must be
+ *  called before the dispatcher is started. Returns false if it was
+ *  started, already has workers, or the workers can't be started.
+ */
+bool dispatcher_set_workers(dispatcher_t *d, uint32_t count, uint32_t capacity, uint32_t group_limit)
+{
+    if (d->running || d->use_workers){
+        return false;
+    }
+
+    d->use_workers = worker_pool_init(&d->workers, count, capacity, group_limit);
+
+    return d->use_workers;
+}
+
+/**
+ *  Start the dispatcher thread
+ *
+ *  Events after the current time are fired. Returns false if the
+ *  thread is already running or can't be started.
+ */
+bool dispatcher_start(dispatcher_t *d)
+{
+    if (d->running){
+        return false;
+    }
+
+    d->stop = false;
+    d->changed = true;
+    if (pthread_create(&d->thread, NULL, _dispatcher_main, d) != 0){
+        return false;
+    }
+    d->running = true;
+
+    return true;
+}
+
+/**
+ *  Stop the dispatcher thread and wait for it to finish
+ */
+void dispatcher_stop(dispatcher_t *d)
+{
+    if (!d->running){
+        return;
+    }
+
+    pthread_mutex_lock(&d->lock);
+    d->stop = true;
+    pthread_cond_signal(&d->wake);
+    pthread_mutex_unlock(&d->lock);
+
+    pthread_join(d->thread, NULL);
+    d->running = false;
+}
+
+/**
+ *  Lock the dispatcher to change its scheduler or callbacks
+ */
+void dispatcher_lock(dispatcher_t *d)
+{
+    pthread_mutex_lock(&d->lock);
+}
+
+/**
+ *  Unlock the dispatcher, which fetches the scheduler's events again
+ */
+void dispatcher_unlock(dispatcher_t *d)
+{
+    d->changed = true;
+    pthread_cond_signal(&d->wake);
+    pthread_mutex_unlock(&d->lock);
+}
+
+/**
+ *  Get the wake-up lateness of the dispatcher so far
+ */
+void dispatcher_get_stats(dispatcher_t *d, dispatcher_stats_t *stats)
+{
+    pthread_mutex_lock(&d->lock);
+    *stats = d->stats;
+    pthread_mutex_unlock(&d->lock);
+}
+
+/**
+ *  Stop the dispatcher and free its callbacks
+ *
+ *  Callbacks waiting for a worker are run first. The scheduler is left
+ *  as it is.
+ */
+void dispatcher_destroy(dispatcher_t *d)
+{
+    dispatcher_stop(d);
+    if (d->use_workers){
+        worker_pool_destroy(&d->workers);
+        d->use_workers = false;
+    }
+    group_table_free(&d->groups);
+    group_table_free(&d->schedules);
+    pool_destroy(&d->handler_pool);
+    free(d->events);
+    free(d->calls);
+    d->events = NULL;
+    d->calls = NULL;
+    d->size = 0;
+    pthread_cond_destroy(&d->wake);
+    pthread_mutex_destroy(&d->lock);
+}
+
+/*************** Static Functions *********************/
+
+static void* _dispatcher_main(void *arg)
+{
+    dispatcher_t *d = arg;
+    struct timespec now;
+
+    pthread_mutex_lock(&d->lock);
+    clock_gettime(CLOCK_REALTIME, &now);
+    d->fired_until = d->tz ? tz_utc_to_local(d->tz, now.tv_sec) : now.tv_sec;
+
+    while (!d->stop){
+        if (d->changed){
+            d->changed = false;
+            _dispatcher_fetch(d);
+            continue;
+        }
+        if (d->next == d->count){
+            // No more events until the scheduler changes
+            pthread_cond_wait(&d->wake, &d->lock);
+            continue;
+        }
+
+        struct timespec deadline = {_dispatcher_to_utc(d, d->events[d->next].epoch), 0};
+        if (pthread_cond_timedwait(&d->wake, &d->lock, &deadline) == ETIMEDOUT){
+            _dispatcher_fire(d);
+        }
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    return NULL;
+}
+
+/**
+ *  Fetch the events after the ones that have fired
+ *
+ *  Every event of a time is fetched together, so the time of the last
+ *  one fired is where the next fetch starts. If the callbacks can't be
+ *  grown to match the events, the events without room are left out.
+ */
+static void _dispatcher_fetch(dispatcher_t *d)
+{
+    struct tm t;
+    uint32_t size = d->size;
+
+    civil_to_tm(d->fired_until, &t);
+    d->count = scheduler_next_whole_events_r(d->scheduler, &t, DISPATCHER_PREFETCH, &d->events, &size);
+    if (size > d->size){
+        dispatcher_handler_t (*calls)[2] = realloc(d->calls, (size_t)size*sizeof(*calls));
+        if (calls){
+            d->calls = calls;
+            d->size = size;
+        }
+    }
+    if (d->count > d->size){
+        d->count = d->size;
+    }
+    d->next = 0;
+}
+
+/**
+ *  Fire every event that is due
+ *
+ *  The callbacks of each event are looked up with the lock held, and
+ *  called after it is released, or handed to the workers. The
+ *  scheduler is updated to the current time, so its group events are
+ *  the ones still to come.
+ */
+static void _dispatcher_fire(dispatcher_t *d)
+{
+    struct timespec now;
+    struct tm t_now;
+    uint32_t first = d->next;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    time_t local = d->tz ? tz_utc_to_local(d->tz, now.tv_sec) : now.tv_sec;
+
+    while (d->next < d->count && d->events[d->next].epoch <= local){
+        d->calls[d->next][0] = _dispatcher_get(&d->groups, d->events[d->next].group);
+        d->calls[d->next][1] = _dispatcher_get(&d->schedules, d->events[d->next].id);
+        d->next++;
+    }
+    uint32_t last = d->next;
+    if (last == first){
+        return;
+    }
+
+    int64_t late = (now.tv_sec - _dispatcher_to_utc(d, d->events[first].epoch))*NS_PER_SEC + now.tv_nsec;
+    d->stats.wakeups++;
+    d->stats.events += last - first;
+    d->stats.late_last_ns = late;
+    d->stats.late_total_ns += late;
+    if (late > d->stats.late_max_ns){
+        d->stats.late_max_ns = late;
+    }
+    // Events after the last one fired may be due too, they are fetched
+    // next and fire straight away
+    d->fired_until = d->events[last - 1].epoch;
+    civil_to_tm(local, &t_now);
+    scheduler_update_events_r(d->scheduler, &t_now);
+
+    if (d->use_workers){
+        for (uint32_t i = first; i < last; i++){
+            for (uint32_t j = 0; j < 2; j++){
+                if (d->calls[i][j].fn &&
+                    !worker_pool_submit(&d->workers, d->events[i].group, d->calls[i][j].fn, d->calls[i][j].arg, &d->events[i])){
+                    d->stats.dropped++;
+                }
+            }
+        }
+    }else{
+        pthread_mutex_unlock(&d->lock);
+        for (uint32_t i = first; i < last; i++){
+            for (uint32_t j = 0; j < 2; j++){
+                if (d->calls[i][j].fn){
+                    d->calls[i][j].fn(d->calls[i][j].arg, &d->events[i]);
+                }
+            }
+        }
+        pthread_mutex_lock(&d->lock);
+    }
+
+    if (d->next == d->count && !d->changed){
+        _dispatcher_fetch(d);
+    }
+}
+
+/**
+ *  Set or remove the callback of a key in a handler table
+ */
+static bool _dispatcher_set(dispatcher_t *d, group_table_t *t, uint32_t key, dispatcher_fn fn, void *arg)
+{
+    bool result = true;
+
+    pthread_mutex_lock(&d->lock);
+    dispatcher_handler_t *h = group_table_find(t, key);
+    if (fn == NULL){
+        if (h){
+            group_table_remove(t, key);
+            pool_free(&d->handler_pool, h);
+        }
+    }else{
+        if (h == NULL){
+            h = pool_alloc(&d->handler_pool);
+            if (h && !group_table_insert(t, key, h)){
+                pool_free(&d->handler_pool, h);
+                h = NULL;
+            }
+        }
+        if (h){
+            h->fn = fn;
+            h->arg = arg;
+        }else{
+            result = false;
+        }
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    return result;
+}
+
+static dispatcher_handler_t _dispatcher_get(group_table_t *t, uint32_t key)
+{
+    dispatcher_handler_t *h = group_table_find(t, key);
+
+    return h ? *h : (dispatcher_handler_t){NULL, NULL};
+}
+
+/**
+ *  Convert a scheduler time to UTC
+ */
+static time_t _dispatcher_to_utc(dispatcher_t *d, time_t t)
+{
+    return d->tz ? tz_local_to_utc(d->tz, t) : t;
+}
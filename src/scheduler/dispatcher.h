@@ -0,0 +1,101 @@
+/*
+ * dispatcher.h
+ *
+ * Created: 16/10/2026 5:46:04 PM
+ */
+
+
+#ifndef DISPATCHER_H_
+#define DISPATCHER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "scheduler.h"
+#include "pool.h"
+#include "group_table.h"
+#include "tz.h"
+#include "worker_pool.h"
+
+// Number of upcoming events fetched at a time, more if they are all
+// at one time
+#ifndef DISPATCHER_PREFETCH
+#define DISPATCHER_PREFETCH 64
+#endif
+
+// Called on the dispatcher thread when an event fires, or on a worker
+// if the dispatcher has workers
+typedef void (*dispatcher_fn)(void *arg, const EVENT *event);
+
+/**
+ * Callback registered for a group or schedule
+ */
+typedef struct {
+    dispatcher_fn fn;
+    void *arg;
+}dispatcher_handler_t;
+
+/**
+ * Wake-up lateness of the dispatcher thread. A wake-up is late by the
+ * time between the first event due and the thread running again.
+ */
+typedef struct {
+    uint32_t wakeups;
+    uint32_t events;
+    int64_t late_last_ns;
+    int64_t late_max_ns;
+    int64_t late_total_ns;
+    // Callbacks dropped because the workers' queue was full
+    uint32_t dropped;
+}dispatcher_stats_t;
+
+/**
+ * Thread that fires the events of a scheduler on time
+ */
+typedef struct dispatcher
+{
+    scheduler_t *scheduler;
+    // Zone of the scheduler's times, NULL if they are UTC
+    const TZTABLE *tz;
+
+    // Handlers by group and by schedule id
+    group_table_t groups;
+    group_table_t schedules;
+    pool_t handler_pool;
+    // Workers the callbacks run on, if use_workers is set
+    worker_pool_t workers;
+    bool use_workers;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool running;
+    bool stop;
+    // Set when the scheduler was changed and the events are fetched again
+    bool changed;
+
+    // Upcoming events, from next up to count, and their callbacks. The
+    // arrays have room for size events.
+    EVENT *events;
+    dispatcher_handler_t (*calls)[2];
+    uint32_t size;
+    uint32_t count;
+    uint32_t next;
+    // Events up to this time have fired
+    time_t fired_until;
+
+    dispatcher_stats_t stats;
+}dispatcher_t;
+
+void dispatcher_init(dispatcher_t *d, scheduler_t *scheduler, const TZTABLE *tz);
+bool dispatcher_on_group(dispatcher_t *d, uint32_t group, dispatcher_fn fn, void *arg);
+bool dispatcher_on_schedule(dispatcher_t *d, uint32_t id, dispatcher_fn fn, void *arg);
+bool dispatcher_set_workers(dispatcher_t *d, uint32_t count, uint32_t capacity, uint32_t group_limit);
+bool dispatcher_start(dispatcher_t *d);
+void dispatcher_stop(dispatcher_t *d);
+void dispatcher_lock(dispatcher_t *d);
+void dispatcher_unlock(dispatcher_t *d);
+void dispatcher_get_stats(dispatcher_t *d, dispatcher_stats_t *stats);
+void dispatcher_destroy(dispatcher_t *d);
+
+#endif /* DISPATCHER_H_ */
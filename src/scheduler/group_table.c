@@ -0,0 +1,241 @@
+/*
+ * group_table.c
+ *
+ * Created: 16/10/2026 4:46:13 PM
+ *
+ *  Maps 32 bit group numbers to values in O(1). Groups are usually
+ *  numbered from 0, so keys below GROUP_TABLE_DENSE_MAX are kept in
+ *  an array indexed by the key, which grows to fit the largest key.
+ *  Larger keys are kept in an open addressing map with linear probing,
+ *  kept at most half full. Removing a key shifts the following keys
+ *  of its probe sequence back, so there are no tombstones.
+ *
+ *  A table given a fixed buffer with group_table_init_static only
+ *  uses the map, and doesn't allocate.
+ *
+ *      group_table_t t;
+ *      group_table_init(&t);
+ *      group_table_insert(&t, group, value);
+ *      value = group_table_find(&t, group);
+ *      group_table_free(&t);
+ */ 
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include "group_table.h"
+
+#define MAP_MIN_SIZE 16
+
+static uint32_t _group_table_hash(uint32_t key, uint32_t size);
+static bool _group_table_grow_dense(group_table_t *t, uint32_t key);
+static bool _group_table_grow_map(group_table_t *t);
+static void _group_table_map_put(group_slot_t *map, uint32_t size, uint32_t key, void *value);
+
+/**
+ *  Initialize an empty table
+ */
+void group_table_init(group_table_t *t)
+{
+    t->dense = NULL;
+    t->dense_size = 0;
+    t->map = NULL;
+    t->map_size = 0;
+    t->map_count = 0;
+    t->fixed = false;
+}
+
+/**
+ *  Initialize a table that holds up to count keys in a fixed buffer
+ *
+ *  The buffer must be GROUP_TABLE_BUFFER_SIZE(count) bytes.
+ */
+void group_table_init_static(group_table_t *t, void *buffer, uint32_t count)
+{
+    group_table_init(t);
+    t->fixed = true;
+    t->map = buffer;
+
+    // Smallest power of 2 that keeps the map at most half full
+    t->map_size = 2;
+    while (t->map_size < 2*count){
+        t->map_size *= 2;
+    }
+    for (uint32_t i = 0; i < t->map_size; i++){
+        t->map[i].value = NULL;
+    }
+}
+
+/**
+ *  Get the value of a key
+ *
+ *  NULL is returned if the key isn't in the table.
+ */
+void* group_table_find(const group_table_t *t, uint32_t key)
+{
+    if (key < t->dense_size){
+        return t->dense[key];
+    }
+    if (t->map_count == 0){
+        return NULL;
+    }
+
+    uint32_t mask = t->map_size - 1;
+    for (uint32_t i = _group_table_hash(key, t->map_size); t->map[i].value; i = (i + 1) & mask){
+        if (t->map[i].key == key){
+            return t->map[i].value;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ *  Add a key that isn't in the table
+ *
+ *  Returns false if memory can't be allocated or a fixed table is full.
+ */
+bool group_table_insert(group_table_t *t, uint32_t key, void *value)
+{
+    if (!t->fixed && key < GROUP_TABLE_DENSE_MAX){
+        if (key >= t->dense_size && !_group_table_grow_dense(t, key)){
+            return false;
+        }
+        t->dense[key] = value;
+        return true;
+    }
+
+    if (2*(t->map_count + 1) > t->map_size){
+        if (t->fixed || !_group_table_grow_map(t)){
+            return false;
+        }
+    }
+    _group_table_map_put(t->map, t->map_size, key, value);
+    t->map_count++;
+
+    return true;
+}
+
+/**
+ *  Remove a key from the table
+ */
+void group_table_remove(group_table_t *t, uint32_t key)
+{
+    if (key < t->dense_size){
+        t->dense[key] = NULL;
+        return;
+    }
+    if (t->map_count == 0){
+        return;
+    }
+
+    uint32_t mask = t->map_size - 1;
+    uint32_t i = _group_table_hash(key, t->map_size);
+    while (t->map[i].value && t->map[i].key != key){
+        i = (i + 1) & mask;
+    }
+    if (t->map[i].value == NULL){
+        return;
+    }
+
+    // Move back keys that can't be found past the hole
+    uint32_t hole = i;
+    for (i = (i + 1) & mask; t->map[i].value; i = (i + 1) & mask){
+        uint32_t home = _group_table_hash(t->map[i].key, t->map_size);
+        if (((i - home) & mask) >= ((i - hole) & mask)){
+            t->map[hole] = t->map[i];
+            hole = i;
+        }
+    }
+    t->map[hole].value = NULL;
+    t->map_count--;
+}
+
+/**
+ *  Free the memory of a table that isn't fixed, leaving it empty
+ */
+void group_table_free(group_table_t *t)
+{
+    if (!t->fixed){
+        free(t->dense);
+        free(t->map);
+        group_table_init(t);
+    }
+}
+
+/*************** Static Functions *********************/
+
+/**
+ *  Fibonacci hash of a key to a slot of a power of 2 sized map
+ */
+static uint32_t _group_table_hash(uint32_t key, uint32_t size)
+{
+    return (uint32_t)(key*UINT32_C(2654435769)) >> (32 - __builtin_ctz(size));
+}
+
+/**
+ *  Grow the dense array to fit a key
+ */
+static bool _group_table_grow_dense(group_table_t *t, uint32_t key)
+{
+    uint32_t size = t->dense_size ? t->dense_size : 8;
+    while (size <= key){
+        size *= 2;
+    }
+    if (size > GROUP_TABLE_DENSE_MAX){
+        size = GROUP_TABLE_DENSE_MAX;
+    }
+
+    void **dense = realloc(t->dense, size*sizeof(void*));
+    if (dense == NULL){
+        return false;
+    }
+    for (uint32_t i = t->dense_size; i < size; i++){
+        dense[i] = NULL;
+    }
+    t->dense = dense;
+    t->dense_size = size;
+
+    return true;
+}
+
+/**
+ *  Double the size of the map
+ */
+static bool _group_table_grow_map(group_table_t *t)
+{
+    uint32_t size = t->map_size ? 2*t->map_size : MAP_MIN_SIZE;
+    group_slot_t *map = malloc(size*sizeof(group_slot_t));
+
+    if (map == NULL){
+        return false;
+    }
+    for (uint32_t i = 0; i < size; i++){
+        map[i].value = NULL;
+    }
+    for (uint32_t i = 0; i < t->map_size; i++){
+        if (t->map[i].value){
+            _group_table_map_put(map, size, t->map[i].key, t->map[i].value);
+        }
+    }
+
+    free(t->map);
+    t->map = map;
+    t->map_size = size;
+
+    return true;
+}
+
+/**
+ *  Put a key in the first empty slot of its probe sequence
+ */
+static void _group_table_map_put(group_slot_t *map, uint32_t size, uint32_t key, void *value)
+{
+    uint32_t i = _group_table_hash(key, size);
+    while (map[i].value){
+        i = (i + 1) & (size - 1);
+    }
+    map[i].key = key;
+    map[i].value = value;
+}
@@ -0,0 +1,55 @@
+/*
+ * group_table.h
+ *
+ * Created: 16/10/2026 4:46:13 PM
+ */ 
+
+
+#ifndef GROUP_TABLE_H_
+#define GROUP_TABLE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Keys below this are kept in a directly indexed array
+#ifndef GROUP_TABLE_DENSE_MAX
+#define GROUP_TABLE_DENSE_MAX 4096
+#endif
+
+/**
+ * Slot of the open addressing map. Empty slots have a NULL value
+ */
+typedef struct {
+    uint32_t key;
+    void *value;
+}group_slot_t;
+
+/**
+ * Table of values indexed by 32 bit group numbers
+ */
+typedef struct group_table
+{
+    // Values of keys below dense_size, NULL if not set
+    void **dense;
+    uint32_t dense_size;
+
+    // Linear probing map of the other keys, map_size is a power of 2
+    group_slot_t *map;
+    uint32_t map_size;
+    uint32_t map_count;
+
+    // Set if the table uses a fixed buffer and can't grow
+    bool fixed;
+}group_table_t;
+
+// Size of a fixed buffer to hold count keys
+#define GROUP_TABLE_BUFFER_SIZE(count) ((4*(count) + 2)*sizeof(group_slot_t))
+
+void group_table_init(group_table_t *t);
+void group_table_init_static(group_table_t *t, void *buffer, uint32_t count);
+void* group_table_find(const group_table_t *t, uint32_t key);
+bool group_table_insert(group_table_t *t, uint32_t key, void *value);
+void group_table_remove(group_table_t *t, uint32_t key);
+void group_table_free(group_table_t *t);
+
+#endif /* GROUP_TABLE_H_ */
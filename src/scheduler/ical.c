@@ -34,6 +34,12 @@
  *    count -     Determines how many times an event can be triggered for 
  *                the schedule. A value of 0 means there is no count limit
  *
+ *    tz -        Optional timezone table (see tz.c) that the start and end
+ *                times are in. When set, the current time passed to
+ *                ical_find_next_event and the next event returned are in
+ *                UTC. When NULL, the schedule uses floating time and all
+ *                times are taken as wall clock times
+ *
  *
  *  eg 1. Every 15 minutes, on Monday and Thursday from 8pm till 8am the next day
  *    Start Date = 2016/10/24
@@ -51,15 +57,19 @@
 #include <time.h>
 #include <math.h>
 #include "ical.h"
+#include "civil.h"
 
 #define ONE_MIN  60
-#define ONE_HOUR 60*ONE_MIN
-#define ONE_DAY  24*ONE_HOUR
+#define ONE_HOUR (60*ONE_MIN)
+#define ONE_DAY  CIVIL_ONE_DAY
 
 // Static Functions
-static ICALEVENT _ical_find_next_recur_event(ICAL *const ical, struct tm *dt_current_time, struct tm *dt_next_event);
-static void _ical_set_new_start_and_end_times(struct tm *dt_date, struct tm *dt_start, struct tm *dt_end);
+static ICALEVENT _ical_find_next_recur_event(const ICALRECORD *const record, time_t e_current, time_t e_end, time_t *e_event);
+static void _ical_set_new_start_and_end_times(const ICALRECORD *const record, int32_t day, time_t *e_start, time_t *e_end);
+static uint32_t _ical_get_steps(const ICALRECORD *const record, ICALEVENT event, time_t e_event);
 static bool _is_day_of_week(uint8_t wday, BYDAY cal_day);
+static time_t _ical_get_period(const ICAL *const ical);
+static time_t _ical_get_seconds_of_day(const struct tm *t);
 
 /**
  * \brief Get default values for schedule struct
@@ -90,6 +100,7 @@ void ical_get_defaults(ICAL *const ical)
     ical->byday = WEEKDAYS;
     ical->enabled = false;
     ical->count = 0;
+    ical->tz = NULL;
 }
 
 /**
@@ -108,61 +119,304 @@ void ical_set_time_struct(struct tm *t, uint16_t year, uint8_t mon, uint8_t day,
     t->tm_isdst = -1;        // Is DST on? 1 = yes, 0 = no, -1 = unknown
 }
 
+/**
+ * \brief Find next event in an ical struct
+ *
+ *  Wrapper for ical_find_next_epoch that takes and returns time structs.
+ *  t_next_event is only written when an event is found.
+ *   
+ */
+ICALEVENT ical_find_next_event(ICAL *const ical, struct tm *t_current_time, struct tm *t_next_event)
+{
+    time_t e_next_event;
+    ICALEVENT event = ical_find_next_epoch(ical, civil_from_tm(t_current_time), &e_next_event);
+
+    if(ical_is_event(event)){
+        civil_to_tm(e_next_event, t_next_event);
+    }
+
+    return(event);
+}
+
 /**
  * \brief Find next event in an ical struct
  *
  *  This function first checks if any of the ical inputs are invalid
  *  Then it checks if the current time is within the start and end date. If
  *  these are all valid, _ical_find_next_recur_event is called.
+ *
+ *  All date math is done in civil seconds (see civil.c) so the result
+ *  does not depend on the TZ environment of the process. If the ical
+ *  has a timezone, the current time is converted from UTC to the
+ *  schedule's local time first and the next event is converted back.
+ *
+ *  When an event is found, e_next_event is set to its time. Otherwise
+ *  it is set to the time the result could next change, or to
+ *  ICAL_EPOCH_NEVER if it won't change. Until then, the same result is
+ *  returned for any later current time.
  *   
  */
-ICALEVENT ical_find_next_event(ICAL *const ical, struct tm *t_current_time, struct tm *t_next_event)
+ICALEVENT ical_find_next_epoch(ICAL *const ical, time_t e_current, time_t *e_next_event)
+{
+    ICALRECORD record;
+
+    ical_compile(ical, &record);
+
+    return(ical_record_find_next_epoch(&record, e_current, e_next_event));
+}
+
+/**
+ * \brief Find next event in a compiled ical
+ *
+ *  Same as ical_find_next_epoch but works on the record made by
+ *  ical_compile, so the struct tm fields don't have to be converted
+ *  on every call.
+ *   
+ */
+ICALEVENT ical_record_find_next_epoch(const ICALRECORD *const record, time_t e_current, time_t *e_next_event)
 {
     ICALEVENT event = ICALEVENT_NONE;
 
-    // Convert all times to seconds since epoch
-    time_t e_current = mktime(t_current_time);
-    time_t e_start = mktime(&ical->t_start);
-    time_t e_end = mktime(&ical->t_end);
+    time_t e_start = (time_t)record->start_date*ONE_DAY + record->start_time;
+    time_t e_end = (time_t)record->end_date*ONE_DAY + record->end_time;
+    time_t e_next = ICAL_EPOCH_NEVER;
+
+    *e_next_event = ICAL_EPOCH_NEVER;
 
     // Error checking
-    if(e_start > e_end){
-        event = ICALERROR_START_GREATER_THAN_END;
-        return(event);
-    }else if(!ical->interval){
-        event = ICALERROR_INVALID_INTERVAL;
-        return(event);
-    }else if(ical->interval>24&&ical->freq==HOURLY){
-        event = ICALERROR_INVALID_INTERVAL;
-        return(event);
-    }else if(ical->byday==0 || ical->byday>0x7F){
-        event = ICALERROR_INVALID_BYDAY;
-        return(event);
-    }else if(ical->freq>3){
-        event = ICALERROR_INVALID_FREQ;
-        return(event);
-    }else if(!(_is_day_of_week(ical->t_start.tm_wday, ical->byday)) &&
-           !(ical->interval%168)&&(ical->freq==HOURLY)){
-        event = ICALERROR_INVALID_RECURRENCE;
+    event = (ICALEVENT)record->error;
+    if(event != ICALEVENT_NONE){
         return(event);
     }
 
     // Continue if ical active
-    if(ical_is_enabled(ical)){
+    if(record->enabled){
+        time_t e_current_utc = e_current;
+        if(record->tz){
+            e_current = tz_utc_to_local(record->tz, e_current);
+        }
+
         if (e_current < e_start){ // Upcoming ical event
             event = ICALEVENT_START;
-            *t_next_event = ical->t_start;
+            e_next = e_start;
         }else if ((e_current >= e_start) && (e_current < e_end)){ // Active ical events
             // Get next recurring event
-            event = _ical_find_next_recur_event(ical, t_current_time, t_next_event);
+            event = _ical_find_next_recur_event(record, e_current, e_end, &e_next);
         }else{ // Past ical event
             event = ICALEVENT_NONE;
         }
+
+        if(record->tz && e_next != ICAL_EPOCH_NEVER){
+            time_t e_local = e_next;
+            e_next = tz_local_to_utc(record->tz, e_local);
+            // When clocks go back, a local time can happen twice. If the
+            // first one has passed, use the current offset to get the second
+            if(e_next <= e_current_utc){
+                e_next = e_local - tz_get_utc_offset(record->tz, e_current_utc);
+            }
+        }
+        *e_next_event = e_next;
     }
 
     return(event);
 }
 
+/**
+ * \brief Check an ical struct for errors
+ *
+ *  Returns the error ical_find_next_event would return for the
+ *  struct, or ICALEVENT_NONE if it is valid.
+ */
+ICALEVENT ical_validate(const ICAL *const ical)
+{
+    time_t e_start = civil_from_tm(&ical->t_start);
+    time_t e_end = civil_from_tm(&ical->t_end);
+
+    if(e_start > e_end){
+        return(ICALERROR_START_GREATER_THAN_END);
+    }else if(!ical->interval){
+        return(ICALERROR_INVALID_INTERVAL);
+    }else if(ical->interval>24&&ical->freq==HOURLY){
+        return(ICALERROR_INVALID_INTERVAL);
+    }else if(ical->byday==0 || ical->byday>0x7F){
+        return(ICALERROR_INVALID_BYDAY);
+    }else if(ical->freq>3){
+        return(ICALERROR_INVALID_FREQ);
+    }else if((ical->freq==HOURLY)&&!(ical->interval%168)&&
+           !(_is_day_of_week(civil_weekday(civil_days_from_time(e_start)), ical->byday))){
+        return(ICALERROR_INVALID_RECURRENCE);
+    }
+
+    return(ICALEVENT_NONE);
+}
+
+/**
+ * \brief Compile an ical struct into a record
+ *
+ *  Times of day are kept as given rather than normalized, so an hour
+ *  of 25 still lands on the next day as it does with the struct.
+ */
+void ical_compile(const ICAL *const ical, ICALRECORD *const record)
+{
+    time_t start_time = _ical_get_seconds_of_day(&ical->t_start);
+    time_t end_time = _ical_get_seconds_of_day(&ical->t_end);
+
+    // civil_from_tm adds the time of day to the date, so this is exact
+    record->start_date = (int32_t)((civil_from_tm(&ical->t_start) - start_time)/ONE_DAY);
+    record->end_date = (int32_t)((civil_from_tm(&ical->t_end) - end_time)/ONE_DAY);
+    record->start_time = (int32_t)start_time;
+    record->end_time = (int32_t)end_time;
+    record->period = (uint32_t)_ical_get_period(ical);
+    record->byday = (uint8_t)ical->byday;
+    record->count = ical->count;
+    record->interval = ical->interval;
+    record->freq = (uint8_t)ical->freq;
+    record->enabled = ical->enabled;
+    record->error = (uint8_t)ical_validate(ical);
+    record->tz = ical->tz;
+}
+
+/**
+ * \brief Rebuild an ical struct from a record
+ *
+ *  Compiling the result gives back the same record. Only an invalid
+ *  freq or byday, which the record stores truncated, is lost.
+ */
+void ical_decompile(const ICALRECORD *const record, ICAL *const ical)
+{
+    civil_to_tm((time_t)record->start_date*ONE_DAY, &ical->t_start);
+    ical->t_start.tm_hour = record->start_time/ONE_HOUR;
+    ical->t_start.tm_min = record->start_time%ONE_HOUR/ONE_MIN;
+    ical->t_start.tm_sec = record->start_time%ONE_MIN;
+    ical->t_start.tm_isdst = -1;
+
+    civil_to_tm((time_t)record->end_date*ONE_DAY, &ical->t_end);
+    ical->t_end.tm_hour = record->end_time/ONE_HOUR;
+    ical->t_end.tm_min = record->end_time%ONE_HOUR/ONE_MIN;
+    ical->t_end.tm_sec = record->end_time%ONE_MIN;
+    ical->t_end.tm_isdst = -1;
+
+    ical->freq = (FREQ)record->freq;
+    ical->interval = record->interval;
+    ical->byday = (BYDAY)record->byday;
+    ical->count = record->count;
+    ical->enabled = record->enabled;
+    ical->tz = record->tz;
+}
+
+/**
+ * \brief Start expanding the occurrences of an ical over a time range
+ *
+ *  ical_expand_next then returns each START, RECUR and END event from
+ *  e_from up to but not including e_to, in order. These are the events
+ *  ical_find_next_epoch gives when each result is fed back in as the
+ *  current time, continuing past a count limit to the next day.
+ */
+void ical_expand_init(ICALEXPAND *const expand, const ICAL *const ical, time_t e_from, time_t e_to)
+{
+    ICALRECORD record;
+
+    ical_compile(ical, &record);
+    ical_record_expand_init(expand, &record, e_from, e_to);
+}
+
+/**
+ * \brief Start expanding the occurrences of a compiled ical
+ *
+ *  Same as ical_expand_init for the record made by ical_compile.
+ */
+void ical_record_expand_init(ICALEXPAND *const expand, const ICALRECORD *const record, time_t e_from, time_t e_to)
+{
+    expand->record = *record;
+    expand->e_current = e_from - 1;
+    expand->e_to = e_to;
+    expand->steps = 0;
+}
+
+/**
+ * \brief Get the next occurrence of an expansion
+ *
+ *  Returns false once there are no more occurrences in the range.
+ *  The rest of a day's occurrences are found by adding the period,
+ *  and the first one of each day with ical_record_find_next_epoch.
+ */
+bool ical_expand_next(ICALEXPAND *const expand, ICALEVENT *const event, time_t *const e_event)
+{
+    time_t e_next;
+    ICALEVENT next;
+
+    if(expand->e_current >= expand->e_to){
+        return false;
+    }
+
+    bool stepped = expand->steps != 0;
+
+    if(stepped){
+        expand->steps--;
+        next = ICALEVENT_RECUR;
+        e_next = expand->e_current + expand->record.period;
+    }else{
+        next = ical_record_find_next_epoch(&expand->record, expand->e_current, &e_next);
+        // Past a count limit the search goes on from the time given
+        while(!ical_is_event(next) && e_next != ICAL_EPOCH_NEVER &&
+              e_next > expand->e_current && e_next < expand->e_to){
+            expand->e_current = e_next;
+            next = ical_record_find_next_epoch(&expand->record, expand->e_current, &e_next);
+        }
+        if(!ical_is_event(next)){
+            e_next = ICAL_EPOCH_NEVER;
+        }
+    }
+
+    if(e_next >= expand->e_to){
+        expand->e_current = expand->e_to;
+        expand->steps = 0;
+        return false;
+    }
+
+    if(!stepped){
+        expand->steps = _ical_get_steps(&expand->record, next, e_next);
+    }
+    expand->e_current = e_next;
+    *event = next;
+    *e_event = e_next;
+
+    return true;
+}
+
+/**
+ * \brief Pass every occurrence of an ical in a time range to fn
+ *
+ *  See ical_expand_init for the range. Stops early if fn returns
+ *  false. Returns the number of occurrences passed to fn.
+ */
+uint32_t ical_expand(const ICAL *const ical, time_t e_from, time_t e_to, ical_expand_fn fn, void *arg)
+{
+    ICALEXPAND expand;
+    ICALEVENT event;
+    time_t e_event;
+    uint32_t count = 0;
+
+    ical_expand_init(&expand, ical, e_from, e_to);
+    while(ical_expand_next(&expand, &event, &e_event)){
+        count++;
+        if(!fn(arg, event, e_event)){
+            break;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * \brief Check if an ICALEVENT is an event rather than none or an error
+ *   
+ */
+bool ical_is_event(ICALEVENT event)
+{
+    return event == ICALEVENT_START || event == ICALEVENT_RECUR || event == ICALEVENT_END;
+}
+
 /**
  * \brief Find next recurring event in an ical struct
  *   
@@ -172,15 +426,16 @@ ICALEVENT ical_find_next_event(ICAL *const ical, struct tm *t_current_time, stru
  *  end of the week (current day + 7).
  *
  */
-ICALEVENT _ical_find_next_recur_event(ICAL *const ical, struct tm *t_current_time, struct tm *t_event)
+static ICALEVENT _ical_find_next_recur_event(const ICALRECORD *const record, time_t e_current, time_t e_end, time_t *e_event)
 {
     ICALEVENT event = ICALEVENT_NONE;
-    uint8_t i = 0, count = 0;
+    uint8_t i = 0;
+    uint32_t count = 0;
 
-    time_t e_next_event = mktime(t_current_time);
-    struct tm t_temp_start = ical->t_start;
-    struct tm t_temp_end = ical->t_end;
-    struct tm * t_next_event;
+    int32_t day = civil_days_from_time(e_current);
+    time_t e_next_event = e_current;
+    time_t e_start_time, e_end_time;
+    time_t e_recheck = ICAL_EPOCH_NEVER;
 
     // Iterate through each day until an active schedule is found
     while(event==ICALEVENT_NONE && i<10){
@@ -188,75 +443,60 @@ ICALEVENT _ical_find_next_recur_event(ICAL *const ical, struct tm *t_current_tim
         if(i==0){
             // Start by checking the schedule from the day before
             e_next_event -= ONE_DAY;
+            day--;
         }else{
             // Now increment the day
             e_next_event += ONE_DAY;
+            day++;
         }
 
-        // Convert back to human readable
-        t_next_event = localtime(&e_next_event);
-
         // Check if schedule is active on this day
-        if(_is_day_of_week(t_next_event->tm_wday, ical->byday)){
+        if(_is_day_of_week(civil_weekday(day), (BYDAY)record->byday)){
           
             // Reset start and end times
-            _ical_set_new_start_and_end_times(t_next_event, &t_temp_start, &t_temp_end);
-            time_t e_current = mktime(t_current_time);
-            time_t e_start_time = mktime(&t_temp_start);
-            time_t e_end_time = mktime(&t_temp_end);
+            _ical_set_new_start_and_end_times(record, day, &e_start_time, &e_end_time);
 
             if(e_current < e_start_time){
                 // If current time is before schedule start, then that is next event
                 e_next_event = e_start_time;
                 event = ICALEVENT_START;
             }else if((e_current >= e_start_time) && (e_current < e_end_time)){
-                // If current time is in between start and end, find next event
-                e_next_event = e_start_time;
-                // Restart count
-                count = 0;
-                // Count up in increments of 'interval' to find next event
-                while (e_next_event <= e_current)
-                {
-                    switch (ical->freq)
-                    {
-                        case LIMITS:
-                            e_next_event = e_end_time;
-                            break;
-                          
-                        case SECONDLY:
-                            e_next_event += ical->interval;
-                            break;
-
-                        case MINUTELY:
-                            e_next_event += ical->interval*60;
-                            break;
-
-                        case HOURLY:
-                            e_next_event += ical->interval*3600;
-                            break;
-
-                        default:
-                            break;
-                    }
-                    count++;
+                // If current time is in between start and end, find next event.
+                // The occurrence index is the number of whole intervals that
+                // fit between the start time and the current time, plus one
+                // for the occurrence that lands strictly after current time
+                if(record->freq == LIMITS){
+                    e_next_event = e_end_time;
+                    count = 1;
+                }else{
+                    time_t period = record->period;
+                    count = (uint32_t)((e_current - e_start_time)/period) + 1;
+                    e_next_event = e_start_time + (time_t)count*period;
                 }
 
                 // If the event is found within a schedule, then we're done, otherwise continue search
                 if(e_next_event <= e_end_time){
                     // Check if an occurrence counter rule is applied
-                    if(ical->count){
-                        if(count < ical->count){
+                    if(record->count){
+                        if(count < record->count){
                             event = ICALEVENT_RECUR;
                         }else{
-                            // Count is exceeded, nothing else to do
+                            // Count is exceeded, nothing else to do until
+                            // the last occurrence in today's schedule has
+                            // passed and the search moves on to the next day
                             event = ICALEVENT_NONE;
+                            e_recheck = e_end_time;
+                            if(record->freq != LIMITS){
+                                time_t period = record->period;
+                                e_recheck = e_start_time + ((e_end_time - e_start_time)/period)*period;
+                            }
                             break;
                         }
                     }else{
                         event = ICALEVENT_RECUR;
                     }
                     // Check for special case of LIMITS
-                    if(ical->freq == LIMITS){
+                    if(record->freq == LIMITS){
                         event = ICALEVENT_END;
                     }
                 }
@@ -266,43 +506,90 @@ ICALEVENT _ical_find_next_recur_event(ICAL *const ical, struct tm *t_current_tim
         // i can go up to 10 in this loop because we first step back a day, then forward
         i++;
     }
-    // Update tm struct
-    *t_event = *localtime(&e_next_event);
-
     // Final check to determine if next event time surpasses end datetime
-    if(e_next_event > mktime(&ical->t_end)){
+    if(e_next_event > e_end){
         event = ICALEVENT_NONE;
+        e_recheck = ICAL_EPOCH_NEVER;
     }
 
+    *e_event = (event == ICALEVENT_NONE) ? e_recheck : e_next_event;
+
     return(event);
 }
 
 /**
- * \brief Output start and end time structs based on a date
+ * \brief Get the start and end times of a day's schedule
  *   
- *  Albeit somewhat convoluted, this function simplifies the process
- *  of setting the correct date and time of the scheduled event. Currently,
- *  it only checks if the start time of the schedule is greater than or equal
- *  to the end time. If this is the case, then we can be certain that the
- *  schedule starts on one day and carries over to the next day.
+ *  The start and end times of day are taken from the ical start and
+ *  end times and applied to the given day. If the start time of the
+ *  schedule is greater than the end time, then we can be certain that
+ *  the schedule starts on one day and carries over to the next day.
  *  
  *  TODO: Add support for a 'duration' variable so that this function can 
  *  handle setting a schedule longer than 24 hours
  */
-static void _ical_set_new_start_and_end_times(struct tm *t_current, struct tm *t_start, struct tm *t_end)
+static void _ical_set_new_start_and_end_times(const ICALRECORD *const record, int32_t day, time_t *e_start, time_t *e_end)
 {
-    // Set start and end structs to the current date
-    t_start->tm_year = t_end->tm_year = t_current->tm_year;
-    t_start->tm_mon = t_end->tm_mon = t_current->tm_mon;
-    t_start->tm_mday = t_end->tm_mday = t_current->tm_mday;
-    // Get epoch time for easier math
-    time_t e_start = mktime(t_start);
-    time_t e_end = mktime(t_end);
+    time_t e_day = (time_t)day*ONE_DAY;
+
+    *e_start = e_day + record->start_time;
+    *e_end = e_day + record->end_time;
     // Increment end time by 1 day if start time is after end time
-    if (e_start > e_end){
-        e_end += ONE_DAY;
-        *t_end = *localtime(&e_end);
+    if (*e_start > *e_end){
+        *e_end += ONE_DAY;
+    }
+}
+
+/**
+ * \brief Get the number of occurrences that follow an event by the period
+ *
+ *  Counts the RECUR events after e_event in the same day's schedule,
+ *  up to the end of the schedule and the count limit. Stepping is only
+ *  done for floating times with times of day within a day, so the
+ *  schedules of each day can't overlap. Otherwise 0 is returned and
+ *  every occurrence is searched for.
+ */
+static uint32_t _ical_get_steps(const ICALRECORD *const record, ICALEVENT event, time_t e_event)
+{
+    time_t e_start_time, e_end_time;
+    time_t e_end = (time_t)record->end_date*ONE_DAY + record->end_time;
+
+    if(record->tz || record->freq == LIMITS ||
+       (event != ICALEVENT_START && event != ICALEVENT_RECUR) ||
+       record->start_time < 0 || record->start_time >= ONE_DAY ||
+       record->end_time < 0 || record->end_time >= ONE_DAY){
+        return 0;
+    }
+
+    // Find the day's schedule the event is in, the first START can be
+    // on a day the byday mask skips
+    int32_t day = civil_days_from_time(e_event);
+    if((time_t)day*ONE_DAY + record->start_time > e_event){
+        day--;
+    }
+    if(!_is_day_of_week(civil_weekday(day), (BYDAY)record->byday)){
+        return 0;
+    }
+    _ical_set_new_start_and_end_times(record, day, &e_start_time, &e_end_time);
+    if(e_end_time > e_end){
+        e_end_time = e_end;
+    }
+    if(e_end_time <= e_event){
+        return 0;
+    }
+
+    time_t steps = (e_end_time - e_event)/record->period;
+    if(record->count){
+        // The event is occurrence index + 1 of the day, and only
+        // occurrences before the count are events
+        time_t index = (e_event - e_start_time)/record->period;
+        time_t left = index + 1 < record->count ? record->count - index - 1 : 0;
+        if(left < steps){
+            steps = left;
+        }
     }
+
+    return steps > UINT32_MAX ? UINT32_MAX : (uint32_t)steps;
 }
 
 /**
@@ -319,12 +606,42 @@ bool ical_is_enabled(ICAL *const ical)
 
 /*************** Static Functions *********************/
 
-static bool _is_day_of_week(uint8_t wday, BYDAY cal_day)
+/**
+ * \brief Get the recurrence period of an ical in seconds
+ *
+ *  LIMITS has no period since it only fires at the start and end
+ *  of each day's schedule, so 0 is returned.
+ */
+static time_t _ical_get_period(const ICAL *const ical)
 {
-    for(int i=0; i<7; i++){
-        if(i==wday && (cal_day>>(6-i))&1){
-            return true;
-        }
+    switch (ical->freq)
+    {
+        case SECONDLY:
+            return (time_t)ical->interval;
+
+        case MINUTELY:
+            return (time_t)ical->interval*ONE_MIN;
+
+        case HOURLY:
+            return (time_t)ical->interval*ONE_HOUR;
+
+        default:
+            return 0;
     }
-    return false;
+}
+
+/**
+ * \brief Get the time of day of a time struct in seconds
+ *
+ *  Fields are not range checked, so an hour of 25 carries over into
+ *  the next day the same way mktime would.
+ */
+static time_t _ical_get_seconds_of_day(const struct tm *t)
+{
+    return (time_t)t->tm_hour*ONE_HOUR + t->tm_min*ONE_MIN + t->tm_sec;
+}
+
+static bool _is_day_of_week(uint8_t wday, BYDAY cal_day)
+{
+    return wday < 7 && ((cal_day>>(6-wday))&1);
 }
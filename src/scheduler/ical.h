@@ -12,6 +12,10 @@
 #include <stdint.h>
 #include <time.h>
 #include <stdbool.h>
+#include "tz.h"
+
+// Returned by ical_find_next_epoch when there are no more events
+#define ICAL_EPOCH_NEVER ((time_t)(((uint64_t)1 << (sizeof(time_t)*8 - 1)) - 1))
 
 typedef enum{
     LIMITS,
@@ -65,9 +69,63 @@ typedef struct {
     uint8_t count;
     /* Enabled/Disabled */
     bool enabled;
+    /* Timezone of start and end times, NULL for floating time */
+    const TZTABLE *tz;
 }ICAL;
 
+/**
+ * Compiled form of an ICAL made by ical_compile. The time structs are
+ * reduced to civil days and seconds of day (see civil.c) and the checks
+ * of ical_validate are done once, so finding the next event needs no
+ * date math on struct tm. Fits in 32 bytes.
+ */
+typedef struct{
+    /* Dates of t_start and t_end in days since 1970/01/01 */
+    int32_t start_date;
+    int32_t end_date;
+    /* Times of day of t_start and t_end in seconds */
+    int32_t start_time;
+    int32_t end_time;
+    /* Recurrence period in seconds, 0 for LIMITS */
+    uint32_t period;
+    uint8_t byday;
+    uint8_t count;
+    uint8_t interval;
+    uint8_t freq : 2;
+    uint8_t enabled : 1;
+    /* Result of ical_validate */
+    uint8_t error : 4;
+    const TZTABLE *tz;
+}ICALRECORD;
+
+/**
+ * State of an expansion made by ical_expand_init. Occurrences within a
+ * day's schedule are stepped by the period, so only the first one of
+ * each day needs a search.
+ */
+typedef struct{
+    ICALRECORD record;
+    /* Last occurrence returned, the next one comes after it */
+    time_t e_current;
+    time_t e_to;
+    /* Occurrences left that can be stepped to from e_current */
+    uint32_t steps;
+}ICALEXPAND;
+
+/* Called by ical_expand for each occurrence, return false to stop */
+typedef bool (*ical_expand_fn)(void *arg, ICALEVENT event, time_t e_event);
+
 ICALEVENT ical_find_next_event(ICAL *const ical, struct tm *t_current_time, struct tm *t_next_event);
+ICALEVENT ical_find_next_epoch(ICAL *const ical, time_t e_current, time_t *e_next_event);
+ICALEVENT ical_validate(const ICAL *const ical);
+void ical_compile(const ICAL *const ical, ICALRECORD *const record);
+void ical_decompile(const ICALRECORD *const record, ICAL *const ical);
+ICALEVENT ical_record_find_next_epoch(const ICALRECORD *const record, time_t e_current, time_t *e_next_event);
+void ical_expand_init(ICALEXPAND *const expand, const ICAL *const ical, time_t e_from, time_t e_to);
+void ical_record_expand_init(ICALEXPAND *const expand, const ICALRECORD *const record, time_t e_from, time_t e_to);
+bool ical_expand_next(ICALEXPAND *const expand, ICALEVENT *const event, time_t *const e_event);
+uint32_t ical_expand(const ICAL *const ical, time_t e_from, time_t e_to, ical_expand_fn fn, void *arg);
+bool ical_is_event(ICALEVENT event);
 void ical_get_defaults(ICAL *const ical);
 bool ical_is_enabled(ICAL *const ical);
 void ical_set_time_struct(struct tm *t, uint16_t year, uint8_t mon, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec);
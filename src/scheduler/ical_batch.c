@@ -0,0 +1,478 @@
+/*
+ * ical_batch.c
+ *
+ * Created: 16/10/2026 5:06:13 PM
+ *
+ *  Finds the next events of many compiled icals at once. The fields
+ *  are kept as a structure of arrays so 8 schedules can be loaded
+ *  into AVX2 registers, or 4 into SSE4 registers, and calculated with
+ *  the same instructions. The instruction set is picked at run time
+ *  from what the CPU supports, other CPUs use the scalar version.
+ *
+ *  Only the common case is calculated: enabled, valid, floating time
+ *  schedules without a count rule, with the current time between
+ *  their start and end dates. Every other schedule returns
+ *  ICAL_BATCH_SLOW and is left to ical_record_find_next_epoch.
+ *
+ *  The current time is taken apart into a day and a time of day once
+ *  for the whole batch. Each schedule is then calculated in 32 bit
+ *  seconds from the start of that day, which is enough for the days
+ *  _ical_find_next_recur_event searches. The days are searched in the
+ *  same order as ical.c, so the results are the same.
+ *
+ *      ical_batch_t b;
+ *      ical_batch_init(&b);
+ *      ical_batch_reserve(&b, count);
+ *      ical_batch_set(&b, i, &record);
+ *      ical_batch_find_next_epoch(&b, 0, count, now, events, epochs);
+ *      ical_batch_free(&b);
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ical_batch.h"
+#include "civil.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ICAL_BATCH_X86
+#include <immintrin.h>
+#endif
+
+#define ONE_DAY CIVIL_ONE_DAY
+// Dates further than this from the current day are clamped to it so
+// times stay in 32 bits. Searches cover less than half of this
+#define BATCH_DAYS 16
+// Most schedules calculated together
+#define BATCH_LANES 8
+
+static void _ical_batch_layout(ical_batch_t *b, void *buffer, uint32_t count);
+static int32_t _ical_batch_lane(const ical_batch_t *b, uint32_t i, int32_t day, int32_t now, uint8_t wday, int32_t *t);
+static int32_t _ical_batch_clamp(int32_t days);
+#ifdef ICAL_BATCH_X86
+static void _ical_batch_sse4(const ical_batch_t *b, uint32_t i, int32_t day, int32_t now, uint8_t wday, int32_t *t, int32_t *events);
+static void _ical_batch_avx2(const ical_batch_t *b, uint32_t i, int32_t day, int32_t now, uint8_t wday, int32_t *t, int32_t *events);
+#endif
+
+/**
+ *  Initialize an empty batch
+ */
+void ical_batch_init(ical_batch_t *b)
+{
+    _ical_batch_layout(b, NULL, 0);
+    b->size = 0;
+    b->fixed = false;
+    b->isa = ICAL_BATCH_AUTO;
+}
+
+/**
+ *  Initialize a batch that holds count schedules in a fixed buffer
+ *
+ *  The buffer must be ICAL_BATCH_BUFFER_SIZE(count) bytes and aligned
+ *  for int32_t.
+ */
+void ical_batch_init_static(ical_batch_t *b, void *buffer, uint32_t count)
+{
+    ical_batch_init(b);
+    _ical_batch_layout(b, buffer, count);
+    memset(b->fast, 0, count);
+    b->size = count;
+    b->fixed = true;
+}
+
+/**
+ *  Make room for count schedules
+ *
+ *  Schedules that are added are not fast until they are set. Returns
+ *  false if memory can't be allocated or a fixed batch is too small.
+ */
+bool ical_batch_reserve(ical_batch_t *b, uint32_t count)
+{
+    if (count <= b->size){
+        return true;
+    }
+    if (b->fixed){
+        return false;
+    }
+
+    void *buffer = malloc(ICAL_BATCH_BUFFER_SIZE(count));
+    if (buffer == NULL){
+        return false;
+    }
+
+    ical_batch_t old = *b;
+    _ical_batch_layout(b, buffer, count);
+    if (old.size){
+        memcpy(b->start_date, old.start_date, old.size*sizeof(int32_t));
+        memcpy(b->end_date, old.end_date, old.size*sizeof(int32_t));
+        memcpy(b->start_time, old.start_time, old.size*sizeof(int32_t));
+        memcpy(b->end_time, old.end_time, old.size*sizeof(int32_t));
+        memcpy(b->period, old.period, old.size*sizeof(int32_t));
+        memcpy(b->byday, old.byday, old.size);
+        memcpy(b->fast, old.fast, old.size);
+    }
+    memset(b->fast + old.size, 0, count - old.size);
+    free(old.start_date);
+    b->size = count;
+
+    return true;
+}
+
+/**
+ *  Free the memory of a batch
+ *
+ *  The batch is left empty and can be used again.
+ */
+void ical_batch_free(ical_batch_t *b)
+{
+    if (!b->fixed){
+        free(b->start_date);
+    }
+    ical_batch_init(b);
+}
+
+/**
+ *  Store a compiled ical at an index
+ */
+void ical_batch_set(ical_batch_t *b, uint32_t i, const ICALRECORD *const record)
+{
+    b->start_date[i] = record->start_date;
+    b->end_date[i] = record->end_date;
+    b->start_time[i] = record->start_time;
+    b->end_time[i] = record->end_time;
+    b->period[i] = (int32_t)record->period;
+    b->byday[i] = record->byday;
+    b->fast[i] = record->enabled && record->error == ICALEVENT_NONE && record->tz == NULL &&
+                 record->count == 0 &&
+                 record->start_time >= 0 && record->start_time < ONE_DAY &&
+                 record->end_time >= 0 && record->end_time < ONE_DAY;
+}
+
+/**
+ *  Mark an index as unused, it returns ICAL_BATCH_SLOW
+ */
+void ical_batch_clear(ical_batch_t *b, uint32_t i)
+{
+    b->fast[i] = false;
+}
+
+/**
+ *  Find the next events of count schedules starting at first
+ *
+ *  Gives the same events and epochs as ical_record_find_next_epoch,
+ *  except for schedules the batch can't calculate, which get
+ *  ICAL_BATCH_SLOW.
+ */
+void ical_batch_find_next_epoch(const ical_batch_t *b, uint32_t first, uint32_t count, time_t e_current, uint8_t *events, time_t *e_next_events)
+{
+    int32_t day = civil_days_from_time(e_current);
+    time_t e_day = (time_t)day*ONE_DAY;
+    int32_t now = (int32_t)(e_current - e_day);
+    uint8_t wday = civil_weekday(day);
+    int32_t t[BATCH_LANES];
+    int32_t lane_events[BATCH_LANES];
+    uint32_t end = first + count;
+    ICAL_BATCH_ISA isa = b->isa == ICAL_BATCH_AUTO ? ical_batch_get_isa() : b->isa;
+
+    for (uint32_t i = first; i < end;){
+        uint32_t lanes = 1;
+
+#ifdef ICAL_BATCH_X86
+        if (isa == ICAL_BATCH_AVX2 && end - i >= 8){
+            _ical_batch_avx2(b, i, day, now, wday, t, lane_events);
+            lanes = 8;
+        }else if (isa == ICAL_BATCH_SSE4 && end - i >= 4){
+            _ical_batch_sse4(b, i, day, now, wday, t, lane_events);
+            lanes = 4;
+        }else
+#endif
+        {
+            lane_events[0] = _ical_batch_lane(b, i, day, now, wday, &t[0]);
+        }
+
+        for (uint32_t j = 0; j < lanes; j++, i++){
+            events[i - first] = (uint8_t)lane_events[j];
+            e_next_events[i - first] = ical_is_event((ICALEVENT)lane_events[j]) ? e_day + t[j] : ICAL_EPOCH_NEVER;
+        }
+    }
+}
+
+/**
+ *  Get the best instruction set the CPU supports
+ */
+ICAL_BATCH_ISA ical_batch_get_isa(void)
+{
+#ifdef ICAL_BATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")){
+        return ICAL_BATCH_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")){
+        return ICAL_BATCH_SSE4;
+    }
+#endif
+    return ICAL_BATCH_SCALAR;
+}
+
+/*************** Static Functions *********************/
+
+/**
+ *  Point the arrays of a batch into a buffer of count schedules
+ */
+static void _ical_batch_layout(ical_batch_t *b, void *buffer, uint32_t count)
+{
+    int32_t *p = buffer;
+
+    if (p == NULL){
+        b->start_date = b->end_date = b->start_time = b->end_time = b->period = NULL;
+        b->byday = b->fast = NULL;
+        return;
+    }
+
+    b->start_date = p;
+    b->end_date = p + count;
+    b->start_time = p + 2*count;
+    b->end_time = p + 3*count;
+    b->period = p + 4*count;
+    b->byday = (uint8_t*)(p + 5*count);
+    b->fast = b->byday + count;
+}
+
+/**
+ *  Calculate one schedule
+ *
+ *  now is the time of day of the current time, and day and wday its
+ *  date and weekday. t is set to the time of the event from the
+ *  start of the day.
+ */
+static int32_t _ical_batch_lane(const ical_batch_t *b, uint32_t i, int32_t day, int32_t now, uint8_t wday, int32_t *t)
+{
+    int32_t event = ICALEVENT_NONE;
+
+    if (!b->fast[i]){
+        return ICAL_BATCH_SLOW;
+    }
+
+    int32_t start = _ical_batch_clamp(b->start_date[i] - day)*ONE_DAY + b->start_time[i];
+    int32_t end = _ical_batch_clamp(b->end_date[i] - day)*ONE_DAY + b->end_time[i];
+    if (now < start || now >= end){
+        return ICAL_BATCH_SLOW;
+    }
+
+    int32_t start_time = b->start_time[i];
+    int32_t end_time = b->end_time[i];
+    int32_t period = b->period[i];
+    // The schedule carries over to the next day
+    if (start_time > end_time){
+        end_time += ONE_DAY;
+    }
+
+    // Start from the day before, like _ical_find_next_recur_event
+    for (int32_t k = -1; k <= 8; k++){
+        uint8_t k_wday = (uint8_t)((wday + 7 + k) % 7);
+        if (!((b->byday[i] >> (6 - k_wday)) & 1)){
+            continue;
+        }
+
+        int32_t s = k*ONE_DAY + start_time;
+        int32_t e = k*ONE_DAY + end_time;
+        if (now < s){
+            *t = s;
+            event = ICALEVENT_START;
+            break;
+        }else if (now < e){
+            if (period == 0){
+                *t = e;
+                event = ICALEVENT_END;
+                break;
+            }
+            int32_t next = s + ((now - s)/period + 1)*period;
+            if (next <= e){
+                *t = next;
+                event = ICALEVENT_RECUR;
+                break;
+            }
+        }
+    }
+
+    // Events after the end date don't happen
+    if (event != ICALEVENT_NONE && *t > end){
+        event = ICALEVENT_NONE;
+    }
+
+    return event;
+}
+
+static int32_t _ical_batch_clamp(int32_t days)
+{
+    return days < -BATCH_DAYS ? -BATCH_DAYS : (days > BATCH_DAYS ? BATCH_DAYS : days);
+}
+
+#ifdef ICAL_BATCH_X86
+
+/**
+ *  Calculate 4 schedules with SSE4.1
+ *
+ *  Same as _ical_batch_lane. Each day of the search is checked for
+ *  every schedule, and a schedule keeps the first event it finds. The
+ *  division by the period is done in float, which is exact enough
+ *  for times under 2 days that one correction fixes it.
+ */
+__attribute__((target("sse4.1")))
+static void _ical_batch_sse4(const ical_batch_t *b, uint32_t i, int32_t day, int32_t now, uint8_t wday, int32_t *t, int32_t *events)
+{
+    const __m128i v_zero = _mm_setzero_si128();
+    const __m128i v_one = _mm_set1_epi32(1);
+    const __m128i v_day = _mm_set1_epi32(ONE_DAY);
+    const __m128i v_now = _mm_set1_epi32(now);
+    const __m128i v_today = _mm_set1_epi32(day);
+    const __m128i v_min = _mm_set1_epi32(-BATCH_DAYS);
+    const __m128i v_max = _mm_set1_epi32(BATCH_DAYS);
+
+    __m128i start_time = _mm_loadu_si128((const __m128i*)(b->start_time + i));
+    __m128i end_time = _mm_loadu_si128((const __m128i*)(b->end_time + i));
+    __m128i period = _mm_loadu_si128((const __m128i*)(b->period + i));
+    int32_t bytes;
+    memcpy(&bytes, b->byday + i, sizeof(bytes));
+    __m128i byday = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+    memcpy(&bytes, b->fast + i, sizeof(bytes));
+    __m128i fast = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+
+    __m128i start = _mm_loadu_si128((const __m128i*)(b->start_date + i));
+    start = _mm_min_epi32(_mm_max_epi32(_mm_sub_epi32(start, v_today), v_min), v_max);
+    start = _mm_add_epi32(_mm_mullo_epi32(start, v_day), start_time);
+    __m128i end = _mm_loadu_si128((const __m128i*)(b->end_date + i));
+    end = _mm_min_epi32(_mm_max_epi32(_mm_sub_epi32(end, v_today), v_min), v_max);
+    end = _mm_add_epi32(_mm_mullo_epi32(end, v_day), end_time);
+
+    // Schedules that can be calculated: fast and start <= now < end
+    __m128i todo = _mm_andnot_si128(_mm_cmpgt_epi32(start, v_now), _mm_cmpgt_epi32(end, v_now));
+    todo = _mm_andnot_si128(_mm_cmpeq_epi32(fast, v_zero), todo);
+
+    end_time = _mm_add_epi32(end_time, _mm_and_si128(_mm_cmpgt_epi32(start_time, end_time), v_day));
+    __m128i limits = _mm_cmpeq_epi32(period, v_zero);
+    period = _mm_max_epi32(period, v_one);
+    __m128 f_period = _mm_cvtepi32_ps(period);
+    __m128i found_event = _mm_blendv_epi8(_mm_set1_epi32(ICALEVENT_RECUR), _mm_set1_epi32(ICALEVENT_END), limits);
+
+    __m128i v_t = v_zero;
+    __m128i v_event = v_zero;
+    __m128i search = todo;
+    for (int32_t k = -1; k <= 8 && !_mm_testz_si128(search, search); k++){
+        int32_t shift = 6 - (wday + 7 + k) % 7;
+        __m128i active = _mm_and_si128(_mm_srl_epi32(byday, _mm_cvtsi32_si128(shift)), v_one);
+        __m128i check = _mm_and_si128(search, _mm_cmpeq_epi32(active, v_one));
+
+        __m128i k_day = _mm_set1_epi32(k*ONE_DAY);
+        __m128i s = _mm_add_epi32(k_day, start_time);
+        __m128i e = _mm_add_epi32(k_day, end_time);
+
+        // Before the day's start
+        __m128i before = _mm_and_si128(check, _mm_cmpgt_epi32(s, v_now));
+
+        // Within the day's schedule
+        __m128i x = _mm_sub_epi32(v_now, s);
+        __m128i q = _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(x), f_period));
+        __m128i r = _mm_sub_epi32(x, _mm_mullo_epi32(q, period));
+        q = _mm_add_epi32(q, _mm_cmpgt_epi32(v_zero, r));
+        __m128i next = _mm_add_epi32(s, _mm_mullo_epi32(_mm_add_epi32(q, v_one), period));
+        next = _mm_blendv_epi8(next, e, limits);
+        __m128i within = _mm_andnot_si128(before, _mm_and_si128(check, _mm_cmpgt_epi32(e, v_now)));
+        __m128i hit = _mm_andnot_si128(_mm_cmpgt_epi32(next, e), within);
+
+        v_t = _mm_blendv_epi8(v_t, s, before);
+        v_event = _mm_blendv_epi8(v_event, _mm_set1_epi32(ICALEVENT_START), before);
+        v_t = _mm_blendv_epi8(v_t, next, hit);
+        v_event = _mm_blendv_epi8(v_event, found_event, hit);
+        search = _mm_andnot_si128(_mm_or_si128(before, hit), search);
+    }
+
+    // Events after the end date don't happen
+    v_event = _mm_andnot_si128(_mm_cmpgt_epi32(v_t, end), v_event);
+    v_event = _mm_blendv_epi8(_mm_set1_epi32(ICAL_BATCH_SLOW), v_event, todo);
+
+    _mm_storeu_si128((__m128i*)t, v_t);
+    _mm_storeu_si128((__m128i*)events, v_event);
+}
+
+/**
+ *  Calculate 8 schedules with AVX2
+ *
+ *  Same as _ical_batch_sse4 with twice the lanes.
+ */
+__attribute__((target("avx2")))
+static void _ical_batch_avx2(const ical_batch_t *b, uint32_t i, int32_t day, int32_t now, uint8_t wday, int32_t *t, int32_t *events)
+{
+    const __m256i v_zero = _mm256_setzero_si256();
+    const __m256i v_one = _mm256_set1_epi32(1);
+    const __m256i v_day = _mm256_set1_epi32(ONE_DAY);
+    const __m256i v_now = _mm256_set1_epi32(now);
+    const __m256i v_today = _mm256_set1_epi32(day);
+    const __m256i v_min = _mm256_set1_epi32(-BATCH_DAYS);
+    const __m256i v_max = _mm256_set1_epi32(BATCH_DAYS);
+
+    __m256i start_time = _mm256_loadu_si256((const __m256i*)(b->start_time + i));
+    __m256i end_time = _mm256_loadu_si256((const __m256i*)(b->end_time + i));
+    __m256i period = _mm256_loadu_si256((const __m256i*)(b->period + i));
+    __m256i byday = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(b->byday + i)));
+    __m256i fast = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(b->fast + i)));
+
+    __m256i start = _mm256_loadu_si256((const __m256i*)(b->start_date + i));
+    start = _mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(start, v_today), v_min), v_max);
+    start = _mm256_add_epi32(_mm256_mullo_epi32(start, v_day), start_time);
+    __m256i end = _mm256_loadu_si256((const __m256i*)(b->end_date + i));
+    end = _mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(end, v_today), v_min), v_max);
+    end = _mm256_add_epi32(_mm256_mullo_epi32(end, v_day), end_time);
+
+    // Schedules that can be calculated: fast and start <= now < end
+    __m256i todo = _mm256_andnot_si256(_mm256_cmpgt_epi32(start, v_now), _mm256_cmpgt_epi32(end, v_now));
+    todo = _mm256_andnot_si256(_mm256_cmpeq_epi32(fast, v_zero), todo);
+
+    end_time = _mm256_add_epi32(end_time, _mm256_and_si256(_mm256_cmpgt_epi32(start_time, end_time), v_day));
+    __m256i limits = _mm256_cmpeq_epi32(period, v_zero);
+    period = _mm256_max_epi32(period, v_one);
+    __m256 f_period = _mm256_cvtepi32_ps(period);
+    __m256i found_event = _mm256_blendv_epi8(_mm256_set1_epi32(ICALEVENT_RECUR), _mm256_set1_epi32(ICALEVENT_END), limits);
+
+    __m256i v_t = v_zero;
+    __m256i v_event = v_zero;
+    __m256i search = todo;
+    for (int32_t k = -1; k <= 8 && !_mm256_testz_si256(search, search); k++){
+        int32_t shift = 6 - (wday + 7 + k) % 7;
+        __m256i active = _mm256_and_si256(_mm256_srl_epi32(byday, _mm_cvtsi32_si128(shift)), v_one);
+        __m256i check = _mm256_and_si256(search, _mm256_cmpeq_epi32(active, v_one));
+
+        __m256i k_day = _mm256_set1_epi32(k*ONE_DAY);
+        __m256i s = _mm256_add_epi32(k_day, start_time);
+        __m256i e = _mm256_add_epi32(k_day, end_time);
+
+        // Before the day's start
+        __m256i before = _mm256_and_si256(check, _mm256_cmpgt_epi32(s, v_now));
+
+        // Within the day's schedule
+        __m256i x = _mm256_sub_epi32(v_now, s);
+        __m256i q = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(x), f_period));
+        __m256i r = _mm256_sub_epi32(x, _mm256_mullo_epi32(q, period));
+        q = _mm256_add_epi32(q, _mm256_cmpgt_epi32(v_zero, r));
+        __m256i next = _mm256_add_epi32(s, _mm256_mullo_epi32(_mm256_add_epi32(q, v_one), period));
+        next = _mm256_blendv_epi8(next, e, limits);
+        __m256i within = _mm256_andnot_si256(before, _mm256_and_si256(check, _mm256_cmpgt_epi32(e, v_now)));
+        __m256i hit = _mm256_andnot_si256(_mm256_cmpgt_epi32(next, e), within);
+
+        v_t = _mm256_blendv_epi8(v_t, s, before);
+        v_event = _mm256_blendv_epi8(v_event, _mm256_set1_epi32(ICALEVENT_START), before);
+        v_t = _mm256_blendv_epi8(v_t, next, hit);
+        v_event = _mm256_blendv_epi8(v_event, found_event, hit);
+        search = _mm256_andnot_si256(_mm256_or_si256(before, hit), search);
+    }
+
+    // Events after the end date don't happen
+    v_event = _mm256_andnot_si256(_mm256_cmpgt_epi32(v_t, end), v_event);
+    v_event = _mm256_blendv_epi8(_mm256_set1_epi32(ICAL_BATCH_SLOW), v_event, todo);
+
+    _mm256_storeu_si256((__m256i*)t, v_t);
+    _mm256_storeu_si256((__m256i*)events, v_event);
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * ical_batch.h
+ *
+ * Created: 16/10/2026 5:06:13 PM
+ */
+
+
+#ifndef ICAL_BATCH_H_
+#define ICAL_BATCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "ical.h"
+
+// Event returned for schedules the batch can't calculate, use
+// ical_record_find_next_epoch for those
+#define ICAL_BATCH_SLOW 0xFF
+
+// Size of a fixed buffer to hold count schedules
+#define ICAL_BATCH_ITEM_SIZE (5*sizeof(int32_t) + 2*sizeof(uint8_t))
+#define ICAL_BATCH_BUFFER_SIZE(count) ((count)*ICAL_BATCH_ITEM_SIZE)
+
+/**
+ * Instruction sets the batch can be calculated with
+ */
+typedef enum{
+    // The best one the CPU supports
+    ICAL_BATCH_AUTO,
+    ICAL_BATCH_SCALAR,
+    ICAL_BATCH_SSE4,
+    ICAL_BATCH_AVX2,
+}ICAL_BATCH_ISA;
+
+/**
+ * Compiled icals kept as a structure of arrays, indexed by the
+ * caller. Only the fields needed to find the next event of a
+ * floating schedule without a count are kept.
+ */
+typedef struct ical_batch
+{
+    // Dates in days since 1970/01/01 and times of day in seconds
+    int32_t *start_date;
+    int32_t *end_date;
+    int32_t *start_time;
+    int32_t *end_time;
+    // Recurrence period in seconds, 0 for LIMITS
+    int32_t *period;
+    uint8_t *byday;
+    // Set if the schedule can be calculated by the batch
+    uint8_t *fast;
+    uint32_t size;
+
+    // Set if the batch uses a fixed buffer and can't grow
+    bool fixed;
+    // Instruction set used, ICAL_BATCH_AUTO by default
+    ICAL_BATCH_ISA isa;
+}ical_batch_t;
+
+void ical_batch_init(ical_batch_t *b);
+void ical_batch_init_static(ical_batch_t *b, void *buffer, uint32_t count);
+bool ical_batch_reserve(ical_batch_t *b, uint32_t count);
+void ical_batch_free(ical_batch_t *b);
+void ical_batch_set(ical_batch_t *b, uint32_t i, const ICALRECORD *const record);
+void ical_batch_clear(ical_batch_t *b, uint32_t i);
+void ical_batch_find_next_epoch(const ical_batch_t *b, uint32_t first, uint32_t count, time_t e_current, uint8_t *events, time_t *e_next_events);
+ICAL_BATCH_ISA ical_batch_get_isa(void);
+
+#endif /* ICAL_BATCH_H_ */
@@ -0,0 +1,190 @@
+/*
+ * pool.c
+ *
+ * Created: 16/10/2026 4:41:28 PM
+ *
+ *  Fixed size item pool. Items are carved out of chunks, so items
+ *  allocated one after another sit next to each other in memory, and
+ *  freed items are kept in a free list for reuse. The first chunk has
+ *  chunk_items items and each chunk after doubles in size, up to
+ *  POOL_MAX_CHUNK_ITEMS. Once a pool has grown to its working size, allocating
+ *  and freeing items doesn't call the allocator.
+ *
+ *  A pool can also be given a fixed buffer with pool_init_static, for
+ *  builds without a heap. pool_alloc returns NULL once it is used up.
+ *
+ *      pool_t pool;
+ *      pool_init(&pool, sizeof(struct item), 64);
+ *      struct item *i = pool_alloc(&pool);
+ *      ...
+ *      pool_free(&pool, i);
+ *      pool_destroy(&pool);
+ */ 
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include "pool.h"
+
+static void _pool_add_items(pool_t *p, char *items, size_t count);
+static bool _pool_grow(pool_t *p, uint32_t count);
+
+/**
+ *  Initialize a pool with a first chunk of chunk_items items
+ */
+void pool_init(pool_t *p, size_t item_size, uint32_t chunk_items)
+{
+    p->free_list = NULL;
+    p->chunks = NULL;
+    p->item_size = POOL_ITEM_SIZE(item_size);
+    p->chunk_items = chunk_items ? chunk_items : 1;
+    p->count = 0;
+    p->size = 0;
+    p->fixed = false;
+}
+
+/**
+ *  Initialize a pool that uses a fixed buffer
+ *
+ *  Returns the number of items that fit in the buffer.
+ */
+uint32_t pool_init_static(pool_t *p, size_t item_size, void *buffer, size_t size)
+{
+    pool_init(p, item_size, 0);
+    p->fixed = true;
+
+    // Skip to the first aligned address in the buffer
+    size_t skip = (POOL_ALIGN - (uintptr_t)buffer % POOL_ALIGN) % POOL_ALIGN;
+    if (buffer == NULL || size <= skip){
+        return 0;
+    }
+
+    size_t count = (size - skip)/p->item_size;
+    if (count > UINT32_MAX){
+        count = UINT32_MAX;
+    }
+    _pool_add_items(p, (char*)buffer + skip, count);
+    p->size = (uint32_t)count;
+
+    return (uint32_t)count;
+}
+
+/**
+ *  Make sure count more items can be allocated
+ *
+ *  If there aren't enough unused items, one chunk is allocated for
+ *  the rest. Returns false if it can't be allocated or the pool is
+ *  fixed and doesn't have enough items.
+ */
+bool pool_reserve(pool_t *p, uint32_t count)
+{
+    uint32_t unused = p->size - p->count;
+
+    if (count <= unused){
+        return true;
+    }
+    if (p->fixed){
+        return false;
+    }
+
+    return _pool_grow(p, count - unused);
+}
+
+/**
+ *  Get an unused item
+ *
+ *  NULL is returned if the pool is fixed and used up, or if a new
+ *  chunk can't be allocated.
+ */
+void* pool_alloc(pool_t *p)
+{
+    if (p->free_list == NULL && (p->fixed || !_pool_grow(p, p->chunk_items))){
+        return NULL;
+    }
+
+    void *item = p->free_list;
+    p->free_list = *(void**)item;
+    p->count++;
+
+    return item;
+}
+
+/**
+ *  Return an item to the pool
+ */
+void pool_free(pool_t *p, void *item)
+{
+    if (item == NULL){
+        return;
+    }
+
+    *(void**)item = p->free_list;
+    p->free_list = item;
+    p->count--;
+}
+
+/**
+ *  Free every chunk of the pool
+ *
+ *  Items from the pool can't be used afterwards. The pool can be
+ *  used again, and a fixed pool is emptied but keeps no memory.
+ */
+void pool_destroy(pool_t *p)
+{
+    void *chunk = p->chunks;
+
+    while (chunk){
+        void *next = *(void**)chunk;
+        free(chunk);
+        chunk = next;
+    }
+
+    p->free_list = NULL;
+    p->chunks = NULL;
+    p->count = 0;
+    p->size = 0;
+}
+
+/*************** Static Functions *********************/
+
+/**
+ *  Add items to the free list, so the first item is used first
+ */
+static void _pool_add_items(pool_t *p, char *items, size_t count)
+{
+    for (size_t i = count; i-- > 0;){
+        void *item = items + i*p->item_size;
+        *(void**)item = p->free_list;
+        p->free_list = item;
+    }
+}
+
+/**
+ *  Allocate a new chunk of count items
+ *
+ *  The start of the chunk links it into the chunk list, the
+ *  items follow.
+ */
+static bool _pool_grow(pool_t *p, uint32_t count)
+{
+    size_t header = POOL_ALIGN_SIZE(sizeof(void*));
+    char *chunk = malloc(header + (size_t)count*p->item_size);
+
+    if (chunk == NULL){
+        return false;
+    }
+
+    *(void**)chunk = p->chunks;
+    p->chunks = chunk;
+    _pool_add_items(p, chunk + header, count);
+    p->size += count;
+
+    if (p->chunk_items < POOL_MAX_CHUNK_ITEMS/2){
+        p->chunk_items *= 2;
+    }else if (p->chunk_items < POOL_MAX_CHUNK_ITEMS){
+        p->chunk_items = POOL_MAX_CHUNK_ITEMS;
+    }
+
+    return true;
+}
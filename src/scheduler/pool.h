@@ -0,0 +1,59 @@
+/*
+ * pool.h
+ *
+ * Created: 16/10/2026 4:41:28 PM
+ */ 
+
+
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Alignment of every item and chunk
+#define POOL_ALIGN _Alignof(max_align_t)
+#define POOL_ALIGN_SIZE(size) (((size) + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1))
+// Size an item of the given size takes up in a pool
+#define POOL_ITEM_SIZE(size) POOL_ALIGN_SIZE((size) < sizeof(void*) ? sizeof(void*) : (size))
+
+// Each chunk allocated is twice the size of the one before, up to
+// this many items
+#ifndef POOL_MAX_CHUNK_ITEMS
+#define POOL_MAX_CHUNK_ITEMS 4096
+#endif
+
+// Initializer for a pool of the given type that allocates chunk_items
+// items at a time
+#define POOL_INITIALIZER(type, chunk_items) {NULL, NULL, POOL_ITEM_SIZE(sizeof(type)), (chunk_items), 0, 0, false}
+
+/**
+ * Pool of fixed size items, allocated in chunks
+ */
+typedef struct pool
+{
+    // Unused items, linked through their first bytes
+    void *free_list;
+    // Allocated chunks, linked through their first bytes
+    void *chunks;
+
+    size_t item_size;
+    // Number of items in the next chunk
+    uint32_t chunk_items;
+    // Number of items in use
+    uint32_t count;
+    // Number of items in the pool, used or not
+    uint32_t size;
+    // Set if the pool uses a fixed buffer and can't grow
+    bool fixed;
+}pool_t;
+
+void pool_init(pool_t *p, size_t item_size, uint32_t chunk_items);
+uint32_t pool_init_static(pool_t *p, size_t item_size, void *buffer, size_t size);
+bool pool_reserve(pool_t *p, uint32_t count);
+void* pool_alloc(pool_t *p);
+void pool_free(pool_t *p, void *item);
+void pool_destroy(pool_t *p);
+
+#endif /* POOL_H_ */
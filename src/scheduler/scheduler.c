@@ -5,8 +5,11 @@
  *  Author: Kyle
  *
  *  This module is a wrapper for ical and is used to manage
- *  scheduling tasks for multiple ical instances. All data
- *  is dynamically allocated using linked lists. The premise
+ *  scheduling tasks for multiple ical instances. Schedules and
+ *  events are kept in linked lists, and are allocated from pools
+ *  (see pool.c) that grow in chunks. For builds without a heap, use
+ *  scheduler_init_static to give a scheduler a fixed buffer of
+ *  SCHEDULER_BUFFER_SIZE(capacity) bytes instead. The premise
  *  for adding groups to the schedules is so that events of
  *  separate groups are calculated, however only the next 
  *  closest event of schedules within the same group are 
@@ -14,6 +17,28 @@
  *  in the event that the event it triggers could cause 
  *  conflict.
  *
+ *  All state is kept in a scheduler_t instance. Each function has a
+ *  reentrant _r variant that takes the instance as its first argument,
+ *  eg. scheduler_add_r(&ctx, 0, &ical_temp), so one scheduler can be
+ *  run per thread without locking. The functions without the suffix
+ *  operate on a default instance, as used in the example below.
+ *
+ *  Each schedule caches its next event, and schedules with an upcoming
+ *  event are kept in a binary min-heap ordered by event time. An update
+ *  only recalculates the schedules whose event has passed since the
+ *  last update, or that were added or invalidated since then, and only
+ *  the groups of those schedules have their event recalculated. Each
+ *  group keeps its schedules with an event in a heap of their own, so
+ *  that costs O(log k) for a group of k schedules. The earliest event
+ *  of all groups is at the top of the min-heap (see
+ *  scheduler_get_next_event). When built with SCHEDULER_USE_WHEEL, a
+ *  timing wheel is used in place of the heap.
+ *
+ *  Any schedule can be removed with scheduler_remove, or given a new
+ *  ICAL with scheduler_update, without recalculating the others. If
+ *  the ICAL is edited in place through scheduler_get_schedule_by_id,
+ *  call scheduler_invalidate so its next event is recalculated.
+ *
  *  
  *      // 1.  Initialize
  *      scheduler_init();
@@ -29,14 +54,16 @@
  *      ical_temp.interval = 10;
  *      scheduler_add(1, &ical_temp);
  *      
- *      // 3. Loop through the schedule list
- *      uint8_t count = 0;
- *      SCHEDULE* schedule = scheduler_get_schedule_by_id(count++);
+ *      // 3. Loop through the schedule list in the order they
+ *      // were added. A schedule can also be looked up by its id
+ *      // with scheduler_get_schedule_by_id
+ *      SCHEDULE* schedule = scheduler_get_first_schedule();
  *      while(schedule){
  *          printf("Schedule: %d\r\n", schedule->id);
- *          schedule = scheduler_get_schedule_by_id(count++);
+ *          schedule = scheduler_get_next_schedule(schedule);
  *      }
  *      
+ *      uint32_t count = 0;
  *      struct tm current_time;
  *      current_time.tm_year = 118;
  *      current_time.tm_mon = 1;
@@ -66,32 +93,381 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include "scheduler.h"
 #include "ical.h"
+#include "civil.h"
+#ifdef SCHEDULER_USE_THREADS
+#include "thread_pool.h"
+#endif
+#ifdef SCHEDULER_USE_TIMERFD
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#endif
+#ifdef SCHEDULER_USE_COMMANDS
+#include "command_queue.h"
+#endif
+#ifdef SCHEDULER_USE_SNAPSHOTS
+#include "snapshot.h"
+#endif
+
+// End of the free list of schedule indexes
+#define SLOT_NONE UINT32_MAX
+// Schedules calculated together on a full update
+#define BATCH_SIZE 64
+
+#ifdef SCHEDULER_USE_THREADS
+/**
+ * Threads for full updates and the work of the current update
+ */
+struct scheduler_threads
+{
+    thread_pool_t pool;
+    // Groups by index, for the threads to order a share each
+    struct event_entry **groups;
+    uint32_t group_size;
 
-static void _event_list_clear(void);
-static void _event_list_update(struct schedule_entry* s, 
-                               struct tm *current_time,
-                               ICALEVENT event);
-static bool _event_add(ICALEVENT event, time_t epoch, 
-                       uint8_t index, uint8_t group);
+    scheduler_t *ctx;
+    time_t now;
+    uint32_t group_count;
+};
+#endif
 
-// Create heads of queues
-typedef TAILQ_HEAD(schedule_head_s, schedule_entry) schedule_head_t;
-typedef TAILQ_HEAD(event_head_s, event_entry) event_head_t;
-static schedule_head_t schedule_head;
-static event_head_t event_head;
+/**
+ * Occurrences of a schedule being merged by scheduler_next_events
+ */
+struct next_stream
+{
+    ICALEXPAND expand;
+    // Next occurrence of the schedule
+    EVENT event;
+    struct schedule_entry *schedule;
+};
+
+static struct event_entry* _event_find(scheduler_t *ctx, uint32_t group);
+static struct event_entry* _event_add(scheduler_t *ctx, uint32_t group);
+static void _event_remove(scheduler_t *ctx, struct event_entry* e);
+static void _event_list_update(struct event_entry* e);
+static void _event_mark_stale(scheduler_t *ctx, struct event_entry* e);
+static void _event_reorder(scheduler_t *ctx, struct schedule_entry* s);
+static void _group_push(struct event_entry* e, struct schedule_entry* s);
+static void _group_remove(struct event_entry* e, struct schedule_entry* s);
+static struct schedule_entry* _group_meld(struct schedule_entry* a, struct schedule_entry* b);
+static struct schedule_entry* _group_merge_pairs(struct schedule_entry* first);
+static struct schedule_entry* _schedule_find(scheduler_t *ctx, uint32_t id);
+static SCHEDULE* _schedule_get(scheduler_t *ctx, struct schedule_entry* s);
+static bool _schedule_table_reserve(scheduler_t *ctx, uint32_t count);
+static struct schedule_entry* _schedule_add(scheduler_t *ctx, uint32_t group, const ICAL* ical);
+static struct schedule_entry* _schedule_try_add(scheduler_t *ctx, uint32_t group, ICAL* ical);
+static void _schedule_add_batch_undo(scheduler_t *ctx, struct schedule_entry *first);
+static void _schedule_set_id(scheduler_t *ctx, struct schedule_entry* s);
+static void _schedule_remove(scheduler_t *ctx, struct schedule_entry* s);
+static void _schedule_update(struct schedule_entry* s, time_t now);
+static void _schedule_list_rewind(scheduler_t *ctx, time_t now);
+static void _schedule_list_calculate(scheduler_t *ctx, uint32_t first, uint32_t count, time_t now, bool group);
+static bool _schedule_earlier(const struct schedule_entry* a, const struct schedule_entry* b);
+#ifdef SCHEDULER_USE_THREADS
+static bool _schedule_list_calculate_threads(scheduler_t *ctx, time_t now);
+static void _schedule_list_calculate_thread(void *arg, uint32_t index);
+static void _event_list_merge_thread(void *arg, uint32_t index);
+static uint32_t _thread_range_start(uint32_t count, uint32_t index, uint32_t threads, uint32_t align);
+#endif
+static bool _schedule_first_event(scheduler_t *ctx, struct schedule_entry* s, time_t now, EVENT *event);
+static uint32_t _next_stream_select(scheduler_t *ctx, time_t now, struct next_stream *streams, uint32_t size, struct next_stream *bound);
+static bool _next_stream_merge(struct next_stream *streams, uint32_t count, const struct next_stream *bound, uint32_t n, EVENT *events, uint32_t *emitted);
+static bool _next_stream_less(const struct next_stream* a, const struct next_stream* b);
+static void _next_stream_sift_down(struct next_stream *streams, uint32_t count, uint32_t i, bool max);
+static uint32_t _update_events(scheduler_t *ctx, time_t now, EVENT *events, uint32_t n);
+#ifdef SCHEDULER_USE_SNAPSHOTS
+static bool _snapshot_publish(scheduler_t *ctx);
+static int _snapshot_compare(const void *a, const void *b);
+#endif
+#ifdef SCHEDULER_USE_TIMERFD
+static void _timer_arm(scheduler_t *ctx, bool now);
+#endif
+static schedule_queue_t* _schedule_get_queue(scheduler_t *ctx, struct schedule_entry* s);
+static void _queue_init(schedule_queue_t *q);
+static void* _queue_init_static(schedule_queue_t *q, void *buffer, uint32_t size);
+static void _queue_free(schedule_queue_t *q);
+static bool _queue_reserve(schedule_queue_t *q, uint32_t size);
+static void _queue_reset(schedule_queue_t *q, time_t now);
+static void _queue_append(schedule_queue_t *q, struct schedule_entry* s);
+static void _queue_build(schedule_queue_t *q);
+static void _queue_push(schedule_queue_t *q, struct schedule_entry* s);
+static void _queue_remove(schedule_queue_t *q, struct schedule_entry* s);
+static struct schedule_entry* _queue_pop_due(schedule_queue_t *q, time_t now);
+static struct schedule_entry* _queue_peek(schedule_queue_t *q);
+#ifndef SCHEDULER_USE_WHEEL
+static bool _queue_less(const struct schedule_entry* a, const struct schedule_entry* b);
+static void _queue_sift_up(schedule_queue_t *q, uint32_t i);
+static void _queue_sift_down(schedule_queue_t *q, uint32_t i);
+#endif
 
-static uint8_t schedule_count = 0;
-static uint8_t event_count = 0;
+// Instance used by the non-reentrant API
+static scheduler_t default_scheduler = {
+    .schedule_head = TAILQ_HEAD_INITIALIZER(default_scheduler.schedule_head),
+    .event_head = TAILQ_HEAD_INITIALIZER(default_scheduler.event_head),
+    .dirty_head = TAILQ_HEAD_INITIALIZER(default_scheduler.dirty_head),
+    .capacity = MAX_SCHEDULES,
+    .schedule_pool = POOL_INITIALIZER(schedule_entry_t, SCHEDULER_POOL_CHUNK),
+    .event_pool = POOL_INITIALIZER(event_entry_t, SCHEDULER_POOL_CHUNK),
+    .rebuild = true,
+#ifdef SCHEDULER_USE_TIMERFD
+    .timer_fd = -1,
+#endif
+};
 
 /**
  *  Initialize scheduler
  */
-void scheduler_init(void)
+void scheduler_init_r(scheduler_t *ctx)
+{
+    TAILQ_INIT(&ctx->schedule_head);
+    TAILQ_INIT(&ctx->event_head);
+    TAILQ_INIT(&ctx->dirty_head);
+    group_table_init(&ctx->groups);
+    _queue_init(&ctx->event_queue);
+    _queue_init(&ctx->recheck_queue);
+    ctx->slots = NULL;
+    ctx->slot_count = 0;
+    ctx->free_slot = SLOT_NONE;
+    ctx->slot_size = 0;
+    ctx->capacity = MAX_SCHEDULES;
+    ical_batch_init(&ctx->batch);
+    pool_init(&ctx->schedule_pool, sizeof(schedule_entry_t), SCHEDULER_POOL_CHUNK);
+    pool_init(&ctx->event_pool, sizeof(event_entry_t), SCHEDULER_POOL_CHUNK);
+    ctx->buffer = NULL;
+    ctx->buffer_size = 0;
+    ctx->stale_head = NULL;
+    ctx->schedule_entry = NULL;
+    ctx->update_time = 0;
+    ctx->rebuild = true;
+    ctx->seq = 0;
+    ctx->schedule_count = 0;
+    ctx->event_count = 0;
+#ifdef SCHEDULER_USE_THREADS
+    ctx->threads = NULL;
+#endif
+#ifdef SCHEDULER_USE_TIMERFD
+    ctx->timer_fd = -1;
+    ctx->timer_tz = NULL;
+#endif
+#ifdef SCHEDULER_USE_COMMANDS
+    ctx->commands = NULL;
+#endif
+#ifdef SCHEDULER_USE_SNAPSHOTS
+    ctx->snapshots = NULL;
+    ctx->snapshot_changed = false;
+#endif
+}
+
+/**
+ *  Initialize scheduler with a fixed buffer
+ *
+ *  Everything the scheduler needs is kept in the buffer, nothing is
+ *  allocated. The capacity is the number of schedules that fit, use
+ *  SCHEDULER_BUFFER_SIZE to size the buffer. Returns false if the
+ *  buffer can't hold a schedule.
+ */
+bool scheduler_init_static_r(scheduler_t *ctx, void *buffer, size_t size)
+{
+    scheduler_init_r(ctx);
+
+    if (buffer == NULL || size < SCHEDULER_BUFFER_SIZE(1)){
+        return false;
+    }
+
+    size_t capacity = (size - SCHEDULER_BUFFER_SIZE(0))/SCHEDULER_BUFFER_ITEM_SIZE;
+    if (capacity > SCHEDULER_MAX_CAPACITY){
+        capacity = SCHEDULER_MAX_CAPACITY;
+    }
+
+    // Schedule table, then queues and groups, then schedule and event entries
+    char *p = (char*)POOL_ALIGN_SIZE((uintptr_t)buffer);
+    ctx->slots = (schedule_slot_t*)p;
+    p += capacity*sizeof(schedule_slot_t);
+    p = _queue_init_static(&ctx->event_queue, p, capacity);
+    p = _queue_init_static(&ctx->recheck_queue, p, capacity);
+    group_table_init_static(&ctx->groups, p, capacity);
+    p += GROUP_TABLE_BUFFER_SIZE(capacity);
+    ical_batch_init_static(&ctx->batch, p, capacity);
+    p += ICAL_BATCH_BUFFER_SIZE(capacity);
+    for (uint32_t i = 0; i < capacity; i++){
+        ctx->slots[i].entry = NULL;
+        ctx->slots[i].generation = 0;
+    }
+
+    size_t used = p - (char*)buffer;
+    size_t schedules_size = POOL_ALIGN + capacity*POOL_ITEM_SIZE(sizeof(schedule_entry_t));
+    pool_init_static(&ctx->schedule_pool, sizeof(schedule_entry_t), p, schedules_size);
+    pool_init_static(&ctx->event_pool, sizeof(event_entry_t), p + schedules_size, size - used - schedules_size);
+
+    ctx->slot_size = capacity;
+    ctx->capacity = capacity;
+    ctx->buffer = buffer;
+    ctx->buffer_size = size;
+
+    return true;
+}
+
+/**
+ *  Set the maximum number of schedules
+ *
+ *  Memory is allocated as schedules are added, up to the capacity.
+ *  Returns false if it is less than the number of indexes that have
+ *  been used, it is larger than SCHEDULER_MAX_CAPACITY, or it doesn't
+ *  fit in the buffer given to scheduler_init_static.
+ */
+bool scheduler_set_capacity_r(scheduler_t *ctx, uint32_t capacity)
+{
+    if (capacity < ctx->slot_count || capacity > SCHEDULER_MAX_CAPACITY){
+        return false;
+    }
+    if (ctx->buffer && capacity > ctx->slot_size){
+        return false;
+    }
+
+    ctx->capacity = capacity;
+
+    return true;
+}
+
+/**
+ *  Split full updates across threads
+ *
+ *  count includes the calling thread, and 1 stops the threads. Full
+ *  updates of at least SCHEDULER_THREAD_MIN_SCHEDULES schedules are
+ *  split, and give the same events as one thread would. The threads
+ *  are kept when the scheduler is cleared. Returns false if count is
+ *  0 or more than SCHEDULER_MAX_THREADS, the threads can't be started,
+ *  or SCHEDULER_USE_THREADS isn't defined.
+ */
+bool scheduler_set_threads_r(scheduler_t *ctx, uint32_t count)
+{
+    if (count == 0 || count > SCHEDULER_MAX_THREADS){
+        return false;
+    }
+
+#ifdef SCHEDULER_USE_THREADS
+    struct scheduler_threads *t = ctx->threads;
+    if (t){
+        thread_pool_destroy(&t->pool);
+        free(t->groups);
+        free(t);
+        ctx->threads = NULL;
+    }
+    if (count == 1){
+        return true;
+    }
+
+    t = malloc(sizeof(struct scheduler_threads));
+    if (t == NULL){
+        return false;
+    }
+    if (!thread_pool_init(&t->pool, count)){
+        free(t);
+        return false;
+    }
+    t->groups = NULL;
+    t->group_size = 0;
+    ctx->threads = t;
+
+    return true;
+#else
+    (void)ctx;
+    return count == 1;
+#endif
+}
+
+/**
+ *  Take schedule changes from a command queue
+ *
+ *  The commands are applied on the scheduler's thread at the start of
+ *  each update, or by scheduler_apply_commands. NULL stops taking
+ *  them. The queue is kept when the scheduler is cleared. Returns
+ *  false if SCHEDULER_USE_COMMANDS isn't defined.
+ */
+bool scheduler_set_commands_r(scheduler_t *ctx, struct command_queue *q)
+{
+#ifdef SCHEDULER_USE_COMMANDS
+    ctx->commands = q;
+    return true;
+#else
+    (void)ctx;
+    (void)q;
+    return false;
+#endif
+}
+
+/**
+ *  Apply the commands waiting in the command queue
+ *
+ *  Each command's callback is called once it is applied, with the id
+ *  of its schedule. Returns the number of commands applied.
+ */
+uint32_t scheduler_apply_commands_r(scheduler_t *ctx)
+{
+    uint32_t count = 0;
+#ifdef SCHEDULER_USE_COMMANDS
+    command_t c;
+
+    if (ctx->commands == NULL){
+        return 0;
+    }
+    while (command_queue_pop(ctx->commands, &c)){
+        struct schedule_entry *s = NULL;
+        uint32_t id = c.key;
+        bool ok = false;
+
+        switch (c.type){
+        case COMMAND_ADD:
+            s = _schedule_try_add(ctx, c.key, &c.ical);
+            ok = s != NULL;
+            id = s ? s->next.id : UINT32_MAX;
+            break;
+        case COMMAND_REMOVE:
+            ok = scheduler_remove_r(ctx, c.key);
+            break;
+        case COMMAND_UPDATE:
+            ok = scheduler_update_r(ctx, c.key, &c.ical);
+            break;
+        case COMMAND_INVALIDATE:
+            ok = scheduler_invalidate_r(ctx, c.key);
+            break;
+        }
+        if (c.fn){
+            c.fn(c.arg, id, ok);
+        }
+        count++;
+    }
+#else
+    (void)ctx;
+#endif
+
+    return count;
+}
+
+/**
+ *  Publish the group events to a snapshot domain
+ *
+ *  Each update that changes a group event publishes a snapshot of all
+ *  of them, which other threads can read while the scheduler goes on.
+ *  The first update after this publishes one either way. NULL stops
+ *  publishing. The domain is kept when the scheduler is cleared.
+ *  Returns false if SCHEDULER_USE_SNAPSHOTS isn't defined.
+ */
+bool scheduler_set_snapshots_r(scheduler_t *ctx, struct snapshot_domain *d)
 {
-    TAILQ_INIT(&schedule_head);
-    TAILQ_INIT(&event_head);
+#ifdef SCHEDULER_USE_SNAPSHOTS
+    ctx->snapshots = d;
+    ctx->snapshot_changed = true;
+    return true;
+#else
+    (void)ctx;
+    (void)d;
+    return false;
+#endif
 }
 
 /**
@@ -100,223 +476,1898 @@ void scheduler_init(void)
  *  This command should return false if it cannot allocate 
  *  any more memory or if the schedule limit is hit.
  */
-bool scheduler_add(uint8_t group, ICAL* ical)
+bool scheduler_add_r(scheduler_t *ctx, uint32_t group, ICAL* ical)
 {
-    if (schedule_count >= MAX_SCHEDULES){
+    return _schedule_try_add(ctx, group, ical) != NULL;
+}
+
+/**
+ *  Add a number of schedules at once
+ *
+ *  Schedule i is added to groups[i]. Either every schedule is added,
+ *  or none are and false is returned, if an ICAL is invalid (see
+ *  ical_validate), the capacity would be exceeded or memory can't be
+ *  allocated. Memory for all the schedules is allocated at once. The
+ *  ICALs are compiled and checked and the schedules put in their
+ *  groups in one pass, and the ids are given out in a second, so a
+ *  batch that fails leaves the ids given out next as they were. If
+ *  the scheduler is empty, the schedules are calculated together in
+ *  the next update.
+ */
+bool scheduler_add_batch_r(scheduler_t *ctx, const ICAL* icals, const uint32_t* groups, size_t n)
+{
+    if (n == 0){
+        return true;
+    }
+    if (n > ctx->capacity - ctx->schedule_count){
+        return false;
+    }
+
+    // Indexes on the free list are used first
+    uint32_t free_slots = ctx->slot_count - ctx->schedule_count;
+    uint32_t new_slots = n > free_slots ? n - free_slots : 0;
+    if (new_slots > ctx->capacity - ctx->slot_count ||
+        !_schedule_table_reserve(ctx, ctx->slot_count + new_slots) ||
+        !pool_reserve(&ctx->schedule_pool, n)){
         return false;
     }
 
-    struct schedule_entry * s = malloc(sizeof(struct schedule_entry));
+    // The entries are reserved, only an invalid ICAL or a new group
+    // can fail. A group is looked up again only when it changes.
+    struct schedule_entry *first = NULL;
+    struct event_entry *e = NULL;
+    for (size_t i = 0; i < n; i++){
+        struct schedule_entry *s = pool_alloc(&ctx->schedule_pool);
+        TAILQ_INSERT_TAIL(&ctx->schedule_head, s, schedule_entries);
+        s->group_entry = NULL;
+        if (first == NULL){
+            first = s;
+        }
+
+        ical_compile(&icals[i], &s->ical);
+        if (s->ical.error != ICALEVENT_NONE){
+            _schedule_add_batch_undo(ctx, first);
+            return false;
+        }
+        if (e == NULL || e->event.group != groups[i]){
+            e = _event_find(ctx, groups[i]);
+            if (e == NULL){
+                e = _event_add(ctx, groups[i]);
+            }
+            if (e == NULL){
+                _schedule_add_batch_undo(ctx, first);
+                return false;
+            }
+        }
+        s->group_entry = e;
+        s->next.group = groups[i];
+        TAILQ_INSERT_TAIL(&e->schedules, s, group_entries);
+    }
+
+    // Calculate the new schedules on the next update, all together if
+    // the scheduler was empty
+    if (ctx->schedule_count == 0){
+        ctx->rebuild = true;
+    }
+    for (struct schedule_entry *s = first; s; s = TAILQ_NEXT(s, schedule_entries)){
+        _schedule_set_id(ctx, s);
+        s->dirty = !ctx->rebuild;
+        if (s->dirty){
+            TAILQ_INSERT_TAIL(&ctx->dirty_head, s, dirty_entries);
+        }
+    }
+    ctx->schedule_count += (uint32_t)n;
+#ifdef SCHEDULER_USE_TIMERFD
+    _timer_arm(ctx, true);
+#endif
+
+    return true;
+}
+
+/**
+ *  Free the entries of a batch from first on, before they have ids
+ *
+ *  Groups the batch added are removed again.
+ */
+static void _schedule_add_batch_undo(scheduler_t *ctx, struct schedule_entry *first)
+{
+    struct schedule_entry *s;
+
+    do{
+        s = TAILQ_LAST(&ctx->schedule_head, schedule_head_s);
+        TAILQ_REMOVE(&ctx->schedule_head, s, schedule_entries);
+        struct event_entry *e = s->group_entry;
+        if (e){
+            TAILQ_REMOVE(&e->schedules, s, group_entries);
+            if (TAILQ_EMPTY(&e->schedules)){
+                _event_remove(ctx, e);
+            }
+        }
+        pool_free(&ctx->schedule_pool, s);
+    }while (s != first);
+}
+
+/**
+ *  Add a schedule, there must be room in the schedule table
+ *
+ *  NULL is returned if memory can't be allocated.
+ */
+static struct schedule_entry* _schedule_add(scheduler_t *ctx, uint32_t group, const ICAL* ical)
+{
+    struct event_entry * e = _event_find(ctx, group);
+    if (e == NULL){
+        e = _event_add(ctx, group);
+        if (e == NULL){
+            return NULL;
+        }
+    }
+
+    struct schedule_entry * s = pool_alloc(&ctx->schedule_pool);
 
     if (s == NULL){
-        return false;
+        if (TAILQ_EMPTY(&e->schedules)){
+            _event_remove(ctx, e);
+        }
+        return NULL;
     }
 
-    s->schedule.id = schedule_count;
-    s->schedule.group = group;
-    s->schedule.ical.t_start = ical->t_start;
-    s->schedule.ical.t_end = ical->t_end;
-    s->schedule.ical.freq = ical->freq;
-    s->schedule.ical.interval = ical->interval;
-    s->schedule.ical.byday = ical->byday;
-    s->schedule.ical.enabled = ical->enabled;
+    ical_compile(ical, &s->ical);
+    s->next.group = group;
+    s->group_entry = e;
+    _schedule_set_id(ctx, s);
 
-    TAILQ_INSERT_TAIL(&schedule_head, s, schedule_entries);
+    TAILQ_INSERT_TAIL(&ctx->schedule_head, s, schedule_entries);
+    TAILQ_INSERT_TAIL(&e->schedules, s, group_entries);
+    // Calculate the new schedule on the next update, a pending
+    // rebuild calculates every schedule
+    s->dirty = !ctx->rebuild;
+    if (s->dirty){
+        TAILQ_INSERT_TAIL(&ctx->dirty_head, s, dirty_entries);
+    }
+#ifdef SCHEDULER_USE_TIMERFD
+    _timer_arm(ctx, true);
+#endif
     // Increment counter
-    schedule_count++;
+    ctx->schedule_count++;
 
-    return true;
+    return s;
 }
 
 /**
- *  Add an event to the list
+ *  Give a new schedule an index and id, and the order it was added in
  *
- *  This command should return false if it cannot allocate 
+ *  The ICAL must be compiled. There must be room in the schedule table.
+ */
+static void _schedule_set_id(scheduler_t *ctx, struct schedule_entry* s)
+{
+    // Reuse an index if there is one free
+    uint32_t index = ctx->free_slot;
+    if (index == SLOT_NONE){
+        index = ctx->slot_count++;
+    }else{
+        ctx->free_slot = ctx->slots[index].next_free;
+    }
+    ctx->slots[index].entry = s;
+    ical_batch_set(&ctx->batch, index, &s->ical);
+
+    s->next.ical_event = ICALEVENT_NONE;
+    s->next.epoch = ICAL_EPOCH_NEVER;
+    s->next.id = SCHEDULER_ID(index, ctx->slots[index].generation);
+    s->valid_from = 0;
+    s->seq = ctx->seq++;
+    s->grouped = false;
+}
+
+/**
+ *  Find the event entry of a group
+ *
+ *  NULL is returned if the group has no schedules
+ */
+static struct event_entry* _event_find(scheduler_t *ctx, uint32_t group)
+{
+    return group_table_find(&ctx->groups, group);
+}
+
+/**
+ *  Add an event for a group to the list
+ *
+ *  This command should return NULL if it cannot allocate 
  *  any more memory or if the schedule limit is hit.
  */
-static bool _event_add(ICALEVENT event, time_t epoch, uint8_t id, uint8_t group)
+static struct event_entry* _event_add(scheduler_t *ctx, uint32_t group)
 {
 
-    if (event_count >= MAX_SCHEDULES){
-        return false;
+    if (ctx->event_count >= ctx->capacity){
+        return NULL;
     }
 
-    struct event_entry * e = malloc(sizeof(struct event_entry));
+    struct event_entry * e = pool_alloc(&ctx->event_pool);
 
     if (e == NULL){
-        return false;
+        return NULL;
+    }
+    if (!group_table_insert(&ctx->groups, group, e)){
+        pool_free(&ctx->event_pool, e);
+        return NULL;
     }
 
-    e->event.ical_event = event;
-    e->event.id = id;
+    e->event.ical_event = ICALEVENT_NONE;
+    e->event.id = 0;
     e->event.group = group;
-    e->event.epoch = epoch;
+    e->event.epoch = ICAL_EPOCH_NEVER;
+    e->stale = false;
+    e->next_stale = NULL;
+    e->earliest = NULL;
+    TAILQ_INIT(&e->schedules);
 
-    TAILQ_INSERT_TAIL(&event_head, e, event_entries);
+    TAILQ_INSERT_TAIL(&ctx->event_head, e, event_entries);
     // Increment counter
-    event_count++;
+    ctx->event_count++;
 
-    return true;
+    return e;
+}
+
+/**
+ *  Remove an event for a group from the list
+ */
+static void _event_remove(scheduler_t *ctx, struct event_entry* e)
+{
+    group_table_remove(&ctx->groups, e->event.group);
+    TAILQ_REMOVE(&ctx->event_head, e, event_entries);
+    pool_free(&ctx->event_pool, e);
+    ctx->event_count--;
 }
 
 /**
  *  Get schedule by id
  *   
  *  This command returns a pointer to the schedule associated
- *  with the input id. NULL is returned if it doesn't exist
+ *  with the input id. NULL is returned if it doesn't exist.
+ *
+ *  The schedule is rebuilt from its compiled ICAL into a struct
+ *  owned by the scheduler, so the pointer is only valid until the
+ *  next lookup. If its ICAL is edited, scheduler_invalidate compiles
+ *  it again.
  */
-SCHEDULE* scheduler_get_schedule_by_id(uint8_t id)
+SCHEDULE* scheduler_get_schedule_by_id_r(scheduler_t *ctx, uint32_t id)
 {
 
-    struct schedule_entry * s = NULL;
-    // Iterate through queue for the index
-    TAILQ_FOREACH(s, &schedule_head, schedule_entries) {
-        if (id == s->schedule.id) {
-            return(&s->schedule);
-        }
+    struct schedule_entry * s = _schedule_find(ctx, id);
+
+    if (s == NULL) {
+        return(NULL);
     }
 
-    return(NULL);
+    return(_schedule_get(ctx, s));
 }
 
 /**
- *  Get event by group number
- *   
- *  This command returns a pointer to the event associated
- *  with the input group. NULL is returned if it doesn't exist
+ *  Get the first schedule
+ *
+ *  Schedules are iterated in the order they were added with
+ *  scheduler_get_next_schedule. NULL is returned if there are
+ *  no schedules.
  */
-EVENT* scheduler_get_event_by_group(uint8_t group)
+SCHEDULE* scheduler_get_first_schedule_r(scheduler_t *ctx)
 {
+    struct schedule_entry * s = TAILQ_FIRST(&ctx->schedule_head);
 
-    struct event_entry * e = NULL;
-    // Iterate through queue for the index
-    TAILQ_FOREACH(e, &event_head, event_entries) {
-        if (group == e->event.group) {
-            return(&e->event);
-        }
+    if (s == NULL) {
+        return(NULL);
     }
 
-    return(NULL);
+    return(_schedule_get(ctx, s));
 }
 
 /**
- *  Clear events list
- * 
+ *  Get the schedule added after a schedule
+ *
+ *  NULL is returned after the last schedule, or if the schedule
+ *  was removed.
  */
-static void _event_list_clear(void)
+SCHEDULE* scheduler_get_next_schedule_r(scheduler_t *ctx, SCHEDULE *schedule)
 {
-    event_count = 0;
+    struct schedule_entry * s = _schedule_find(ctx, schedule->id);
 
-    struct event_entry * e = NULL;
-    while ((e = TAILQ_FIRST(&event_head))) {
-        TAILQ_REMOVE(&event_head, e, event_entries);
-        free(e);
+    if (s == NULL || (s = TAILQ_NEXT(s, schedule_entries)) == NULL) {
+        return(NULL);
     }
+
+    return(_schedule_get(ctx, s));
 }
 
 /**
- *  Remove a schedule from the bottom of the list
- *   
- *  returns false if empty
+ *  Find a schedule by id
+ *
+ *  NULL is returned if the index is unused or the schedule at the
+ *  index was added after the id was given out.
  */
-bool scheduler_remove_last(void)
+static struct schedule_entry* _schedule_find(scheduler_t *ctx, uint32_t id)
 {
-    struct schedule_entry * s = NULL;
-    // Get first entry in queue
-    s = TAILQ_LAST(&schedule_head, schedule_head_s);
-    if(s == NULL)
-    {
-        return(false);
+    uint32_t index = SCHEDULER_ID_INDEX(id);
+
+    if (index >= ctx->slot_count || ctx->slots[index].generation != SCHEDULER_ID_GENERATION(id)) {
+        return(NULL);
+    }
+
+    return(ctx->slots[index].entry);
+}
+
+/**
+ *  Build the SCHEDULE struct of a schedule for a lookup
+ */
+static SCHEDULE* _schedule_get(scheduler_t *ctx, struct schedule_entry* s)
+{
+    ical_decompile(&s->ical, &ctx->schedule.ical);
+    ctx->schedule.group = s->next.group;
+    ctx->schedule.id = s->next.id;
+    ctx->schedule_entry = s;
+
+    return(&ctx->schedule);
+}
+
+/**
+ *  Make room in the schedule table and queues for count schedules
+ *
+ *  The table grows by doubling up to the capacity.
+ */
+static bool _schedule_table_reserve(scheduler_t *ctx, uint32_t count)
+{
+    if (count <= ctx->slot_size){
+        return true;
+    }
+
+    uint32_t size = ctx->slot_size*2;
+    if (size < count){
+        size = count;
     }
+    if (size > ctx->capacity){
+        size = ctx->capacity;
+    }
+
+    schedule_slot_t *slots = realloc(ctx->slots, size*sizeof(schedule_slot_t));
+    if (slots == NULL){
+        return false;
+    }
+    ctx->slots = slots;
 
-    // Delete first item from queue
-    TAILQ_REMOVE(&schedule_head, s, schedule_entries);
-    free(s);
+    if (!_queue_reserve(&ctx->event_queue, size) || !_queue_reserve(&ctx->recheck_queue, size) ||
+        !ical_batch_reserve(&ctx->batch, size)){
+        return false;
+    }
+
+    for (uint32_t i = ctx->slot_size; i < size; i++){
+        slots[i].entry = NULL;
+        slots[i].generation = 0;
+    }
+    ctx->slot_size = size;
 
     return true;
 }
 
 /**
- *  Clear schedule list
- * 
+ *  Get event by group number
+ *   
+ *  This command returns a pointer to the event associated
+ *  with the input group. NULL is returned if it doesn't exist
  */
-void scheduler_clear(void)
+EVENT* scheduler_get_event_by_group_r(scheduler_t *ctx, uint32_t group)
 {
-    schedule_count = 0;
-    _event_list_clear();
 
-    struct schedule_entry * s = NULL;
-    while ((s = TAILQ_FIRST(&schedule_head))) {
-        TAILQ_REMOVE(&schedule_head, s, schedule_entries);
-        free(s);
+    struct event_entry * e = _event_find(ctx, group);
+
+    if (e == NULL || !ical_is_event(e->event.ical_event)) {
+        return(NULL);
     }
+
+    return(&e->event);
 }
 
 /**
- *  Main scheduling function to determine next alarm event(s) 
- *  based on all schedules
+ *  Get the earliest event of all groups
+ *
+ *  NULL is returned if there are no events. Like the group events,
+ *  this is only updated by scheduler_update_events.
  */
-void scheduler_update_events(struct tm *current_time)
+EVENT* scheduler_get_next_event_r(scheduler_t *ctx)
 {
-    struct tm t_temp;
-    ICALEVENT ical_event = ICALEVENT_NONE;
-    struct schedule_entry * s = NULL;
+    struct schedule_entry * s = _queue_peek(&ctx->event_queue);
 
-    // Clear old event list
-    _event_list_clear();
+    if (s == NULL) {
+        return(NULL);
+    }
+
+    return(&s->next);
+}
+
+/**
+ *  Get the next n events of every schedule after the current time
+ *
+ *  The occurrences of the schedules are merged in time order, ties
+ *  going to the schedule added first. Like the group events, only one
+ *  event of a group is given for the same time. The events are found
+ *  from the schedules alone, so scheduler_update_events doesn't need
+ *  to be called first, and nothing is changed.
+ *
+ *  Only the schedules with one of the n earliest first events are
+ *  merged, which needs a temporary allocation of n streams. If events
+ *  of a group at the same time leave the merge short, it is redone
+ *  with twice as many schedules. Returns the number of events written
+ *  to events, which is less than n if there are no more or memory
+ *  can't be allocated. If a redo can't be allocated, the events of the
+ *  short merge are kept.
+ */
+uint32_t scheduler_next_events_r(scheduler_t *ctx, struct tm *current_time, uint32_t n, EVENT *events)
+{
+    time_t now = civil_from_tm(current_time);
+    uint32_t size = n < ctx->schedule_count ? n : ctx->schedule_count;
+    uint32_t emitted = 0;
 
-    // Loop through each schedule
-    TAILQ_FOREACH(s, &schedule_head, schedule_entries) {
-        // Get next event for each enabled schedule
-        if(s->schedule.ical.enabled){
-            ical_event = ical_find_next_event(&s->schedule.ical,
-                                          current_time,
-                                          &t_temp);
+    while(size){
+        struct next_stream *streams = malloc((size_t)size*sizeof(struct next_stream));
+        if(streams == NULL){
+            // The events of a short merge are still the earliest ones
+            return emitted;
+        }
 
-            // Update the list with the new event
-            _event_list_update(s, &t_temp, ical_event);
+        struct next_stream bound;
+        uint32_t count = _next_stream_select(ctx, now, streams, size, &bound);
+        bool complete = _next_stream_merge(streams, count, bound.schedule ? &bound : NULL, n, events, &emitted);
+        free(streams);
 
+        if(complete || size == ctx->schedule_count){
+            return emitted;
         }
+        size = size < ctx->schedule_count/2 ? 2*size : ctx->schedule_count;
     }
+
+    return 0;
 }
 
 /**
- *  Update event list with new schedule event
+ *  Get the next events after the current time, never splitting a time
  *
- *  This function checks if the schedule group is already
- *  in the list. If yes, it then checks if the new event time
- *  happens before the stored one. If yes, update the list.
+ *  Like scheduler_next_events, but the events of every time written
+ *  are all there, so the caller can go on from the last one. If n
+ *  events end partway through a time, that time is left out. If they
+ *  are all at one time, every event of that time is written instead,
+ *  which may be more than n. *events is an array of *size events that
+ *  is grown with realloc when it is too small. Returns the number of
+ *  events written. If the array can't be grown, the events of the one
+ *  time found so far are kept, which may not be all of them.
  */
-static void _event_list_update(struct schedule_entry* s, 
-                               struct tm *new_event_time,
-                               ICALEVENT event)
+uint32_t scheduler_next_whole_events_r(scheduler_t *ctx, struct tm *current_time, uint32_t n, EVENT **events, uint32_t *size)
 {
+    uint32_t want = n;
+    uint32_t found = 0;
 
-    struct event_entry * e = NULL;
-    //struct tm t_temp;
-    time_t new_epoch = mktime(new_event_time);
-    // Loop through all events
-    TAILQ_FOREACH(e, &event_head, event_entries) {
-
-        // Check if group is in event list
-        if(s->schedule.group == e->event.group){
-
-            // Check if new event happens before old one
-            if(new_epoch < e->event.epoch){
-                // Replace event with new one
-                e->event.ical_event = event;
-                e->event.id = s->schedule.id;
-                e->event.group = s->schedule.group;
-                e->event.epoch = new_epoch;
+    while(want){
+        if(want > *size){
+            EVENT *grown = realloc(*events, (size_t)want*sizeof(EVENT));
+            if(grown == NULL){
+                return found;
+            }
+            *events = grown;
+            *size = want;
+        }
+
+        EVENT *e = *events;
+        uint32_t count = scheduler_next_events_r(ctx, current_time, want, e);
+        if(count < want && want == n){
+            return count;
+        }
+        uint32_t first = 0;
+        while(first < count && e[first].epoch == e[0].epoch){
+            first++;
+        }
+        if(first < count || count < want){
+            if(want > n){
+                // Only the first time, which has more than n events
+                return first;
+            }
+            uint32_t whole = count;
+            while(e[whole - 1].epoch == e[count - 1].epoch){
+                whole--;
             }
-            // Either way return immediately
-            return;
+            return whole;
         }
+
+        // Every event is at one time, which may have more
+        found = count;
+        want = want <= UINT32_MAX/2 ? 2*want : 0;
     }
 
-    // If we're here, this means there isn't an event for 
-    // the group number so create one
-    _event_add(event, new_epoch, s->schedule.id, s->schedule.group);
+    return found;
+}
+
+/**
+ *  Remove a schedule from the bottom of the list
+ *   
+ *  returns false if empty
+ */
+bool scheduler_remove_last_r(scheduler_t *ctx)
+{
+    struct schedule_entry * s = NULL;
+    // Get first entry in queue
+    s = TAILQ_LAST(&ctx->schedule_head, schedule_head_s);
+    if(s == NULL)
+    {
+        return(false);
+    }
+
+    _schedule_remove(ctx, s);
+
+    return true;
+}
+
+/**
+ *  Remove a schedule by id
+ *
+ *  If the schedule has its group's event, the group's event is
+ *  recalculated from the cached events of the other schedules.
+ *  Returns false if the schedule doesn't exist.
+ */
+bool scheduler_remove_r(scheduler_t *ctx, uint32_t id)
+{
+    struct schedule_entry * s = _schedule_find(ctx, id);
+
+    if(s == NULL){
+        return false;
+    }
+
+    _schedule_remove(ctx, s);
+
+    return true;
+}
+
+/**
+ *  Replace the ICAL of a schedule
+ *
+ *  The schedule keeps its id and group, and is recalculated on the
+ *  next update like scheduler_invalidate. Returns false if the
+ *  schedule doesn't exist.
+ */
+bool scheduler_update_r(scheduler_t *ctx, uint32_t id, const ICAL* ical)
+{
+    struct schedule_entry * s = _schedule_find(ctx, id);
+
+    if(s == NULL){
+        return false;
+    }
+
+    ical_compile(ical, &s->ical);
+    // Keep a looked up copy in step, scheduler_invalidate compiles it
+    if(ctx->schedule_entry == s){
+        ctx->schedule.ical = *ical;
+    }
+
+    return scheduler_invalidate_r(ctx, id);
+}
+
+/**
+ *  Add a schedule if there is room for it
+ *
+ *  Returns NULL if the schedule limit is hit or memory can't be
+ *  allocated.
+ */
+static struct schedule_entry* _schedule_try_add(scheduler_t *ctx, uint32_t group, ICAL* ical)
+{
+    if (ctx->schedule_count >= ctx->capacity){
+        return NULL;
+    }
+    if (ctx->free_slot == SLOT_NONE){
+        if (ctx->slot_count >= ctx->capacity || !_schedule_table_reserve(ctx, ctx->slot_count + 1)){
+            return NULL;
+        }
+    }
+
+    return _schedule_add(ctx, group, ical);
+}
+
+/**
+ *  Unlink a schedule from the lists, queues and id table and free it
+ */
+static void _schedule_remove(scheduler_t *ctx, struct schedule_entry* s)
+{
+    schedule_queue_t *q = _schedule_get_queue(ctx, s);
+    if(q){
+        _queue_remove(q, s);
+    }
+    if(s->dirty){
+        TAILQ_REMOVE(&ctx->dirty_head, s, dirty_entries);
+    }
+
+    // Remove the schedule from its group, the group's event only
+    // changes if it came from this schedule
+    struct event_entry * e = s->group_entry;
+    TAILQ_REMOVE(&e->schedules, s, group_entries);
+    if(s->grouped){
+        _group_remove(e, s);
+    }
+    if(TAILQ_EMPTY(&e->schedules)){
+        _event_remove(ctx, e);
+    }else if(ical_is_event(e->event.ical_event) && e->event.id == s->next.id){
+        _event_list_update(e);
+    }
+#ifdef SCHEDULER_USE_SNAPSHOTS
+    // Published with the next update
+    ctx->snapshot_changed = true;
+#endif
+
+    // Free the index, the next schedule added there gets a new id
+    uint32_t index = SCHEDULER_ID_INDEX(s->next.id);
+    ctx->slots[index].entry = NULL;
+    ical_batch_clear(&ctx->batch, index);
+    ctx->slots[index].generation = (ctx->slots[index].generation + 1) & SCHEDULER_GENERATION_MASK;
+    ctx->slots[index].next_free = ctx->free_slot;
+    ctx->free_slot = index;
+    ctx->schedule_count--;
+    if(ctx->schedule_entry == s){
+        ctx->schedule_entry = NULL;
+    }
+
+    TAILQ_REMOVE(&ctx->schedule_head, s, schedule_entries);
+    pool_free(&ctx->schedule_pool, s);
+}
+
+/**
+ *  Recalculate a schedule on the next update
+ *
+ *  This must be called after the ICAL of a schedule returned by a
+ *  lookup is changed, and before the next lookup.
+ *  The events are not changed until scheduler_update_events is
+ *  called. Returns false if the schedule doesn't exist.
+ */
+bool scheduler_invalidate_r(scheduler_t *ctx, uint32_t id)
+{
+    struct schedule_entry * s = _schedule_find(ctx, id);
+
+    if(s == NULL){
+        return false;
+    }
+
+    // The ICAL may have been edited through the last lookup
+    if(ctx->schedule_entry == s){
+        ical_compile(&ctx->schedule.ical, &s->ical);
+    }
+    ical_batch_set(&ctx->batch, SCHEDULER_ID_INDEX(id), &s->ical);
+
+    if(!s->dirty){
+        schedule_queue_t *q = _schedule_get_queue(ctx, s);
+        if(q){
+            _queue_remove(q, s);
+        }
+        s->next.ical_event = ICALEVENT_NONE;
+        s->next.epoch = ICAL_EPOCH_NEVER;
+        // The group's event is updated once the schedule is calculated
+        if(s->grouped){
+            _group_remove(s->group_entry, s);
+        }
+        s->dirty = true;
+        TAILQ_INSERT_TAIL(&ctx->dirty_head, s, dirty_entries);
+    }
+#ifdef SCHEDULER_USE_TIMERFD
+    _timer_arm(ctx, true);
+#endif
+
+    return true;
+}
+
+/**
+ *  Clear schedule list
+ * 
+ */
+void scheduler_clear_r(scheduler_t *ctx)
+{
+    // Keep the capacity, threads, timer, commands and snapshots that
+    // were set
+    uint32_t capacity = ctx->capacity;
+#ifdef SCHEDULER_USE_THREADS
+    struct scheduler_threads *threads = ctx->threads;
+#endif
+#ifdef SCHEDULER_USE_TIMERFD
+    int timer_fd = ctx->timer_fd;
+    const TZTABLE *timer_tz = ctx->timer_tz;
+#endif
+#ifdef SCHEDULER_USE_COMMANDS
+    struct command_queue *commands = ctx->commands;
+#endif
+#ifdef SCHEDULER_USE_SNAPSHOTS
+    struct snapshot_domain *snapshots = ctx->snapshots;
+#endif
+
+    // Schedules and events are freed with their pools
+    pool_destroy(&ctx->schedule_pool);
+    pool_destroy(&ctx->event_pool);
+
+    if (ctx->buffer){
+        scheduler_init_static_r(ctx, ctx->buffer, ctx->buffer_size);
+    }else{
+        group_table_free(&ctx->groups);
+        ical_batch_free(&ctx->batch);
+        free(ctx->slots);
+        _queue_free(&ctx->event_queue);
+        _queue_free(&ctx->recheck_queue);
+        scheduler_init_r(ctx);
+    }
+    ctx->capacity = capacity;
+#ifdef SCHEDULER_USE_THREADS
+    ctx->threads = threads;
+#endif
+#ifdef SCHEDULER_USE_TIMERFD
+    ctx->timer_fd = timer_fd;
+    ctx->timer_tz = timer_tz;
+    _timer_arm(ctx, false);
+#endif
+#ifdef SCHEDULER_USE_COMMANDS
+    ctx->commands = commands;
+#endif
+#ifdef SCHEDULER_USE_SNAPSHOTS
+    ctx->snapshots = snapshots;
+    ctx->snapshot_changed = true;
+#endif
+}
+
+/**
+ *  Main scheduling function to determine next alarm event(s) 
+ *  based on all schedules
+ *
+ *  Only schedules with an event at or before the current time, and
+ *  schedules that were added or invalidated, are recalculated. If the
+ *  current time is earlier than the last update, schedules calculated
+ *  after the current time are recalculated too.
+ */
+void scheduler_update_events_r(scheduler_t *ctx, struct tm *current_time)
+{
+    _update_events(ctx, civil_from_tm(current_time), NULL, 0);
+}
+
+/**
+ *  Get a timer that is readable when the next event is due
+ *
+ *  The timer is a timerfd armed for the earliest event, or the time a
+ *  schedule without an event has to be checked again, as of the last
+ *  update. Each update arms it again. Adding or invalidating a
+ *  schedule arms it to expire straight away, so the new schedule is
+ *  calculated. When it is readable, call scheduler_process_expired.
+ *  tz is the zone of the scheduler's times, NULL if they are UTC.
+ *  The timer is kept when the scheduler is cleared. Returns -1 if the
+ *  timer can't be made or SCHEDULER_USE_TIMERFD isn't defined.
+ */
+int scheduler_fd_r(scheduler_t *ctx, const TZTABLE *tz)
+{
+#ifdef SCHEDULER_USE_TIMERFD
+    if (ctx->timer_fd < 0){
+        ctx->timer_fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (ctx->timer_fd < 0){
+            return -1;
+        }
+    }
+    ctx->timer_tz = tz;
+    // The events haven't been calculated since the first update
+    _timer_arm(ctx, ctx->rebuild || !TAILQ_EMPTY(&ctx->dirty_head));
+
+    return ctx->timer_fd;
+#else
+    (void)ctx;
+    (void)tz;
+    return -1;
+#endif
+}
+
+/**
+ *  Close the timer of scheduler_fd
+ */
+void scheduler_fd_close_r(scheduler_t *ctx)
+{
+#ifdef SCHEDULER_USE_TIMERFD
+    if (ctx->timer_fd >= 0){
+        close(ctx->timer_fd);
+        ctx->timer_fd = -1;
+    }
+#else
+    (void)ctx;
+#endif
+}
+
+/**
+ *  Update the events to the current time after the timer expires
+ *
+ *  The current time is read from CLOCK_REALTIME in the zone given to
+ *  scheduler_fd. Group events that are due are written to events, up
+ *  to n of them. A group event is due if it was the group's event at
+ *  the last update and its time has come. If more than n are due, the
+ *  rest are left for the next call and the timer expires again
+ *  straight away. Returns the number of events written, or 0 if
+ *  SCHEDULER_USE_TIMERFD isn't defined.
+ */
+uint32_t scheduler_process_expired_r(scheduler_t *ctx, EVENT *events, uint32_t n)
+{
+#ifdef SCHEDULER_USE_TIMERFD
+    struct timespec ts;
+    uint64_t expirations;
+
+    // Clear the expiry, this fails with EAGAIN if the timer hasn't
+    // expired, and the events are updated anyway
+    if (ctx->timer_fd >= 0){
+        ssize_t size = read(ctx->timer_fd, &expirations, sizeof(expirations));
+        (void)size;
+    }
+    clock_gettime(CLOCK_REALTIME, &ts);
+    time_t now = ctx->timer_tz ? tz_utc_to_local(ctx->timer_tz, ts.tv_sec) : ts.tv_sec;
+
+    return _update_events(ctx, now, events, n);
+#else
+    (void)ctx;
+    (void)events;
+    (void)n;
+    return 0;
+#endif
+}
+
+/**
+ *  Update the events to a current time
+ *
+ *  If events is not NULL, each group event that is due is written to
+ *  it before its schedule is recalculated, and at most n are taken.
+ *  Due schedules that aren't taken stay in the queue. Returns the
+ *  number of events written.
+ */
+static uint32_t _update_events(scheduler_t *ctx, time_t now, EVENT *events, uint32_t n)
+{
+    struct schedule_entry * s = NULL;
+    struct event_entry * e = NULL;
+    uint32_t count = 0;
+
+#ifdef SCHEDULER_USE_COMMANDS
+    scheduler_apply_commands_r(ctx);
+#endif
+
+    if(ctx->rebuild){
+        _queue_reset(&ctx->event_queue, now);
+        _queue_reset(&ctx->recheck_queue, now);
+        TAILQ_INIT(&ctx->dirty_head);
+
+        // Each group's heap is filled as its schedules are calculated
+        TAILQ_FOREACH(e, &ctx->event_head, event_entries) {
+            e->earliest = NULL;
+        }
+
+        // Calculate every schedule, split across threads if there are any
+#ifdef SCHEDULER_USE_THREADS
+        if(!_schedule_list_calculate_threads(ctx, now))
+#endif
+        {
+            _schedule_list_calculate(ctx, 0, ctx->slot_count, now, true);
+        }
+        TAILQ_FOREACH(e, &ctx->event_head, event_entries) {
+            _event_list_update(e);
+        }
+
+        for(uint32_t i = 0; i < ctx->slot_count; i++){
+            s = ctx->slots[i].entry;
+            if(s){
+                schedule_queue_t *q = _schedule_get_queue(ctx, s);
+                if(q){
+                    _queue_append(q, s);
+                }
+            }
+        }
+        _queue_build(&ctx->event_queue);
+        _queue_build(&ctx->recheck_queue);
+    }else{
+        if(now < ctx->update_time){
+            _schedule_list_rewind(ctx, now);
+        }
+
+        // Calculate added and invalidated schedules
+        while((s = TAILQ_FIRST(&ctx->dirty_head))){
+            TAILQ_REMOVE(&ctx->dirty_head, s, dirty_entries);
+            s->dirty = false;
+            _schedule_update(s, now);
+            _event_reorder(ctx, s);
+
+            schedule_queue_t *q = _schedule_get_queue(ctx, s);
+            if(q){
+                _queue_push(q, s);
+            }
+        }
+
+        // Only recalculate schedules whose event has passed
+        schedule_queue_t *queues[] = {&ctx->event_queue, &ctx->recheck_queue};
+        for(uint8_t i = 0; i < 2; i++){
+            schedule_queue_t *q = queues[i];
+            while((i > 0 || events == NULL || count < n) && (s = _queue_pop_due(q, now))){
+                e = s->group_entry;
+                if(i == 0 && events && e->event.id == s->next.id && e->event.epoch == s->next.epoch){
+                    events[count++] = s->next;
+                }
+                _schedule_update(s, now);
+                _event_reorder(ctx, s);
+
+                schedule_queue_t *new_q = _schedule_get_queue(ctx, s);
+                if(new_q){
+                    _queue_push(new_q, s);
+                }
+            }
+        }
+    }
+
+#ifdef SCHEDULER_USE_SNAPSHOTS
+    if(ctx->rebuild || ctx->stale_head){
+        ctx->snapshot_changed = true;
+    }
+#endif
+
+    // Update the events of groups with recalculated schedules
+    while((e = ctx->stale_head)){
+        ctx->stale_head = e->next_stale;
+        e->stale = false;
+        _event_list_update(e);
+    }
+
+    ctx->update_time = now;
+    ctx->rebuild = false;
+#ifdef SCHEDULER_USE_TIMERFD
+    _timer_arm(ctx, false);
+#endif
+#ifdef SCHEDULER_USE_SNAPSHOTS
+    if(ctx->snapshots && ctx->snapshot_changed && _snapshot_publish(ctx)){
+        ctx->snapshot_changed = false;
+    }
+#endif
+
+    return count;
+}
+
+#ifdef SCHEDULER_USE_SNAPSHOTS
+/**
+ *  Publish a snapshot of the group events
+ *
+ *  Returns false if memory can't be allocated, so the next update
+ *  tries again.
+ */
+static bool _snapshot_publish(scheduler_t *ctx)
+{
+    struct event_entry * e = NULL;
+    snapshot_t *snapshot = snapshot_alloc(ctx->event_count);
+
+    if(snapshot == NULL){
+        return false;
+    }
+
+    TAILQ_FOREACH(e, &ctx->event_head, event_entries) {
+        if(ical_is_event(e->event.ical_event)){
+            snapshot->events[snapshot->count++] = e->event;
+        }
+    }
+    qsort(snapshot->events, snapshot->count, sizeof(EVENT), _snapshot_compare);
+
+    // The earliest event is the event of the group at the top of the
+    // queue
+    struct schedule_entry *s = _queue_peek(&ctx->event_queue);
+    const EVENT *next = s ? snapshot_find_group(snapshot, s->next.group) : NULL;
+    snapshot->next = next ? (uint32_t)(next - snapshot->events) : snapshot->count;
+    snapshot->update_time = ctx->update_time;
+
+    snapshot_publish(ctx->snapshots, snapshot);
+
+    return true;
+}
+
+static int _snapshot_compare(const void *a, const void *b)
+{
+    uint32_t group_a = ((const EVENT*)a)->group;
+    uint32_t group_b = ((const EVENT*)b)->group;
+
+    return (group_a > group_b) - (group_a < group_b);
+}
+#endif
+
+#ifdef SCHEDULER_USE_TIMERFD
+/**
+ *  Arm the timer for the earliest event or recheck, or to expire
+ *  straight away if now is set
+ */
+static void _timer_arm(scheduler_t *ctx, bool now)
+{
+    struct itimerspec spec = {{0, 0}, {0, 0}};
+
+    if (ctx->timer_fd < 0){
+        return;
+    }
+
+    if (now){
+        spec.it_value.tv_nsec = 1;
+    }else{
+        time_t next = ICAL_EPOCH_NEVER;
+        struct schedule_entry *s = _queue_peek(&ctx->event_queue);
+        if (s){
+            next = s->next.epoch;
+        }
+        s = _queue_peek(&ctx->recheck_queue);
+        if (s && s->next.epoch < next){
+            next = s->next.epoch;
+        }
+
+        if (next != ICAL_EPOCH_NEVER){
+            spec.it_value.tv_sec = ctx->timer_tz ? tz_local_to_utc(ctx->timer_tz, next) : next;
+            // An absolute time of 0 would disarm the timer
+            if (spec.it_value.tv_sec <= 0){
+                spec.it_value.tv_sec = 0;
+                spec.it_value.tv_nsec = 1;
+            }
+        }
+    }
+    timerfd_settime(ctx->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+#endif
+
+/**
+ *  Calculate the next event of a schedule
+ */
+static void _schedule_update(struct schedule_entry* s, time_t now)
+{
+    time_t epoch = ICAL_EPOCH_NEVER;
+    ICALEVENT ical_event = ICALEVENT_NONE;
+
+    // Get next event for each enabled schedule
+    if(s->ical.enabled){
+        ical_event = ical_record_find_next_epoch(&s->ical, now, &epoch);
+    }
+
+    s->next.ical_event = ical_event;
+    s->next.epoch = epoch;
+    s->valid_from = now;
+}
+
+/**
+ *  Calculate the schedules with indexes in a range
+ *
+ *  Blocks of schedules are calculated with the batch, and the ones it
+ *  can't calculate are done one at a time. If group is set, schedules
+ *  with an event are added to their group's heap, which must have
+ *  been emptied. Otherwise the heaps are left to the caller.
+ */
+static void _schedule_list_calculate(scheduler_t *ctx, uint32_t first, uint32_t count, time_t now, bool group)
+{
+    for(uint32_t block = first; block < first + count; block += BATCH_SIZE){
+        uint8_t events[BATCH_SIZE];
+        time_t epochs[BATCH_SIZE];
+        uint32_t n = first + count - block < BATCH_SIZE ? first + count - block : BATCH_SIZE;
+
+        ical_batch_find_next_epoch(&ctx->batch, block, n, now, events, epochs);
+        for(uint32_t i = 0; i < n; i++){
+            struct schedule_entry * s = ctx->slots[block + i].entry;
+            if(s == NULL){
+                continue;
+            }
+
+            s->dirty = false;
+            if(events[i] == ICAL_BATCH_SLOW){
+                _schedule_update(s, now);
+            }else{
+                s->next.ical_event = (ICALEVENT)events[i];
+                s->next.epoch = epochs[i];
+                s->valid_from = now;
+            }
+            s->grouped = false;
+            if(group && ical_is_event(s->next.ical_event)){
+                _group_push(s->group_entry, s);
+            }
+        }
+    }
+}
+
+/**
+ *  Check if a schedule's event comes before another's
+ *
+ *  Ties go to the schedule added first.
+ */
+static bool _schedule_earlier(const struct schedule_entry* a, const struct schedule_entry* b)
+{
+    return a->next.epoch < b->next.epoch || (a->next.epoch == b->next.epoch && a->seq < b->seq);
+}
+
+#ifdef SCHEDULER_USE_THREADS
+/**
+ *  Calculate every schedule with the threads of the scheduler
+ *
+ *  Each thread calculates a range of schedule indexes. The groups are
+ *  then split between the threads, and each fills the heaps of its
+ *  groups. Returns false if there are no threads, too few schedules,
+ *  or memory can't be allocated.
+ */
+static bool _schedule_list_calculate_threads(scheduler_t *ctx, time_t now)
+{
+    struct scheduler_threads *t = ctx->threads;
+    struct event_entry * e = NULL;
+
+    if(t == NULL || ctx->slot_count < SCHEDULER_THREAD_MIN_SCHEDULES){
+        return false;
+    }
+
+    if(ctx->event_count > t->group_size){
+        struct event_entry **groups = malloc((size_t)ctx->event_count*sizeof(struct event_entry*));
+        if(groups == NULL){
+            return false;
+        }
+        free(t->groups);
+        t->groups = groups;
+        t->group_size = ctx->event_count;
+    }
+
+    uint32_t index = 0;
+    TAILQ_FOREACH(e, &ctx->event_head, event_entries) {
+        t->groups[index++] = e;
+    }
+
+    t->ctx = ctx;
+    t->now = now;
+    t->group_count = ctx->event_count;
+    thread_pool_run(&t->pool, _schedule_list_calculate_thread, t);
+    thread_pool_run(&t->pool, _event_list_merge_thread, t);
+
+    return true;
+}
+
+/**
+ *  Calculate a thread's range of schedules
+ */
+static void _schedule_list_calculate_thread(void *arg, uint32_t index)
+{
+    struct scheduler_threads *t = arg;
+    uint32_t first = _thread_range_start(t->ctx->slot_count, index, t->pool.count, BATCH_SIZE);
+    uint32_t last = _thread_range_start(t->ctx->slot_count, index + 1, t->pool.count, BATCH_SIZE);
+
+    _schedule_list_calculate(t->ctx, first, last - first, t->now, false);
+}
+
+/**
+ *  Fill the heaps of a thread's range of groups
+ *
+ *  The heaps were already emptied.
+ */
+static void _event_list_merge_thread(void *arg, uint32_t index)
+{
+    struct scheduler_threads *t = arg;
+    uint32_t first = _thread_range_start(t->group_count, index, t->pool.count, 1);
+    uint32_t last = _thread_range_start(t->group_count, index + 1, t->pool.count, 1);
+
+    for(uint32_t i = first; i < last; i++){
+        struct schedule_entry * s = NULL;
+
+        TAILQ_FOREACH(s, &t->groups[i]->schedules, group_entries) {
+            if(ical_is_event(s->next.ical_event)){
+                _group_push(t->groups[i], s);
+            }
+        }
+    }
+}
+
+/**
+ *  Get the start of a thread's share of count items
+ *
+ *  Shares start on a multiple of align, and the share after the last
+ *  thread starts at count.
+ */
+static uint32_t _thread_range_start(uint32_t count, uint32_t index, uint32_t threads, uint32_t align)
+{
+    if(index >= threads){
+        return count;
+    }
+
+    return (uint32_t)((uint64_t)count*index/threads)/align*align;
+}
+#endif
+
+/**
+ *  Recalculate schedules after the current time goes backwards
+ *
+ *  Every queued event is after the last update, and so after now.
+ *  Only schedules calculated after now need to be calculated again,
+ *  but the queues are rebuilt as they can't be moved back in time.
+ */
+static void _schedule_list_rewind(scheduler_t *ctx, time_t now)
+{
+    struct schedule_entry * s = NULL;
+
+    _queue_reset(&ctx->event_queue, now);
+    _queue_reset(&ctx->recheck_queue, now);
+
+    TAILQ_FOREACH(s, &ctx->schedule_head, schedule_entries) {
+        if(s->dirty){
+            continue;
+        }
+        if(s->valid_from > now){
+            _schedule_update(s, now);
+            _event_reorder(ctx, s);
+        }
+
+        schedule_queue_t *q = _schedule_get_queue(ctx, s);
+        if(q){
+            _queue_append(q, s);
+        }
+    }
+    _queue_build(&ctx->event_queue);
+    _queue_build(&ctx->recheck_queue);
+}
+
+/**
+ *  Find the first event of a schedule after now
+ *
+ *  The cached next event is used if it is still valid. Returns false
+ *  if the schedule has no more events.
+ */
+static bool _schedule_first_event(scheduler_t *ctx, struct schedule_entry* s, time_t now, EVENT *event)
+{
+    ICALEXPAND expand;
+
+    *event = s->next;
+    if(!ctx->rebuild && !s->dirty && ical_is_event(s->next.ical_event) &&
+       s->valid_from <= now && now < s->next.epoch){
+        return true;
+    }
+
+    ical_record_expand_init(&expand, &s->ical, now + 1, ICAL_EPOCH_NEVER);
+    return ical_expand_next(&expand, &event->ical_event, &event->epoch);
+}
+
+/**
+ *  Select the size schedules with the earliest first events
+ *
+ *  The schedules are kept in a max-heap while they are selected, so
+ *  the latest can be swapped out. Each selected schedule is then set
+ *  up to expand its occurrences, and streams is left as a min-heap.
+ *  The earliest first event of the schedules left out is put in
+ *  bound, or its schedule is NULL if none were left out. Returns the
+ *  number of schedules selected.
+ */
+static uint32_t _next_stream_select(scheduler_t *ctx, time_t now, struct next_stream *streams, uint32_t size, struct next_stream *bound)
+{
+    struct schedule_entry * s = NULL;
+    struct next_stream candidate;
+    uint32_t count = 0;
+
+    bound->schedule = NULL;
+    TAILQ_FOREACH(s, &ctx->schedule_head, schedule_entries) {
+        if(!_schedule_first_event(ctx, s, now, &candidate.event)){
+            continue;
+        }
+        candidate.schedule = s;
+
+        if(count < size){
+            streams[count++] = candidate;
+            if(count == size){
+                for(uint32_t i = size/2; i-- > 0;){
+                    _next_stream_sift_down(streams, count, i, true);
+                }
+            }
+            continue;
+        }
+
+        if(_next_stream_less(&candidate, &streams[0])){
+            struct next_stream latest = streams[0];
+            streams[0] = candidate;
+            _next_stream_sift_down(streams, count, 0, true);
+            candidate = latest;
+        }
+        if(bound->schedule == NULL || _next_stream_less(&candidate, bound)){
+            *bound = candidate;
+        }
+    }
+
+    for(uint32_t i = 0; i < count; i++){
+        ical_record_expand_init(&streams[i].expand, &streams[i].schedule->ical, now + 1, ICAL_EPOCH_NEVER);
+        ical_expand_next(&streams[i].expand, &streams[i].event.ical_event, &streams[i].event.epoch);
+    }
+    for(uint32_t i = count/2; i-- > 0;){
+        _next_stream_sift_down(streams, count, i, false);
+    }
+
+    return count;
+}
+
+/**
+ *  Merge the occurrences of the selected schedules into events
+ *
+ *  Returns false if the next event would be at or after bound, as a
+ *  schedule that wasn't selected could come first.
+ */
+static bool _next_stream_merge(struct next_stream *streams, uint32_t count, const struct next_stream *bound, uint32_t n, EVENT *events, uint32_t *emitted)
+{
+    *emitted = 0;
+
+    while(*emitted < n){
+        if(count == 0){
+            return bound == NULL;
+        }
+        struct next_stream *first = &streams[0];
+        if(bound && !_next_stream_less(first, bound)){
+            return false;
+        }
+
+        // Only the first event of a group at the same time is given
+        bool found = false;
+        for(uint32_t i = *emitted; i-- > 0 && events[i].epoch == first->event.epoch;){
+            if(events[i].group == first->event.group){
+                found = true;
+                break;
+            }
+        }
+        if(!found){
+            events[(*emitted)++] = first->event;
+        }
+
+        if(!ical_expand_next(&first->expand, &first->event.ical_event, &first->event.epoch)){
+            *first = streams[--count];
+        }
+        _next_stream_sift_down(streams, count, 0, false);
+    }
+
+    return true;
+}
+
+/**
+ *  Check if a stream's event comes before another's
+ *
+ *  Ties go to the schedule added first, as in the event queue.
+ */
+static bool _next_stream_less(const struct next_stream* a, const struct next_stream* b)
+{
+    return a->event.epoch < b->event.epoch ||
+           (a->event.epoch == b->event.epoch && a->schedule->seq < b->schedule->seq);
+}
+
+/**
+ *  Move a stream down a min-heap, or a max-heap if max is set
+ */
+static void _next_stream_sift_down(struct next_stream *streams, uint32_t count, uint32_t i, bool max)
+{
+    while(true){
+        uint32_t child = 2*i + 1;
+        if(child >= count){
+            break;
+        }
+        if(child + 1 < count &&
+           (max ? _next_stream_less(&streams[child], &streams[child + 1]) : _next_stream_less(&streams[child + 1], &streams[child]))){
+            child++;
+        }
+        if(max ? !_next_stream_less(&streams[i], &streams[child]) : !_next_stream_less(&streams[child], &streams[i])){
+            break;
+        }
+        struct next_stream temp = streams[i];
+        streams[i] = streams[child];
+        streams[child] = temp;
+        i = child;
+    }
+}
+
+/**
+ *  Get the queue a schedule belongs in based on its next event
+ *
+ *  NULL is returned if the schedule never needs to be recalculated.
+ */
+static schedule_queue_t* _schedule_get_queue(scheduler_t *ctx, struct schedule_entry* s)
+{
+    if(ical_is_event(s->next.ical_event)){
+        return &ctx->event_queue;
+    }else if(s->next.epoch != ICAL_EPOCH_NEVER){
+        return &ctx->recheck_queue;
+    }
+    return NULL;
+}
+
+/**
+ *  Update a group's event with the earliest event of its schedules
+ *
+ *  This is the top of the group's heap. If two schedules have an event
+ *  at the same time, the one that was added first is used.
+ */
+static void _event_list_update(struct event_entry* e)
+{
+    if(e->earliest){
+        e->event = e->earliest->next;
+    }else{
+        e->event.ical_event = ICALEVENT_NONE;
+        e->event.epoch = ICAL_EPOCH_NEVER;
+    }
+}
+
+/**
+ *  Add a group to the list of groups to update
+ */
+static void _event_mark_stale(scheduler_t *ctx, struct event_entry* e)
+{
+    if(!e->stale){
+        e->stale = true;
+        e->next_stale = ctx->stale_head;
+        ctx->stale_head = e;
+    }
+}
+
+/**
+ *  Move a schedule to its place in its group's heap after its next
+ *  event changed, and mark the group to be updated
+ */
+static void _event_reorder(scheduler_t *ctx, struct schedule_entry* s)
+{
+    struct event_entry * e = s->group_entry;
+
+    if(s->grouped){
+        _group_remove(e, s);
+    }
+    if(ical_is_event(s->next.ical_event)){
+        _group_push(e, s);
+    }
+    _event_mark_stale(ctx, e);
+}
+
+/*************** Group Heap *********************/
+
+/**
+ *  Add a schedule to its group's heap
+ *
+ *  The schedules of a group with an event are kept in a pairing heap
+ *  linked through the schedules, so a group's event is found without
+ *  going through all of its schedules, and moving a schedule costs
+ *  O(log k) amortized for a group of k schedules.
+ */
+static void _group_push(struct event_entry* e, struct schedule_entry* s)
+{
+    s->group_child = NULL;
+    s->group_next = NULL;
+    s->group_prev = NULL;
+    s->grouped = true;
+    e->earliest = _group_meld(e->earliest, s);
+}
+
+/**
+ *  Take a schedule out of its group's heap
+ */
+static void _group_remove(struct event_entry* e, struct schedule_entry* s)
+{
+    struct schedule_entry * children = _group_merge_pairs(s->group_child);
+
+    if(s == e->earliest){
+        e->earliest = children;
+    }else{
+        // Unlink the schedule from its parent or previous sibling
+        if(s->group_prev->group_child == s){
+            s->group_prev->group_child = s->group_next;
+        }else{
+            s->group_prev->group_next = s->group_next;
+        }
+        if(s->group_next){
+            s->group_next->group_prev = s->group_prev;
+        }
+        e->earliest = _group_meld(e->earliest, children);
+    }
+    s->grouped = false;
+}
+
+/**
+ *  Join two heaps, the later root becomes the first child of the
+ *  earlier one
+ */
+static struct schedule_entry* _group_meld(struct schedule_entry* a, struct schedule_entry* b)
+{
+    if(a == NULL){
+        return b;
+    }
+    if(b == NULL){
+        return a;
+    }
+    if(_schedule_earlier(b, a)){
+        struct schedule_entry * t = a;
+        a = b;
+        b = t;
+    }
+
+    b->group_prev = a;
+    b->group_next = a->group_child;
+    if(a->group_child){
+        a->group_child->group_prev = b;
+    }
+    a->group_child = b;
+
+    return a;
+}
+
+/**
+ *  Join a list of siblings into one heap, melding them in pairs from
+ *  the front and then the pairs from the back
+ */
+static struct schedule_entry* _group_merge_pairs(struct schedule_entry* first)
+{
+    struct schedule_entry * pairs = NULL;
+    struct schedule_entry * root = NULL;
+
+    while(first){
+        struct schedule_entry * a = first;
+        struct schedule_entry * b = a->group_next;
+
+        first = b ? b->group_next : NULL;
+        a->group_next = NULL;
+        a->group_prev = NULL;
+        if(b){
+            b->group_next = NULL;
+            b->group_prev = NULL;
+            a = _group_meld(a, b);
+        }
+        // Pairs are kept in reverse through group_next
+        a->group_next = pairs;
+        pairs = a;
+    }
+
+    while(pairs){
+        struct schedule_entry * next = pairs->group_next;
+        pairs->group_next = NULL;
+        root = _group_meld(root, pairs);
+        pairs = next;
+    }
+
+    return root;
+}
+
+/*************** Event Queue *********************/
+
+#ifdef SCHEDULER_USE_WHEEL
+
+#define QUEUE_ENTRY(n) ((struct schedule_entry*)((char*)(n) - offsetof(struct schedule_entry, queue_node)))
+
+static void _queue_init(schedule_queue_t *q)
+{
+    wheel_init(q, 0);
+}
+
+static void* _queue_init_static(schedule_queue_t *q, void *buffer, uint32_t size)
+{
+    (void)size;
+    _queue_init(q);
+    return buffer;
+}
+
+static void _queue_free(schedule_queue_t *q)
+{
+    (void)q;
+}
+
+static bool _queue_reserve(schedule_queue_t *q, uint32_t size)
+{
+    (void)q;
+    (void)size;
+    return true;
+}
+
+static void _queue_reset(schedule_queue_t *q, time_t now)
+{
+    wheel_init(q, now);
+}
+
+static void _queue_append(schedule_queue_t *q, struct schedule_entry* s)
+{
+    _queue_push(q, s);
+}
+
+static void _queue_build(schedule_queue_t *q)
+{
+    (void)q;
+}
+
+static void _queue_push(schedule_queue_t *q, struct schedule_entry* s)
+{
+    s->queue_node.expires = s->next.epoch;
+    s->queue_node.seq = s->seq;
+    wheel_insert(q, &s->queue_node);
+}
+
+static void _queue_remove(schedule_queue_t *q, struct schedule_entry* s)
+{
+    wheel_remove(q, &s->queue_node);
+}
+
+static struct schedule_entry* _queue_pop_due(schedule_queue_t *q, time_t now)
+{
+    wheel_node_t *n = wheel_pop_expired(q, now);
+    return n ? QUEUE_ENTRY(n) : NULL;
+}
+
+static struct schedule_entry* _queue_peek(schedule_queue_t *q)
+{
+    wheel_node_t *n = wheel_peek(q);
+    return n ? QUEUE_ENTRY(n) : NULL;
+}
+
+#else
+
+static void _queue_init(schedule_queue_t *q)
+{
+    q->entries = NULL;
+    q->count = 0;
+    q->size = 0;
+}
+
+/**
+ *  Use a buffer for size entries, returns the end of the entries
+ */
+static void* _queue_init_static(schedule_queue_t *q, void *buffer, uint32_t size)
+{
+    q->entries = buffer;
+    q->count = 0;
+    q->size = size;
+    return q->entries + size;
+}
+
+static void _queue_free(schedule_queue_t *q)
+{
+    free(q->entries);
+}
+
+/**
+ *  Allocate room for size entries
+ */
+static bool _queue_reserve(schedule_queue_t *q, uint32_t size)
+{
+    if (size <= q->size){
+        return true;
+    }
+
+    struct schedule_entry **entries = realloc(q->entries, size*sizeof(struct schedule_entry*));
+    if (entries == NULL){
+        return false;
+    }
+    q->entries = entries;
+    q->size = size;
+
+    return true;
+}
+
+static void _queue_reset(schedule_queue_t *q, time_t now)
+{
+    (void)now;
+    q->count = 0;
+}
+
+/**
+ *  Add an entry without keeping heap order, _queue_build must be
+ *  called once all entries are added
+ */
+static void _queue_append(schedule_queue_t *q, struct schedule_entry* s)
+{
+    s->queue_index = q->count;
+    q->entries[q->count++] = s;
+}
+
+static void _queue_build(schedule_queue_t *q)
+{
+    for(uint32_t i = q->count/2; i-- > 0;){
+        _queue_sift_down(q, i);
+    }
+}
+
+static void _queue_push(schedule_queue_t *q, struct schedule_entry* s)
+{
+    _queue_append(q, s);
+    _queue_sift_up(q, s->queue_index);
+}
+
+static void _queue_remove(schedule_queue_t *q, struct schedule_entry* s)
+{
+    uint32_t i = s->queue_index;
+    struct schedule_entry *last = q->entries[--q->count];
+
+    if(i == q->count){
+        return;
+    }
+
+    // Move the last entry into the hole and restore the heap order
+    q->entries[i] = last;
+    last->queue_index = i;
+    _queue_sift_up(q, i);
+    _queue_sift_down(q, last->queue_index);
+}
+
+static struct schedule_entry* _queue_pop_due(schedule_queue_t *q, time_t now)
+{
+    struct schedule_entry *s = _queue_peek(q);
+
+    if(s == NULL || s->next.epoch > now){
+        return NULL;
+    }
+    _queue_remove(q, s);
+
+    return s;
+}
+
+static struct schedule_entry* _queue_peek(schedule_queue_t *q)
+{
+    return q->count ? q->entries[0] : NULL;
+}
+
+static bool _queue_less(const struct schedule_entry* a, const struct schedule_entry* b)
+{
+    if(a->next.epoch != b->next.epoch){
+        return a->next.epoch < b->next.epoch;
+    }
+    return a->seq < b->seq;
+}
+
+static void _queue_sift_up(schedule_queue_t *q, uint32_t i)
+{
+    struct schedule_entry *s = q->entries[i];
+
+    while(i > 0){
+        uint32_t parent = (i - 1)/2;
+        if(!_queue_less(s, q->entries[parent])){
+            break;
+        }
+        q->entries[i] = q->entries[parent];
+        q->entries[i]->queue_index = i;
+        i = parent;
+    }
+    q->entries[i] = s;
+    s->queue_index = i;
+}
+
+static void _queue_sift_down(schedule_queue_t *q, uint32_t i)
+{
+    struct schedule_entry *s = q->entries[i];
+
+    while(1){
+        uint32_t child = 2*i + 1;
+        if(child >= q->count){
+            break;
+        }
+        if(child + 1 < q->count && _queue_less(q->entries[child + 1], q->entries[child])){
+            child++;
+        }
+        if(!_queue_less(q->entries[child], s)){
+            break;
+        }
+        q->entries[i] = q->entries[child];
+        q->entries[i]->queue_index = i;
+        i = child;
+    }
+    q->entries[i] = s;
+    s->queue_index = i;
+}
+
+#endif
+
+/*************** Default Instance *********************/
+
+/**
+ *  Get the instance used by the non-reentrant API
+ */
+scheduler_t* scheduler_get_default(void)
+{
+    return &default_scheduler;
+}
+
+void scheduler_init(void)
+{
+    scheduler_init_r(&default_scheduler);
+}
+
+bool scheduler_init_static(void *buffer, size_t size)
+{
+    return scheduler_init_static_r(&default_scheduler, buffer, size);
+}
+
+void scheduler_clear(void)
+{
+    scheduler_clear_r(&default_scheduler);
+}
+
+bool scheduler_set_capacity(uint32_t capacity)
+{
+    return scheduler_set_capacity_r(&default_scheduler, capacity);
+}
+
+bool scheduler_set_threads(uint32_t count)
+{
+    return scheduler_set_threads_r(&default_scheduler, count);
+}
+
+bool scheduler_set_commands(struct command_queue *q)
+{
+    return scheduler_set_commands_r(&default_scheduler, q);
+}
+
+uint32_t scheduler_apply_commands(void)
+{
+    return scheduler_apply_commands_r(&default_scheduler);
+}
+
+bool scheduler_set_snapshots(struct snapshot_domain *d)
+{
+    return scheduler_set_snapshots_r(&default_scheduler, d);
+}
+
+bool scheduler_add(uint32_t group, ICAL* ical)
+{
+    return scheduler_add_r(&default_scheduler, group, ical);
+}
+
+bool scheduler_add_batch(const ICAL* icals, const uint32_t* groups, size_t n)
+{
+    return scheduler_add_batch_r(&default_scheduler, icals, groups, n);
+}
+
+bool scheduler_remove_last(void)
+{
+    return scheduler_remove_last_r(&default_scheduler);
+}
+
+bool scheduler_remove(uint32_t id)
+{
+    return scheduler_remove_r(&default_scheduler, id);
+}
+
+bool scheduler_update(uint32_t id, const ICAL* ical)
+{
+    return scheduler_update_r(&default_scheduler, id, ical);
+}
+
+bool scheduler_invalidate(uint32_t id)
+{
+    return scheduler_invalidate_r(&default_scheduler, id);
+}
+
+SCHEDULE* scheduler_get_schedule_by_id(uint32_t id)
+{
+    return scheduler_get_schedule_by_id_r(&default_scheduler, id);
+}
+
+SCHEDULE* scheduler_get_first_schedule(void)
+{
+    return scheduler_get_first_schedule_r(&default_scheduler);
+}
+
+SCHEDULE* scheduler_get_next_schedule(SCHEDULE *schedule)
+{
+    return scheduler_get_next_schedule_r(&default_scheduler, schedule);
+}
+
+EVENT* scheduler_get_event_by_group(uint32_t group)
+{
+    return scheduler_get_event_by_group_r(&default_scheduler, group);
+}
+
+EVENT* scheduler_get_next_event(void)
+{
+    return scheduler_get_next_event_r(&default_scheduler);
+}
+
+void scheduler_update_events(struct tm *current_time)
+{
+    scheduler_update_events_r(&default_scheduler, current_time);
+}
+
+uint32_t scheduler_next_events(struct tm *current_time, uint32_t n, EVENT *events)
+{
+    return scheduler_next_events_r(&default_scheduler, current_time, n, events);
+}
+
+uint32_t scheduler_next_whole_events(struct tm *current_time, uint32_t n, EVENT **events, uint32_t *size)
+{
+    return scheduler_next_whole_events_r(&default_scheduler, current_time, n, events, size);
+}
+
+int scheduler_fd(const TZTABLE *tz)
+{
+    return scheduler_fd_r(&default_scheduler, tz);
+}
+
+void scheduler_fd_close(void)
+{
+    scheduler_fd_close_r(&default_scheduler);
+}
+
+uint32_t scheduler_process_expired(EVENT *events, uint32_t n)
+{
+    return scheduler_process_expired_r(&default_scheduler, events, n);
 }
 
 
@@ -10,8 +10,71 @@
 
 #include "ical.h"
 #include "queue.h"
+#include "pool.h"
+#include "group_table.h"
+#include "ical_batch.h"
 
+// Default maximum number of schedules in a scheduler. This can be
+// changed at runtime with scheduler_set_capacity
+#ifndef MAX_SCHEDULES
 #define MAX_SCHEDULES 5
+#endif
+
+// Schedule ids are handles made of the index of the schedule in the
+// low SCHEDULER_INDEX_BITS bits and a generation count in the high bits.
+// The generation of an index is incremented when its schedule is
+// removed, so the id of a removed schedule isn't found again once the
+// index is reused. The first schedule added at an index has generation
+// 0, so its id is the same as the index.
+#define SCHEDULER_INDEX_BITS 20
+#define SCHEDULER_MAX_CAPACITY (UINT32_C(1) << SCHEDULER_INDEX_BITS)
+#define SCHEDULER_GENERATION_MASK (UINT32_MAX >> SCHEDULER_INDEX_BITS)
+#define SCHEDULER_ID(index, generation) (((uint32_t)(generation) << SCHEDULER_INDEX_BITS) | (uint32_t)(index))
+#define SCHEDULER_ID_INDEX(id) ((uint32_t)(id) & (SCHEDULER_MAX_CAPACITY - 1))
+#define SCHEDULER_ID_GENERATION(id) ((uint32_t)(id) >> SCHEDULER_INDEX_BITS)
+
+#if MAX_SCHEDULES > SCHEDULER_MAX_CAPACITY
+#error "MAX_SCHEDULES is larger than SCHEDULER_MAX_CAPACITY"
+#endif
+
+// Number of schedules or events in the first chunk allocated,
+// following chunks double in size
+#ifndef SCHEDULER_POOL_CHUNK
+#define SCHEDULER_POOL_CHUNK 8
+#endif
+
+// Define SCHEDULER_USE_WHEEL to keep upcoming events in a hierarchical
+// timing wheel (see wheel.c) rather than a binary heap. Insert, remove
+// and expire are O(1) instead of O(log n), which suits very large
+// schedule sets, but finding the earliest event needs a search.
+#ifdef SCHEDULER_USE_WHEEL
+#include "wheel.h"
+#endif
+
+// Define SCHEDULER_USE_THREADS to allow full updates to be split across
+// a pool of threads with scheduler_set_threads. This needs pthreads.
+// Most threads a scheduler can use:
+#ifndef SCHEDULER_MAX_THREADS
+#define SCHEDULER_MAX_THREADS 64
+#endif
+// Full updates of fewer schedules than this are not split
+#ifndef SCHEDULER_THREAD_MIN_SCHEDULES
+#define SCHEDULER_THREAD_MIN_SCHEDULES 8192
+#endif
+
+// Define SCHEDULER_USE_TIMERFD to get a Linux timerfd from scheduler_fd
+// that is armed for the next event, to wait on with poll or epoll.
+
+// Define SCHEDULER_USE_COMMANDS to let other threads change schedules
+// through a lock-free command queue (see command_queue.c) given to
+// scheduler_set_commands. This needs C11 atomics.
+struct command_queue;
+
+// Define SCHEDULER_USE_SNAPSHOTS to publish the group events of each
+// update as an immutable snapshot (see snapshot.c) that other threads
+// read without locking, with scheduler_set_snapshots. This needs C11
+// atomics.
+struct snapshot_domain;
 
 typedef struct {
     // Defines calendar event and recurrence (see ical.c)
@@ -20,9 +83,9 @@ typedef struct {
     // Schedule Group
     // Schedules are grouped together to determine whether
     // there can be an event at the same time
-    uint8_t group;
+    uint32_t group;
 
-    uint8_t id;
+    uint32_t id;
 }SCHEDULE;
 
 typedef struct {
@@ -31,31 +94,239 @@ typedef struct {
     // Event time
     time_t epoch;
     // Schedule id
-    uint8_t id;
+    uint32_t id;
     // Group
-    uint8_t group;
+    uint32_t group;
 }EVENT;
 
 typedef struct schedule_entry
 {
-    SCHEDULE schedule;
+    // Compiled ICAL of the schedule (see ical_compile). The SCHEDULE
+    // struct is only built when the schedule is looked up
+    ICALRECORD ical;
+
+    // Next event of the schedule, which also holds its id and group.
+    // If the schedule has no event, epoch is the time it needs to be
+    // checked again
+    EVENT next;
+    // Current time the next event was calculated at. The next event
+    // stays valid for current times from here up to next.epoch
+    time_t valid_from;
+    // Set while the schedule is waiting to be calculated
+    bool dirty;
+    // Order the schedule was added in, used to break ties between events
+    uint32_t seq;
+#ifdef SCHEDULER_USE_WHEEL
+    // Node in the event or recheck wheel
+    wheel_node_t queue_node;
+#else
+    // Position in the event or recheck queue
+    uint32_t queue_index;
+#endif
+    // Group the schedule belongs to
+    struct event_entry *group_entry;
+    // Node in the group's pairing heap of schedules with an event,
+    // ordered by event time and then by the order they were added.
+    // prev is the parent of a first child, else the previous sibling
+    struct schedule_entry *group_child;
+    struct schedule_entry *group_next;
+    struct schedule_entry *group_prev;
+    // Set while the schedule is in its group's heap
+    bool grouped;
 
     TAILQ_ENTRY(schedule_entry) schedule_entries;
+    TAILQ_ENTRY(schedule_entry) group_entries;
+    TAILQ_ENTRY(schedule_entry) dirty_entries;
 }schedule_entry_t;
 
 typedef struct event_entry
 {
+    // Earliest event of the schedules in the group
     EVENT event;
 
+    // Schedules in the group
+    TAILQ_HEAD(group_head_s, schedule_entry) schedules;
+    // Root of the heap of the group's schedules with an event, NULL if
+    // none has one
+    struct schedule_entry *earliest;
+
+    // Set while the event is waiting to be recalculated
+    bool stale;
+    struct event_entry *next_stale;
+
     TAILQ_ENTRY(event_entry) event_entries;
 }event_entry_t;
 
+typedef TAILQ_HEAD(schedule_head_s, schedule_entry) schedule_head_t;
+typedef TAILQ_HEAD(event_head_s, event_entry) event_head_t;
+
+#ifdef SCHEDULER_USE_WHEEL
+typedef wheel_t schedule_queue_t;
+#else
+/**
+ * Binary min-heap of schedules, ordered by the epoch of their
+ * next event and then by the order they were added
+ */
+typedef struct {
+    struct schedule_entry **entries;
+    uint32_t count;
+    // Number of allocated entries
+    uint32_t size;
+}schedule_queue_t;
+#endif
+
+#ifdef SCHEDULER_USE_WHEEL
+#define SCHEDULER_QUEUE_ITEM_SIZE 0
+#else
+#define SCHEDULER_QUEUE_ITEM_SIZE (2*sizeof(struct schedule_entry*))
+#endif
+
+/**
+ * Entry in the schedule table, indexed by the low bits of the id
+ */
+typedef struct {
+    // NULL if there is no schedule at this index
+    struct schedule_entry *entry;
+    uint32_t generation;
+    // Next unused index in the free list
+    uint32_t next_free;
+}schedule_slot_t;
+
+// Size of a buffer for scheduler_init_static to hold capacity schedules
+#define SCHEDULER_BUFFER_ITEM_SIZE (POOL_ITEM_SIZE(sizeof(schedule_entry_t)) + POOL_ITEM_SIZE(sizeof(event_entry_t)) + \
+    sizeof(schedule_slot_t) + SCHEDULER_QUEUE_ITEM_SIZE + GROUP_TABLE_BUFFER_SIZE(1) + ICAL_BATCH_ITEM_SIZE)
+#define SCHEDULER_BUFFER_SIZE(capacity) ((capacity)*SCHEDULER_BUFFER_ITEM_SIZE + 4*POOL_ALIGN)
+
+/**
+ * Scheduler instance. Each instance owns its own schedules and
+ * events, so separate instances can be used from separate threads
+ * without locking.
+ */
+typedef struct scheduler
+{
+    schedule_head_t schedule_head;
+    event_head_t event_head;
+    // Events indexed by group
+    group_table_t groups;
+
+    // Schedule table indexed by id
+    schedule_slot_t *slots;
+    // Number of indexes that have been used
+    uint32_t slot_count;
+    // First index of the list of unused indexes below slot_count
+    uint32_t free_slot;
+    // Number of allocated slots
+    uint32_t slot_size;
+    // Maximum number of schedules, and of groups
+    uint32_t capacity;
+
+    // Compiled ICALs indexed like the schedule table, to calculate
+    // every schedule at once
+    ical_batch_t batch;
+
+    // Storage of schedule and event entries
+    pool_t schedule_pool;
+    pool_t event_pool;
+    // Buffer given to scheduler_init_static, NULL if memory is allocated
+    void *buffer;
+    size_t buffer_size;
+
+    // Schedules with an upcoming event
+    schedule_queue_t event_queue;
+    // Schedules without an event that need to be checked again later
+    schedule_queue_t recheck_queue;
+    // Groups waiting for their event to be recalculated
+    struct event_entry *stale_head;
+    // Schedules that were added or edited since the last update
+    schedule_head_t dirty_head;
+
+    // Schedule returned by the last lookup and the entry it was built
+    // from, NULL if there is none
+    SCHEDULE schedule;
+    struct schedule_entry *schedule_entry;
+
+    // Current time of the last update
+    time_t update_time;
+    // Set when every schedule needs to be recalculated
+    bool rebuild;
+
+    uint32_t seq;
+    uint32_t schedule_count;
+    uint32_t event_count;
+#ifdef SCHEDULER_USE_THREADS
+    // Threads for full updates, NULL when updates aren't split
+    struct scheduler_threads *threads;
+#endif
+#ifdef SCHEDULER_USE_TIMERFD
+    // Timer armed for the next event or recheck, -1 if there is none
+    int timer_fd;
+    // Zone of the scheduler's times for the timer, NULL if they are UTC
+    const TZTABLE *timer_tz;
+#endif
+#ifdef SCHEDULER_USE_COMMANDS
+    // Commands applied at the start of each update, NULL if there is none
+    struct command_queue *commands;
+#endif
+#ifdef SCHEDULER_USE_SNAPSHOTS
+    // Domain the group events are published to, NULL if there is none
+    struct snapshot_domain *snapshots;
+    // Set when the group events changed outside of an update
+    bool snapshot_changed;
+#endif
+}scheduler_t;
+
+void scheduler_clear_r(scheduler_t *ctx);
+void scheduler_init_r(scheduler_t *ctx);
+bool scheduler_init_static_r(scheduler_t *ctx, void *buffer, size_t size);
+bool scheduler_set_capacity_r(scheduler_t *ctx, uint32_t capacity);
+bool scheduler_set_threads_r(scheduler_t *ctx, uint32_t count);
+bool scheduler_set_commands_r(scheduler_t *ctx, struct command_queue *q);
+uint32_t scheduler_apply_commands_r(scheduler_t *ctx);
+bool scheduler_set_snapshots_r(scheduler_t *ctx, struct snapshot_domain *d);
+bool scheduler_add_r(scheduler_t *ctx, uint32_t group, ICAL* ical);
+bool scheduler_add_batch_r(scheduler_t *ctx, const ICAL* icals, const uint32_t* groups, size_t n);
+bool scheduler_remove_last_r(scheduler_t *ctx);
+bool scheduler_remove_r(scheduler_t *ctx, uint32_t id);
+bool scheduler_update_r(scheduler_t *ctx, uint32_t id, const ICAL* ical);
+bool scheduler_invalidate_r(scheduler_t *ctx, uint32_t id);
+SCHEDULE* scheduler_get_schedule_by_id_r(scheduler_t *ctx, uint32_t id);
+SCHEDULE* scheduler_get_first_schedule_r(scheduler_t *ctx);
+SCHEDULE* scheduler_get_next_schedule_r(scheduler_t *ctx, SCHEDULE *schedule);
+EVENT* scheduler_get_event_by_group_r(scheduler_t *ctx, uint32_t group);
+EVENT* scheduler_get_next_event_r(scheduler_t *ctx);
+uint32_t scheduler_next_events_r(scheduler_t *ctx, struct tm *current_time, uint32_t n, EVENT *events);
+uint32_t scheduler_next_whole_events_r(scheduler_t *ctx, struct tm *current_time, uint32_t n, EVENT **events, uint32_t *size);
+void scheduler_update_events_r(scheduler_t *ctx, struct tm *current_time);
+int scheduler_fd_r(scheduler_t *ctx, const TZTABLE *tz);
+void scheduler_fd_close_r(scheduler_t *ctx);
+uint32_t scheduler_process_expired_r(scheduler_t *ctx, EVENT *events, uint32_t n);
+
+// Same as above, using a default instance
+scheduler_t* scheduler_get_default(void);
 void scheduler_clear(void);
 void scheduler_init(void);
-bool scheduler_add(uint8_t group, ICAL* ical);
+bool scheduler_init_static(void *buffer, size_t size);
+bool scheduler_set_capacity(uint32_t capacity);
+bool scheduler_set_threads(uint32_t count);
+bool scheduler_set_commands(struct command_queue *q);
+uint32_t scheduler_apply_commands(void);
+bool scheduler_set_snapshots(struct snapshot_domain *d);
+bool scheduler_add(uint32_t group, ICAL* ical);
+bool scheduler_add_batch(const ICAL* icals, const uint32_t* groups, size_t n);
 bool scheduler_remove_last(void);
-SCHEDULE* scheduler_get_schedule_by_id(uint8_t id);
-EVENT* scheduler_get_event_by_group(uint8_t group);
+bool scheduler_remove(uint32_t id);
+bool scheduler_update(uint32_t id, const ICAL* ical);
+bool scheduler_invalidate(uint32_t id);
+SCHEDULE* scheduler_get_schedule_by_id(uint32_t id);
+SCHEDULE* scheduler_get_first_schedule(void);
+SCHEDULE* scheduler_get_next_schedule(SCHEDULE *schedule);
+EVENT* scheduler_get_event_by_group(uint32_t group);
+EVENT* scheduler_get_next_event(void);
+uint32_t scheduler_next_events(struct tm *current_time, uint32_t n, EVENT *events);
+uint32_t scheduler_next_whole_events(struct tm *current_time, uint32_t n, EVENT **events, uint32_t *size);
 void scheduler_update_events(struct tm *current_time);
+int scheduler_fd(const TZTABLE *tz);
+void scheduler_fd_close(void);
+uint32_t scheduler_process_expired(EVENT *events, uint32_t n);
 
 #endif /* SCHEDULER_H_ */
\ No newline at end of file
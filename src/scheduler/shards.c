@@ -0,0 +1,390 @@
+/*
+ * shards.c
+ *
+ * Created: 16/10/2026 6:18:54 PM
+ *
+ *  Splits schedules across count schedulers, the shards, by a hash of
+ *  their group. Each shard has its own schedules, events and queues,
+ *  and an update runs every shard at once on a thread pool, thread i
+ *  updating shard i. The threads can be pinned to a core each, so a
+ *  shard stays in the caches of one core. A group never spans shards,
+ *  so the event of a group is found by its shard alone and is the same
+ *  as with one scheduler. Schedules are numbered in the order added
+ *  across every shard, so events at the same time are merged in that
+ *  order, as one scheduler breaks ties.
+ *
+ *  Ids given by shards_add have the shard in the high bits of the
+ *  schedule index, so calls by id go to the right shard, and a shard
+ *  holds up to SCHEDULER_MAX_CAPACITY/count schedules. Events are
+ *  copied out with those ids.
+ *
+ *      shards_t sh;
+ *      shards_init(&sh, 4, 1 << 18, true);
+ *      shards_add(&sh, group, &ical, &id);
+ *      shards_update_events(&sh, &current_time);
+ *      shards_get_event_by_group(&sh, group, &event);
+ *      shards_destroy(&sh);
+ *
+ *  Like scheduler_t, a shards_t is used from one thread, and the pool
+ *  is only used inside shards_update_events and shards_next_events.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "shards.h"
+
+static uint32_t _shards_index(shards_t *sh, uint32_t group);
+static uint32_t _shards_global_id(shards_t *sh, uint32_t shard, uint32_t id);
+static scheduler_t* _shards_route(shards_t *sh, uint32_t id, uint32_t *local_id);
+static void _shards_event(shards_t *sh, uint32_t shard, const EVENT *e, EVENT *event);
+static bool _shards_earlier(shards_t *sh, uint32_t a_shard, const EVENT *a, uint32_t b_shard, const EVENT *b);
+static void _shards_pin_thread(void *arg, uint32_t index);
+static void _shards_update_thread(void *arg, uint32_t index);
+static void _shards_next_events_thread(void *arg, uint32_t index);
+
+/**
+ *  Initialize count shards of up to capacity schedules each
+ *
+ *  count is a power of 2 up to SHARDS_MAX_COUNT, and capacity is
+ *  limited to SCHEDULER_MAX_CAPACITY/count. If pin is set each thread
+ *  of the pool is pinned to a core, except the calling thread, which
+ *  updates shard 0. Returns false if count isn't valid or the shards
+ *  can't be allocated or started.
+ */
+bool shards_init(shards_t *sh, uint32_t count, uint32_t capacity, bool pin)
+{
+    if (count == 0 || count > SHARDS_MAX_COUNT || (count & (count - 1))){
+        return false;
+    }
+
+    sh->count = count;
+    sh->seq = 0;
+    sh->bits = 0;
+    while ((UINT32_C(1) << sh->bits) < count){
+        sh->bits++;
+    }
+    if (capacity > SCHEDULER_MAX_CAPACITY >> sh->bits){
+        capacity = SCHEDULER_MAX_CAPACITY >> sh->bits;
+    }
+
+    sh->shards = malloc((size_t)count*sizeof(scheduler_t));
+    if (sh->shards == NULL){
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++){
+        scheduler_init_r(&sh->shards[i]);
+        scheduler_set_capacity_r(&sh->shards[i], capacity);
+    }
+    if (!thread_pool_init(&sh->pool, count)){
+        free(sh->shards);
+        sh->shards = NULL;
+        return false;
+    }
+    if (pin){
+        thread_pool_run(&sh->pool, _shards_pin_thread, sh);
+    }
+
+    return true;
+}
+
+/**
+ *  Get the scheduler of the shard a group is in
+ *
+ *  The ids of its schedules and events are local to the shard.
+ */
+scheduler_t* shards_get_shard(shards_t *sh, uint32_t group)
+{
+    return &sh->shards[_shards_index(sh, group)];
+}
+
+/**
+ *  Add a schedule to the shard of its group
+ *
+ *  The id of the schedule is written to id if it isn't NULL. Returns
+ *  false if the shard is full or memory can't be allocated.
+ */
+bool shards_add(shards_t *sh, uint32_t group, ICAL* ical, uint32_t *id)
+{
+    uint32_t shard = _shards_index(sh, group);
+    scheduler_t *ctx = &sh->shards[shard];
+
+    // The shard numbers the schedule from the order of every shard
+    ctx->seq = sh->seq;
+    if (!scheduler_add_r(ctx, group, ical)){
+        return false;
+    }
+    sh->seq = ctx->seq;
+    if (id){
+        // Schedules are appended to the schedule list as they are added
+        struct schedule_entry *s = TAILQ_LAST(&ctx->schedule_head, schedule_head_s);
+        *id = _shards_global_id(sh, shard, s->next.id);
+    }
+
+    return true;
+}
+
+/**
+ *  Remove a schedule by id
+ */
+bool shards_remove(shards_t *sh, uint32_t id)
+{
+    uint32_t local_id;
+    scheduler_t *ctx = _shards_route(sh, id, &local_id);
+
+    return ctx && scheduler_remove_r(ctx, local_id);
+}
+
+/**
+ *  Replace the ICAL of a schedule by id
+ */
+bool shards_update(shards_t *sh, uint32_t id, const ICAL* ical)
+{
+    uint32_t local_id;
+    scheduler_t *ctx = _shards_route(sh, id, &local_id);
+
+    return ctx && scheduler_update_r(ctx, local_id, ical);
+}
+
+/**
+ *  Recalculate a schedule at the next update
+ */
+bool shards_invalidate(shards_t *sh, uint32_t id)
+{
+    uint32_t local_id;
+    scheduler_t *ctx = _shards_route(sh, id, &local_id);
+
+    return ctx && scheduler_invalidate_r(ctx, local_id);
+}
+
+/**
+ *  Update the events of every shard to a current time, in parallel
+ */
+void shards_update_events(shards_t *sh, struct tm *current_time)
+{
+    sh->current_time = current_time;
+    thread_pool_run(&sh->pool, _shards_update_thread, sh);
+}
+
+/**
+ *  Copy the event of a group to event
+ *
+ *  Returns false if the group has no event.
+ */
+bool shards_get_event_by_group(shards_t *sh, uint32_t group, EVENT *event)
+{
+    uint32_t shard = _shards_index(sh, group);
+    EVENT *e = scheduler_get_event_by_group_r(&sh->shards[shard], group);
+
+    if (e == NULL){
+        return false;
+    }
+    _shards_event(sh, shard, e, event);
+
+    return true;
+}
+
+/**
+ *  Copy the earliest event of all shards to event
+ *
+ *  Events at the same time go to the schedule added first. Returns
+ *  false if there are no events.
+ */
+bool shards_get_next_event(shards_t *sh, EVENT *event)
+{
+    EVENT *best = NULL;
+    uint32_t best_shard = 0;
+
+    for (uint32_t i = 0; i < sh->count; i++){
+        EVENT *e = scheduler_get_next_event_r(&sh->shards[i]);
+        if (e && (best == NULL || _shards_earlier(sh, i, e, best_shard, best))){
+            best = e;
+            best_shard = i;
+        }
+    }
+    if (best == NULL){
+        return false;
+    }
+    _shards_event(sh, best_shard, best, event);
+
+    return true;
+}
+
+/**
+ *  Get the next n events of every schedule after the current time
+ *
+ *  Each shard finds its next n events in parallel, and they are merged
+ *  in time order, events at the same time going to the schedule added
+ *  first.
+ *  Needs a temporary allocation of count*n events. Returns the number
+ *  of events written, which is less than n if there are no more or
+ *  memory can't be allocated.
+ */
+uint32_t shards_next_events(shards_t *sh, struct tm *current_time, uint32_t n, EVENT *events)
+{
+    uint32_t heads[SHARDS_MAX_COUNT] = {0};
+    uint32_t count = 0;
+
+    if (n == 0){
+        return 0;
+    }
+    sh->events = malloc((size_t)sh->count*n*sizeof(EVENT));
+    sh->event_counts = malloc(sh->count*sizeof(uint32_t));
+    if (sh->events == NULL || sh->event_counts == NULL){
+        free(sh->events);
+        free(sh->event_counts);
+        return 0;
+    }
+    sh->current_time = current_time;
+    sh->n = n;
+    thread_pool_run(&sh->pool, _shards_next_events_thread, sh);
+
+    while (count < n){
+        const EVENT *best = NULL;
+        uint32_t best_shard = 0;
+        for (uint32_t i = 0; i < sh->count; i++){
+            if (heads[i] < sh->event_counts[i]){
+                const EVENT *e = &sh->events[(size_t)i*n + heads[i]];
+                if (best == NULL || _shards_earlier(sh, i, e, best_shard, best)){
+                    best = e;
+                    best_shard = i;
+                }
+            }
+        }
+        if (best == NULL){
+            break;
+        }
+        _shards_event(sh, best_shard, best, &events[count++]);
+        heads[best_shard]++;
+    }
+
+    free(sh->events);
+    free(sh->event_counts);
+    sh->events = NULL;
+    sh->event_counts = NULL;
+
+    return count;
+}
+
+/**
+ *  Get the number of schedules of all shards
+ */
+uint32_t shards_get_schedule_count(shards_t *sh)
+{
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < sh->count; i++){
+        count += sh->shards[i].schedule_count;
+    }
+
+    return count;
+}
+
+/**
+ *  Stop the threads and free every shard
+ */
+void shards_destroy(shards_t *sh)
+{
+    thread_pool_destroy(&sh->pool);
+    for (uint32_t i = 0; i < sh->count; i++){
+        scheduler_clear_r(&sh->shards[i]);
+    }
+    free(sh->shards);
+    sh->shards = NULL;
+}
+
+/*************** Static Functions *********************/
+
+/**
+ *  Shard of a group, from the high bits of a multiplicative hash so
+ *  consecutive groups are spread out
+ */
+static uint32_t _shards_index(shards_t *sh, uint32_t group)
+{
+    if (sh->bits == 0){
+        return 0;
+    }
+
+    return (uint32_t)(group*UINT32_C(2654435761)) >> (32 - sh->bits);
+}
+
+static uint32_t _shards_global_id(shards_t *sh, uint32_t shard, uint32_t id)
+{
+    return id | shard << (SCHEDULER_INDEX_BITS - sh->bits);
+}
+
+/**
+ *  Get the shard of a global id and the id within it
+ *
+ *  Returns NULL if the shard doesn't exist.
+ */
+static scheduler_t* _shards_route(shards_t *sh, uint32_t id, uint32_t *local_id)
+{
+    uint32_t shift = SCHEDULER_INDEX_BITS - sh->bits;
+    uint32_t shard = SCHEDULER_ID_INDEX(id) >> shift;
+
+    if (shard >= sh->count){
+        return NULL;
+    }
+    *local_id = id & ~(shard << shift);
+
+    return &sh->shards[shard];
+}
+
+/**
+ *  Copy an event of a shard with its global id
+ */
+static void _shards_event(shards_t *sh, uint32_t shard, const EVENT *e, EVENT *event)
+{
+    *event = *e;
+    event->id = _shards_global_id(sh, shard, e->id);
+}
+
+/**
+ *  Whether an event of a shard comes before one of another, by time
+ *  then by the order their schedules were added
+ */
+static bool _shards_earlier(shards_t *sh, uint32_t a_shard, const EVENT *a, uint32_t b_shard, const EVENT *b)
+{
+    if (a->epoch != b->epoch){
+        return a->epoch < b->epoch;
+    }
+
+    return sh->shards[a_shard].slots[SCHEDULER_ID_INDEX(a->id)].entry->seq <
+           sh->shards[b_shard].slots[SCHEDULER_ID_INDEX(b->id)].entry->seq;
+}
+
+static void _shards_pin_thread(void *arg, uint32_t index)
+{
+#ifdef __linux__
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+
+    // The calling thread is left where it is
+    if (index == 0 || cores <= 0){
+        return;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(index % (uint32_t)cores, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+    (void)arg;
+    (void)index;
+}
+
+static void _shards_update_thread(void *arg, uint32_t index)
+{
+    shards_t *sh = arg;
+
+    scheduler_update_events_r(&sh->shards[index], sh->current_time);
+}
+
+static void _shards_next_events_thread(void *arg, uint32_t index)
+{
+    shards_t *sh = arg;
+
+    sh->event_counts[index] = scheduler_next_events_r(&sh->shards[index], sh->current_time, sh->n, &sh->events[(size_t)index*sh->n]);
+}
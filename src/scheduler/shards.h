@@ -0,0 +1,58 @@
+/*
+ * shards.h
+ *
+ * Created: 16/10/2026 6:18:54 PM
+ */
+
+
+#ifndef SHARDS_H_
+#define SHARDS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "scheduler.h"
+#include "thread_pool.h"
+
+// Most shards, a power of 2. Each shard holds up to
+// SCHEDULER_MAX_CAPACITY/count schedules
+#ifndef SHARDS_MAX_COUNT
+#define SHARDS_MAX_COUNT 64
+#endif
+
+/**
+ * Schedules split across schedulers by group, each updated on its own
+ * thread
+ */
+typedef struct shards
+{
+    // Number of shards, a power of 2, and its log2
+    uint32_t count;
+    uint32_t bits;
+    scheduler_t *shards;
+    // Thread i updates shard i, the calling thread is thread 0
+    thread_pool_t pool;
+    // Order of the next schedule added to any shard
+    uint32_t seq;
+
+    // Arguments of the run on the pool
+    struct tm *current_time;
+    uint32_t n;
+    EVENT *events;
+    uint32_t *event_counts;
+}shards_t;
+
+bool shards_init(shards_t *sh, uint32_t count, uint32_t capacity, bool pin);
+scheduler_t* shards_get_shard(shards_t *sh, uint32_t group);
+bool shards_add(shards_t *sh, uint32_t group, ICAL* ical, uint32_t *id);
+bool shards_remove(shards_t *sh, uint32_t id);
+bool shards_update(shards_t *sh, uint32_t id, const ICAL* ical);
+bool shards_invalidate(shards_t *sh, uint32_t id);
+void shards_update_events(shards_t *sh, struct tm *current_time);
+bool shards_get_event_by_group(shards_t *sh, uint32_t group, EVENT *event);
+bool shards_get_next_event(shards_t *sh, EVENT *event);
+uint32_t shards_next_events(shards_t *sh, struct tm *current_time, uint32_t n, EVENT *events);
+uint32_t shards_get_schedule_count(shards_t *sh);
+void shards_destroy(shards_t *sh);
+
+#endif /* SHARDS_H_ */
@@ -0,0 +1,245 @@
+/*
+ * snapshot.c
+ *
+ * Created: 16/10/2026 6:15:10 PM
+ *
+ *  Immutable copies of the group events of a scheduler, for threads
+ *  other than the one updating it. The writer builds a new snapshot
+ *  and swaps it in with one atomic exchange, and readers take the
+ *  current one without locking or waiting. A snapshot that was
+ *  swapped out is freed once no reader can still have it, using
+ *  epoch based reclamation:
+ *
+ *  A reader stores the domain's epoch in its slot before it loads the
+ *  current snapshot, and clears it when done. The writer retires a
+ *  replaced snapshot in the current epoch, and only advances the epoch
+ *  when every reader that is reading has stored the current one. A
+ *  reader can then only hold snapshots retired in the epoch it stored
+ *  or later, so the snapshots retired two epochs back are freed on
+ *  each advance. A reader that stays in a read section holds back
+ *  reclaiming, but never the writer or other readers.
+ *
+ *  With SCHEDULER_USE_SNAPSHOTS, scheduler_set_snapshots makes each
+ *  update that changes a group event publish a snapshot:
+ *
+ *      snapshot_domain_t d;
+ *      snapshot_domain_init(&d);
+ *      scheduler_set_snapshots_r(&ctx, &d);
+ *
+ *      // Reader thread
+ *      snapshot_reader_t *r = snapshot_reader_register(&d);
+ *      const snapshot_t *s = snapshot_read_begin(&d, r);
+ *      const EVENT *event = snapshot_find_group(s, group);
+ *      snapshot_read_end(r);
+ *
+ *  Only one thread may publish and reclaim.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "snapshot.h"
+
+static uint32_t _snapshot_free_list(snapshot_t *s);
+
+/**
+ *  Initialize a domain without a snapshot
+ */
+void snapshot_domain_init(snapshot_domain_t *d)
+{
+    atomic_init(&d->current, NULL);
+    atomic_init(&d->epoch, 1);
+    for (uint32_t i = 0; i < SNAPSHOT_MAX_READERS; i++){
+        atomic_init(&d->readers[i].epoch, 0);
+        atomic_init(&d->readers[i].used, false);
+    }
+    for (uint32_t i = 0; i < 3; i++){
+        d->retired[i] = NULL;
+    }
+    d->retired_count = 0;
+    d->version = 0;
+}
+
+/**
+ *  Allocate a snapshot with room for count events
+ *
+ *  The writer fills in the events, count and next before publishing.
+ *  Returns NULL if memory can't be allocated.
+ */
+snapshot_t* snapshot_alloc(uint32_t count)
+{
+    snapshot_t *s = malloc(sizeof(snapshot_t) + (size_t)count*sizeof(EVENT));
+
+    if (s){
+        s->version = 0;
+        s->update_time = 0;
+        s->count = 0;
+        s->next = 0;
+        s->retired_next = NULL;
+    }
+
+    return s;
+}
+
+/**
+ *  Make s the current snapshot
+ *
+ *  s is given the next version and must not be changed afterwards. The
+ *  snapshot it replaces is retired, and the ones no reader can have
+ *  any more are freed.
+ */
+void snapshot_publish(snapshot_domain_t *d, snapshot_t *s)
+{
+    s->version = ++d->version;
+    snapshot_t *old = atomic_exchange(&d->current, s);
+
+    if (old){
+        uint64_t epoch = atomic_load(&d->epoch);
+        old->retired_next = d->retired[epoch % 3];
+        d->retired[epoch % 3] = old;
+        d->retired_count++;
+    }
+    snapshot_reclaim(d);
+}
+
+/**
+ *  Advance the epoch if every reader has seen it, and free the
+ *  snapshots retired two epochs before
+ *
+ *  Returns the number of snapshots freed.
+ */
+uint32_t snapshot_reclaim(snapshot_domain_t *d)
+{
+    uint64_t epoch = atomic_load(&d->epoch);
+
+    for (uint32_t i = 0; i < SNAPSHOT_MAX_READERS; i++){
+        if (!atomic_load(&d->readers[i].used)){
+            continue;
+        }
+        uint64_t reader_epoch = atomic_load(&d->readers[i].epoch);
+        if (reader_epoch != 0 && reader_epoch != epoch){
+            return 0;
+        }
+    }
+
+    atomic_store(&d->epoch, epoch + 1);
+    uint32_t count = _snapshot_free_list(d->retired[(epoch + 1) % 3]);
+    d->retired[(epoch + 1) % 3] = NULL;
+    d->retired_count -= count;
+
+    return count;
+}
+
+/**
+ *  Free every snapshot of a domain
+ *
+ *  No reader may be reading.
+ */
+void snapshot_domain_destroy(snapshot_domain_t *d)
+{
+    for (uint32_t i = 0; i < 3; i++){
+        _snapshot_free_list(d->retired[i]);
+        d->retired[i] = NULL;
+    }
+    free(atomic_exchange(&d->current, NULL));
+    d->retired_count = 0;
+}
+
+/**
+ *  Take a reader slot for the calling thread
+ *
+ *  Returns NULL if SNAPSHOT_MAX_READERS slots are taken.
+ */
+snapshot_reader_t* snapshot_reader_register(snapshot_domain_t *d)
+{
+    for (uint32_t i = 0; i < SNAPSHOT_MAX_READERS; i++){
+        bool used = false;
+        if (atomic_compare_exchange_strong(&d->readers[i].used, &used, true)){
+            return &d->readers[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ *  Give a reader slot back, outside a read section
+ */
+void snapshot_reader_unregister(snapshot_reader_t *r)
+{
+    atomic_store(&r->epoch, 0);
+    atomic_store(&r->used, false);
+}
+
+/**
+ *  Start reading and get the current snapshot
+ *
+ *  The snapshot stays valid until snapshot_read_end. Returns NULL if
+ *  none has been published.
+ */
+const snapshot_t* snapshot_read_begin(snapshot_domain_t *d, snapshot_reader_t *r)
+{
+    atomic_store(&r->epoch, atomic_load(&d->epoch));
+
+    return atomic_load(&d->current);
+}
+
+/**
+ *  Stop reading, the snapshot may be freed after this
+ */
+void snapshot_read_end(snapshot_reader_t *r)
+{
+    atomic_store_explicit(&r->epoch, 0, memory_order_release);
+}
+
+/**
+ *  Find the event of a group in a snapshot
+ *
+ *  Returns NULL if the group has no event.
+ */
+const EVENT* snapshot_find_group(const snapshot_t *s, uint32_t group)
+{
+    uint32_t low = 0;
+    uint32_t high;
+
+    if (s == NULL){
+        return NULL;
+    }
+
+    high = s->count;
+    while (low < high){
+        uint32_t mid = low + (high - low)/2;
+        if (s->events[mid].group < group){
+            low = mid + 1;
+        }else{
+            high = mid;
+        }
+    }
+
+    return low < s->count && s->events[low].group == group ? &s->events[low] : NULL;
+}
+
+/**
+ *  Get the earliest event of a snapshot, NULL if there is none
+ */
+const EVENT* snapshot_next_event(const snapshot_t *s)
+{
+    return s && s->next < s->count ? &s->events[s->next] : NULL;
+}
+
+/*************** Static Functions *********************/
+
+static uint32_t _snapshot_free_list(snapshot_t *s)
+{
+    uint32_t count = 0;
+
+    while (s){
+        snapshot_t *next = s->retired_next;
+        free(s);
+        s = next;
+        count++;
+    }
+
+    return count;
+}
@@ -0,0 +1,84 @@
+/*
+ * snapshot.h
+ *
+ * Created: 16/10/2026 6:15:10 PM
+ */
+
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "scheduler.h"
+
+// Most reader threads registered with a domain at once
+#ifndef SNAPSHOT_MAX_READERS
+#define SNAPSHOT_MAX_READERS 64
+#endif
+
+// Size of a cache line, to keep the readers' slots apart
+#ifndef SNAPSHOT_LINE_SIZE
+#define SNAPSHOT_LINE_SIZE 64
+#endif
+
+/**
+ * Group events as of an update. Never changed once published
+ */
+typedef struct snapshot
+{
+    // Counts the snapshots published to the domain, from 1
+    uint64_t version;
+    // Current time of the update
+    time_t update_time;
+    // Events sorted by group, a group without an event isn't included
+    uint32_t count;
+    // Index of the earliest event, count if there is none
+    uint32_t next;
+    // Next snapshot replaced in the same epoch
+    struct snapshot *retired_next;
+    EVENT events[];
+}snapshot_t;
+
+/**
+ * Slot of a reader thread. epoch is the domain's epoch when the reader
+ * started reading, 0 when it isn't reading
+ */
+typedef struct {
+    _Alignas(SNAPSHOT_LINE_SIZE) _Atomic uint64_t epoch;
+    atomic_bool used;
+}snapshot_reader_t;
+
+/**
+ * Current snapshot, published by one writer thread and read by any
+ * number of reader threads
+ */
+typedef struct snapshot_domain
+{
+    _Atomic(snapshot_t*) current;
+    // Advanced when every reader has seen the current epoch, from 1
+    _Atomic uint64_t epoch;
+    snapshot_reader_t readers[SNAPSHOT_MAX_READERS];
+
+    // Snapshots replaced in each of the last three epochs, and the
+    // number of them. Only used by the writer.
+    snapshot_t *retired[3];
+    uint32_t retired_count;
+    uint64_t version;
+}snapshot_domain_t;
+
+void snapshot_domain_init(snapshot_domain_t *d);
+snapshot_t* snapshot_alloc(uint32_t count);
+void snapshot_publish(snapshot_domain_t *d, snapshot_t *s);
+uint32_t snapshot_reclaim(snapshot_domain_t *d);
+void snapshot_domain_destroy(snapshot_domain_t *d);
+snapshot_reader_t* snapshot_reader_register(snapshot_domain_t *d);
+void snapshot_reader_unregister(snapshot_reader_t *r);
+const snapshot_t* snapshot_read_begin(snapshot_domain_t *d, snapshot_reader_t *r);
+void snapshot_read_end(snapshot_reader_t *r);
+const EVENT* snapshot_find_group(const snapshot_t *s, uint32_t group);
+const EVENT* snapshot_next_event(const snapshot_t *s);
+
+#endif /* SNAPSHOT_H_ */
@@ -0,0 +1,153 @@
+/*
+ * thread_pool.c
+ *
+ * Created: 16/10/2026 5:35:12 PM
+ *
+ *  Fixed set of threads that run the same function together. The
+ *  calling thread takes part as thread 0, so a pool of 1 starts no
+ *  threads. thread_pool_run returns once every thread is done, so the
+ *  work of a run can be split by thread index without more locking.
+ *
+ *      thread_pool_t p;
+ *      thread_pool_init(&p, 4);
+ *      thread_pool_run(&p, fn, arg);   // fn(arg, 0) to fn(arg, 3)
+ *      thread_pool_destroy(&p);
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "thread_pool.h"
+
+static void* _thread_pool_main(void *arg);
+static void _thread_pool_stop(thread_pool_t *p, uint32_t started);
+
+/**
+ *  Start a pool of count threads, counting the calling thread
+ *
+ *  Returns false if count is 0 or the threads can't be started.
+ */
+bool thread_pool_init(thread_pool_t *p, uint32_t count)
+{
+    if (count == 0){
+        return false;
+    }
+
+    p->count = count;
+    p->workers = NULL;
+    p->fn = NULL;
+    p->arg = NULL;
+    p->generation = 0;
+    p->running = 0;
+    p->stop = false;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->done, NULL);
+
+    if (count > 1){
+        p->workers = malloc((count - 1)*sizeof(thread_pool_worker_t));
+        if (p->workers == NULL){
+            _thread_pool_stop(p, 0);
+            return false;
+        }
+        for (uint32_t i = 0; i < count - 1; i++){
+            p->workers[i].pool = p;
+            p->workers[i].index = i + 1;
+            if (pthread_create(&p->workers[i].thread, NULL, _thread_pool_main, &p->workers[i]) != 0){
+                _thread_pool_stop(p, i);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ *  Run fn on every thread of the pool and wait for all of them
+ */
+void thread_pool_run(thread_pool_t *p, thread_pool_fn fn, void *arg)
+{
+    if (p->count == 1){
+        fn(arg, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->fn = fn;
+    p->arg = arg;
+    p->running = p->count - 1;
+    p->generation++;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    fn(arg, 0);
+
+    pthread_mutex_lock(&p->lock);
+    while (p->running){
+        pthread_cond_wait(&p->done, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+/**
+ *  Stop the threads of a pool and free it
+ */
+void thread_pool_destroy(thread_pool_t *p)
+{
+    _thread_pool_stop(p, p->count - 1);
+}
+
+/*************** Static Functions *********************/
+
+static void* _thread_pool_main(void *arg)
+{
+    thread_pool_worker_t *w = arg;
+    thread_pool_t *p = w->pool;
+    uint32_t generation = 0;
+
+    pthread_mutex_lock(&p->lock);
+    while (true){
+        while (p->generation == generation && !p->stop){
+            pthread_cond_wait(&p->start, &p->lock);
+        }
+        if (p->stop){
+            break;
+        }
+        generation = p->generation;
+        thread_pool_fn fn = p->fn;
+        void *fn_arg = p->arg;
+        pthread_mutex_unlock(&p->lock);
+
+        fn(fn_arg, w->index);
+
+        pthread_mutex_lock(&p->lock);
+        if (--p->running == 0){
+            pthread_cond_signal(&p->done);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+/**
+ *  Stop the first started workers and free the pool
+ */
+static void _thread_pool_stop(thread_pool_t *p, uint32_t started)
+{
+    pthread_mutex_lock(&p->lock);
+    p->stop = true;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    for (uint32_t i = 0; i < started; i++){
+        pthread_join(p->workers[i].thread, NULL);
+    }
+    free(p->workers);
+    p->workers = NULL;
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->start);
+    pthread_mutex_destroy(&p->lock);
+}
@@ -0,0 +1,56 @@
+/*
+ * thread_pool.h
+ *
+ * Created: 16/10/2026 5:35:12 PM
+ */
+
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Function run by every thread of a pool, index is 0 for the
+// calling thread
+typedef void (*thread_pool_fn)(void *arg, uint32_t index);
+
+struct thread_pool;
+
+/**
+ * Thread of a pool other than the calling thread
+ */
+typedef struct {
+    struct thread_pool *pool;
+    uint32_t index;
+    pthread_t thread;
+}thread_pool_worker_t;
+
+/**
+ * Fixed set of threads that run the same function together
+ */
+typedef struct thread_pool
+{
+    // Number of threads, counting the calling thread
+    uint32_t count;
+    thread_pool_worker_t *workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+
+    // Current run, generation counts the runs started
+    thread_pool_fn fn;
+    void *arg;
+    uint32_t generation;
+    // Workers that haven't finished the current run
+    uint32_t running;
+    bool stop;
+}thread_pool_t;
+
+bool thread_pool_init(thread_pool_t *p, uint32_t count);
+void thread_pool_run(thread_pool_t *p, thread_pool_fn fn, void *arg);
+void thread_pool_destroy(thread_pool_t *p);
+
+#endif /* THREAD_POOL_H_ */
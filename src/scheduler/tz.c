@@ -0,0 +1,554 @@
+/*
+ * tz.c
+ *
+ * Created: 16/10/2026 4:25:03 PM
+ *
+ *  This module loads timezone information from compiled TZif
+ *  files (https://tools.ietf.org/html/rfc8536), such as the ones
+ *  found in /usr/share/zoneinfo, into a TZTABLE. A table only holds
+ *  the UTC time of each change in offset and the offset itself, so
+ *  converting between UTC and local time is a binary search with no
+ *  dependency on the TZ environment or the libc timezone lock.
+ *
+ *  Newer "slim" TZif files stop listing transitions once a zone
+ *  settles into a repeating rule and describe the rule in a POSIX
+ *  TZ string at the end of the file instead (eg. EST5EDT,M3.2.0,M11.1.0).
+ *  These rules are expanded into the table up to TZ_LAST_YEAR when
+ *  the file is loaded.
+ *
+ *  Tables are loaded once and can then be shared by any number
+ *  of ICAL structs:
+ *
+ *      TZTABLE tz;
+ *      tz_load(&tz, "Australia/Brisbane");
+ *      ical.tz = &tz;
+ */ 
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tz.h"
+#include "civil.h"
+
+#define TZIF_HEADER_SIZE 44
+#define TZIF_MAX_FILE_SIZE 0x40000
+#define TZ_DEFAULT_RULE_TIME 7200
+
+typedef struct {
+    uint32_t isutcnt;
+    uint32_t isstdcnt;
+    uint32_t leapcnt;
+    uint32_t timecnt;
+    uint32_t typecnt;
+    uint32_t charcnt;
+}_tzif_header_t;
+
+typedef struct {
+    // 'M' for Mm.w.d, 'J' for Jn or 'N' for n
+    char type;
+    int32_t mon;
+    int32_t week;
+    int32_t wday;
+    int32_t day;
+    // Local time of day the rule applies, in seconds
+    int32_t time;
+}_tz_rule_t;
+
+typedef struct {
+    int32_t std_offset;
+    int32_t dst_offset;
+    bool has_dst;
+    _tz_rule_t start;
+    _tz_rule_t end;
+}_tz_posix_t;
+
+static bool _tz_parse(TZTABLE *tz, const uint8_t *buf, size_t len);
+static bool _tz_read_header(const uint8_t *buf, size_t len, _tzif_header_t *h);
+static size_t _tz_data_size(const _tzif_header_t *h, size_t time_size);
+static bool _tz_append(TZTABLE *tz, int64_t utc, int32_t offset);
+static bool _tz_parse_posix(const char *s, _tz_posix_t *posix);
+static bool _tz_parse_name(const char **s);
+static bool _tz_parse_time(const char **s, int32_t *secs);
+static bool _tz_parse_rule(const char **s, _tz_rule_t *rule);
+static bool _tz_parse_number(const char **s, int32_t *n);
+static int64_t _tz_rule_to_local(const _tz_rule_t *rule, int32_t year);
+static uint32_t _tz_be32(const uint8_t *p);
+static int64_t _tz_be64(const uint8_t *p);
+
+/**
+ * \brief Load a zone by name from TZ_DIR
+ *
+ *  eg. tz_load(&tz, "Europe/Berlin")
+ */
+bool tz_load(TZTABLE *tz, const char *name)
+{
+    char path[256];
+
+    if(name == NULL || strstr(name, "..") != NULL){
+        return false;
+    }
+    if((size_t)snprintf(path, sizeof(path), "%s/%s", TZ_DIR, name) >= sizeof(path)){
+        return false;
+    }
+
+    return tz_load_file(tz, path);
+}
+
+/**
+ * \brief Load a zone from a TZif file
+ *
+ *  Returns false if the file cannot be read or is malformed, in
+ *  which case tz is left empty.
+ */
+bool tz_load_file(TZTABLE *tz, const char *path)
+{
+    bool ok = false;
+    long len;
+    uint8_t *buf = NULL;
+    FILE *f = fopen(path, "rb");
+
+    tz->count = 0;
+    tz->utc = NULL;
+    tz->offset = NULL;
+
+    if(f == NULL){
+        return false;
+    }
+
+    if(fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0 && len <= TZIF_MAX_FILE_SIZE){
+        buf = malloc((size_t)len);
+        rewind(f);
+        if(buf != NULL && fread(buf, 1, (size_t)len, f) == (size_t)len){
+            ok = _tz_parse(tz, buf, (size_t)len);
+        }
+    }
+
+    free(buf);
+    fclose(f);
+
+    if(!ok){
+        tz_free(tz);
+    }
+
+    return ok;
+}
+
+/**
+ * \brief Free the memory held by a table
+ *   
+ */
+void tz_free(TZTABLE *tz)
+{
+    // utc and offset share one allocation
+    free(tz->utc);
+    tz->utc = NULL;
+    tz->offset = NULL;
+    tz->count = 0;
+}
+
+/**
+ * \brief Get the UTC offset in seconds at a UTC time
+ *   
+ */
+int32_t tz_get_utc_offset(const TZTABLE *tz, time_t utc)
+{
+    uint32_t lo = 0, hi = tz->count;
+
+    // Find the number of transitions at or before utc
+    while(lo < hi){
+        uint32_t mid = lo + (hi - lo)/2;
+        if(tz->utc[mid] <= (int64_t)utc){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+
+    return tz->offset[lo];
+}
+
+/**
+ * \brief Convert a UTC time to local civil time
+ *   
+ */
+time_t tz_utc_to_local(const TZTABLE *tz, time_t utc)
+{
+    return utc + tz_get_utc_offset(tz, utc);
+}
+
+/**
+ * \brief Convert local civil time to a UTC time
+ *
+ *  Local times that happen twice when clocks go back resolve to the
+ *  first occurrence. Local times skipped when clocks go forward are
+ *  treated as if the clocks had not changed yet, ie. 02:30 becomes
+ *  03:30 on a night where 02:00 jumps to 03:00.
+ */
+time_t tz_local_to_utc(const TZTABLE *tz, time_t local)
+{
+    uint32_t lo = 0, hi = tz->count;
+
+    // Find the number of transitions that have happened by local,
+    // using the local time on the clock just before each transition
+    while(lo < hi){
+        uint32_t mid = lo + (hi - lo)/2;
+        if(tz->utc[mid] + tz->offset[mid] <= (int64_t)local){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+
+    if(lo == 0){
+        return local - tz->offset[0];
+    }
+
+    int32_t before = tz->offset[lo-1];
+    int32_t after = tz->offset[lo];
+
+    // Check if local falls in the gap left by clocks going forward
+    if(after > before && (int64_t)local < tz->utc[lo-1] + after){
+        return local - before;
+    }
+
+    return local - after;
+}
+
+/*************** Static Functions *********************/
+
+/**
+ * \brief Build a table from the contents of a TZif file
+ *   
+ */
+static bool _tz_parse(TZTABLE *tz, const uint8_t *buf, size_t len)
+{
+    _tzif_header_t h;
+    size_t time_size = 4;
+    _tz_posix_t posix;
+    bool has_posix = false;
+
+    if(!_tz_read_header(buf, len, &h)){
+        return false;
+    }
+
+    // Version 2+ files repeat the data with 64-bit times after the
+    // version 1 data, followed by a footer with a POSIX TZ string
+    if(buf[4] >= '2'){
+        size_t skip = TZIF_HEADER_SIZE + _tz_data_size(&h, 4);
+        if(skip > len || !_tz_read_header(buf + skip, len - skip, &h)){
+            return false;
+        }
+        buf += skip;
+        len -= skip;
+        time_size = 8;
+    }
+
+    size_t data_size = _tz_data_size(&h, time_size);
+    if(h.typecnt == 0 || TZIF_HEADER_SIZE + data_size > len){
+        return false;
+    }
+
+    const uint8_t *times = buf + TZIF_HEADER_SIZE;
+    const uint8_t *types = times + h.timecnt*time_size;
+    const uint8_t *ttinfo = types + h.timecnt;
+
+    // Footer is enclosed in newlines
+    if(time_size == 8){
+        const char *footer = (const char *)buf + TZIF_HEADER_SIZE + data_size;
+        const char *footer_end = (const char *)buf + len;
+        char rule[64];
+        if(footer < footer_end && *footer == '\n'){
+            const char *nl = memchr(footer + 1, '\n', (size_t)(footer_end - footer - 1));
+            size_t rule_len = nl ? (size_t)(nl - footer - 1) : 0;
+            if(rule_len && rule_len < sizeof(rule)){
+                memcpy(rule, footer + 1, rule_len);
+                rule[rule_len] = '\0';
+                has_posix = _tz_parse_posix(rule, &posix);
+            }
+        }
+    }
+
+    // Work out the largest table that could be needed
+    int32_t first_year = 1970;
+    size_t max_count = h.timecnt;
+    if(h.timecnt){
+        int64_t last = time_size == 8 ? _tz_be64(times + (h.timecnt-1)*8)
+                                      : (int32_t)_tz_be32(times + (h.timecnt-1)*4);
+        int32_t mon, mday;
+        civil_date_from_days(civil_days_from_time((time_t)last), &first_year, &mon, &mday);
+    }
+    if(has_posix && posix.has_dst && first_year <= TZ_LAST_YEAR){
+        max_count += 2*(size_t)(TZ_LAST_YEAR - first_year + 1);
+    }
+
+    // Transition times and offsets share one allocation
+    tz->count = 0;
+    tz->utc = malloc(max_count*sizeof(int64_t) + (max_count+1)*sizeof(int32_t));
+    if(tz->utc == NULL){
+        return false;
+    }
+    tz->offset = (int32_t *)(tz->utc + max_count);
+    tz->offset[0] = (int32_t)_tz_be32(ttinfo);
+
+    for(uint32_t i = 0; i < h.timecnt; i++){
+        int64_t t = time_size == 8 ? _tz_be64(times + i*8) : (int32_t)_tz_be32(times + i*4);
+        if(types[i] >= h.typecnt){
+            return false;
+        }
+        _tz_append(tz, t, (int32_t)_tz_be32(ttinfo + types[i]*6));
+    }
+
+    // Expand the footer rule past the last listed transition
+    if(has_posix && posix.has_dst){
+        for(int32_t year = first_year; year <= TZ_LAST_YEAR; year++){
+            int64_t to_dst = _tz_rule_to_local(&posix.start, year) - posix.std_offset;
+            int64_t to_std = _tz_rule_to_local(&posix.end, year) - posix.dst_offset;
+            if(to_dst < to_std){
+                _tz_append(tz, to_dst, posix.dst_offset);
+                _tz_append(tz, to_std, posix.std_offset);
+            }else{
+                _tz_append(tz, to_std, posix.std_offset);
+                _tz_append(tz, to_dst, posix.dst_offset);
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * \brief Append a transition, dropping it if it doesn't change the offset
+ *   
+ *  Transitions at or before the last one in the table are ignored.
+ */
+static bool _tz_append(TZTABLE *tz, int64_t utc, int32_t offset)
+{
+    if(tz->count && utc <= tz->utc[tz->count-1]){
+        return false;
+    }
+    if(offset == tz->offset[tz->count]){
+        return false;
+    }
+
+    tz->utc[tz->count] = utc;
+    tz->offset[tz->count+1] = offset;
+    tz->count++;
+
+    return true;
+}
+
+static bool _tz_read_header(const uint8_t *buf, size_t len, _tzif_header_t *h)
+{
+    if(len < TZIF_HEADER_SIZE || memcmp(buf, "TZif", 4) != 0){
+        return false;
+    }
+
+    h->isutcnt = _tz_be32(buf + 20);
+    h->isstdcnt = _tz_be32(buf + 24);
+    h->leapcnt = _tz_be32(buf + 28);
+    h->timecnt = _tz_be32(buf + 32);
+    h->typecnt = _tz_be32(buf + 36);
+    h->charcnt = _tz_be32(buf + 40);
+
+    // Limit counts so the data size can't overflow
+    return h->timecnt < 0x100000 && h->typecnt <= 256 && h->leapcnt < 0x100000 &&
+           h->charcnt < 0x100000 && h->isstdcnt <= 256 && h->isutcnt <= 256;
+}
+
+static size_t _tz_data_size(const _tzif_header_t *h, size_t time_size)
+{
+    return h->timecnt*time_size + h->timecnt + h->typecnt*6 + h->charcnt +
+           h->leapcnt*(time_size + 4) + h->isstdcnt + h->isutcnt;
+}
+
+/**
+ * \brief Parse a POSIX TZ string, eg. AEST-10AEDT,M10.1.0,M4.1.0/3
+ *
+ *  Offsets are stored as seconds east of UTC, which is the opposite
+ *  sign to the TZ string.
+ */
+static bool _tz_parse_posix(const char *s, _tz_posix_t *posix)
+{
+    int32_t offset;
+
+    if(!_tz_parse_name(&s) || !_tz_parse_time(&s, &offset)){
+        return false;
+    }
+    posix->std_offset = -offset;
+    posix->dst_offset = posix->std_offset;
+    posix->has_dst = false;
+
+    if(*s == '\0'){
+        return true;
+    }
+
+    if(!_tz_parse_name(&s)){
+        return false;
+    }
+    posix->has_dst = true;
+    posix->dst_offset = posix->std_offset + 3600;
+
+    if(*s != ',' && *s != '\0'){
+        if(!_tz_parse_time(&s, &offset)){
+            return false;
+        }
+        posix->dst_offset = -offset;
+    }
+
+    // Rules are required to be able to expand DST transitions
+    if(*s++ != ',' || !_tz_parse_rule(&s, &posix->start) ||
+       *s++ != ',' || !_tz_parse_rule(&s, &posix->end)){
+        return false;
+    }
+
+    return *s == '\0';
+}
+
+static bool _tz_parse_name(const char **s)
+{
+    const char *p = *s;
+
+    if(*p == '<'){
+        while(*p && *p != '>'){
+            p++;
+        }
+        if(*p++ != '>'){
+            return false;
+        }
+    }else{
+        while((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z')){
+            p++;
+        }
+        if(p - *s < 3){
+            return false;
+        }
+    }
+
+    *s = p;
+    return true;
+}
+
+/**
+ * \brief Parse [+-]hh[:mm[:ss]] into seconds
+ *   
+ */
+static bool _tz_parse_time(const char **s, int32_t *secs)
+{
+    int32_t sign = 1, hh, mm = 0, ss = 0;
+
+    if(**s == '+' || **s == '-'){
+        sign = (**s == '-') ? -1 : 1;
+        (*s)++;
+    }
+    if(!_tz_parse_number(s, &hh)){
+        return false;
+    }
+    if(**s == ':'){
+        (*s)++;
+        if(!_tz_parse_number(s, &mm)){
+            return false;
+        }
+        if(**s == ':'){
+            (*s)++;
+            if(!_tz_parse_number(s, &ss)){
+                return false;
+            }
+        }
+    }
+
+    *secs = sign*(hh*3600 + mm*60 + ss);
+    return true;
+}
+
+/**
+ * \brief Parse a rule date, Mm.w.d, Jn or n, with an optional /time
+ *   
+ */
+static bool _tz_parse_rule(const char **s, _tz_rule_t *rule)
+{
+    bool ok;
+
+    if(**s == 'M'){
+        (*s)++;
+        rule->type = 'M';
+        ok = _tz_parse_number(s, &rule->mon) && *(*s)++ == '.' &&
+             _tz_parse_number(s, &rule->week) && *(*s)++ == '.' &&
+             _tz_parse_number(s, &rule->wday) &&
+             rule->mon >= 1 && rule->mon <= 12 &&
+             rule->week >= 1 && rule->week <= 5 && rule->wday <= 6;
+    }else if(**s == 'J'){
+        (*s)++;
+        rule->type = 'J';
+        ok = _tz_parse_number(s, &rule->day) && rule->day >= 1 && rule->day <= 365;
+    }else{
+        rule->type = 'N';
+        ok = _tz_parse_number(s, &rule->day) && rule->day <= 365;
+    }
+
+    rule->time = TZ_DEFAULT_RULE_TIME;
+    if(ok && **s == '/'){
+        (*s)++;
+        ok = _tz_parse_time(s, &rule->time);
+    }
+
+    return ok;
+}
+
+static bool _tz_parse_number(const char **s, int32_t *n)
+{
+    const char *p = *s;
+
+    *n = 0;
+    while(*p >= '0' && *p <= '9' && p - *s < 4){
+        *n = *n*10 + (*p - '0');
+        p++;
+    }
+    if(p == *s){
+        return false;
+    }
+
+    *s = p;
+    return true;
+}
+
+/**
+ * \brief Get the local civil time a rule applies in a given year
+ *   
+ */
+static int64_t _tz_rule_to_local(const _tz_rule_t *rule, int32_t year)
+{
+    int32_t jan1 = civil_days_from_date(year, 1, 1);
+    int32_t day;
+
+    if(rule->type == 'M'){
+        int32_t first = civil_days_from_date(year, rule->mon, 1);
+        int32_t next = rule->mon == 12 ? civil_days_from_date(year+1, 1, 1)
+                                       : civil_days_from_date(year, rule->mon+1, 1);
+        day = first + (rule->wday - civil_weekday(first) + 7) % 7 + (rule->week-1)*7;
+        // Week 5 means the last matching weekday of the month
+        while(day >= next){
+            day -= 7;
+        }
+    }else if(rule->type == 'J'){
+        // Jn never counts February 29
+        bool leap = civil_days_from_date(year, 3, 1) - civil_days_from_date(year, 2, 28) == 2;
+        day = jan1 + rule->day - 1 + (leap && rule->day >= 60);
+    }else{
+        day = jan1 + rule->day;
+    }
+
+    return (int64_t)day*CIVIL_ONE_DAY + rule->time;
+}
+
+static uint32_t _tz_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static int64_t _tz_be64(const uint8_t *p)
+{
+    return (int64_t)(((uint64_t)_tz_be32(p) << 32) | _tz_be32(p + 4));
+}
@@ -0,0 +1,46 @@
+/*
+ * tz.h
+ *
+ * Created: 16/10/2026 4:25:03 PM
+ */ 
+
+
+#ifndef TZ_H_
+#define TZ_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+// Directory that zone names are looked up in
+#ifndef TZ_DIR
+#define TZ_DIR "/usr/share/zoneinfo"
+#endif
+
+// Rules from the TZif footer are expanded into transitions up to
+// the end of this year
+#ifndef TZ_LAST_YEAR
+#define TZ_LAST_YEAR 2037
+#endif
+
+/**
+ * Compact transition table for a single timezone.
+ *
+ * utc[i] is the time of the i'th transition in seconds since epoch.
+ * offset[0] is the UTC offset before the first transition and
+ * offset[i+1] is the UTC offset from transition i onwards.
+ */
+typedef struct {
+    uint32_t count;
+    int64_t *utc;
+    int32_t *offset;
+}TZTABLE;
+
+bool tz_load(TZTABLE *tz, const char *name);
+bool tz_load_file(TZTABLE *tz, const char *path);
+void tz_free(TZTABLE *tz);
+int32_t tz_get_utc_offset(const TZTABLE *tz, time_t utc);
+time_t tz_utc_to_local(const TZTABLE *tz, time_t utc);
+time_t tz_local_to_utc(const TZTABLE *tz, time_t local);
+
+#endif /* TZ_H_ */
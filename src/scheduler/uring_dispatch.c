@@ -0,0 +1,296 @@
+/*
+ * uring_dispatch.c
+ *
+ * Created: 16/10/2026 6:01:39 PM
+ *
+ *  Fires the events of a scheduler from the host's io_uring, instead
+ *  of a dispatcher thread or polling scheduler_update_events. The next
+ *  URING_DISPATCH_BATCH events are fetched with
+ *  scheduler_next_whole_events, which never splits the events of one
+ *  time, and submitted as IORING_OP_TIMEOUT entries on absolute
+ *  CLOCK_REALTIME times, one entry for the events due at the same time.
+ *  The host reaps the expiries with its other completions and passes
+ *  them to uring_dispatch_complete, which calls the callback for each
+ *  event that fired. When the last timeout of the batch expires the
+ *  next batch is fetched and submitted.
+ *
+ *  The ring isn't owned here. Entries are written to the host's
+ *  submission queue through get_sqe, and submitting them is left to the
+ *  host. The user_data of every entry has tag in its high 32 bits, so
+ *  the host can tell which completions belong to the dispatcher.
+ *
+ *      struct io_uring_sqe* get_sqe(void *ring)
+ *      {
+ *          return io_uring_get_sqe(ring);
+ *      }
+ *
+ *      uring_dispatch_init(&d, &ctx, NULL, 1, fn, arg);
+ *      uring_dispatch_submit(&d, get_sqe, &ring);
+ *      io_uring_submit(&ring);
+ *
+ *      io_uring_wait_cqe(&ring, &cqe);
+ *      if (!uring_dispatch_complete(&d, cqe, get_sqe, &ring)){
+ *          // Host's own completion
+ *      }
+ *      io_uring_cqe_seen(&ring, cqe);
+ *
+ *      uring_dispatch_destroy(&d);
+ *
+ *  After a schedule is changed, uring_dispatch_invalidate removes the
+ *  submitted timeouts and submits the events of the scheduler again.
+ *
+ *  Scheduler times are taken as UTC, or as local times of tz if one is
+ *  given, which is the zone floating schedules are meant in.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "uring_dispatch.h"
+#include "civil.h"
+
+// Index of the entries removing timeouts
+#define URING_DISPATCH_REMOVE 0xFFFF
+
+static void _uring_dispatch_fetch(uring_dispatch_t *d);
+static uint64_t _uring_dispatch_user_data(uring_dispatch_t *d, uint32_t index);
+static time_t _uring_dispatch_now(uring_dispatch_t *d);
+
+/**
+ *  Initialize an io_uring dispatcher for a scheduler
+ *
+ *  tz is the zone of the scheduler's times, or NULL if they are UTC.
+ *  fn is called with arg for each event that fires. Events after the
+ *  current time are fired.
+ */
+void uring_dispatch_init(uring_dispatch_t *d, scheduler_t *scheduler, const TZTABLE *tz, uint32_t tag, uring_dispatch_fn fn, void *arg)
+{
+    d->scheduler = scheduler;
+    d->tz = tz;
+    d->fn = fn;
+    d->arg = arg;
+    d->tag = tag;
+    d->generation = 0;
+    d->events = NULL;
+    d->size = 0;
+    d->count = 0;
+    d->next = 0;
+    d->timeout_count = 0;
+    d->prepared = 0;
+    d->fired_until = _uring_dispatch_now(d);
+    d->firing = false;
+    d->invalidated = false;
+}
+
+/**
+ *  Write the timeouts of the batch to the host's submission queue
+ *
+ *  The batch is fetched first if all its events have fired, unless
+ *  their callbacks are still being called. Returns the
+ *  number of entries written, which is less than the timeouts left if
+ *  the queue is full. Call it again once there is room.
+ */
+uint32_t uring_dispatch_submit(uring_dispatch_t *d, uring_dispatch_sqe_fn get_sqe, void *sqe_arg)
+{
+    uint32_t count = 0;
+
+    if (d->next == d->count && !d->firing){
+        _uring_dispatch_fetch(d);
+    }
+
+    while (d->prepared < d->timeout_count){
+        struct io_uring_sqe *sqe = get_sqe(sqe_arg);
+        if (sqe == NULL){
+            break;
+        }
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)(uintptr_t)&d->timeouts[d->prepared].ts;
+        sqe->len = 1;
+        sqe->timeout_flags = IORING_TIMEOUT_ABS | IORING_TIMEOUT_REALTIME;
+        sqe->user_data = _uring_dispatch_user_data(d, d->prepared);
+        d->prepared++;
+        count++;
+    }
+
+    return count;
+}
+
+/**
+ *  Submit the events of the scheduler again after it was changed
+ *
+ *  Removes the timeouts still pending and writes the ones of a new
+ *  batch. Completions of the old timeouts are ignored. Called from a
+ *  callback, the batch is fetched again once the callbacks of every
+ *  event due have been called, so the events at the same time as the
+ *  one firing still fire and the event passed to the callback stays
+ *  valid. Returns the number of entries written.
+ */
+uint32_t uring_dispatch_invalidate(uring_dispatch_t *d, uring_dispatch_sqe_fn get_sqe, void *sqe_arg)
+{
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < d->prepared; i++){
+        if (d->timeouts[i].done){
+            continue;
+        }
+        struct io_uring_sqe *sqe = get_sqe(sqe_arg);
+        if (sqe == NULL){
+            // The timeout is left to expire
+            break;
+        }
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = _uring_dispatch_user_data(d, i);
+        sqe->user_data = _uring_dispatch_user_data(d, URING_DISPATCH_REMOVE);
+        d->timeouts[i].done = true;
+        count++;
+    }
+
+    if (d->firing){
+        d->invalidated = true;
+        return count;
+    }
+    d->next = d->count;
+
+    return count + uring_dispatch_submit(d, get_sqe, sqe_arg);
+}
+
+/**
+ *  Handle a completion of the host's ring
+ *
+ *  Returns false if the completion isn't one of the dispatcher's. When
+ *  a timeout expired, the callback is called for each event due up to
+ *  it, in order. The scheduler is updated to the current time first,
+ *  so its group events are the ones still to come. The callback may
+ *  change schedules and call uring_dispatch_invalidate. When the batch
+ *  has fired or was invalidated, the next one is written through
+ *  get_sqe after the callbacks return.
+ */
+bool uring_dispatch_complete(uring_dispatch_t *d, const struct io_uring_cqe *cqe, uring_dispatch_sqe_fn get_sqe, void *sqe_arg)
+{
+    struct tm t_now;
+
+    if ((uint32_t)(cqe->user_data >> 32) != d->tag){
+        return false;
+    }
+
+    uint16_t generation = (uint16_t)(cqe->user_data >> 16);
+    uint32_t index = (uint32_t)(cqe->user_data & 0xFFFF);
+    if (index == URING_DISPATCH_REMOVE || generation != d->generation || index >= d->prepared){
+        return true;
+    }
+
+    d->timeouts[index].done = true;
+    // A timeout without a count completes with -ETIME when it expires,
+    // and with -ECANCELED when it is removed
+    if (cqe->res != -ETIME){
+        return true;
+    }
+
+    uint32_t first = d->next;
+    uint32_t last = d->timeouts[index].last + 1;
+    if (last <= first){
+        // Fired with a later timeout already
+        return true;
+    }
+
+    // Timeouts up to this one won't fire anything
+    for (uint32_t i = 0; i < index; i++){
+        d->timeouts[i].done = true;
+    }
+    d->next = last;
+    d->fired_until = d->events[last - 1].epoch;
+    civil_to_tm(_uring_dispatch_now(d), &t_now);
+    scheduler_update_events_r(d->scheduler, &t_now);
+
+    d->firing = true;
+    for (uint32_t i = first; i < last; i++){
+        d->fn(d->arg, &d->events[i]);
+    }
+    d->firing = false;
+
+    if (d->invalidated){
+        d->invalidated = false;
+        d->next = d->count;
+    }
+    if (d->next == d->count){
+        uring_dispatch_submit(d, get_sqe, sqe_arg);
+    }
+
+    return true;
+}
+
+/**
+ *  Free the events of the batch
+ *
+ *  Pending timeouts must be removed and reaped first, their
+ *  completions can't be handled after this.
+ */
+void uring_dispatch_destroy(uring_dispatch_t *d)
+{
+    free(d->events);
+    d->events = NULL;
+    d->size = 0;
+    d->count = 0;
+    d->next = 0;
+    d->timeout_count = 0;
+    d->prepared = 0;
+}
+
+/*************** Static Functions *********************/
+
+/**
+ *  Fetch the events after the ones that have fired
+ *
+ *  Every event of a time is fetched together, so the time of the last
+ *  one fired is where the next batch starts. Events due at the same
+ *  time share a timeout.
+ */
+static void _uring_dispatch_fetch(uring_dispatch_t *d)
+{
+    struct tm t;
+
+    civil_to_tm(d->fired_until, &t);
+    d->count = scheduler_next_whole_events_r(d->scheduler, &t, URING_DISPATCH_BATCH, &d->events, &d->size);
+    d->next = 0;
+    d->timeout_count = 0;
+    d->prepared = 0;
+    d->generation++;
+
+    for (uint32_t i = 0; i < d->count; i++){
+        if (i + 1 < d->count && d->events[i + 1].epoch == d->events[i].epoch){
+            continue;
+        }
+        uring_dispatch_timeout_t *timeout = &d->timeouts[d->timeout_count++];
+        time_t t_utc = d->tz ? tz_local_to_utc(d->tz, d->events[i].epoch) : d->events[i].epoch;
+        timeout->ts.tv_sec = t_utc;
+        timeout->ts.tv_nsec = 0;
+        timeout->last = i;
+        timeout->done = false;
+    }
+}
+
+static uint64_t _uring_dispatch_user_data(uring_dispatch_t *d, uint32_t index)
+{
+    return (uint64_t)d->tag << 32 | (uint64_t)d->generation << 16 | index;
+}
+
+/**
+ *  Current time in the zone of the scheduler
+ */
+static time_t _uring_dispatch_now(uring_dispatch_t *d)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return d->tz ? tz_utc_to_local(d->tz, now.tv_sec) : now.tv_sec;
+}
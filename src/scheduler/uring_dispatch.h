@@ -0,0 +1,83 @@
+/*
+ * uring_dispatch.h
+ *
+ * Created: 16/10/2026 6:01:39 PM
+ */
+
+
+#ifndef URING_DISPATCH_H_
+#define URING_DISPATCH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/io_uring.h>
+#include "scheduler.h"
+#include "tz.h"
+
+// Number of upcoming events fetched and submitted at a time, more if
+// they are all at one time
+#ifndef URING_DISPATCH_BATCH
+#define URING_DISPATCH_BATCH 32
+#endif
+
+// Called from uring_dispatch_complete for each event that fires
+typedef void (*uring_dispatch_fn)(void *arg, const EVENT *event);
+
+// Returns a free submission queue entry of the host's ring, or NULL if
+// the queue is full
+typedef struct io_uring_sqe* (*uring_dispatch_sqe_fn)(void *arg);
+
+/**
+ * Timeout submitted for the events of a batch due at the same time
+ */
+typedef struct {
+    struct __kernel_timespec ts;
+    // Last event of the batch covered by the timeout
+    uint32_t last;
+    bool done;
+}uring_dispatch_timeout_t;
+
+/**
+ * Fires the events of a scheduler from IORING_OP_TIMEOUT completions
+ * of the host's io_uring
+ */
+typedef struct uring_dispatch
+{
+    scheduler_t *scheduler;
+    // Zone of the scheduler's times, NULL if they are UTC
+    const TZTABLE *tz;
+    uring_dispatch_fn fn;
+    void *arg;
+    // High 32 bits of the user_data of every entry submitted
+    uint32_t tag;
+    // Bumped when the batch is fetched again, completions of older
+    // batches are ignored
+    uint16_t generation;
+
+    // Events of the batch, from next up to count, with room for size.
+    // A batch of more than URING_DISPATCH_BATCH events is all at one
+    // time, so it never needs more timeouts than that.
+    EVENT *events;
+    uint32_t size;
+    uring_dispatch_timeout_t timeouts[URING_DISPATCH_BATCH];
+    uint32_t count;
+    uint32_t next;
+    // Timeouts of the batch, the ones from prepared up to timeout_count
+    // don't have an entry yet
+    uint32_t timeout_count;
+    uint32_t prepared;
+    // Events up to this time have fired
+    time_t fired_until;
+    // Set while the callbacks of the events due are called, and when
+    // one of them invalidates the batch
+    bool firing;
+    bool invalidated;
+}uring_dispatch_t;
+
+void uring_dispatch_init(uring_dispatch_t *d, scheduler_t *scheduler, const TZTABLE *tz, uint32_t tag, uring_dispatch_fn fn, void *arg);
+uint32_t uring_dispatch_submit(uring_dispatch_t *d, uring_dispatch_sqe_fn get_sqe, void *sqe_arg);
+uint32_t uring_dispatch_invalidate(uring_dispatch_t *d, uring_dispatch_sqe_fn get_sqe, void *sqe_arg);
+bool uring_dispatch_complete(uring_dispatch_t *d, const struct io_uring_cqe *cqe, uring_dispatch_sqe_fn get_sqe, void *sqe_arg);
+void uring_dispatch_destroy(uring_dispatch_t *d);
+
+#endif /* URING_DISPATCH_H_ */
@@ -0,0 +1,347 @@
+/*
+ * wheel.c
+ *
+ * Created: 16/10/2026 4:34:16 PM
+ *
+ *  Hashed hierarchical timing wheel. Nodes are placed in a slot of
+ *  the seconds, minutes, hours or days level depending on how far
+ *  away they expire, or in an overflow list if they expire more than
+ *  WHEEL_DAYS days away. As the wheel steps through each second, the
+ *  slot of the next level up is cascaded into the lower levels at
+ *  every minute, hour and day boundary, so a node is only touched
+ *  when its level changes or when it expires.
+ *
+ *  Inserting and removing a node is O(1). Stepping the wheel costs
+ *  O(1) per second plus the nodes that cascade or expire.
+ *
+ *      wheel_t w;
+ *      wheel_init(&w, now);
+ *      wheel_insert(&w, &item->node);
+ *      ...
+ *      while((n = wheel_pop_expired(&w, now))){
+ *          // handle expired node
+ *      }
+ */ 
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include "wheel.h"
+
+#define ONE_MIN  60
+#define ONE_HOUR 3600
+#define ONE_DAY  86400
+
+static void _wheel_tick(wheel_t *w);
+static void _wheel_place(wheel_t *w, wheel_node_t *n);
+static void _wheel_cascade(wheel_t *w, wheel_node_t *head);
+static void _wheel_rehash(wheel_t *w, time_t now);
+static wheel_node_t* _wheel_earliest(wheel_node_t *head, wheel_node_t *best);
+static bool _wheel_less(const wheel_node_t *a, const wheel_node_t *b);
+static void _list_init(wheel_node_t *head);
+static bool _list_empty(const wheel_node_t *head);
+static void _list_insert(wheel_node_t *head, wheel_node_t *n);
+static void _list_unlink(wheel_node_t *n);
+static time_t _floor_div(time_t t, time_t n);
+static uint32_t _floor_mod(time_t t, time_t n);
+
+/**
+ * \brief Initialize an empty wheel at the given time
+ *   
+ */
+void wheel_init(wheel_t *w, time_t now)
+{
+    for(uint8_t i = 0; i < 60; i++){
+        _list_init(&w->seconds[i]);
+        _list_init(&w->minutes[i]);
+    }
+    for(uint8_t i = 0; i < 24; i++){
+        _list_init(&w->hours[i]);
+    }
+    for(uint32_t i = 0; i < WHEEL_DAYS; i++){
+        _list_init(&w->days[i]);
+    }
+    _list_init(&w->overflow);
+    _list_init(&w->expired);
+
+    w->now = now;
+    w->count = 0;
+}
+
+/**
+ * \brief Insert a node using its expires time
+ *
+ *  Nodes that have already expired are returned by the next call
+ *  to wheel_pop_expired.
+ */
+void wheel_insert(wheel_t *w, wheel_node_t *n)
+{
+    _wheel_place(w, n);
+    w->count++;
+}
+
+/**
+ * \brief Remove a node from the wheel
+ *   
+ */
+void wheel_remove(wheel_t *w, wheel_node_t *n)
+{
+    _list_unlink(n);
+    w->count--;
+}
+
+/**
+ * \brief Pop a node that expires at or before now
+ *
+ *  The wheel is stepped towards now until a node expires. NULL is
+ *  returned once there are no more nodes expiring at or before now.
+ */
+wheel_node_t* wheel_pop_expired(wheel_t *w, time_t now)
+{
+    while(1){
+        if(!_list_empty(&w->expired)){
+            wheel_node_t *n = w->expired.next;
+            wheel_remove(w, n);
+            return n;
+        }
+
+        if(w->now >= now){
+            return NULL;
+        }
+
+        if(w->count == 0){
+            w->now = now;
+        }else if(now - w->now > WHEEL_MAX_STEP){
+            _wheel_rehash(w, now);
+        }else{
+            w->now++;
+            _wheel_tick(w);
+        }
+    }
+}
+
+/**
+ * \brief Get the node with the earliest expiry time
+ *
+ *  Only the first occupied slot of each level has to be searched,
+ *  along with the overflow list. NULL is returned if the wheel is empty.
+ */
+wheel_node_t* wheel_peek(wheel_t *w)
+{
+    wheel_node_t *best = NULL;
+
+    if(w->count == 0){
+        return NULL;
+    }
+
+    best = _wheel_earliest(&w->expired, best);
+
+    for(uint8_t k = 1; k < 60; k++){
+        wheel_node_t *head = &w->seconds[_floor_mod(w->now + k, 60)];
+        if(!_list_empty(head)){
+            best = _wheel_earliest(head, best);
+            break;
+        }
+    }
+
+    time_t minute = _floor_div(w->now, ONE_MIN);
+    for(uint8_t k = 1; k <= 60; k++){
+        wheel_node_t *head = &w->minutes[_floor_mod(minute + k, 60)];
+        if(!_list_empty(head)){
+            best = _wheel_earliest(head, best);
+            break;
+        }
+    }
+
+    time_t hour = _floor_div(w->now, ONE_HOUR);
+    for(uint8_t k = 1; k <= 24; k++){
+        wheel_node_t *head = &w->hours[_floor_mod(hour + k, 24)];
+        if(!_list_empty(head)){
+            best = _wheel_earliest(head, best);
+            break;
+        }
+    }
+
+    time_t day = _floor_div(w->now, ONE_DAY);
+    for(uint32_t k = 1; k <= WHEEL_DAYS; k++){
+        wheel_node_t *head = &w->days[_floor_mod(day + k, WHEEL_DAYS)];
+        if(!_list_empty(head)){
+            best = _wheel_earliest(head, best);
+            break;
+        }
+    }
+
+    return _wheel_earliest(&w->overflow, best);
+}
+
+/*************** Static Functions *********************/
+
+/**
+ * \brief Process the second at w->now
+ *   
+ *  Higher levels are cascaded first so that nodes moving down
+ *  several levels end up in the right slot for this second.
+ */
+static void _wheel_tick(wheel_t *w)
+{
+    time_t t = w->now;
+
+    if(_floor_mod(t, ONE_MIN) == 0){
+        if(_floor_mod(t, ONE_HOUR) == 0){
+            if(_floor_mod(t, ONE_DAY) == 0){
+                _wheel_cascade(w, &w->overflow);
+                _wheel_cascade(w, &w->days[_floor_mod(_floor_div(t, ONE_DAY), WHEEL_DAYS)]);
+            }
+            _wheel_cascade(w, &w->hours[_floor_mod(_floor_div(t, ONE_HOUR), 24)]);
+        }
+        _wheel_cascade(w, &w->minutes[_floor_mod(_floor_div(t, ONE_MIN), 60)]);
+    }
+
+    // Everything in this second's slot has expired
+    wheel_node_t *head = &w->seconds[_floor_mod(t, 60)];
+    while(!_list_empty(head)){
+        wheel_node_t *n = head->next;
+        _list_unlink(n);
+        _list_insert(&w->expired, n);
+    }
+}
+
+/**
+ * \brief Put a node in the slot for its expiry time
+ *   
+ */
+static void _wheel_place(wheel_t *w, wheel_node_t *n)
+{
+    time_t delta = n->expires - w->now;
+    wheel_node_t *head;
+
+    if(delta <= 0){
+        head = &w->expired;
+    }else if(delta < ONE_MIN){
+        head = &w->seconds[_floor_mod(n->expires, 60)];
+    }else if(delta < ONE_HOUR){
+        head = &w->minutes[_floor_mod(_floor_div(n->expires, ONE_MIN), 60)];
+    }else if(delta < ONE_DAY){
+        head = &w->hours[_floor_mod(_floor_div(n->expires, ONE_HOUR), 24)];
+    }else if(delta < (time_t)ONE_DAY*WHEEL_DAYS){
+        head = &w->days[_floor_mod(_floor_div(n->expires, ONE_DAY), WHEEL_DAYS)];
+    }else{
+        head = &w->overflow;
+    }
+
+    _list_insert(head, n);
+}
+
+/**
+ * \brief Move every node in a slot down to the level it now belongs in
+ *   
+ */
+static void _wheel_cascade(wheel_t *w, wheel_node_t *head)
+{
+    wheel_node_t list;
+
+    if(_list_empty(head)){
+        return;
+    }
+
+    // Detach the slot first since nodes can be placed back into it
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    _list_init(head);
+
+    while(!_list_empty(&list)){
+        wheel_node_t *n = list.next;
+        _list_unlink(n);
+        _wheel_place(w, n);
+    }
+}
+
+/**
+ * \brief Jump the wheel to a new time by placing every node again
+ *   
+ */
+static void _wheel_rehash(wheel_t *w, time_t now)
+{
+    wheel_node_t list;
+    wheel_node_t *heads[] = {w->seconds, w->minutes, w->hours, w->days, &w->overflow};
+    uint32_t sizes[] = {60, 60, 24, WHEEL_DAYS, 1};
+
+    _list_init(&list);
+    for(uint8_t level = 0; level < 5; level++){
+        for(uint32_t i = 0; i < sizes[level]; i++){
+            wheel_node_t *head = &heads[level][i];
+            while(!_list_empty(head)){
+                wheel_node_t *n = head->next;
+                _list_unlink(n);
+                _list_insert(&list, n);
+            }
+        }
+    }
+
+    w->now = now;
+    while(!_list_empty(&list)){
+        wheel_node_t *n = list.next;
+        _list_unlink(n);
+        _wheel_place(w, n);
+    }
+}
+
+static wheel_node_t* _wheel_earliest(wheel_node_t *head, wheel_node_t *best)
+{
+    for(wheel_node_t *n = head->next; n != head; n = n->next){
+        if(best == NULL || _wheel_less(n, best)){
+            best = n;
+        }
+    }
+    return best;
+}
+
+static bool _wheel_less(const wheel_node_t *a, const wheel_node_t *b)
+{
+    if(a->expires != b->expires){
+        return a->expires < b->expires;
+    }
+    return a->seq < b->seq;
+}
+
+static void _list_init(wheel_node_t *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static bool _list_empty(const wheel_node_t *head)
+{
+    return head->next == head;
+}
+
+static void _list_insert(wheel_node_t *head, wheel_node_t *n)
+{
+    n->prev = head->prev;
+    n->next = head;
+    head->prev->next = n;
+    head->prev = n;
+}
+
+static void _list_unlink(wheel_node_t *n)
+{
+    n->prev->next = n->next;
+    n->next->prev = n->prev;
+    n->next = n;
+    n->prev = n;
+}
+
+static time_t _floor_div(time_t t, time_t n)
+{
+    time_t q = t / n;
+    return (t % n < 0) ? q - 1 : q;
+}
+
+static uint32_t _floor_mod(time_t t, time_t n)
+{
+    time_t r = t % n;
+    return (uint32_t)(r < 0 ? r + n : r);
+}
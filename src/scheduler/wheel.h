@@ -0,0 +1,64 @@
+/*
+ * wheel.h
+ *
+ * Created: 16/10/2026 4:34:16 PM
+ */ 
+
+
+#ifndef WHEEL_H_
+#define WHEEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+// Number of slots in the days level. Nodes further away than this
+// are kept in an overflow list that is checked once a day
+#ifndef WHEEL_DAYS
+#define WHEEL_DAYS 64
+#endif
+
+// Time steps larger than this rehash the wheel instead of
+// stepping through every second
+#ifndef WHEEL_MAX_STEP
+#define WHEEL_MAX_STEP 86400
+#endif
+
+/**
+ * Node embedded in each item kept in a wheel
+ */
+typedef struct wheel_node
+{
+    struct wheel_node *next;
+    struct wheel_node *prev;
+    // Expiry time in seconds
+    time_t expires;
+    // Breaks ties between nodes with the same expiry time
+    uint32_t seq;
+}wheel_node_t;
+
+/**
+ * Hierarchical timing wheel with second, minute, hour and day levels
+ */
+typedef struct wheel
+{
+    wheel_node_t seconds[60];
+    wheel_node_t minutes[60];
+    wheel_node_t hours[24];
+    wheel_node_t days[WHEEL_DAYS];
+    wheel_node_t overflow;
+    // Nodes that have expired but haven't been popped
+    wheel_node_t expired;
+
+    // Every second up to and including this time has been processed
+    time_t now;
+    uint32_t count;
+}wheel_t;
+
+void wheel_init(wheel_t *w, time_t now);
+void wheel_insert(wheel_t *w, wheel_node_t *n);
+void wheel_remove(wheel_t *w, wheel_node_t *n);
+wheel_node_t* wheel_pop_expired(wheel_t *w, time_t now);
+wheel_node_t* wheel_peek(wheel_t *w);
+
+#endif /* WHEEL_H_ */
@@ -0,0 +1,256 @@
+/*
+ * worker_pool.c
+ *
+ * Created: 16/10/2026 6:04:07 PM
+ *
+ *  Threads that run callbacks handed over from another thread. Each job
+ *  has a key, and the jobs of a key run one at a time in the order they
+ *  were submitted, while jobs of different keys run in parallel. The
+ *  jobs of a key are kept in a strand, and the strands with jobs wait
+ *  in a ready queue that every worker takes from. A worker runs one job
+ *  of a strand and puts the strand back at the end of the queue if it
+ *  has more, so a key with many jobs doesn't hold back the others.
+ *
+ *  The queue is bounded. Submitting never waits: a job is dropped when
+ *  the pool has capacity jobs waiting, or its key has strand_limit, so
+ *  a slow key can't hold up the thread submitting jobs.
+ *
+ *      worker_pool_t p;
+ *      worker_pool_init(&p, 4, 1024, 64);
+ *      worker_pool_submit(&p, group, fn, arg, &event);
+ *      worker_pool_destroy(&p);
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "worker_pool.h"
+
+static void* _worker_pool_main(void *arg);
+static void _worker_pool_push_ready(worker_pool_t *p, worker_pool_strand_t *s);
+static void _worker_pool_stop(worker_pool_t *p, uint32_t started);
+
+/**
+ *  Start a pool of count threads with room for capacity waiting jobs
+ *
+ *  At most strand_limit jobs wait for one key, or capacity if it is 0.
+ *  Returns false if count or capacity is 0, or the pool can't be
+ *  allocated or started.
+ */
+bool worker_pool_init(worker_pool_t *p, uint32_t count, uint32_t capacity, uint32_t strand_limit)
+{
+    if (count == 0 || capacity == 0){
+        return false;
+    }
+
+    p->count = count;
+    p->capacity = capacity;
+    p->strand_limit = strand_limit && strand_limit < capacity ? strand_limit : capacity;
+    p->ready_head = 0;
+    p->ready_count = 0;
+    p->pending = 0;
+    p->dropped = 0;
+    p->stop = false;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->idle, NULL);
+    group_table_init(&p->strands);
+    pool_init(&p->strand_pool, sizeof(worker_pool_strand_t), 16);
+
+    p->jobs = malloc((size_t)capacity*sizeof(worker_pool_job_t));
+    p->ready = malloc((size_t)capacity*sizeof(worker_pool_strand_t*));
+    p->threads = malloc((size_t)count*sizeof(pthread_t));
+    if (p->jobs == NULL || p->ready == NULL || p->threads == NULL){
+        _worker_pool_stop(p, 0);
+        return false;
+    }
+    for (uint32_t i = 0; i < capacity; i++){
+        p->jobs[i].next = i + 1 < capacity ? i + 1 : WORKER_POOL_NONE;
+    }
+    p->free_job = 0;
+
+    for (uint32_t i = 0; i < count; i++){
+        if (pthread_create(&p->threads[i], NULL, _worker_pool_main, p) != 0){
+            _worker_pool_stop(p, i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ *  Queue fn to be called with arg and a copy of event
+ *
+ *  The job runs after the jobs submitted before it with the same key.
+ *  Returns false if the job was dropped because the queue is full.
+ */
+bool worker_pool_submit(worker_pool_t *p, uint32_t key, worker_pool_fn fn, void *arg, const EVENT *event)
+{
+    pthread_mutex_lock(&p->lock);
+
+    worker_pool_strand_t *s = group_table_find(&p->strands, key);
+    if (p->free_job == WORKER_POOL_NONE || (s && s->count >= p->strand_limit)){
+        p->dropped++;
+        pthread_mutex_unlock(&p->lock);
+        return false;
+    }
+    if (s == NULL){
+        s = pool_alloc(&p->strand_pool);
+        if (s && !group_table_insert(&p->strands, key, s)){
+            pool_free(&p->strand_pool, s);
+            s = NULL;
+        }
+        if (s == NULL){
+            p->dropped++;
+            pthread_mutex_unlock(&p->lock);
+            return false;
+        }
+        s->key = key;
+        s->head = WORKER_POOL_NONE;
+        s->count = 0;
+        s->scheduled = false;
+    }
+
+    uint32_t j = p->free_job;
+    p->free_job = p->jobs[j].next;
+    p->jobs[j].fn = fn;
+    p->jobs[j].arg = arg;
+    p->jobs[j].event = *event;
+    p->jobs[j].next = WORKER_POOL_NONE;
+    if (s->head == WORKER_POOL_NONE){
+        s->head = j;
+    }else{
+        p->jobs[s->tail].next = j;
+    }
+    s->tail = j;
+    s->count++;
+    p->pending++;
+
+    if (!s->scheduled){
+        _worker_pool_push_ready(p, s);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return true;
+}
+
+/**
+ *  Wait until every job submitted has run
+ */
+void worker_pool_drain(worker_pool_t *p)
+{
+    pthread_mutex_lock(&p->lock);
+    while (p->pending){
+        pthread_cond_wait(&p->idle, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+/**
+ *  Get the number of jobs dropped because the queue was full
+ */
+uint32_t worker_pool_get_dropped(worker_pool_t *p)
+{
+    pthread_mutex_lock(&p->lock);
+    uint32_t dropped = p->dropped;
+    pthread_mutex_unlock(&p->lock);
+
+    return dropped;
+}
+
+/**
+ *  Run the jobs still waiting, then stop the threads and free the pool
+ */
+void worker_pool_destroy(worker_pool_t *p)
+{
+    _worker_pool_stop(p, p->count);
+}
+
+/*************** Static Functions *********************/
+
+static void* _worker_pool_main(void *arg)
+{
+    worker_pool_t *p = arg;
+
+    pthread_mutex_lock(&p->lock);
+    while (true){
+        while (p->ready_count == 0 && !p->stop){
+            pthread_cond_wait(&p->work, &p->lock);
+        }
+        if (p->ready_count == 0){
+            break;
+        }
+
+        worker_pool_strand_t *s = p->ready[p->ready_head];
+        p->ready_head = (p->ready_head + 1) % p->capacity;
+        p->ready_count--;
+
+        // The strand stays scheduled while its job runs, so the next
+        // job of the key can't start on another worker
+        uint32_t j = s->head;
+        worker_pool_job_t job = p->jobs[j];
+        s->head = job.next;
+        s->count--;
+        p->jobs[j].next = p->free_job;
+        p->free_job = j;
+        pthread_mutex_unlock(&p->lock);
+
+        job.fn(job.arg, &job.event);
+
+        pthread_mutex_lock(&p->lock);
+        if (s->count){
+            _worker_pool_push_ready(p, s);
+        }else{
+            group_table_remove(&p->strands, s->key);
+            pool_free(&p->strand_pool, s);
+        }
+        if (--p->pending == 0){
+            pthread_cond_broadcast(&p->idle);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+/**
+ *  Put a strand at the end of the ready queue
+ *
+ *  A strand in the queue has a job waiting, so the queue can't hold
+ *  more strands than there are jobs.
+ */
+static void _worker_pool_push_ready(worker_pool_t *p, worker_pool_strand_t *s)
+{
+    p->ready[(p->ready_head + p->ready_count) % p->capacity] = s;
+    p->ready_count++;
+    s->scheduled = true;
+    pthread_cond_signal(&p->work);
+}
+
+/**
+ *  Stop the first started threads and free the pool
+ */
+static void _worker_pool_stop(worker_pool_t *p, uint32_t started)
+{
+    pthread_mutex_lock(&p->lock);
+    p->stop = true;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+
+    for (uint32_t i = 0; i < started; i++){
+        pthread_join(p->threads[i], NULL);
+    }
+    free(p->threads);
+    free(p->ready);
+    free(p->jobs);
+    p->threads = NULL;
+    p->ready = NULL;
+    p->jobs = NULL;
+    group_table_free(&p->strands);
+    pool_destroy(&p->strand_pool);
+    pthread_cond_destroy(&p->idle);
+    pthread_cond_destroy(&p->work);
+    pthread_mutex_destroy(&p->lock);
+}
@@ -0,0 +1,89 @@
+/*
+ * worker_pool.h
+ *
+ * Created: 16/10/2026 6:04:07 PM
+ */
+
+
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "scheduler.h"
+#include "pool.h"
+#include "group_table.h"
+
+// Index of no job
+#define WORKER_POOL_NONE UINT32_MAX
+
+// Called on a worker thread for a job
+typedef void (*worker_pool_fn)(void *arg, const EVENT *event);
+
+/**
+ * Call waiting to run on a worker
+ */
+typedef struct {
+    worker_pool_fn fn;
+    void *arg;
+    EVENT event;
+    // Next job of the same key, or the next free job
+    uint32_t next;
+}worker_pool_job_t;
+
+/**
+ * Jobs of a key, which run one at a time in the order they were
+ * submitted
+ */
+typedef struct {
+    uint32_t key;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t count;
+    // Set while the strand is in the ready queue or running
+    bool scheduled;
+}worker_pool_strand_t;
+
+/**
+ * Threads that run submitted jobs, serially for each key and in
+ * parallel across keys
+ */
+typedef struct worker_pool
+{
+    uint32_t count;
+    pthread_t *threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t idle;
+
+    // Job slots, the unused ones linked from free_job
+    worker_pool_job_t *jobs;
+    uint32_t capacity;
+    uint32_t free_job;
+    // Most jobs waiting for one key
+    uint32_t strand_limit;
+
+    // Strands that have jobs, by key
+    group_table_t strands;
+    pool_t strand_pool;
+    // Ring of the strands waiting for a worker
+    worker_pool_strand_t **ready;
+    uint32_t ready_head;
+    uint32_t ready_count;
+
+    // Jobs submitted that haven't finished
+    uint32_t pending;
+    // Jobs that didn't fit in the queue
+    uint32_t dropped;
+    bool stop;
+}worker_pool_t;
+
+bool worker_pool_init(worker_pool_t *p, uint32_t count, uint32_t capacity, uint32_t strand_limit);
+bool worker_pool_submit(worker_pool_t *p, uint32_t key, worker_pool_fn fn, void *arg, const EVENT *event);
+void worker_pool_drain(worker_pool_t *p);
+uint32_t worker_pool_get_dropped(worker_pool_t *p);
+void worker_pool_destroy(worker_pool_t *p);
+
+#endif /* WORKER_POOL_H_ */
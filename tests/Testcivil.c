@@ -0,0 +1,80 @@
+#include "civil.h"
+#include "unity.h"
+#include <time.h>
+
+void setUp(void)
+{
+
+}
+
+void tearDown(void)
+{
+
+}
+
+void test_civil_days_from_date_epoch(void)
+{
+    TEST_ASSERT_EQUAL_INT32(0, civil_days_from_date(1970, 1, 1));
+    TEST_ASSERT_EQUAL_INT32(-1, civil_days_from_date(1969, 12, 31));
+    TEST_ASSERT_EQUAL_INT32(17222, civil_days_from_date(2017, 2, 25));
+}
+
+void test_civil_date_from_days_leap_day(void)
+{
+    int32_t year, mon, mday;
+    civil_date_from_days(civil_days_from_date(2016, 2, 29), &year, &mon, &mday);
+
+    TEST_ASSERT_EQUAL_INT32(2016, year);
+    TEST_ASSERT_EQUAL_INT32(2, mon);
+    TEST_ASSERT_EQUAL_INT32(29, mday);
+
+    civil_date_from_days(civil_days_from_date(2016, 2, 29)+1, &year, &mon, &mday);
+    TEST_ASSERT_EQUAL_INT32(3, mon);
+    TEST_ASSERT_EQUAL_INT32(1, mday);
+}
+
+void test_civil_weekday(void)
+{
+    // 1970/01/01 was a Thursday, 2016/10/24 was a Monday
+    TEST_ASSERT_EQUAL_UINT8(4, civil_weekday(0));
+    TEST_ASSERT_EQUAL_UINT8(3, civil_weekday(-1));
+    TEST_ASSERT_EQUAL_UINT8(6, civil_weekday(-5));
+    TEST_ASSERT_EQUAL_UINT8(1, civil_weekday(civil_days_from_date(2016, 10, 24)));
+}
+
+void test_civil_from_tm_normalizes_out_of_range_fields(void)
+{
+    struct tm t = {0};
+    t.tm_year = 116;
+    t.tm_mon = 11;
+    t.tm_mday = 32;
+    t.tm_hour = 25;
+
+    struct tm t_expected = {0};
+    t_expected.tm_year = 117;
+    t_expected.tm_mon = 0;
+    t_expected.tm_mday = 2;
+    t_expected.tm_hour = 1;
+
+    TEST_ASSERT_EQUAL_INT64(civil_from_tm(&t_expected), civil_from_tm(&t));
+}
+
+void test_civil_matches_gmtime(void)
+{
+    struct tm t_civil, t_gm;
+
+    for(time_t t = -2000000000; t < 4000000000; t += 7777777){
+        civil_to_tm(t, &t_civil);
+        gmtime_r(&t, &t_gm);
+
+        TEST_ASSERT_EQUAL_INT(t_gm.tm_sec, t_civil.tm_sec);
+        TEST_ASSERT_EQUAL_INT(t_gm.tm_min, t_civil.tm_min);
+        TEST_ASSERT_EQUAL_INT(t_gm.tm_hour, t_civil.tm_hour);
+        TEST_ASSERT_EQUAL_INT(t_gm.tm_mday, t_civil.tm_mday);
+        TEST_ASSERT_EQUAL_INT(t_gm.tm_mon, t_civil.tm_mon);
+        TEST_ASSERT_EQUAL_INT(t_gm.tm_year, t_civil.tm_year);
+        TEST_ASSERT_EQUAL_INT(t_gm.tm_wday, t_civil.tm_wday);
+        TEST_ASSERT_EQUAL_INT(t_gm.tm_yday, t_civil.tm_yday);
+        TEST_ASSERT_EQUAL_INT64(t, civil_from_tm(&t_civil));
+    }
+}
@@ -0,0 +1,89 @@
+#include "command_queue.h"
+#include "unity.h"
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define PRODUCERS 4
+#define COMMANDS 20000
+
+static command_queue_t queue;
+
+void setUp(void)
+{
+    TEST_ASSERT_TRUE(command_queue_init(&queue, 5));
+}
+
+void tearDown(void)
+{
+    command_queue_free(&queue);
+}
+
+void test_command_queue_pops_in_order_until_empty(void)
+{
+    command_t c;
+
+    // 5 is rounded up to 8 slots
+    for(uint32_t i = 0; i < 8; i++){
+        TEST_ASSERT_TRUE(command_queue_remove(&queue, i, NULL, NULL));
+    }
+    TEST_ASSERT_FALSE(command_queue_remove(&queue, 8, NULL, NULL));
+
+    // Wraps around the ring a few times
+    for(uint32_t i = 0; i < 20; i++){
+        TEST_ASSERT_TRUE(command_queue_pop(&queue, &c));
+        TEST_ASSERT_EQUAL_UINT32(i < 8 ? COMMAND_REMOVE : COMMAND_INVALIDATE, c.type);
+        TEST_ASSERT_EQUAL_UINT32(i, c.key);
+        TEST_ASSERT_TRUE(command_queue_invalidate(&queue, i + 8, NULL, NULL));
+    }
+    for(uint32_t i = 20; i < 28; i++){
+        TEST_ASSERT_TRUE(command_queue_pop(&queue, &c));
+        TEST_ASSERT_EQUAL_UINT32(i, c.key);
+    }
+    TEST_ASSERT_FALSE(command_queue_pop(&queue, &c));
+}
+
+static void* _produce(void *arg)
+{
+    uint32_t producer = (uint32_t)(uintptr_t)arg;
+
+    for(uint32_t i = 0; i < COMMANDS; i++){
+        while(!command_queue_invalidate(&queue, producer*COMMANDS + i, NULL, NULL)){
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+void test_command_queue_keeps_the_order_of_each_producer(void)
+{
+    pthread_t threads[PRODUCERS];
+    uint32_t next[PRODUCERS] = {0};
+    uint32_t count = 0;
+    command_t c;
+
+    command_queue_free(&queue);
+    TEST_ASSERT_TRUE(command_queue_init(&queue, 256));
+    for(uint32_t i = 0; i < PRODUCERS; i++){
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, _produce, (void*)(uintptr_t)i));
+    }
+
+    while(count < PRODUCERS*COMMANDS){
+        if(!command_queue_pop(&queue, &c)){
+            sched_yield();
+            continue;
+        }
+        uint32_t producer = c.key/COMMANDS;
+        TEST_ASSERT_TRUE(producer < PRODUCERS);
+        TEST_ASSERT_EQUAL_UINT32(next[producer], c.key%COMMANDS);
+        next[producer]++;
+        count++;
+    }
+
+    for(uint32_t i = 0; i < PRODUCERS; i++){
+        pthread_join(threads[i], NULL);
+        TEST_ASSERT_EQUAL_UINT32(COMMANDS, next[i]);
+    }
+    TEST_ASSERT_FALSE(command_queue_pop(&queue, &c));
+}
@@ -0,0 +1,173 @@
+#include "dispatcher.h"
+#include "scheduler.h"
+#include "civil.h"
+#include "fixtures.h"
+#include "unity.h"
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+static scheduler_t ctx;
+static dispatcher_t dispatcher;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fired = PTHREAD_COND_INITIALIZER;
+static EVENT events[16];
+static uint32_t event_count;
+
+void setUp(void)
+{
+    scheduler_init_r(&ctx);
+    dispatcher_init(&dispatcher, &ctx, NULL);
+    event_count = 0;
+}
+
+void tearDown(void)
+{
+    dispatcher_destroy(&dispatcher);
+    scheduler_clear_r(&ctx);
+}
+
+static void _on_event(void *arg, const EVENT *event)
+{
+    pthread_mutex_lock(&lock);
+    if(event_count < 16){
+        events[event_count] = *event;
+        events[event_count].group = (uint32_t)(uintptr_t)arg;
+        event_count++;
+    }
+    pthread_cond_signal(&fired);
+    pthread_mutex_unlock(&lock);
+}
+
+static uint32_t _wait_for_events(uint32_t count, uint32_t timeout_s)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_s;
+
+    pthread_mutex_lock(&lock);
+    while(event_count < count && pthread_cond_timedwait(&fired, &lock, &deadline) == 0);
+    count = event_count;
+    pthread_mutex_unlock(&lock);
+
+    return count;
+}
+
+void test_dispatcher_fires_events_on_time(void)
+{
+    dispatcher_stats_t stats;
+
+    fixture_add_secondly(&ctx, 0, 1);
+    TEST_ASSERT_TRUE(dispatcher_on_group(&dispatcher, 0, _on_event, (void*)(uintptr_t)7));
+    TEST_ASSERT_TRUE(dispatcher_start(&dispatcher));
+    TEST_ASSERT_FALSE(dispatcher_start(&dispatcher));
+
+    TEST_ASSERT_TRUE(_wait_for_events(2, 5) >= 2);
+    dispatcher_stop(&dispatcher);
+
+    TEST_ASSERT_EQUAL_UINT32(0, events[0].id);
+    TEST_ASSERT_EQUAL_UINT32(7, events[0].group);
+    TEST_ASSERT_TRUE(events[1].epoch == events[0].epoch + 1);
+
+    dispatcher_get_stats(&dispatcher, &stats);
+    TEST_ASSERT_TRUE(stats.wakeups >= 2);
+    TEST_ASSERT_TRUE(stats.late_last_ns >= 0);
+    TEST_ASSERT_TRUE(stats.late_max_ns < 500000000);
+}
+
+void test_dispatcher_fetches_events_after_unlock(void)
+{
+    TEST_ASSERT_TRUE(dispatcher_on_schedule(&dispatcher, 0, _on_event, (void*)(uintptr_t)3));
+    TEST_ASSERT_TRUE(dispatcher_start(&dispatcher));
+
+    // Nothing to fire until a schedule is added
+    dispatcher_lock(&dispatcher);
+    fixture_add_secondly(&ctx, 5, 1);
+    dispatcher_unlock(&dispatcher);
+
+    TEST_ASSERT_TRUE(_wait_for_events(1, 5) >= 1);
+    TEST_ASSERT_EQUAL_UINT32(0, events[0].id);
+    TEST_ASSERT_EQUAL_UINT32(3, events[0].group);
+
+    // The scheduler's group events follow the dispatcher
+    dispatcher_lock(&dispatcher);
+    EVENT *event = scheduler_get_event_by_group_r(&ctx, 5);
+    TEST_ASSERT_NOT_NULL(event);
+    TEST_ASSERT_TRUE(event->epoch > events[0].epoch);
+    dispatcher_unlock(&dispatcher);
+
+    // Removed callbacks aren't called
+    TEST_ASSERT_TRUE(dispatcher_on_schedule(&dispatcher, 0, NULL, NULL));
+    uint32_t count = _wait_for_events(16, 2);
+    TEST_ASSERT_TRUE(count <= 2);
+}
+
+// Count the callbacks of each of the first seconds after base
+static time_t tied_base;
+static uint32_t tied_counts[4];
+
+static void _on_tied_event(void *arg, const EVENT *event)
+{
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    if(event->epoch > tied_base && event->epoch <= tied_base + 4){
+        tied_counts[event->epoch - tied_base - 1]++;
+    }
+    event_count++;
+    pthread_cond_signal(&fired);
+    pthread_mutex_unlock(&lock);
+}
+
+void test_dispatcher_fires_every_event_of_a_time(void)
+{
+    const uint32_t groups = 2*DISPATCHER_PREFETCH + 1;
+
+    // More groups fire each second than are fetched at a time
+    TEST_ASSERT_TRUE(scheduler_set_capacity_r(&ctx, groups));
+    for(uint32_t group = 0; group < groups; group++){
+        fixture_add_secondly(&ctx, group, 1);
+        TEST_ASSERT_TRUE(dispatcher_on_group(&dispatcher, group, _on_tied_event, NULL));
+    }
+    tied_base = time(NULL);
+    for(uint32_t i = 0; i < 4; i++){
+        tied_counts[i] = 0;
+    }
+    TEST_ASSERT_TRUE(dispatcher_start(&dispatcher));
+
+    TEST_ASSERT_TRUE(_wait_for_events(3*groups, 6) >= 3*groups);
+    dispatcher_stop(&dispatcher);
+
+    // The first second may have passed before the thread started
+    TEST_ASSERT_EQUAL_UINT32(groups, tied_counts[1]);
+    TEST_ASSERT_EQUAL_UINT32(groups, tied_counts[2]);
+}
+
+static void _on_slow_event(void *arg, const EVENT *event)
+{
+    (void)arg;
+    (void)event;
+    struct timespec delay = {3, 0};
+    nanosleep(&delay, NULL);
+}
+
+void test_dispatcher_workers_run_groups_in_parallel(void)
+{
+    dispatcher_stats_t stats;
+
+    fixture_add_secondly(&ctx, 0, 1);
+    fixture_add_secondly(&ctx, 1, 1);
+    TEST_ASSERT_TRUE(dispatcher_set_workers(&dispatcher, 2, 64, 8));
+    TEST_ASSERT_FALSE(dispatcher_set_workers(&dispatcher, 2, 64, 8));
+    TEST_ASSERT_TRUE(dispatcher_on_group(&dispatcher, 0, _on_slow_event, NULL));
+    TEST_ASSERT_TRUE(dispatcher_on_group(&dispatcher, 1, _on_event, (void*)(uintptr_t)1));
+    TEST_ASSERT_TRUE(dispatcher_start(&dispatcher));
+
+    // Group 1 keeps firing while group 0's callback sleeps
+    TEST_ASSERT_TRUE(_wait_for_events(2, 3) >= 2);
+    TEST_ASSERT_TRUE(events[1].epoch == events[0].epoch + 1);
+    dispatcher_stop(&dispatcher);
+
+    dispatcher_get_stats(&dispatcher, &stats);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.dropped);
+    TEST_ASSERT_TRUE(stats.late_max_ns < 500000000);
+}
@@ -0,0 +1,77 @@
+#include "group_table.h"
+#include "unity.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+static group_table_t table;
+static int values[1000];
+
+void setUp(void)
+{
+    group_table_init(&table);
+}
+
+void tearDown(void)
+{
+    group_table_free(&table);
+}
+
+void test_group_table_dense_keys(void)
+{
+    TEST_ASSERT_NULL(group_table_find(&table, 0));
+
+    TEST_ASSERT_TRUE(group_table_insert(&table, 0, &values[0]));
+    TEST_ASSERT_TRUE(group_table_insert(&table, 100, &values[1]));
+
+    TEST_ASSERT_EQUAL_PTR(&values[0], group_table_find(&table, 0));
+    TEST_ASSERT_EQUAL_PTR(&values[1], group_table_find(&table, 100));
+    TEST_ASSERT_NULL(group_table_find(&table, 99));
+    TEST_ASSERT_EQUAL_UINT32(0, table.map_count);
+
+    group_table_remove(&table, 0);
+    TEST_ASSERT_NULL(group_table_find(&table, 0));
+}
+
+void test_group_table_sparse_keys_with_removal(void)
+{
+    uint32_t keys[1000];
+
+    srand(1);
+    for(uint32_t i = 0; i < 1000; i++){
+        keys[i] = GROUP_TABLE_DENSE_MAX + (uint32_t)rand()*2654435761u % (UINT32_MAX - GROUP_TABLE_DENSE_MAX);
+        if(group_table_find(&table, keys[i])){
+            keys[i] = 0;
+            continue;
+        }
+        TEST_ASSERT_TRUE(group_table_insert(&table, keys[i], &values[i]));
+    }
+
+    // Remove every other key, the rest must still be found
+    for(uint32_t i = 0; i < 1000; i += 2){
+        group_table_remove(&table, keys[i]);
+    }
+    for(uint32_t i = 0; i < 1000; i++){
+        if(keys[i] == 0){
+            continue;
+        }
+        TEST_ASSERT_EQUAL_PTR(i % 2 ? &values[i] : NULL, group_table_find(&table, keys[i]));
+    }
+}
+
+void test_group_table_static_buffer_doesnt_grow(void)
+{
+    static group_slot_t buffer[GROUP_TABLE_BUFFER_SIZE(3)/sizeof(group_slot_t)];
+    group_table_t fixed;
+
+    group_table_init_static(&fixed, buffer, 3);
+
+    // Small keys use the map too
+    TEST_ASSERT_TRUE(group_table_insert(&fixed, 1, &values[0]));
+    TEST_ASSERT_TRUE(group_table_insert(&fixed, 2, &values[1]));
+    TEST_ASSERT_TRUE(group_table_insert(&fixed, UINT32_MAX, &values[2]));
+    TEST_ASSERT_EQUAL_PTR(&values[2], group_table_find(&fixed, UINT32_MAX));
+
+    // The map has 8 slots and is kept at most half full
+    TEST_ASSERT_TRUE(group_table_insert(&fixed, 3, &values[3]));
+    TEST_ASSERT_FALSE(group_table_insert(&fixed, 4, &values[4]));
+}
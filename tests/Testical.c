@@ -1,4 +1,5 @@
 #include "ical.h"
+#include "civil.h"
 #include "unity.h"
 #include <stdio.h>
 #include <time.h>
@@ -426,4 +427,260 @@ void test_ical_returns_recur_event_when_count_is_used(void)
     event = ical_find_next_event(&ical, &t_now, &t_next);
     TEST_ASSERT_EQUAL_HEX16(ICALEVENT_RECUR, event);
     assert_test_time(&t_next, 2016, 10, 24, 8, 49, 0);
-}
\ No newline at end of file
+}
+
+void test_ical_secondly_event_late_in_window(void)
+{
+    ical_set_time_struct(&t_now, 2016, 10, 24, 15, 59, 58);
+    ical.freq = SECONDLY;
+    ical.interval = 1;
+
+    ICALEVENT event = ical_find_next_event(&ical, &t_now, &t_next);
+    TEST_ASSERT_EQUAL_HEX16(ICALEVENT_RECUR, event);
+    assert_test_time(&t_next, 2016, 10, 24, 15, 59, 59);
+}
+
+void test_ical_returns_no_event_when_count_is_exceeded_late_in_window(void)
+{
+    // Occurrence index is well past 255 so it must not wrap
+    ical_set_time_struct(&t_now, 2016, 10, 24, 8, 4, 20);
+    ical.freq = SECONDLY;
+    ical.interval = 1;
+    ical.count = 50;
+
+    ICALEVENT event = ical_find_next_event(&ical, &t_now, &t_next);
+    TEST_ASSERT_EQUAL_HEX16(ICALEVENT_NONE, event);
+}
+
+void test_ical_returns_next_days_start_when_interval_passes_midnight(void)
+{
+    ical_set_time_struct(&t_end, 2018, 10, 24, 23, 50, 0);
+    ical_set_time_struct(&t_now, 2016, 10, 24, 23, 30, 0);
+    ical.t_end = t_end;
+    ical.freq = HOURLY;
+    ical.interval = 1;
+
+    ICALEVENT event = ical_find_next_event(&ical, &t_now, &t_next);
+    TEST_ASSERT_EQUAL_HEX16(ICALEVENT_START, event);
+    assert_test_time(&t_next, 2016, 10, 25, 8, 0, 0);
+}
+
+void test_ical_uses_timezone_table(void)
+{
+    TZTABLE tz;
+    if(!tz_load(&tz, "America/New_York")){
+        TEST_IGNORE_MESSAGE("zoneinfo not available");
+    }
+    ical.tz = &tz;
+
+    // 08:00 EDT is 12:00 UTC
+    ical_set_time_struct(&t_now, 2016, 10, 24, 11, 0, 0);
+    ICALEVENT event = ical_find_next_event(&ical, &t_now, &t_next);
+    TEST_ASSERT_EQUAL_HEX16(ICALEVENT_START, event);
+    assert_test_time(&t_next, 2016, 10, 24, 12, 0, 0);
+
+    // 08:00 EST is 13:00 UTC
+    ical_set_time_struct(&t_now, 2016, 11, 7, 12, 30, 0);
+    event = ical_find_next_event(&ical, &t_now, &t_next);
+    TEST_ASSERT_EQUAL_HEX16(ICALEVENT_START, event);
+    assert_test_time(&t_next, 2016, 11, 7, 13, 0, 0);
+
+    // 08:57 EST, next event at 09:00 EST is 14:00 UTC
+    ical_set_time_struct(&t_now, 2016, 11, 7, 13, 57, 0);
+    event = ical_find_next_event(&ical, &t_now, &t_next);
+    TEST_ASSERT_EQUAL_HEX16(ICALEVENT_RECUR, event);
+    assert_test_time(&t_next, 2016, 11, 7, 14, 0, 0);
+
+    tz_free(&tz);
+}
+
+void test_ical_validate(void)
+{
+    ICAL ical;
+    ical_get_defaults(&ical);
+
+    TEST_ASSERT_EQUAL(ICALEVENT_NONE, ical_validate(&ical));
+
+    ical.interval = 0;
+    TEST_ASSERT_EQUAL(ICALERROR_INVALID_INTERVAL, ical_validate(&ical));
+
+    ical.interval = 1;
+    ical.t_end.tm_year = ical.t_start.tm_year - 1;
+    TEST_ASSERT_EQUAL(ICALERROR_START_GREATER_THAN_END, ical_validate(&ical));
+}
+
+void test_ical_compile_round_trip(void)
+{
+    ICAL rebuilt;
+    ICALRECORD record, recompiled;
+    ical_set_time_struct(&ical.t_start, 2016, 10, 24, 20, 0, 0);
+    ical_set_time_struct(&ical.t_end, 2016, 12, 24, 8, 15, 30);
+    ical.freq = HOURLY;
+    ical.interval = 3;
+    ical.byday = MO|TH;
+    ical.count = 4;
+    ical.enabled = true;
+
+    TEST_ASSERT_TRUE(sizeof(ICALRECORD) <= 32);
+
+    ical_compile(&ical, &record);
+    TEST_ASSERT_EQUAL(3*60*60, record.period);
+    TEST_ASSERT_EQUAL(ICALEVENT_NONE, record.error);
+
+    ical_decompile(&record, &rebuilt);
+    TEST_ASSERT_EQUAL(2016 - 1900, rebuilt.t_start.tm_year);
+    TEST_ASSERT_EQUAL(9, rebuilt.t_start.tm_mon);
+    TEST_ASSERT_EQUAL(24, rebuilt.t_start.tm_mday);
+    TEST_ASSERT_EQUAL(20, rebuilt.t_start.tm_hour);
+    TEST_ASSERT_EQUAL(11, rebuilt.t_end.tm_mon);
+    TEST_ASSERT_EQUAL(8, rebuilt.t_end.tm_hour);
+    TEST_ASSERT_EQUAL(15, rebuilt.t_end.tm_min);
+    TEST_ASSERT_EQUAL(30, rebuilt.t_end.tm_sec);
+    TEST_ASSERT_EQUAL(HOURLY, rebuilt.freq);
+    TEST_ASSERT_EQUAL(3, rebuilt.interval);
+    TEST_ASSERT_EQUAL(MO|TH, rebuilt.byday);
+    TEST_ASSERT_EQUAL(4, rebuilt.count);
+    TEST_ASSERT_TRUE(rebuilt.enabled);
+
+    // Out of range times of day are kept as they are
+    ical.t_start.tm_hour = 25;
+    ical_compile(&ical, &record);
+    ical_decompile(&record, &rebuilt);
+    ical_compile(&rebuilt, &recompiled);
+    TEST_ASSERT_EQUAL_MEMORY(&record, &recompiled, sizeof(record));
+}
+
+void test_ical_record_find_next_epoch_matches_ical(void)
+{
+    ICALRECORD record;
+    time_t e_current = civil_from_tm(&t_now);
+    ical_set_time_struct(&ical.t_start, 2016, 10, 24, 20, 0, 0);
+    ical_set_time_struct(&ical.t_end, 2016, 12, 24, 8, 0, 0);
+    ical.freq = MINUTELY;
+    ical.interval = 45;
+    ical.byday = MO|TH;
+    ical.enabled = true;
+    ical_compile(&ical, &record);
+
+    // Step through a week of events with both
+    for(int i = 0; i < 200; i++){
+        time_t e_ical, e_record;
+        ICALEVENT event = ical_find_next_epoch(&ical, e_current, &e_ical);
+        TEST_ASSERT_EQUAL(event, ical_record_find_next_epoch(&record, e_current, &e_record));
+        TEST_ASSERT_TRUE(e_ical == e_record);
+        e_current = e_ical;
+    }
+
+    ical.interval = 0;
+    ical_compile(&ical, &record);
+    TEST_ASSERT_EQUAL(ICALERROR_INVALID_INTERVAL, ical_record_find_next_epoch(&record, e_current, &e_current));
+}
+
+static void _assert_expand_matches_search(time_t e_from, time_t e_to)
+{
+    ICALEXPAND expand;
+    ICALEVENT event, expected;
+    time_t e_event, e_expected;
+    time_t e_current = e_from - 1;
+    uint32_t count = 0;
+
+    ical_expand_init(&expand, &ical, e_from, e_to);
+    while(true){
+        // Feed each result back in as the current time
+        expected = ical_find_next_epoch(&ical, e_current, &e_expected);
+        while(!ical_is_event(expected) && e_expected != ICAL_EPOCH_NEVER && e_expected < e_to){
+            e_current = e_expected;
+            expected = ical_find_next_epoch(&ical, e_current, &e_expected);
+        }
+        if(!ical_is_event(expected) || e_expected >= e_to){
+            break;
+        }
+        TEST_ASSERT_TRUE(ical_expand_next(&expand, &event, &e_event));
+        TEST_ASSERT_EQUAL(expected, event);
+        TEST_ASSERT_TRUE(e_expected == e_event);
+        e_current = e_expected;
+        count++;
+    }
+    TEST_ASSERT_FALSE(ical_expand_next(&expand, &event, &e_event));
+    TEST_ASSERT_FALSE(ical_expand_next(&expand, &event, &e_event));
+    TEST_ASSERT_TRUE(count > 0);
+}
+
+void test_ical_expand_matches_repeated_search(void)
+{
+    time_t e_from = civil_from_tm(&t_start) - ONE_DAY;
+
+    // Whole range, including the first START and the last event
+    ical_set_time_struct(&ical.t_end, 2016, 11, 24, 16, 0, 0);
+    _assert_expand_matches_search(e_from, civil_from_tm(&ical.t_end) + 1);
+
+    // Overnight schedule on some days, starting on a skipped day
+    ical_set_time_struct(&ical.t_start, 2016, 10, 23, 20, 0, 0);
+    ical_set_time_struct(&ical.t_end, 2016, 12, 24, 8, 0, 0);
+    ical.interval = 45;
+    ical.byday = MO|TH;
+    _assert_expand_matches_search(e_from, e_from + 30*ONE_DAY);
+
+    // Count limit in every day's schedule
+    ical.freq = HOURLY;
+    ical.interval = 1;
+    ical.count = 3;
+    _assert_expand_matches_search(e_from, e_from + 14*ONE_DAY);
+
+    ical.freq = LIMITS;
+    ical.count = 0;
+    _assert_expand_matches_search(e_from, e_from + 14*ONE_DAY);
+
+    // Range starting inside a day's schedule
+    ical.freq = SECONDLY;
+    ical.interval = 7;
+    ical.byday = EVERYDAY;
+    _assert_expand_matches_search(e_from + 5*ONE_DAY + 3*ONE_HOUR + 13, e_from + 8*ONE_DAY);
+}
+
+void test_ical_expand_matches_repeated_search_with_timezone(void)
+{
+    TZTABLE tz;
+    if(!tz_load(&tz, "America/New_York")){
+        TEST_IGNORE_MESSAGE("zoneinfo not available");
+    }
+    ical.tz = &tz;
+
+    // Across the end of daylight saving time
+    ical_set_time_struct(&ical.t_start, 2016, 10, 24, 0, 30, 0);
+    ical.interval = 20;
+    ical_set_time_struct(&t_now, 2016, 11, 4, 0, 0, 0);
+    _assert_expand_matches_search(civil_from_tm(&t_now), civil_from_tm(&t_now) + 4*ONE_DAY);
+
+    tz_free(&tz);
+}
+
+typedef struct{
+    uint32_t count;
+    uint32_t limit;
+}expand_count_t;
+
+static bool _count_events(void *arg, ICALEVENT event, time_t e_event)
+{
+    expand_count_t *c = arg;
+    (void)event;
+    (void)e_event;
+    return ++c->count < c->limit;
+}
+
+void test_ical_expand_calls_fn_for_each_event(void)
+{
+    expand_count_t c = {0, 100};
+    ical_set_time_struct(&t_now, 2016, 10, 24, 8, 0, 0);
+    time_t e_from = civil_from_tm(&t_now);
+
+    // 08:00 to 09:00 includes 08:00 but not 09:00
+    TEST_ASSERT_EQUAL_UINT32(12, ical_expand(&ical, e_from, e_from + ONE_HOUR, _count_events, &c));
+    TEST_ASSERT_EQUAL_UINT32(12, c.count);
+
+    // Stops when fn returns false
+    c.count = 0;
+    c.limit = 5;
+    TEST_ASSERT_EQUAL_UINT32(5, ical_expand(&ical, e_from, e_from + ONE_HOUR, _count_events, &c));
+    TEST_ASSERT_EQUAL_UINT32(0, ical_expand(&ical, e_from, e_from, _count_events, &c));
+}
@@ -0,0 +1,137 @@
+#include "ical_batch.h"
+#include "civil.h"
+#include "unity.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#define COUNT 203
+
+static ical_batch_t batch;
+static ICALRECORD records[COUNT];
+static uint8_t events[COUNT];
+static time_t epochs[COUNT];
+
+void setUp(void)
+{
+    ical_batch_init(&batch);
+    TEST_ASSERT_TRUE(ical_batch_reserve(&batch, COUNT));
+}
+
+void tearDown(void)
+{
+    ical_batch_free(&batch);
+}
+
+static void _random_records(void)
+{
+    ICAL ical;
+
+    for(uint32_t i = 0; i < COUNT; i++){
+        ical_get_defaults(&ical);
+        ical_set_time_struct(&ical.t_start, 2016, 1, 1 + rand()%28, rand()%24, rand()%60, rand()%60);
+        ical_set_time_struct(&ical.t_end, 2016, 3 + rand()%2, 1 + rand()%28, rand()%24, rand()%60, rand()%60);
+        ical.freq = (FREQ)(rand()%4);
+        ical.interval = 1 + rand()%90;
+        ical.byday = (BYDAY)(1 + rand()%127);
+        ical.count = rand()%8 ? 0 : 1 + rand()%5;
+        ical.enabled = rand()%8 != 0;
+        ical_compile(&ical, &records[i]);
+        ical_batch_set(&batch, i, &records[i]);
+    }
+}
+
+// Every instruction set must match ical_record_find_next_epoch
+static void _assert_matches_records(time_t e_current, uint32_t *fast)
+{
+    ICAL_BATCH_ISA best = ical_batch_get_isa();
+
+    for(int isa = ICAL_BATCH_SCALAR; isa <= (int)best; isa++){
+        batch.isa = (ICAL_BATCH_ISA)isa;
+        ical_batch_find_next_epoch(&batch, 0, COUNT, e_current, events, epochs);
+
+        for(uint32_t i = 0; i < COUNT; i++){
+            time_t e_next;
+            ICALEVENT event = ical_record_find_next_epoch(&records[i], e_current, &e_next);
+            if(events[i] == ICAL_BATCH_SLOW){
+                continue;
+            }
+            *fast += isa == ICAL_BATCH_SCALAR;
+            TEST_ASSERT_EQUAL(event, events[i]);
+            TEST_ASSERT_TRUE(e_next == epochs[i]);
+        }
+    }
+}
+
+void test_ical_batch_matches_ical_record(void)
+{
+    struct tm t_now;
+    uint32_t fast = 0;
+
+    srand(3);
+    for(uint32_t round = 0; round < 20; round++){
+        _random_records();
+        ical_set_time_struct(&t_now, 2016, 2, 1 + rand()%28, rand()%24, rand()%60, rand()%60);
+        time_t e_current = civil_from_tm(&t_now);
+
+        for(uint32_t step = 0; step < 50; step++){
+            _assert_matches_records(e_current, &fast);
+            e_current += rand()%3 ? rand()%900 : rand()%(2*CIVIL_ONE_DAY);
+        }
+    }
+
+    // Most of the schedules should be calculated by the batch
+    TEST_ASSERT_TRUE(fast > 20*50*COUNT/2);
+}
+
+void test_ical_batch_slow_schedules(void)
+{
+    ICAL ical;
+    struct tm t_now;
+    ical_get_defaults(&ical);
+    ical.enabled = true;
+    ical_set_time_struct(&t_now, 2018, 2, 23, 11, 20, 0);
+    time_t e_current = civil_from_tm(&t_now);
+
+    // Before the start date
+    ical_set_time_struct(&ical.t_start, 2019, 1, 1, 8, 0, 0);
+    ical_compile(&ical, &records[0]);
+    ical_batch_set(&batch, 0, &records[0]);
+    // Count rule
+    ical_get_defaults(&ical);
+    ical.enabled = true;
+    ical.count = 3;
+    ical_compile(&ical, &records[1]);
+    ical_batch_set(&batch, 1, &records[1]);
+    // Cleared
+    ical.count = 0;
+    ical_compile(&ical, &records[2]);
+    ical_batch_set(&batch, 2, &records[2]);
+    ical_batch_clear(&batch, 2);
+    // Calculated: 5 minutes past 11:20 on a Friday
+    ical_compile(&ical, &records[3]);
+    ical_batch_set(&batch, 3, &records[3]);
+
+    ical_batch_find_next_epoch(&batch, 0, 4, e_current, events, epochs);
+    TEST_ASSERT_EQUAL(ICAL_BATCH_SLOW, events[0]);
+    TEST_ASSERT_EQUAL(ICAL_BATCH_SLOW, events[1]);
+    TEST_ASSERT_EQUAL(ICAL_BATCH_SLOW, events[2]);
+    TEST_ASSERT_EQUAL(ICALEVENT_RECUR, events[3]);
+    TEST_ASSERT_TRUE(e_current + 5*60 == epochs[3]);
+}
+
+void test_ical_batch_static_buffer(void)
+{
+    static int32_t buffer[(ICAL_BATCH_BUFFER_SIZE(8) + 3)/4];
+    ical_batch_t b;
+
+    ical_batch_init_static(&b, buffer, 8);
+    TEST_ASSERT_FALSE(ical_batch_reserve(&b, 9));
+    TEST_ASSERT_TRUE((void*)b.fast < (void*)((uint8_t*)buffer + sizeof(buffer)));
+
+    // Nothing is calculated until it is set
+    ical_batch_find_next_epoch(&b, 0, 8, 0, events, epochs);
+    for(uint32_t i = 0; i < 8; i++){
+        TEST_ASSERT_EQUAL(ICAL_BATCH_SLOW, events[i]);
+    }
+    ical_batch_free(&b);
+}
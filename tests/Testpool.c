@@ -0,0 +1,71 @@
+#include "pool.h"
+#include "unity.h"
+#include <stdint.h>
+
+typedef struct {
+    uint64_t a;
+    uint8_t b;
+}item_t;
+
+void setUp(void)
+{
+
+}
+
+void tearDown(void)
+{
+
+}
+
+void test_pool_items_are_contiguous_and_aligned(void)
+{
+    pool_t pool;
+    pool_init(&pool, sizeof(item_t), 4);
+
+    char *first = pool_alloc(&pool);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_EQUAL_UINT32(0, (uintptr_t)first % POOL_ALIGN);
+    for(uint32_t i = 1; i < 4; i++){
+        TEST_ASSERT_EQUAL_PTR(first + i*pool.item_size, pool_alloc(&pool));
+    }
+
+    // A new chunk is allocated once the first is used up
+    TEST_ASSERT_NOT_NULL(pool_alloc(&pool));
+    TEST_ASSERT_EQUAL_UINT32(5, pool.count);
+
+    pool_destroy(&pool);
+}
+
+void test_pool_reuses_freed_items(void)
+{
+    pool_t pool;
+    pool_init(&pool, sizeof(item_t), 4);
+
+    item_t *a = pool_alloc(&pool);
+    item_t *b = pool_alloc(&pool);
+    pool_free(&pool, a);
+
+    TEST_ASSERT_EQUAL_PTR(a, pool_alloc(&pool));
+    TEST_ASSERT_NOT_EQUAL(b, pool_alloc(&pool));
+    TEST_ASSERT_EQUAL_UINT32(3, pool.count);
+
+    pool_destroy(&pool);
+}
+
+void test_pool_static_buffer_doesnt_grow(void)
+{
+    static uint8_t buffer[3*POOL_ITEM_SIZE(sizeof(item_t)) + POOL_ALIGN];
+    pool_t pool;
+
+    // Start unaligned to check the buffer is aligned
+    uint32_t count = pool_init_static(&pool, sizeof(item_t), buffer + 1, sizeof(buffer) - 1);
+    TEST_ASSERT_EQUAL_UINT32(3, count);
+
+    for(uint32_t i = 0; i < count; i++){
+        item_t *item = pool_alloc(&pool);
+        TEST_ASSERT_NOT_NULL(item);
+        TEST_ASSERT_EQUAL_UINT32(0, (uintptr_t)item % POOL_ALIGN);
+        TEST_ASSERT_TRUE((uint8_t*)item >= buffer + 1 && (uint8_t*)(item + 1) <= buffer + sizeof(buffer));
+    }
+    TEST_ASSERT_NULL(pool_alloc(&pool));
+}
@@ -1,6 +1,17 @@
+#include <stdlib.h>
 #include "unity.h"
 #include "ical.h"
 #include "scheduler.h"
+#include "civil.h"
+#ifdef SCHEDULER_USE_TIMERFD
+#include <poll.h>
+#endif
+#ifdef SCHEDULER_USE_COMMANDS
+#include "command_queue.h"
+#endif
+#ifdef SCHEDULER_USE_SNAPSHOTS
+#include "snapshot.h"
+#endif
 
 static struct tm current_time;
 EVENT *next_event;
@@ -15,6 +26,13 @@ void assert_test_time(const struct tm *time, uint16_t year, uint8_t month, uint8
     TEST_ASSERT_EQUAL_UINT16(year, time->tm_year+1900);
 }
 
+void assert_test_epoch(time_t epoch, uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec)
+{
+    struct tm time;
+    civil_to_tm(epoch, &time);
+    assert_test_time(&time, year, month, day, hour, min, sec);
+}
+
 void setUp(void)
 {
     // Clear all schedules
@@ -120,3 +138,793 @@ void test_scheduler_get_next_events_with_overlapping_groups(void)
 }
 
 
+
+void test_scheduler_instances_are_independent(void)
+{
+    scheduler_t ctx_a, ctx_b;
+    ICAL ical_temp;
+
+    scheduler_init_r(&ctx_a);
+    scheduler_init_r(&ctx_b);
+
+    ical_get_defaults(&ical_temp);
+    ical_temp.enabled = true;
+    scheduler_add_r(&ctx_a, 0, &ical_temp); // id: 0 in ctx_a
+    scheduler_add_r(&ctx_a, 1, &ical_temp); // id: 1 in ctx_a
+    scheduler_add_r(&ctx_b, 3, &ical_temp); // id: 0 in ctx_b
+
+    TEST_ASSERT_NOT_NULL(scheduler_get_schedule_by_id_r(&ctx_a, 1));
+    TEST_ASSERT_NULL(scheduler_get_schedule_by_id_r(&ctx_b, 1));
+    // Default instance is untouched
+    TEST_ASSERT_NULL(scheduler_get_schedule_by_id(0));
+
+    scheduler_update_events_r(&ctx_b, &current_time);
+    TEST_ASSERT_NULL(scheduler_get_event_by_group_r(&ctx_a, 3));
+    EVENT* event = scheduler_get_event_by_group_r(&ctx_b, 3);
+    TEST_ASSERT_NOT_NULL(event);
+    TEST_ASSERT_EQUAL_UINT8(0, event->id);
+
+    scheduler_clear_r(&ctx_a);
+    scheduler_clear_r(&ctx_b);
+}
+
+void test_scheduler_get_next_event_returns_earliest_event(void)
+{
+    ICAL ical_temp;
+
+    ical_get_defaults(&ical_temp);
+    ical_temp.enabled = true;
+    ical_temp.interval = 20;
+    scheduler_add(0, &ical_temp); // id: 0
+    ical_temp.interval = 15;
+    scheduler_add(1, &ical_temp); // id: 1
+    ical_temp.interval = 7;
+    scheduler_add(2, &ical_temp); // id: 2
+
+    TEST_ASSERT_NULL(scheduler_get_next_event());
+
+    // 11:20 is a multiple of 20 minutes after 08:00, next is 11:40
+    // for id 0, 11:30 for id 1 and 11:23 for id 2
+    scheduler_update_events(&current_time);
+    EVENT* event = scheduler_get_next_event();
+
+    TEST_ASSERT_NOT_NULL(event);
+    TEST_ASSERT_EQUAL_UINT8(2, event->id);
+    TEST_ASSERT_EQUAL_UINT8(2, event->group);
+    assert_test_epoch(event->epoch, 2018, 2, 23, 11, 23, 0);
+}
+
+void test_scheduler_update_events_advances_passed_events(void)
+{
+    ICAL ical_temp;
+
+    ical_get_defaults(&ical_temp);
+    ical_temp.enabled = true;
+    ical_temp.interval = 20;
+    scheduler_add(0, &ical_temp); // id: 0
+    ical_temp.interval = 15;
+    scheduler_add(0, &ical_temp); // id: 1
+
+    scheduler_update_events(&current_time);
+    EVENT* event = scheduler_get_event_by_group(0);
+    TEST_ASSERT_EQUAL_UINT8(1, event->id);
+    assert_test_epoch(event->epoch, 2018, 2, 23, 11, 30, 0);
+
+    // Step to the event, id 0 is now the earliest at 11:40
+    current_time.tm_min = 30;
+    scheduler_update_events(&current_time);
+    event = scheduler_get_event_by_group(0);
+    TEST_ASSERT_EQUAL_UINT8(0, event->id);
+    assert_test_epoch(event->epoch, 2018, 2, 23, 11, 40, 0);
+
+    // Both schedules have an event at 12:00, the first added is used
+    current_time.tm_min = 45;
+    scheduler_update_events(&current_time);
+    event = scheduler_get_event_by_group(0);
+    TEST_ASSERT_EQUAL_UINT8(0, event->id);
+    assert_test_epoch(event->epoch, 2018, 2, 23, 12, 0, 0);
+}
+
+void test_scheduler_update_events_when_time_goes_backwards(void)
+{
+    ICAL ical_temp;
+
+    ical_get_defaults(&ical_temp);
+    ical_temp.enabled = true;
+    ical_temp.interval = 20;
+    scheduler_add(0, &ical_temp); // id: 0
+
+    scheduler_update_events(&current_time);
+    EVENT* event = scheduler_get_event_by_group(0);
+    assert_test_epoch(event->epoch, 2018, 2, 23, 11, 40, 0);
+
+    current_time.tm_hour = 9;
+    scheduler_update_events(&current_time);
+    event = scheduler_get_event_by_group(0);
+    assert_test_epoch(event->epoch, 2018, 2, 23, 9, 40, 0);
+}
+
+void test_scheduler_add_after_update_keeps_other_events(void)
+{
+    ICAL ical_temp;
+
+    ical_get_defaults(&ical_temp);
+    ical_temp.enabled = true;
+    ical_temp.interval = 20;
+    scheduler_add(0, &ical_temp); // id: 0
+
+    scheduler_update_events(&current_time);
+
+    ical_temp.interval = 15;
+    scheduler_add(1, &ical_temp); // id: 1
+    current_time.tm_min = 21;
+    scheduler_update_events(&current_time);
+
+    EVENT* event = scheduler_get_event_by_group(0);
+    assert_test_epoch(event->epoch, 2018, 2, 23, 11, 40, 0);
+    event = scheduler_get_event_by_group(1);
+    assert_test_epoch(event->epoch, 2018, 2, 23, 11, 30, 0);
+    TEST_ASSERT_EQUAL_UINT8(1, scheduler_get_next_event()->id);
+}
+
+void test_scheduler_invalidate_recalculates_edited_schedule(void)
+{
+    ICAL ical_temp;
+
+    ical_get_defaults(&ical_temp);
+    ical_temp.enabled = true;
+    ical_temp.interval = 20;
+    scheduler_add(0, &ical_temp); // id: 0
+
+    scheduler_update_events(&current_time);
+    assert_test_epoch(scheduler_get_event_by_group(0)->epoch, 2018, 2, 23, 11, 40, 0);
+
+    // The cached event is kept until the schedule is invalidated
+    scheduler_get_schedule_by_id(0)->ical.interval = 15;
+    scheduler_update_events(&current_time);
+    assert_test_epoch(scheduler_get_event_by_group(0)->epoch, 2018, 2, 23, 11, 40, 0);
+
+    TEST_ASSERT_TRUE(scheduler_invalidate(0));
+    TEST_ASSERT_FALSE(scheduler_invalidate(1));
+    scheduler_update_events(&current_time);
+    assert_test_epoch(scheduler_get_event_by_group(0)->epoch, 2018, 2, 23, 11, 30, 0);
+}
+
+void test_scheduler_add_returns_false_at_capacity(void)
+{
+    ICAL ical_temp;
+    ical_get_defaults(&ical_temp);
+
+    TEST_ASSERT_TRUE(scheduler_set_capacity(2));
+    TEST_ASSERT_TRUE(scheduler_add(0, &ical_temp)); // id: 0
+    TEST_ASSERT_TRUE(scheduler_add(1000000, &ical_temp)); // id: 1
+    TEST_ASSERT_FALSE(scheduler_add(0, &ical_temp));
+
+    // Can't go below the number of schedules or above the id range
+    TEST_ASSERT_FALSE(scheduler_set_capacity(1));
+    TEST_ASSERT_FALSE(scheduler_set_capacity(SCHEDULER_MAX_CAPACITY + 1));
+    TEST_ASSERT_TRUE(scheduler_set_capacity(3));
+    TEST_ASSERT_TRUE(scheduler_add(0, &ical_temp)); // id: 2
+
+    TEST_ASSERT_EQUAL_UINT32(1000000, scheduler_get_schedule_by_id(1)->group);
+    TEST_ASSERT_TRUE(scheduler_set_capacity(MAX_SCHEDULES));
+}
+
+void test_scheduler_removed_schedule_id_is_not_found(void)
+{
+    ICAL ical_temp;
+    ical_get_defaults(&ical_temp);
+
+    scheduler_add(0, &ical_temp); // id: 0
+    scheduler_add(0, &ical_temp); // id: 1
+    scheduler_remove_last();
+
+    TEST_ASSERT_NULL(scheduler_get_schedule_by_id(1));
+
+    // The index is reused with a new generation
+    scheduler_add(0, &ical_temp);
+    TEST_ASSERT_NULL(scheduler_get_schedule_by_id(1));
+    SCHEDULE *sched = scheduler_get_schedule_by_id(SCHEDULER_ID(1, 1));
+    TEST_ASSERT_NOT_NULL(sched);
+    TEST_ASSERT_EQUAL_UINT32(SCHEDULER_ID(1, 1), sched->id);
+    TEST_ASSERT_NOT_NULL(scheduler_get_schedule_by_id(0));
+}
+
+void test_scheduler_init_static_uses_buffer_capacity(void)
+{
+    static uint8_t buffer[SCHEDULER_BUFFER_SIZE(3)];
+    ICAL ical_temp;
+
+    ical_get_defaults(&ical_temp);
+    ical_temp.enabled = true;
+    ical_temp.interval = 20;
+
+    TEST_ASSERT_FALSE(scheduler_init_static(buffer, SCHEDULER_BUFFER_SIZE(0)));
+    TEST_ASSERT_TRUE(scheduler_init_static(buffer, sizeof(buffer)));
+    TEST_ASSERT_FALSE(scheduler_set_capacity(4));
+
+    TEST_ASSERT_TRUE(scheduler_add(0, &ical_temp)); // id: 0
+    TEST_ASSERT_TRUE(scheduler_add(1, &ical_temp)); // id: 1
+    TEST_ASSERT_TRUE(scheduler_add(2, &ical_temp)); // id: 2
+    TEST_ASSERT_FALSE(scheduler_add(3, &ical_temp));
+
+    scheduler_update_events(&current_time);
+    EVENT *event = scheduler_get_event_by_group(2);
+    TEST_ASSERT_TRUE((uint8_t*)event >= buffer && (uint8_t*)event < buffer + sizeof(buffer));
+    assert_test_epoch(event->epoch, 2018, 2, 23, 11, 40, 0);
+
+    // Clearing keeps the buffer
+    scheduler_clear();
+    TEST_ASSERT_TRUE(scheduler_add(0, &ical_temp));
+    scheduler_update_events(&current_time);
+    TEST_ASSERT_TRUE((uint8_t*)scheduler_get_event_by_group(0) >= buffer);
+    scheduler_init();
+}
+
+void test_scheduler_iterates_schedules_in_order_added(void)
+{
+    ICAL ical_temp;
+    ical_get_defaults(&ical_temp);
+
+    scheduler_add(2, &ical_temp); // id: 0
+    scheduler_add(0, &ical_temp); // id: 1
+    scheduler_add(1, &ical_temp); // id: 2
+
+    uint32_t groups[] = {2, 0, 1};
+    uint32_t count = 0;
+    SCHEDULE *sched = scheduler_get_first_schedule();
+    while(sched){
+        TEST_ASSERT_EQUAL_UINT32(count, sched->id);
+        TEST_ASSERT_EQUAL_UINT32(groups[count], sched->group);
+        count++;
+        sched = scheduler_get_next_schedule(sched);
+    }
+    TEST_ASSERT_EQUAL_UINT32(3, count);
+
+    scheduler_clear();
+    TEST_ASSERT_NULL(scheduler_get_first_schedule());
+}
+
+void test_scheduler_remove_from_middle(void)
+{
+    ICAL ical_temp;
+
+    ical_get_defaults(&ical_temp);
+    ical_temp.enabled = true;
+    ical_temp.interval = 20;
+    scheduler_add(0, &ical_temp); // id: 0
+    ical_temp.interval = 15;
+    scheduler_add(0, &ical_temp); // id: 1
+    ical_temp.interval = 10;
+    scheduler_add(1, &ical_temp); // id: 2
+
+    scheduler_update_events(&current_time);
+    TEST_ASSERT_EQUAL_UINT32(1, scheduler_get_event_by_group(0)->id);
+
+    // Removing the schedule with the group's event updates the group
+    TEST_ASSERT_TRUE(scheduler_remove(1));
+    TEST_ASSERT_FALSE(scheduler_remove(1));
+    TEST_ASSERT_NULL(scheduler_get_schedule_by_id(1));
+    EVENT *event = scheduler_get_event_by_group(0);
+    TEST_ASSERT_EQUAL_UINT32(0, event->id);
+    assert_test_epoch(event->epoch, 2018, 2, 23, 11, 40, 0);
+
+    // The other schedules keep their ids
+    TEST_ASSERT_EQUAL_UINT32(2, scheduler_get_schedule_by_id(2)->id);
+    TEST_ASSERT_EQUAL_UINT32(2, scheduler_get_next_event()->id);
+
+    // Removing the last schedule of a group removes the group
+    TEST_ASSERT_TRUE(scheduler_remove(2));
+    TEST_ASSERT_NULL(scheduler_get_event_by_group(1));
+    TEST_ASSERT_EQUAL_UINT32(1, scheduler_get_default()->schedule_count);
+}
+
+void test_scheduler_update_replaces_ical(void)
+{
+    ICAL ical_temp;
+
+    ical_get_defaults(&ical_temp);
+    ical_temp.enabled = true;
+    ical_temp.interval = 20;
+    scheduler_add(0, &ical_temp); // id: 0
+    scheduler_add(0, &ical_temp); // id: 1
+
+    scheduler_update_events(&current_time);
+    EVENT *event = scheduler_get_event_by_group(0);
+    TEST_ASSERT_EQUAL_UINT32(0, event->id);
+
+    ical_temp.interval = 15;
+    TEST_ASSERT_TRUE(scheduler_update(1, &ical_temp));
+    TEST_ASSERT_FALSE(scheduler_update(2, &ical_temp));
+    TEST_ASSERT_EQUAL_UINT8(15, scheduler_get_schedule_by_id(1)->ical.interval);
+
+    scheduler_update_events(&current_time);
+    event = scheduler_get_event_by_group(0);
+    TEST_ASSERT_EQUAL_UINT32(1, event->id);
+    assert_test_epoch(event->epoch, 2018, 2, 23, 11, 30, 0);
+}
+
+void test_scheduler_group_event_is_earliest_schedule_of_group(void)
+{
+    ICAL ical_temp;
+    uint32_t ids[60];
+    uint32_t count = 0;
+
+    // Few groups with many schedules each, so the group's order is
+    // changed at almost every update
+    srand(3);
+    TEST_ASSERT_TRUE(scheduler_set_capacity(60));
+    for(uint32_t i = 0; i < 60; i++){
+        ical_get_defaults(&ical_temp);
+        ical_temp.enabled = true;
+        ical_temp.interval = 1 + rand()%30;
+        TEST_ASSERT_TRUE(scheduler_add(i%3, &ical_temp));
+        ids[count++] = i;
+    }
+
+    time_t now = civil_from_tm(&current_time);
+    for(uint32_t tick = 0; tick < 200; tick++){
+        struct tm t_now;
+        civil_to_tm(now + 60*(time_t)tick, &t_now);
+
+        // Edit and remove schedules between updates
+        uint32_t i = (uint32_t)rand()%count;
+        ical_get_defaults(&ical_temp);
+        ical_temp.enabled = rand()%4 != 0;
+        ical_temp.interval = 1 + rand()%30;
+        TEST_ASSERT_TRUE(scheduler_update(ids[i], &ical_temp));
+        if(tick%10 == 9 && count > 6){
+            i = (uint32_t)rand()%count;
+            TEST_ASSERT_TRUE(scheduler_remove(ids[i]));
+            ids[i] = ids[--count];
+        }
+        scheduler_update_events(&t_now);
+
+        // Each group's event is the earliest of its schedules, the
+        // first added on a tie
+        EVENT expected[3];
+        for(uint32_t group = 0; group < 3; group++){
+            expected[group].epoch = ICAL_EPOCH_NEVER;
+        }
+        SCHEDULE *schedule = scheduler_get_first_schedule();
+        while(schedule){
+            struct tm t_next;
+            if(ical_is_event(ical_find_next_event(&schedule->ical, &t_now, &t_next))){
+                time_t epoch = civil_from_tm(&t_next);
+                if(epoch < expected[schedule->group].epoch){
+                    expected[schedule->group].epoch = epoch;
+                    expected[schedule->group].id = schedule->id;
+                }
+            }
+            schedule = scheduler_get_next_schedule(schedule);
+        }
+        for(uint32_t group = 0; group < 3; group++){
+            EVENT *event = scheduler_get_event_by_group(group);
+            TEST_ASSERT_NOT_NULL(event);
+            if(expected[group].epoch == ICAL_EPOCH_NEVER){
+                TEST_ASSERT_FALSE(ical_is_event(event->ical_event));
+            }else{
+                TEST_ASSERT_TRUE(expected[group].epoch == event->epoch);
+                TEST_ASSERT_EQUAL_UINT32(expected[group].id, event->id);
+            }
+        }
+    }
+}
+
+void test_scheduler_add_batch(void)
+{
+    ICAL icals[3];
+    uint32_t groups[] = {0, 1, 0};
+
+    for(uint8_t i = 0; i < 3; i++){
+        ical_get_defaults(&icals[i]);
+        icals[i].enabled = true;
+        icals[i].interval = 20 - 5*i;
+    }
+
+    TEST_ASSERT_TRUE(scheduler_add_batch(icals, groups, 3));
+    TEST_ASSERT_EQUAL_UINT32(1, scheduler_get_schedule_by_id(1)->group);
+
+    scheduler_update_events(&current_time);
+    EVENT *event = scheduler_get_event_by_group(0);
+    TEST_ASSERT_EQUAL_UINT32(2, event->id);
+    assert_test_epoch(event->epoch, 2018, 2, 23, 11, 30, 0);
+    event = scheduler_get_event_by_group(1);
+    TEST_ASSERT_EQUAL_UINT32(1, event->id);
+    assert_test_epoch(event->epoch, 2018, 2, 23, 11, 30, 0);
+
+    // Added to a scheduler with schedules, only those are calculated
+    groups[0] = 2;
+    TEST_ASSERT_TRUE(scheduler_add_batch(icals, groups, 1));
+    scheduler_update_events(&current_time);
+    TEST_ASSERT_EQUAL_UINT32(3, scheduler_get_event_by_group(2)->id);
+}
+
+void test_scheduler_add_batch_adds_nothing_on_error(void)
+{
+    ICAL icals[3];
+    uint32_t groups[] = {0, 1, 2};
+
+    for(uint8_t i = 0; i < 3; i++){
+        ical_get_defaults(&icals[i]);
+    }
+    icals[1].byday = 0;
+
+    TEST_ASSERT_FALSE(scheduler_add_batch(icals, groups, 3));
+    TEST_ASSERT_NULL(scheduler_get_first_schedule());
+    TEST_ASSERT_NULL(scheduler_get_event_by_group(0));
+
+    // More than the capacity
+    icals[1].byday = EVERYDAY;
+    TEST_ASSERT_TRUE(scheduler_set_capacity(2));
+    TEST_ASSERT_FALSE(scheduler_add_batch(icals, groups, 3));
+    TEST_ASSERT_NULL(scheduler_get_first_schedule());
+    TEST_ASSERT_TRUE(scheduler_add_batch(icals, groups, 2));
+    TEST_ASSERT_TRUE(scheduler_set_capacity(MAX_SCHEDULES));
+
+    // A failed batch leaves the ids given out next as they were
+    TEST_ASSERT_TRUE(scheduler_remove(0));
+    icals[1].byday = 0;
+    groups[0] = 3;
+    TEST_ASSERT_FALSE(scheduler_add_batch(icals, groups, 2));
+    TEST_ASSERT_NULL(scheduler_get_event_by_group(3));
+    TEST_ASSERT_TRUE(scheduler_add(4, &icals[0]));
+    TEST_ASSERT_EQUAL_UINT32(4, scheduler_get_schedule_by_id(SCHEDULER_ID(0, 1))->group);
+    TEST_ASSERT_TRUE(scheduler_add(5, &icals[0]));
+    TEST_ASSERT_EQUAL_UINT32(5, scheduler_get_schedule_by_id(2)->group);
+}
+
+#ifdef SCHEDULER_USE_THREADS
+void test_scheduler_threads_match_single_thread(void)
+{
+    static scheduler_t single, threaded;
+    ICAL ical;
+    uint32_t count = 2*SCHEDULER_THREAD_MIN_SCHEDULES;
+
+    TEST_ASSERT_FALSE(scheduler_set_threads(0));
+    TEST_ASSERT_FALSE(scheduler_set_threads(SCHEDULER_MAX_THREADS + 1));
+
+    scheduler_init_r(&single);
+    scheduler_init_r(&threaded);
+    TEST_ASSERT_TRUE(scheduler_set_capacity_r(&single, count));
+    TEST_ASSERT_TRUE(scheduler_set_capacity_r(&threaded, count));
+    TEST_ASSERT_TRUE(scheduler_set_threads_r(&threaded, 4));
+
+    // Many schedules share an event, so ties decide most groups
+    srand(1);
+    for(uint32_t i = 0; i < count; i++){
+        ical_get_defaults(&ical);
+        ical.enabled = rand()%8 != 0;
+        ical.interval = 5*(1 + rand()%4);
+        uint32_t group = rand()%100;
+        TEST_ASSERT_TRUE(scheduler_add_r(&single, group, &ical));
+        TEST_ASSERT_TRUE(scheduler_add_r(&threaded, group, &ical));
+    }
+
+    scheduler_update_events_r(&single, &current_time);
+    scheduler_update_events_r(&threaded, &current_time);
+    for(uint32_t group = 0; group < 100; group++){
+        EVENT *expected = scheduler_get_event_by_group_r(&single, group);
+        EVENT *event = scheduler_get_event_by_group_r(&threaded, group);
+        TEST_ASSERT_NOT_NULL(event);
+        TEST_ASSERT_EQUAL_UINT32(expected->id, event->id);
+        TEST_ASSERT_EQUAL_INT64(expected->epoch, event->epoch);
+    }
+
+    // Threads are kept when cleared
+    scheduler_clear_r(&threaded);
+    TEST_ASSERT_NOT_NULL(threaded.threads);
+    TEST_ASSERT_TRUE(scheduler_set_threads_r(&threaded, 1));
+    TEST_ASSERT_NULL(threaded.threads);
+    scheduler_clear_r(&single);
+}
+#endif
+
+void test_scheduler_next_events(void)
+{
+    ICAL ical_temp;
+    EVENT events[8];
+
+    ical_get_defaults(&ical_temp);
+    ical_temp.enabled = true;
+    ical_temp.interval = 20;
+    scheduler_add(0, &ical_temp); // id: 0
+    ical_temp.interval = 15;
+    scheduler_add(1, &ical_temp); // id: 1
+    ical_temp.interval = 10;
+    scheduler_add(1, &ical_temp); // id: 2
+
+    // Group 1 has one event at 11:30 and 12:00, from the schedule
+    // added first
+    TEST_ASSERT_EQUAL_UINT32(8, scheduler_next_events(&current_time, 8, events));
+    uint32_t ids[] = {1, 0, 2, 1, 2, 0, 1, 2};
+    uint8_t hours[] = {11, 11, 11, 11, 11, 12, 12, 12};
+    uint8_t mins[] = {30, 40, 40, 45, 50, 0, 0, 10};
+    for(uint8_t i = 0; i < 8; i++){
+        TEST_ASSERT_EQUAL_UINT32(ids[i], events[i].id);
+        TEST_ASSERT_EQUAL(ICALEVENT_RECUR, events[i].ical_event);
+        assert_test_epoch(events[i].epoch, 2018, 2, 23, hours[i], mins[i], 0);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, events[0].group);
+    TEST_ASSERT_EQUAL_UINT32(0, events[1].group);
+
+    // Matches the first event given by an update
+    scheduler_update_events(&current_time);
+    TEST_ASSERT_EQUAL_UINT32(1, scheduler_next_events(&current_time, 1, events));
+    TEST_ASSERT_EQUAL_UINT32(scheduler_get_next_event()->id, events[0].id);
+
+    // Fewer events than asked for at the end of the schedules
+    ical_set_time_struct(&current_time, 2020, 12, 31, 16, 30, 0);
+    TEST_ASSERT_EQUAL_UINT32(6, scheduler_next_events(&current_time, 8, events));
+    assert_test_epoch(events[5].epoch, 2020, 12, 31, 17, 0, 0);
+}
+
+void test_scheduler_next_events_matches_expanded_schedules(void)
+{
+    static scheduler_t ctx;
+    static EVENT events[500];
+    static EVENT expected[2000];
+    ICAL icals[40];
+    uint32_t count = 0;
+
+    scheduler_init_r(&ctx);
+    TEST_ASSERT_TRUE(scheduler_set_capacity_r(&ctx, 40));
+
+    // Few groups and short intervals, so there are many ties
+    srand(2);
+    time_t now = civil_from_tm(&current_time);
+    for(uint32_t i = 0; i < 40; i++){
+        ical_get_defaults(&icals[i]);
+        icals[i].enabled = true;
+        icals[i].interval = 5*(1 + rand()%6);
+        icals[i].byday = 1 + rand()%0x7F;
+        icals[i].count = rand()%3 == 0 ? 4 : 0;
+        TEST_ASSERT_TRUE(scheduler_add_r(&ctx, rand()%4, &icals[i]));
+
+        ICALEXPAND expand;
+        ical_expand_init(&expand, &icals[i], now + 1, now + 3*24*60*60);
+        while(count < 2000 && ical_expand_next(&expand, &expected[count].ical_event, &expected[count].epoch)){
+            expected[count].id = i;
+            expected[count++].group = scheduler_get_schedule_by_id_r(&ctx, i)->group;
+        }
+    }
+    TEST_ASSERT_TRUE(count < 2000);
+
+    // Sort by time then by the order added, keeping the first of a
+    // group at each time
+    for(uint32_t i = 1; i < count; i++){
+        EVENT e = expected[i];
+        uint32_t j = i;
+        while(j > 0 && (expected[j - 1].epoch > e.epoch || (expected[j - 1].epoch == e.epoch && expected[j - 1].id > e.id))){
+            expected[j] = expected[j - 1];
+            j--;
+        }
+        expected[j] = e;
+    }
+    uint32_t unique = 0;
+    for(uint32_t i = 0; i < count; i++){
+        bool found = false;
+        for(uint32_t j = unique; j-- > 0 && expected[j].epoch == expected[i].epoch;){
+            found = found || expected[j].group == expected[i].group;
+        }
+        if(!found){
+            expected[unique++] = expected[i];
+        }
+    }
+    TEST_ASSERT_TRUE(unique >= 500);
+
+    // Fewer events than schedules only merges some of them
+    uint32_t sizes[] = {1, 7, 20, 500};
+    for(uint32_t n = 0; n < 4; n++){
+        TEST_ASSERT_EQUAL_UINT32(sizes[n], scheduler_next_events_r(&ctx, &current_time, sizes[n], events));
+        for(uint32_t i = 0; i < sizes[n]; i++){
+            TEST_ASSERT_EQUAL_UINT32(expected[i].id, events[i].id);
+            TEST_ASSERT_EQUAL(expected[i].ical_event, events[i].ical_event);
+            TEST_ASSERT_TRUE(expected[i].epoch == events[i].epoch);
+        }
+    }
+
+    scheduler_clear_r(&ctx);
+}
+
+void test_scheduler_next_whole_events(void)
+{
+    static scheduler_t ctx;
+    ICAL ical_temp;
+    EVENT *events = NULL;
+    uint32_t size = 0;
+
+    scheduler_init_r(&ctx);
+    TEST_ASSERT_TRUE(scheduler_set_capacity_r(&ctx, 11));
+
+    // Ten groups at every 10 minutes and one more at every 15
+    ical_get_defaults(&ical_temp);
+    ical_temp.enabled = true;
+    ical_temp.interval = 10;
+    for(uint32_t group = 0; group < 10; group++){
+        TEST_ASSERT_TRUE(scheduler_add_r(&ctx, group, &ical_temp));
+    }
+    ical_temp.interval = 15;
+    TEST_ASSERT_TRUE(scheduler_add_r(&ctx, 10, &ical_temp));
+
+    // More than n events of one time are all given
+    TEST_ASSERT_EQUAL_UINT32(11, scheduler_next_whole_events_r(&ctx, &current_time, 4, &events, &size));
+    TEST_ASSERT_EQUAL_UINT32(16, size);
+    for(uint32_t i = 0; i < 11; i++){
+        TEST_ASSERT_EQUAL_UINT32(i, events[i].id);
+        assert_test_epoch(events[i].epoch, 2018, 2, 23, 11, 30, 0);
+    }
+
+    // 11:50 is left out rather than split
+    ical_set_time_struct(&current_time, 2018, 2, 23, 11, 40, 0);
+    TEST_ASSERT_EQUAL_UINT32(1, scheduler_next_whole_events_r(&ctx, &current_time, 4, &events, &size));
+    TEST_ASSERT_EQUAL_UINT32(10, events[0].id);
+    assert_test_epoch(events[0].epoch, 2018, 2, 23, 11, 45, 0);
+
+    // The same as scheduler_next_events if the last time is whole
+    TEST_ASSERT_EQUAL_UINT32(11, scheduler_next_whole_events_r(&ctx, &current_time, 12, &events, &size));
+    assert_test_epoch(events[10].epoch, 2018, 2, 23, 11, 50, 0);
+    free(events);
+    scheduler_clear_r(&ctx);
+}
+
+#ifdef SCHEDULER_USE_TIMERFD
+void test_scheduler_fd_expires_at_next_event(void)
+{
+    static scheduler_t ctx;
+    ICAL ical;
+    EVENT events[4];
+    struct pollfd pfd;
+    time_t now = time(NULL);
+
+    scheduler_init_r(&ctx);
+    int fd = scheduler_fd_r(&ctx, NULL);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL_INT(fd, scheduler_fd_r(&ctx, NULL));
+
+    // Every second today and tomorrow in two groups, UTC
+    ical_get_defaults(&ical);
+    civil_to_tm(now - now%(24*60*60), &ical.t_start);
+    civil_to_tm(now - now%(24*60*60) + 2*24*60*60 - 1, &ical.t_end);
+    ical.freq = SECONDLY;
+    ical.interval = 1;
+    ical.byday = EVERYDAY;
+    ical.enabled = true;
+    TEST_ASSERT_TRUE(scheduler_add_r(&ctx, 0, &ical));
+    TEST_ASSERT_TRUE(scheduler_add_r(&ctx, 1, &ical));
+
+    // Adding expires the timer so the schedules are calculated
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    TEST_ASSERT_EQUAL_INT(1, poll(&pfd, 1, 0));
+    TEST_ASSERT_EQUAL_UINT32(0, scheduler_process_expired_r(&ctx, events, 4));
+    TEST_ASSERT_NOT_NULL(scheduler_get_next_event_r(&ctx));
+
+    // Both groups are due at the next second, one at a time
+    TEST_ASSERT_EQUAL_INT(1, poll(&pfd, 1, 2000));
+    TEST_ASSERT_EQUAL_UINT32(1, scheduler_process_expired_r(&ctx, events, 1));
+    TEST_ASSERT_EQUAL_UINT32(0, events[0].group);
+    TEST_ASSERT_EQUAL_INT(1, poll(&pfd, 1, 0));
+    TEST_ASSERT_EQUAL_UINT32(1, scheduler_process_expired_r(&ctx, events, 1));
+    TEST_ASSERT_EQUAL_UINT32(1, events[0].group);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    TEST_ASSERT_TRUE(events[0].epoch <= ts.tv_sec);
+
+    // Disarmed when cleared
+    scheduler_clear_r(&ctx);
+    TEST_ASSERT_EQUAL_INT(0, poll(&pfd, 1, 1100));
+    scheduler_fd_close_r(&ctx);
+}
+#endif
+
+#ifdef SCHEDULER_USE_COMMANDS
+static void _command_done(void *arg, uint32_t id, bool ok)
+{
+    uint32_t *result = arg;
+    result[0] = id;
+    result[1] = ok;
+}
+
+void test_scheduler_applies_commands_at_update(void)
+{
+    command_queue_t q;
+    ICAL ical_temp;
+    uint32_t added[2] = {0, 0};
+    uint32_t removed[2] = {0, 0};
+
+    TEST_ASSERT_TRUE(command_queue_init(&q, 8));
+    TEST_ASSERT_TRUE(scheduler_set_commands(&q));
+
+    ical_get_defaults(&ical_temp);
+    ical_temp.enabled = true;
+    ical_temp.interval = 10;
+    TEST_ASSERT_TRUE(command_queue_add(&q, 3, &ical_temp, _command_done, added));
+    TEST_ASSERT_NULL(scheduler_get_first_schedule());
+
+    // The add is applied at the start of the update, so its event is
+    // there straight away
+    scheduler_update_events(&current_time);
+    TEST_ASSERT_EQUAL_UINT32(1, added[1]);
+    SCHEDULE *sched = scheduler_get_schedule_by_id(added[0]);
+    TEST_ASSERT_NOT_NULL(sched);
+    TEST_ASSERT_EQUAL_UINT32(3, sched->group);
+    next_event = scheduler_get_event_by_group(3);
+    TEST_ASSERT_NOT_NULL(next_event);
+    TEST_ASSERT_EQUAL_UINT32(added[0], next_event->id);
+
+    // The queue is kept when the scheduler is cleared
+    scheduler_clear();
+    TEST_ASSERT_TRUE(command_queue_add(&q, 3, &ical_temp, _command_done, added));
+    TEST_ASSERT_TRUE(command_queue_remove(&q, added[0] + 1, _command_done, removed));
+    TEST_ASSERT_EQUAL_UINT32(2, scheduler_apply_commands());
+    TEST_ASSERT_EQUAL_UINT32(1, added[1]);
+    TEST_ASSERT_EQUAL_UINT32(0, removed[1]);
+    TEST_ASSERT_TRUE(command_queue_remove(&q, added[0], _command_done, removed));
+    scheduler_update_events(&current_time);
+    TEST_ASSERT_EQUAL_UINT32(added[0], removed[0]);
+    TEST_ASSERT_EQUAL_UINT32(1, removed[1]);
+    TEST_ASSERT_NULL(scheduler_get_event_by_group(3));
+
+    scheduler_set_commands(NULL);
+    command_queue_free(&q);
+}
+#endif
+
+#ifdef SCHEDULER_USE_SNAPSHOTS
+void test_scheduler_publishes_snapshots_of_group_events(void)
+{
+    snapshot_domain_t d;
+    ICAL ical_temp;
+
+    snapshot_domain_init(&d);
+    snapshot_reader_t *r = snapshot_reader_register(&d);
+    TEST_ASSERT_TRUE(scheduler_set_snapshots(&d));
+
+    ical_get_defaults(&ical_temp);
+    ical_temp.enabled = true;
+    ical_temp.interval = 20;
+    scheduler_add(7, &ical_temp); // id: 0
+    ical_temp.interval = 3;
+    scheduler_add(2, &ical_temp); // id: 1
+    scheduler_add(5, &ical_temp); // id: 2
+    scheduler_update_events(&current_time);
+
+    const snapshot_t *s = snapshot_read_begin(&d, r);
+    TEST_ASSERT_EQUAL_UINT64(1, s->version);
+    TEST_ASSERT_EQUAL_UINT32(3, s->count);
+    for(uint32_t group = 0; group < 8; group++){
+        const EVENT *event = snapshot_find_group(s, group);
+        EVENT *expected = scheduler_get_event_by_group(group);
+        if(expected == NULL){
+            TEST_ASSERT_NULL(event);
+        }else{
+            TEST_ASSERT_NOT_NULL(event);
+            TEST_ASSERT_EQUAL_UINT32(expected->id, event->id);
+            TEST_ASSERT_EQUAL_INT64(expected->epoch, event->epoch);
+        }
+    }
+    TEST_ASSERT_EQUAL_INT64(scheduler_get_next_event()->epoch, snapshot_next_event(s)->epoch);
+
+    // The snapshot stays as it is while the scheduler changes
+    scheduler_remove(1);
+    TEST_ASSERT_NOT_NULL(snapshot_find_group(s, 2));
+    snapshot_read_end(r);
+
+    // The removal is published with the next update
+    scheduler_update_events(&current_time);
+    s = snapshot_read_begin(&d, r);
+    TEST_ASSERT_EQUAL_UINT64(2, s->version);
+    TEST_ASSERT_NULL(snapshot_find_group(s, 2));
+    TEST_ASSERT_NOT_NULL(snapshot_find_group(s, 5));
+    snapshot_read_end(r);
+
+    // An update without changes keeps the snapshot
+    scheduler_update_events(&current_time);
+    TEST_ASSERT_EQUAL_UINT64(2, d.version);
+
+    scheduler_set_snapshots(NULL);
+    snapshot_reader_unregister(r);
+    snapshot_domain_destroy(&d);
+}
+#endif
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include "unity.h"
+#include "ical.h"
+#include "scheduler.h"
+#include "shards.h"
+
+#define SHARDS 4
+#define GROUPS 40
+#define SCHEDULES 200
+
+static struct tm current_time;
+static shards_t sh;
+static scheduler_t ctx;
+static uint32_t ids[SCHEDULES];
+
+void setUp(void)
+{
+    TEST_ASSERT_TRUE(shards_init(&sh, SHARDS, SCHEDULES, true));
+    scheduler_init_r(&ctx);
+    scheduler_set_capacity_r(&ctx, SCHEDULES);
+
+    current_time.tm_year = 118; /* year   */
+    current_time.tm_mon = 1;   /* month, range 0 to 11             */
+    current_time.tm_mday = 23;  /* day of the month, range 1 to 31  */
+    current_time.tm_hour = 11;  /* hours, range 0 to 23             */
+    current_time.tm_min = 20;   /* minutes, range 0 to 59           */
+    current_time.tm_sec = 0;   /* seconds,  range 0 to 59          */
+}
+
+void tearDown(void)
+{
+    shards_destroy(&sh);
+    scheduler_clear_r(&ctx);
+}
+
+// Add the same schedules to the shards and to one scheduler
+static void _add_schedules(void)
+{
+    ICAL ical;
+
+    for(uint32_t i = 0; i < SCHEDULES; i++){
+        ical_get_defaults(&ical);
+        ical.enabled = true;
+        ical.interval = 1 + (i*7)%59;
+        TEST_ASSERT_TRUE(shards_add(&sh, i%GROUPS, &ical, &ids[i]));
+        TEST_ASSERT_TRUE(scheduler_add_r(&ctx, i%GROUPS, &ical));
+    }
+}
+
+void test_shards_init_needs_a_power_of_2(void)
+{
+    shards_t other;
+
+    TEST_ASSERT_FALSE(shards_init(&other, 0, 1, false));
+    TEST_ASSERT_FALSE(shards_init(&other, 3, 1, false));
+    TEST_ASSERT_FALSE(shards_init(&other, 2*SHARDS_MAX_COUNT, 1, false));
+    TEST_ASSERT_TRUE(shards_init(&other, 1, 1, false));
+    shards_destroy(&other);
+}
+
+void test_shards_route_ids_to_the_shard_of_the_group(void)
+{
+    _add_schedules();
+    TEST_ASSERT_EQUAL_UINT32(SCHEDULES, shards_get_schedule_count(&sh));
+
+    // Groups are spread over every shard
+    for(uint32_t i = 0; i < SHARDS; i++){
+        TEST_ASSERT_TRUE(sh.shards[i].schedule_count > 0);
+    }
+
+    for(uint32_t i = 0; i < SCHEDULES; i++){
+        // Each id is unique and finds the schedule in its group's shard
+        for(uint32_t j = 0; j < i; j++){
+            TEST_ASSERT_NOT_EQUAL(ids[j], ids[i]);
+        }
+        scheduler_t *shard = shards_get_shard(&sh, i%GROUPS);
+        uint32_t local_id = ids[i] & ~((uint32_t)(SHARDS - 1) << (SCHEDULER_INDEX_BITS - 2));
+        SCHEDULE *s = scheduler_get_schedule_by_id_r(shard, local_id);
+        TEST_ASSERT_NOT_NULL(s);
+        TEST_ASSERT_EQUAL_UINT32(i%GROUPS, s->group);
+        TEST_ASSERT_EQUAL_UINT32(1 + (i*7)%59, s->ical.interval);
+    }
+
+    ICAL ical;
+    ical_get_defaults(&ical);
+    ical.interval = 5;
+    TEST_ASSERT_TRUE(shards_update(&sh, ids[3], &ical));
+    TEST_ASSERT_TRUE(shards_invalidate(&sh, ids[4]));
+    TEST_ASSERT_TRUE(shards_remove(&sh, ids[5]));
+    TEST_ASSERT_FALSE(shards_remove(&sh, ids[5]));
+    TEST_ASSERT_FALSE(shards_update(&sh, ids[5], &ical));
+    TEST_ASSERT_EQUAL_UINT32(SCHEDULES - 1, shards_get_schedule_count(&sh));
+}
+
+void test_shards_events_match_one_scheduler(void)
+{
+    EVENT event, expected[GROUPS], events[GROUPS];
+
+    _add_schedules();
+    TEST_ASSERT_FALSE(shards_get_next_event(&sh, &event));
+
+    shards_update_events(&sh, &current_time);
+    scheduler_update_events_r(&ctx, &current_time);
+
+    // Ids are assigned in the same order, so map them back by position
+    for(uint32_t group = 0; group < GROUPS; group++){
+        EVENT *e = scheduler_get_event_by_group_r(&ctx, group);
+        TEST_ASSERT_NOT_NULL(e);
+        TEST_ASSERT_TRUE(shards_get_event_by_group(&sh, group, &event));
+        TEST_ASSERT_EQUAL_UINT32(group, event.group);
+        TEST_ASSERT_EQUAL_INT64(e->epoch, event.epoch);
+        TEST_ASSERT_EQUAL_UINT32(ids[e->id], event.id);
+    }
+    TEST_ASSERT_FALSE(shards_get_event_by_group(&sh, GROUPS, &event));
+
+    TEST_ASSERT_TRUE(shards_get_next_event(&sh, &event));
+    TEST_ASSERT_EQUAL_INT64(scheduler_get_next_event_r(&ctx)->epoch, event.epoch);
+    TEST_ASSERT_EQUAL_UINT32(ids[scheduler_get_next_event_r(&ctx)->id], event.id);
+
+    // The merged events come in the same order, ties between shards
+    // going to the schedule added first
+    uint32_t n = scheduler_next_events_r(&ctx, &current_time, GROUPS, expected);
+    TEST_ASSERT_EQUAL_UINT32(n, shards_next_events(&sh, &current_time, GROUPS, events));
+    uint32_t ties = 0;
+    for(uint32_t i = 0; i < n; i++){
+        TEST_ASSERT_EQUAL_INT64(expected[i].epoch, events[i].epoch);
+        TEST_ASSERT_EQUAL_UINT32(ids[expected[i].id], events[i].id);
+        if(i > 0 && events[i - 1].epoch == events[i].epoch){
+            ties++;
+        }
+    }
+    TEST_ASSERT_TRUE(ties > 0);
+}
@@ -0,0 +1,157 @@
+#include "snapshot.h"
+#include "unity.h"
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <pthread.h>
+
+#define READERS 3
+#define PUBLISHES 20000
+#define GROUPS 8
+
+static snapshot_domain_t domain;
+static atomic_bool done;
+static atomic_uint errors;
+
+void setUp(void)
+{
+    snapshot_domain_init(&domain);
+    atomic_store(&done, false);
+    atomic_store(&errors, 0);
+}
+
+void tearDown(void)
+{
+    snapshot_domain_destroy(&domain);
+}
+
+// Snapshot of GROUPS groups, every 2nd group, with events at version
+static snapshot_t* _build(uint32_t version)
+{
+    snapshot_t *s = snapshot_alloc(GROUPS);
+
+    TEST_ASSERT_NOT_NULL(s);
+    for(uint32_t i = 0; i < GROUPS; i++){
+        s->events[i] = (EVENT){0};
+        s->events[i].group = 2*i;
+        s->events[i].epoch = version + GROUPS - i;
+    }
+    s->count = GROUPS;
+    s->next = GROUPS - 1;
+
+    return s;
+}
+
+void test_snapshot_find_group(void)
+{
+    snapshot_reader_t *r = snapshot_reader_register(&domain);
+
+    TEST_ASSERT_NOT_NULL(r);
+    TEST_ASSERT_NULL(snapshot_read_begin(&domain, r));
+    snapshot_read_end(r);
+    TEST_ASSERT_NULL(snapshot_find_group(NULL, 0));
+    TEST_ASSERT_NULL(snapshot_next_event(NULL));
+
+    snapshot_publish(&domain, _build(1));
+    const snapshot_t *s = snapshot_read_begin(&domain, r);
+    TEST_ASSERT_EQUAL_UINT64(1, s->version);
+    for(uint32_t group = 0; group < 2*GROUPS; group++){
+        const EVENT *event = snapshot_find_group(s, group);
+        if(group%2){
+            TEST_ASSERT_NULL(event);
+        }else{
+            TEST_ASSERT_NOT_NULL(event);
+            TEST_ASSERT_EQUAL_UINT32(group, event->group);
+        }
+    }
+    TEST_ASSERT_NULL(snapshot_find_group(s, 2*GROUPS));
+    TEST_ASSERT_EQUAL_UINT32(2*(GROUPS - 1), snapshot_next_event(s)->group);
+    snapshot_read_end(r);
+
+    snapshot_reader_unregister(r);
+}
+
+void test_snapshot_reader_holds_back_reclaiming(void)
+{
+    snapshot_reader_t *r = snapshot_reader_register(&domain);
+
+    snapshot_publish(&domain, _build(1));
+    const snapshot_t *s = snapshot_read_begin(&domain, r);
+
+    // The snapshot being read is retired but not freed
+    for(uint32_t i = 2; i < 10; i++){
+        snapshot_publish(&domain, _build(i));
+    }
+    TEST_ASSERT_EQUAL_UINT32(8, domain.retired_count);
+    TEST_ASSERT_EQUAL_UINT64(1, s->version);
+    TEST_ASSERT_EQUAL_UINT64(9, snapshot_find_group(s, 0)->epoch);
+
+    // Once the reader is done they are freed when the epoch is two past
+    // the one they were retired in
+    snapshot_read_end(r);
+    snapshot_reclaim(&domain);
+    snapshot_reclaim(&domain);
+    snapshot_reclaim(&domain);
+    TEST_ASSERT_EQUAL_UINT32(0, domain.retired_count);
+
+    // Idle readers don't hold anything back
+    snapshot_publish(&domain, _build(10));
+    snapshot_reclaim(&domain);
+    snapshot_reclaim(&domain);
+    TEST_ASSERT_EQUAL_UINT32(0, domain.retired_count);
+
+    snapshot_reader_unregister(r);
+}
+
+static void* _read(void *arg)
+{
+    snapshot_reader_t *r = snapshot_reader_register(&domain);
+    uint64_t last = 0;
+    (void)arg;
+
+    while(!atomic_load(&done)){
+        const snapshot_t *s = snapshot_read_begin(&domain, r);
+        if(s){
+            // Every event of a snapshot comes from the same version,
+            // and versions only go forward
+            for(uint32_t i = 0; i < GROUPS; i++){
+                const EVENT *event = snapshot_find_group(s, 2*i);
+                if(event == NULL || event->epoch != (time_t)(s->version + GROUPS - i)){
+                    atomic_fetch_add(&errors, 1);
+                }
+            }
+            if(s->version < last){
+                atomic_fetch_add(&errors, 1);
+            }
+            last = s->version;
+        }
+        snapshot_read_end(r);
+        sched_yield();
+    }
+    snapshot_reader_unregister(r);
+
+    return NULL;
+}
+
+void test_snapshot_readers_see_whole_snapshots(void)
+{
+    pthread_t threads[READERS];
+
+    for(uint32_t i = 0; i < READERS; i++){
+        TEST_ASSERT_EQUAL_INT(0, pthread_create(&threads[i], NULL, _read, NULL));
+    }
+    for(uint32_t i = 1; i <= PUBLISHES; i++){
+        snapshot_publish(&domain, _build(i));
+        if(i%64 == 0){
+            sched_yield();
+        }
+    }
+    atomic_store(&done, true);
+    for(uint32_t i = 0; i < READERS; i++){
+        pthread_join(threads[i], NULL);
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(0, atomic_load(&errors));
+    // Snapshots don't pile up while readers come and go
+    TEST_ASSERT_TRUE(domain.retired_count < PUBLISHES/2);
+}
@@ -0,0 +1,60 @@
+#include "thread_pool.h"
+#include "unity.h"
+#include <stdint.h>
+#include <pthread.h>
+
+#define THREADS 4
+#define RUNS 100
+
+static thread_pool_t pool;
+static uint32_t runs[THREADS];
+static pthread_t threads[THREADS];
+
+void setUp(void)
+{
+    for(uint32_t i = 0; i < THREADS; i++){
+        runs[i] = 0;
+    }
+}
+
+void tearDown(void)
+{
+}
+
+static void _count_run(void *arg, uint32_t index)
+{
+    uint32_t *counts = arg;
+    counts[index]++;
+    threads[index] = pthread_self();
+}
+
+void test_thread_pool_runs_every_index(void)
+{
+    TEST_ASSERT_TRUE(thread_pool_init(&pool, THREADS));
+
+    // Each run only returns after every thread is done with it
+    for(uint32_t i = 0; i < RUNS; i++){
+        thread_pool_run(&pool, _count_run, runs);
+        for(uint32_t j = 0; j < THREADS; j++){
+            TEST_ASSERT_EQUAL_UINT32(i + 1, runs[j]);
+        }
+    }
+    TEST_ASSERT_TRUE(pthread_equal(pthread_self(), threads[0]));
+    TEST_ASSERT_FALSE(pthread_equal(threads[1], threads[2]));
+
+    thread_pool_destroy(&pool);
+}
+
+void test_thread_pool_single_thread_runs_on_caller(void)
+{
+    TEST_ASSERT_TRUE(thread_pool_init(&pool, 1));
+    thread_pool_run(&pool, _count_run, runs);
+    TEST_ASSERT_EQUAL_UINT32(1, runs[0]);
+    TEST_ASSERT_TRUE(pthread_equal(pthread_self(), threads[0]));
+    thread_pool_destroy(&pool);
+}
+
+void test_thread_pool_needs_a_thread(void)
+{
+    TEST_ASSERT_FALSE(thread_pool_init(&pool, 0));
+}
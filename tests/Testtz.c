@@ -0,0 +1,128 @@
+#include "tz.h"
+#include "civil.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static TZTABLE tz;
+// TZif file written by a test, removed in tearDown
+static char tzif_path[256];
+
+static time_t _utc(int32_t year, int32_t mon, int32_t day, int32_t hour, int32_t min)
+{
+    return (time_t)civil_days_from_date(year, mon, day)*CIVIL_ONE_DAY + hour*3600 + min*60;
+}
+
+// Write a version 2 TZif file with no transitions and a POSIX TZ footer
+// to a new file under $TMPDIR and return its path
+static const char* _write_slim_tzif(int32_t utoff, const char *abbr, const char *footer)
+{
+    const char *dir = getenv("TMPDIR");
+    uint8_t header[44] = {'T', 'Z', 'i', 'f', '2'};
+    uint8_t ttinfo[6] = {(uint8_t)(utoff >> 24), (uint8_t)(utoff >> 16), (uint8_t)(utoff >> 8), (uint8_t)utoff, 0, 0};
+    header[39] = 1;                         // typecnt
+    header[43] = (uint8_t)strlen(abbr) + 1; // charcnt
+
+    snprintf(tzif_path, sizeof(tzif_path), "%s/tz_slim_test_XXXXXX", dir ? dir : "/tmp");
+    int fd = mkstemp(tzif_path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    FILE *f = fdopen(fd, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    for(int i = 0; i < 2; i++){
+        fwrite(header, 1, sizeof(header), f);
+        fwrite(ttinfo, 1, sizeof(ttinfo), f);
+        fwrite(abbr, 1, strlen(abbr) + 1, f);
+    }
+    fprintf(f, "\n%s\n", footer);
+    fclose(f);
+
+    return tzif_path;
+}
+
+void setUp(void)
+{
+    memset(&tz, 0, sizeof(tz));
+}
+
+void tearDown(void)
+{
+    tz_free(&tz);
+    if(tzif_path[0]){
+        remove(tzif_path);
+        tzif_path[0] = '\0';
+    }
+}
+
+void test_tz_load_returns_false_for_unknown_zone(void)
+{
+    TEST_ASSERT_FALSE(tz_load(&tz, "Not/A_Zone"));
+    TEST_ASSERT_FALSE(tz_load(&tz, "../../etc/passwd"));
+}
+
+void test_tz_get_utc_offset_across_dst(void)
+{
+    if(!tz_load(&tz, "America/New_York")){
+        TEST_IGNORE_MESSAGE("zoneinfo not available");
+    }
+
+    TEST_ASSERT_EQUAL_INT32(-5*3600, tz_get_utc_offset(&tz, _utc(2016, 1, 15, 12, 0)));
+    TEST_ASSERT_EQUAL_INT32(-4*3600, tz_get_utc_offset(&tz, _utc(2016, 7, 15, 12, 0)));
+    // DST started 2016/03/13 at 07:00 UTC
+    TEST_ASSERT_EQUAL_INT32(-5*3600, tz_get_utc_offset(&tz, _utc(2016, 3, 13, 6, 59)));
+    TEST_ASSERT_EQUAL_INT32(-4*3600, tz_get_utc_offset(&tz, _utc(2016, 3, 13, 7, 0)));
+}
+
+void test_tz_local_to_utc_round_trip(void)
+{
+    if(!tz_load(&tz, "Australia/Sydney")){
+        TEST_IGNORE_MESSAGE("zoneinfo not available");
+    }
+
+    for(time_t t = _utc(2015, 1, 1, 0, 0); t < _utc(2019, 1, 1, 0, 0); t += 3607){
+        time_t local = tz_utc_to_local(&tz, t);
+        time_t utc = tz_local_to_utc(&tz, local);
+        // Times in the repeated hour map to the first occurrence
+        TEST_ASSERT_TRUE(utc == t || utc == t - 3600);
+        TEST_ASSERT_EQUAL_INT64(local, tz_utc_to_local(&tz, utc));
+    }
+}
+
+void test_tz_local_to_utc_in_gap_and_overlap(void)
+{
+    if(!tz_load(&tz, "America/New_York")){
+        TEST_IGNORE_MESSAGE("zoneinfo not available");
+    }
+
+    // 02:30 on 2016/03/13 doesn't exist, it is treated as 03:30 EDT
+    TEST_ASSERT_EQUAL_INT64(_utc(2016, 3, 13, 7, 30), tz_local_to_utc(&tz, _utc(2016, 3, 13, 2, 30)));
+    // 01:30 on 2016/11/06 happens twice, the first is in EDT
+    TEST_ASSERT_EQUAL_INT64(_utc(2016, 11, 6, 5, 30), tz_local_to_utc(&tz, _utc(2016, 11, 6, 1, 30)));
+}
+
+void test_tz_expands_footer_rule(void)
+{
+    const char *path = _write_slim_tzif(-5*3600, "EST", "EST5EDT,M3.2.0,M11.1.0");
+
+    TEST_ASSERT_TRUE(tz_load_file(&tz, path));
+
+    TEST_ASSERT_EQUAL_INT32(-5*3600, tz_get_utc_offset(&tz, _utc(2030, 3, 10, 6, 59)));
+    TEST_ASSERT_EQUAL_INT32(-4*3600, tz_get_utc_offset(&tz, _utc(2030, 3, 10, 7, 0)));
+    TEST_ASSERT_EQUAL_INT32(-4*3600, tz_get_utc_offset(&tz, _utc(2030, 11, 3, 5, 59)));
+    TEST_ASSERT_EQUAL_INT32(-5*3600, tz_get_utc_offset(&tz, _utc(2030, 11, 3, 6, 0)));
+}
+
+void test_tz_expands_southern_hemisphere_footer_rule(void)
+{
+    const char *path = _write_slim_tzif(10*3600, "AEST", "AEST-10AEDT,M10.1.0,M4.1.0/3");
+
+    TEST_ASSERT_TRUE(tz_load_file(&tz, path));
+
+    // DST ends 2030/04/07 03:00 AEDT and starts 2030/10/06 02:00 AEST
+    TEST_ASSERT_EQUAL_INT32(11*3600, tz_get_utc_offset(&tz, _utc(2030, 4, 6, 15, 59)));
+    TEST_ASSERT_EQUAL_INT32(10*3600, tz_get_utc_offset(&tz, _utc(2030, 4, 6, 16, 0)));
+    TEST_ASSERT_EQUAL_INT32(10*3600, tz_get_utc_offset(&tz, _utc(2030, 10, 5, 15, 59)));
+    TEST_ASSERT_EQUAL_INT32(11*3600, tz_get_utc_offset(&tz, _utc(2030, 10, 5, 16, 0)));
+}
@@ -0,0 +1,383 @@
+#include "uring_dispatch.h"
+#include "scheduler.h"
+#include "civil.h"
+#include "fixtures.h"
+#include "unity.h"
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define TAG 0x5C4Eu
+
+static scheduler_t ctx;
+static uring_dispatch_t dispatch;
+// Submission queue the entries are written to
+static struct io_uring_sqe sqes[128];
+static uint32_t sqe_count;
+static uint32_t sqe_limit;
+static EVENT events[256];
+static uint32_t event_count;
+
+// Ring of the kernel, set up with the system calls alone
+typedef struct {
+    int fd;
+    void *sq_ring;
+    void *cq_ring;
+    struct io_uring_sqe *sqes;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_array;
+    uint32_t sq_mask;
+    uint32_t sq_entries;
+    // Tail of the entries written but not submitted
+    uint32_t sq_local_tail;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    struct io_uring_cqe *cqes;
+    uint32_t cq_mask;
+}ring_t;
+
+static ring_t ring;
+
+void setUp(void)
+{
+    scheduler_init_r(&ctx);
+    memset(sqes, 0, sizeof(sqes));
+    sqe_count = 0;
+    sqe_limit = 128;
+    event_count = 0;
+    ring.fd = -1;
+}
+
+static void _ring_close(ring_t *r);
+
+void tearDown(void)
+{
+    uring_dispatch_destroy(&dispatch);
+    scheduler_clear_r(&ctx);
+    _ring_close(&ring);
+}
+
+static struct io_uring_sqe* _get_sqe(void *arg)
+{
+    (void)arg;
+    return sqe_count < sqe_limit ? &sqes[sqe_count++] : NULL;
+}
+
+static void _on_event(void *arg, const EVENT *event)
+{
+    (void)arg;
+    if(event_count < 256){
+        events[event_count++] = *event;
+    }
+}
+
+// Complete an entry the way the kernel does
+static bool _complete(uint32_t i, int32_t res)
+{
+    struct io_uring_cqe cqe = {.user_data = sqes[i].user_data, .res = res};
+
+    return uring_dispatch_complete(&dispatch, &cqe, _get_sqe, NULL);
+}
+
+static time_t _timeout_sec(uint32_t i)
+{
+    return ((const struct __kernel_timespec*)(uintptr_t)sqes[i].addr)->tv_sec;
+}
+
+static bool _ring_init(ring_t *r, uint32_t entries)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if(r->fd < 0){
+        return false;
+    }
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries*sizeof(uint32_t);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    r->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    TEST_ASSERT_TRUE(r->sq_ring != MAP_FAILED && r->cq_ring != MAP_FAILED && r->sqes != MAP_FAILED);
+
+    char *sq = r->sq_ring;
+    char *cq = r->cq_ring;
+    r->sq_head = (uint32_t*)(sq + p.sq_off.head);
+    r->sq_tail = (uint32_t*)(sq + p.sq_off.tail);
+    r->sq_array = (uint32_t*)(sq + p.sq_off.array);
+    r->sq_mask = *(uint32_t*)(sq + p.sq_off.ring_mask);
+    r->sq_entries = p.sq_entries;
+    r->sq_local_tail = *r->sq_tail;
+    r->cq_head = (uint32_t*)(cq + p.cq_off.head);
+    r->cq_tail = (uint32_t*)(cq + p.cq_off.tail);
+    r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    r->cq_mask = *(uint32_t*)(cq + p.cq_off.ring_mask);
+
+    return true;
+}
+
+static void _ring_close(ring_t *r)
+{
+    if(r->fd < 0){
+        return;
+    }
+    munmap(r->sqes, r->sqes_size);
+    munmap(r->cq_ring, r->cq_ring_size);
+    munmap(r->sq_ring, r->sq_ring_size);
+    close(r->fd);
+    r->fd = -1;
+}
+
+static struct io_uring_sqe* _ring_get_sqe(void *arg)
+{
+    ring_t *r = arg;
+
+    if(r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries){
+        return NULL;
+    }
+    uint32_t index = r->sq_local_tail++ & r->sq_mask;
+    r->sq_array[index] = index;
+
+    return &r->sqes[index];
+}
+
+// Submit the entries written and wait for at least one completion
+static void _ring_submit_and_wait(ring_t *r)
+{
+    uint32_t count = r->sq_local_tail - *r->sq_tail;
+
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+    TEST_ASSERT_TRUE(syscall(__NR_io_uring_enter, r->fd, count, 1, IORING_ENTER_GETEVENTS, NULL, 0) >= 0);
+}
+
+// Pass the completions of the ring to the dispatcher
+static void _ring_reap(ring_t *r)
+{
+    uint32_t head = *r->cq_head;
+
+    while(head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)){
+        TEST_ASSERT_TRUE(uring_dispatch_complete(&dispatch, &r->cqes[head & r->cq_mask], _ring_get_sqe, r));
+        head++;
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+void test_uring_dispatch_submits_a_timeout_per_time(void)
+{
+    fixture_add_secondly(&ctx, 0, 1);
+    fixture_add_secondly(&ctx, 1, 2);
+    uring_dispatch_init(&dispatch, &ctx, NULL, TAG, _on_event, NULL);
+
+    uint32_t count = uring_dispatch_submit(&dispatch, _get_sqe, NULL);
+    TEST_ASSERT_EQUAL_UINT32(count, sqe_count);
+    // Every other second both schedules share a timeout
+    TEST_ASSERT_TRUE(count < dispatch.count);
+    TEST_ASSERT_TRUE(count > 0);
+
+    for(uint32_t i = 0; i < count; i++){
+        TEST_ASSERT_EQUAL_UINT8(IORING_OP_TIMEOUT, sqes[i].opcode);
+        TEST_ASSERT_EQUAL_UINT32(IORING_TIMEOUT_ABS | IORING_TIMEOUT_REALTIME, sqes[i].timeout_flags);
+        TEST_ASSERT_EQUAL_UINT32(TAG, (uint32_t)(sqes[i].user_data >> 32));
+        if(i > 0){
+            TEST_ASSERT_EQUAL_INT64(_timeout_sec(i - 1) + 1, _timeout_sec(i));
+        }
+    }
+    TEST_ASSERT_TRUE(_timeout_sec(0) > time(NULL) - 1);
+
+    // Nothing left to write until the batch has fired
+    TEST_ASSERT_EQUAL_UINT32(0, uring_dispatch_submit(&dispatch, _get_sqe, NULL));
+}
+
+void test_uring_dispatch_fires_events_up_to_the_expired_timeout(void)
+{
+    struct io_uring_cqe other = {.user_data = 42, .res = 0};
+
+    fixture_add_secondly(&ctx, 0, 1);
+    fixture_add_secondly(&ctx, 1, 2);
+    uring_dispatch_init(&dispatch, &ctx, NULL, TAG, _on_event, NULL);
+    uint32_t count = uring_dispatch_submit(&dispatch, _get_sqe, NULL);
+
+    TEST_ASSERT_FALSE(uring_dispatch_complete(&dispatch, &other, _get_sqe, NULL));
+
+    // Completions out of order fire the earlier events first
+    TEST_ASSERT_TRUE(_complete(2, -ETIME));
+    TEST_ASSERT_TRUE(event_count >= 3);
+    TEST_ASSERT_EQUAL_INT64(_timeout_sec(2), events[event_count - 1].epoch);
+    TEST_ASSERT_EQUAL_INT64(_timeout_sec(0), events[0].epoch);
+    for(uint32_t i = 1; i < event_count; i++){
+        TEST_ASSERT_TRUE(events[i - 1].epoch < events[i].epoch ||
+                         (events[i - 1].epoch == events[i].epoch && events[i - 1].id < events[i].id));
+    }
+    uint32_t fired = event_count;
+    TEST_ASSERT_TRUE(_complete(0, -ETIME));
+    TEST_ASSERT_TRUE(_complete(1, -ETIME));
+    TEST_ASSERT_EQUAL_UINT32(fired, event_count);
+
+    // The scheduler's group events follow the dispatcher
+    EVENT *event = scheduler_get_event_by_group_r(&ctx, 0);
+    TEST_ASSERT_NOT_NULL(event);
+    TEST_ASSERT_TRUE(event->epoch > time(NULL) - 1);
+
+    // The last timeout writes the next batch
+    time_t last = _timeout_sec(count - 1);
+    uint32_t batch = dispatch.count;
+    TEST_ASSERT_TRUE(_complete(count - 1, -ETIME));
+    TEST_ASSERT_EQUAL_UINT32(batch, event_count);
+    TEST_ASSERT_TRUE(sqe_count > count);
+    TEST_ASSERT_EQUAL_INT64(last + 1, _timeout_sec(count));
+
+    // Completions of the old batch are ignored
+    fired = event_count;
+    TEST_ASSERT_TRUE(_complete(count - 2, -ETIME));
+    TEST_ASSERT_EQUAL_UINT32(fired, event_count);
+}
+
+void test_uring_dispatch_invalidate_removes_pending_timeouts(void)
+{
+    fixture_add_secondly(&ctx, 0, 1);
+    uring_dispatch_init(&dispatch, &ctx, NULL, TAG, _on_event, NULL);
+
+    // Only part of the batch fits in the queue
+    sqe_limit = 4;
+    TEST_ASSERT_EQUAL_UINT32(4, uring_dispatch_submit(&dispatch, _get_sqe, NULL));
+    TEST_ASSERT_TRUE(_complete(0, -ETIME));
+    TEST_ASSERT_EQUAL_UINT32(1, event_count);
+
+    sqe_limit = 128;
+    fixture_add_secondly(&ctx, 1, 1);
+    uint32_t count = uring_dispatch_invalidate(&dispatch, _get_sqe, NULL);
+    TEST_ASSERT_EQUAL_UINT32(count, sqe_count - 4);
+
+    // The three pending timeouts are removed first
+    for(uint32_t i = 0; i < 3; i++){
+        TEST_ASSERT_EQUAL_UINT8(IORING_OP_TIMEOUT_REMOVE, sqes[4 + i].opcode);
+        TEST_ASSERT_EQUAL_UINT64(sqes[1 + i].user_data, sqes[4 + i].addr);
+        TEST_ASSERT_TRUE(_complete(4 + i, 0));
+        TEST_ASSERT_TRUE(_complete(1 + i, -ECANCELED));
+    }
+    TEST_ASSERT_EQUAL_UINT8(IORING_OP_TIMEOUT, sqes[7].opcode);
+    TEST_ASSERT_EQUAL_UINT32(1, event_count);
+
+    // The new batch has both schedules, after the event already fired
+    TEST_ASSERT_EQUAL_INT64(events[0].epoch + 1, _timeout_sec(7));
+    TEST_ASSERT_TRUE(_complete(7, -ETIME));
+    TEST_ASSERT_EQUAL_UINT32(3, event_count);
+    TEST_ASSERT_EQUAL_UINT32(0, events[1].group);
+    TEST_ASSERT_EQUAL_UINT32(1, events[2].group);
+}
+
+// Invalidate on the first event, then keep the event passed in
+static void _on_invalidating_event(void *arg, const EVENT *event)
+{
+    (void)arg;
+    if(event_count == 0){
+        uring_dispatch_invalidate(&dispatch, _get_sqe, NULL);
+    }
+    _on_event(NULL, event);
+}
+
+void test_uring_dispatch_invalidate_from_a_callback_fires_the_time(void)
+{
+    for(uint32_t group = 0; group < 3; group++){
+        fixture_add_secondly(&ctx, group, 1);
+    }
+    uring_dispatch_init(&dispatch, &ctx, NULL, TAG, _on_invalidating_event, NULL);
+    uint32_t count = uring_dispatch_submit(&dispatch, _get_sqe, NULL);
+    time_t t = _timeout_sec(0);
+
+    // Every event due still fires, as it was fetched
+    TEST_ASSERT_TRUE(_complete(0, -ETIME));
+    TEST_ASSERT_EQUAL_UINT32(3, event_count);
+    for(uint32_t i = 0; i < 3; i++){
+        TEST_ASSERT_EQUAL_UINT32(i, events[i].group);
+        TEST_ASSERT_EQUAL_INT64(t, events[i].epoch);
+    }
+
+    // The other timeouts are removed, and the new batch starts at the
+    // next time
+    for(uint32_t i = 1; i < count; i++){
+        TEST_ASSERT_EQUAL_UINT8(IORING_OP_TIMEOUT_REMOVE, sqes[count + i - 1].opcode);
+        TEST_ASSERT_EQUAL_UINT64(sqes[i].user_data, sqes[count + i - 1].addr);
+    }
+    uint32_t first = 2*count - 1;
+    TEST_ASSERT_TRUE(sqe_count > first);
+    TEST_ASSERT_EQUAL_UINT8(IORING_OP_TIMEOUT, sqes[first].opcode);
+    TEST_ASSERT_EQUAL_INT64(t + 1, _timeout_sec(first));
+
+    // Completions of the old batch are ignored
+    TEST_ASSERT_TRUE(_complete(1, -ECANCELED));
+    TEST_ASSERT_TRUE(_complete(2, -ETIME));
+    TEST_ASSERT_EQUAL_UINT32(3, event_count);
+    TEST_ASSERT_TRUE(_complete(first, -ETIME));
+    TEST_ASSERT_EQUAL_UINT32(6, event_count);
+    TEST_ASSERT_EQUAL_INT64(t + 1, events[3].epoch);
+}
+
+void test_uring_dispatch_fires_every_event_of_a_time(void)
+{
+    const uint32_t groups = 2*URING_DISPATCH_BATCH + 1;
+
+    // More groups fire each second than are fetched at a time
+    TEST_ASSERT_TRUE(scheduler_set_capacity_r(&ctx, groups));
+    for(uint32_t group = 0; group < groups; group++){
+        fixture_add_secondly(&ctx, group, 1);
+    }
+    uring_dispatch_init(&dispatch, &ctx, NULL, TAG, _on_event, NULL);
+
+    // Each batch is one time with one timeout, and the last timeout
+    // writes the next batch at the time after it
+    TEST_ASSERT_EQUAL_UINT32(1, uring_dispatch_submit(&dispatch, _get_sqe, NULL));
+    for(uint32_t i = 0; i < 2; i++){
+        time_t t = _timeout_sec(i);
+        TEST_ASSERT_EQUAL_UINT32(groups, dispatch.count);
+        TEST_ASSERT_TRUE(_complete(i, -ETIME));
+        TEST_ASSERT_EQUAL_UINT32(i + 2, sqe_count);
+        TEST_ASSERT_EQUAL_UINT32((i + 1)*groups, event_count);
+        for(uint32_t j = 0; j < groups; j++){
+            TEST_ASSERT_EQUAL_UINT32(j, events[i*groups + j].id);
+            TEST_ASSERT_EQUAL_INT64(t, events[i*groups + j].epoch);
+        }
+    }
+    TEST_ASSERT_EQUAL_INT64(events[0].epoch + 1, events[groups].epoch);
+}
+
+void test_uring_dispatch_fires_on_a_kernel_ring(void)
+{
+    if(!_ring_init(&ring, 8)){
+        TEST_IGNORE_MESSAGE("io_uring isn't available");
+    }
+
+    fixture_add_secondly(&ctx, 0, 1);
+    fixture_add_secondly(&ctx, 1, 1);
+    uring_dispatch_init(&dispatch, &ctx, NULL, TAG, _on_event, NULL);
+
+    // The ring has room for part of the batch, the rest is written as
+    // the timeouts expire
+    TEST_ASSERT_EQUAL_UINT32(8, uring_dispatch_submit(&dispatch, _ring_get_sqe, &ring));
+    time_t deadline = time(NULL) + 5;
+    while(event_count < 6 && time(NULL) < deadline){
+        _ring_submit_and_wait(&ring);
+        _ring_reap(&ring);
+        uring_dispatch_submit(&dispatch, _ring_get_sqe, &ring);
+    }
+
+    // Both groups fire each second, none before its time
+    TEST_ASSERT_TRUE(event_count >= 6);
+    for(uint32_t i = 0; i < event_count; i++){
+        TEST_ASSERT_EQUAL_UINT32(i%2, events[i].group);
+        TEST_ASSERT_EQUAL_INT64(events[0].epoch + i/2, events[i].epoch);
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    TEST_ASSERT_TRUE(events[event_count - 1].epoch <= now.tv_sec);
+}
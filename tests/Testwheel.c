@@ -0,0 +1,100 @@
+#include "wheel.h"
+#include "unity.h"
+#include <stdlib.h>
+
+void setUp(void)
+{
+
+}
+
+void tearDown(void)
+{
+
+}
+
+void test_wheel_pop_expired_only_returns_expired_nodes(void)
+{
+    wheel_t w;
+    wheel_node_t a = {.expires = 1010}, b = {.expires = 1070}, c = {.expires = 1000 + 3*86400};
+
+    wheel_init(&w, 1000);
+    wheel_insert(&w, &a);
+    wheel_insert(&w, &b);
+    wheel_insert(&w, &c);
+
+    TEST_ASSERT_NULL(wheel_pop_expired(&w, 1009));
+    TEST_ASSERT_EQUAL_PTR(&a, wheel_pop_expired(&w, 1069));
+    TEST_ASSERT_NULL(wheel_pop_expired(&w, 1069));
+    TEST_ASSERT_EQUAL_PTR(&b, wheel_pop_expired(&w, 2000));
+    TEST_ASSERT_NULL(wheel_pop_expired(&w, 1000 + 3*86400 - 1));
+    TEST_ASSERT_EQUAL_PTR(&c, wheel_pop_expired(&w, 1000 + 3*86400));
+    TEST_ASSERT_EQUAL_UINT32(0, w.count);
+}
+
+void test_wheel_peek_returns_earliest_node(void)
+{
+    wheel_t w;
+    wheel_node_t a = {.expires = 5000, .seq = 1}, b = {.expires = 4000, .seq = 2};
+    wheel_node_t c = {.expires = 4000, .seq = 0}, d = {.expires = 100*86400};
+
+    wheel_init(&w, 0);
+    TEST_ASSERT_NULL(wheel_peek(&w));
+
+    wheel_insert(&w, &d);
+    TEST_ASSERT_EQUAL_PTR(&d, wheel_peek(&w));
+    wheel_insert(&w, &a);
+    wheel_insert(&w, &b);
+    TEST_ASSERT_EQUAL_PTR(&b, wheel_peek(&w));
+
+    // Same expiry time goes to the lowest seq
+    wheel_insert(&w, &c);
+    TEST_ASSERT_EQUAL_PTR(&c, wheel_peek(&w));
+
+    wheel_remove(&w, &c);
+    wheel_remove(&w, &b);
+    TEST_ASSERT_EQUAL_PTR(&a, wheel_peek(&w));
+}
+
+void test_wheel_matches_sorted_order_over_long_steps(void)
+{
+    enum { NODES = 200 };
+    wheel_node_t nodes[NODES];
+    wheel_t w;
+    time_t now = 1487980800;
+
+    srand(1);
+    wheel_init(&w, now);
+    for(int i = 0; i < NODES; i++){
+        // Spread expiry times from seconds to beyond the days level
+        nodes[i].expires = now + rand()%(WHEEL_DAYS*2*86400L)/(1 + rand()%10000);
+        nodes[i].seq = i;
+        wheel_insert(&w, &nodes[i]);
+    }
+
+    int popped = 0;
+    while(popped < NODES){
+        now += 1 + rand()%(2*WHEEL_MAX_STEP);
+
+        wheel_node_t *n;
+        while((n = wheel_pop_expired(&w, now))){
+            TEST_ASSERT_TRUE(n->expires <= now);
+            n->expires = 0;
+            popped++;
+        }
+
+        // Nothing left behind has expired and peek is the minimum
+        wheel_node_t *min = NULL;
+        for(int i = 0; i < NODES; i++){
+            if(nodes[i].expires){
+                TEST_ASSERT_TRUE(nodes[i].expires > now);
+                if(min == NULL || nodes[i].expires < min->expires){
+                    min = &nodes[i];
+                }
+            }
+        }
+        if(min){
+            TEST_ASSERT_EQUAL_INT64(min->expires, wheel_peek(&w)->expires);
+        }
+    }
+    TEST_ASSERT_NULL(wheel_peek(&w));
+}
@@ -0,0 +1,135 @@
+#include "worker_pool.h"
+#include "unity.h"
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+
+#define KEYS 4
+#define JOBS 200
+
+static worker_pool_t pool;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static time_t last[KEYS];
+static uint32_t runs[KEYS];
+static atomic_uint running[KEYS];
+static atomic_uint overlaps;
+static bool gate_open;
+
+void setUp(void)
+{
+    for(uint32_t i = 0; i < KEYS; i++){
+        last[i] = -1;
+        runs[i] = 0;
+        atomic_store(&running[i], 0);
+    }
+    atomic_store(&overlaps, 0);
+    gate_open = false;
+}
+
+void tearDown(void)
+{
+}
+
+static void _record(void *arg, const EVENT *event)
+{
+    uint32_t key = (uint32_t)(uintptr_t)arg;
+
+    if(atomic_fetch_add(&running[key], 1) != 0){
+        atomic_fetch_add(&overlaps, 1);
+    }
+    pthread_mutex_lock(&lock);
+    if(event->epoch != last[key] + 1){
+        last[key] = -2;
+    }else{
+        last[key] = event->epoch;
+    }
+    runs[key]++;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+    atomic_fetch_sub(&running[key], 1);
+}
+
+// Waits until the gate is opened
+static void _blocked(void *arg, const EVENT *event)
+{
+    (void)arg;
+    (void)event;
+    pthread_mutex_lock(&lock);
+    while(!gate_open){
+        pthread_cond_wait(&changed, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static bool _wait_for_runs(uint32_t key, uint32_t count, uint32_t timeout_s)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_s;
+
+    pthread_mutex_lock(&lock);
+    while(runs[key] < count && pthread_cond_timedwait(&changed, &lock, &deadline) == 0);
+    bool done = runs[key] >= count;
+    pthread_mutex_unlock(&lock);
+
+    return done;
+}
+
+void test_worker_pool_runs_jobs_of_a_key_in_order(void)
+{
+    EVENT event = {0};
+
+    TEST_ASSERT_FALSE(worker_pool_init(&pool, 0, 16, 0));
+    TEST_ASSERT_TRUE(worker_pool_init(&pool, 4, KEYS*JOBS, 0));
+
+    for(uint32_t i = 0; i < JOBS; i++){
+        for(uint32_t key = 0; key < KEYS; key++){
+            event.epoch = i;
+            TEST_ASSERT_TRUE(worker_pool_submit(&pool, key, _record, (void*)(uintptr_t)key, &event));
+        }
+    }
+    worker_pool_drain(&pool);
+
+    for(uint32_t key = 0; key < KEYS; key++){
+        TEST_ASSERT_EQUAL_UINT32(JOBS, runs[key]);
+        TEST_ASSERT_EQUAL_INT64(JOBS - 1, last[key]);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, atomic_load(&overlaps));
+    TEST_ASSERT_EQUAL_UINT32(0, worker_pool_get_dropped(&pool));
+
+    worker_pool_destroy(&pool);
+}
+
+void test_worker_pool_slow_key_does_not_hold_up_others(void)
+{
+    EVENT event = {0};
+
+    TEST_ASSERT_TRUE(worker_pool_init(&pool, 2, 16, 4));
+    TEST_ASSERT_TRUE(worker_pool_submit(&pool, 0, _blocked, NULL, &event));
+
+    // Only strand_limit jobs wait behind the blocked one
+    for(uint32_t i = 0; i < 6; i++){
+        worker_pool_submit(&pool, 0, _record, (void*)(uintptr_t)0, &event);
+    }
+    TEST_ASSERT_TRUE(worker_pool_get_dropped(&pool) >= 2);
+
+    // Other keys keep running on the other worker
+    for(uint32_t i = 0; i < 8; i++){
+        event.epoch = i;
+        TEST_ASSERT_TRUE(worker_pool_submit(&pool, 1, _record, (void*)(uintptr_t)1, &event));
+        TEST_ASSERT_TRUE(_wait_for_runs(1, i + 1, 5));
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, runs[0]);
+
+    pthread_mutex_lock(&lock);
+    gate_open = true;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+
+    // Jobs still waiting run before the pool stops
+    worker_pool_destroy(&pool);
+    TEST_ASSERT_TRUE(runs[0] >= 3);
+    TEST_ASSERT_EQUAL_UINT32(8, runs[1]);
+}
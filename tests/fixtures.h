@@ -0,0 +1,33 @@
+/*
+ * fixtures.h
+ *
+ *  Schedules shared by the tests of the dispatchers
+ */
+
+
+#ifndef FIXTURES_H_
+#define FIXTURES_H_
+
+#include <stdint.h>
+#include <time.h>
+#include "unity.h"
+#include "scheduler.h"
+#include "civil.h"
+
+// Schedule every interval seconds today and tomorrow, in UTC
+static inline void fixture_add_secondly(scheduler_t *ctx, uint32_t group, uint8_t interval)
+{
+    ICAL ical;
+    time_t now = time(NULL);
+
+    ical_get_defaults(&ical);
+    civil_to_tm(now - now%(24*60*60), &ical.t_start);
+    civil_to_tm(now - now%(24*60*60) + 2*24*60*60 - 1, &ical.t_end);
+    ical.freq = SECONDLY;
+    ical.interval = interval;
+    ical.byday = EVERYDAY;
+    ical.enabled = true;
+    TEST_ASSERT_TRUE(scheduler_add_r(ctx, group, &ical));
+}
+
+#endif /* FIXTURES_H_ */